@@ -299,8 +299,51 @@ struct assoc_iterator {
     item *it;
     item *next;
     bool bucket_locked;
+    bool use_cursor; /* walk buckets in reverse-binary (cursor) order */
+    bool done;
 };
 
+/* Reverse the bits of a 64bit value. */
+static uint64_t _rev_bits(uint64_t v) {
+    uint64_t s = 64;
+    uint64_t mask = ~0ULL;
+    while ((s >>= 1) > 0) {
+        mask ^= (mask << s);
+        v = ((v >> s) & mask) | ((v << s) & ~mask);
+    }
+    return v;
+}
+
+/* Cursors walk the buckets by incrementing the high bits first. Since the
+ * table only ever grows by doubling, a bucket N in a table of 2^x becomes
+ * buckets N and N + 2^x after expansion; both sort after every bucket
+ * visited so far in reverse-binary order. This means a cursor handed back to
+ * a client stays valid across hash table expansions: no items present for
+ * the whole walk are missed, though some may be returned twice.
+ */
+static uint64_t _cursor_next(uint64_t v) {
+    v |= ~hashmask(hashpower);
+    v = _rev_bits(v);
+    v++;
+    v = _rev_bits(v);
+    return v;
+}
+
+static void _iterator_advance(struct assoc_iterator *iter) {
+    if (iter->use_cursor) {
+        iter->bucket = _cursor_next(iter->bucket);
+        // wrapped back to the start.
+        if (iter->bucket == 0) {
+            iter->done = true;
+        }
+    } else {
+        iter->bucket++;
+        if (iter->bucket == hashsize(hashpower)) {
+            iter->done = true;
+        }
+    }
+}
+
 void *assoc_get_iterator(void) {
     struct assoc_iterator *iter = calloc(1, sizeof(struct assoc_iterator));
     if (iter == NULL) {
@@ -310,10 +353,36 @@ void *assoc_get_iterator(void) {
     if (mutex_trylock(&maintenance_lock) == 0) {
         return iter;
     } else {
+        free(iter);
         return NULL;
     }
 }
 
+/* Like assoc_get_iterator() but resumes a walk from a cursor previously
+ * returned by assoc_iterator_cursor(). A cursor of 0 starts a new walk.
+ */
+void *assoc_get_iterator_at(uint64_t cursor) {
+    struct assoc_iterator *iter = assoc_get_iterator();
+    if (iter == NULL) {
+        return NULL;
+    }
+    iter->use_cursor = true;
+    iter->bucket = cursor & hashmask(hashpower);
+    return iter;
+}
+
+/* Returns the cursor to resume this walk from. If called while the iterator
+ * is inside of a bucket, that bucket will be walked again on resume.
+ * Returns 0 once the walk is complete.
+ */
+uint64_t assoc_iterator_cursor(void *iterp) {
+    struct assoc_iterator *iter = (struct assoc_iterator *) iterp;
+    if (iter->done) {
+        return 0;
+    }
+    return iter->bucket;
+}
+
 bool assoc_iterate(void *iterp, item **it) {
     struct assoc_iterator *iter = (struct assoc_iterator *) iterp;
     *it = NULL;
@@ -327,7 +396,7 @@ bool assoc_iterate(void *iterp, item **it) {
             // unlock previous bucket, if any
             item_unlock(iter->bucket);
             // iterate the bucket post since it starts at 0.
-            iter->bucket++;
+            _iterator_advance(iter);
             iter->bucket_locked = false;
             *it = NULL;
         }
@@ -335,7 +404,7 @@ bool assoc_iterate(void *iterp, item **it) {
     }
 
     // - loop until we hit the end or find something.
-    if (iter->bucket != hashsize(hashpower)) {
+    if (!iter->done) {
         // - lock next bucket
         item_lock(iter->bucket);
         iter->bucket_locked = true;
@@ -349,7 +418,7 @@ bool assoc_iterate(void *iterp, item **it) {
             // - nothing found in this bucket, try next.
             item_unlock(iter->bucket);
             iter->bucket_locked = false;
-            iter->bucket++;
+            _iterator_advance(iter);
         }
     } else {
         return false;
@@ -11,6 +11,8 @@ void assoc_start_expand(uint64_t curr_items);
 
 /* walk functions */
 void *assoc_get_iterator(void);
+void *assoc_get_iterator_at(uint64_t cursor);
+uint64_t assoc_iterator_cursor(void *iterp);
 bool assoc_iterate(void *iterp, item **it);
 void assoc_iterate_final(void *iterp);
 
@@ -7,6 +7,7 @@
 /* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
 #include "memcached.h"
 #include "storage.h"
+#include "snapshot.h"
 #include <sys/stat.h>
 #include <sys/socket.h>
 #include <sys/resource.h>
@@ -41,10 +42,12 @@ typedef int (*crawler_init_func)(crawler_module_t *cm, void *data); // TODO: ini
 typedef void (*crawler_deinit_func)(crawler_module_t *cm); // TODO: extra args?
 typedef void (*crawler_doneclass_func)(crawler_module_t *cm, int slab_cls);
 typedef void (*crawler_finalize_func)(crawler_module_t *cm);
+typedef void (*crawler_flush_func)(crawler_module_t *cm);
 
 typedef struct {
     crawler_init_func init; /* run before crawl starts */
     crawler_eval_func eval; /* runs on an item. */
+    crawler_flush_func flush; /* runs between items, with no locks held. */
     crawler_doneclass_func doneclass; /* runs once per sub-crawler completion. */
     crawler_finalize_func finalize; /* runs once when all sub-crawlers are done. */
     bool needs_lock; /* whether or not we need the LRU lock held when eval is called */
@@ -98,16 +101,53 @@ crawler_module_reg_t crawler_mgdump_mod = {
     .needs_client = true,
 };
 
-crawler_module_reg_t *crawler_mod_regs[4] = {
+static int crawler_prefixstats_init(crawler_module_t *cm, void *data);
+static void crawler_prefixstats_eval(crawler_module_t *cm, item *search, uint32_t hv, int i);
+static void crawler_prefixstats_finalize(crawler_module_t *cm);
+
+crawler_module_reg_t crawler_prefixstats_mod = {
+    .init = crawler_prefixstats_init,
+    .eval = crawler_prefixstats_eval,
+    .doneclass = NULL,
+    .finalize = crawler_prefixstats_finalize,
+    .needs_lock = false,
+    .needs_client = true,
+};
+
+static int crawler_snapshot_init(crawler_module_t *cm, void *data);
+static void crawler_snapshot_eval(crawler_module_t *cm, item *search, uint32_t hv, int i);
+static void crawler_snapshot_flush(crawler_module_t *cm);
+static void crawler_snapshot_finalize(crawler_module_t *cm);
+
+crawler_module_reg_t crawler_snapshot_mod = {
+    .init = crawler_snapshot_init,
+    .eval = crawler_snapshot_eval,
+    .flush = crawler_snapshot_flush,
+    .doneclass = NULL,
+    .finalize = crawler_snapshot_finalize,
+    .needs_lock = false,
+    .needs_client = false,
+};
+
+crawler_module_reg_t *crawler_mod_regs[6] = {
     &crawler_expired_mod,
     &crawler_expired_mod,
     &crawler_metadump_mod,
     &crawler_mgdump_mod,
+    &crawler_prefixstats_mod,
+    &crawler_snapshot_mod,
 };
 
+typedef struct {
+    bool enabled; /* hash walk resumes from and reports a cursor */
+    uint64_t cursor; /* where to resume; updated when the walk stops */
+    uint32_t limit; /* stop at the next bucket after this many items */
+} crawler_hash_cursor_t;
+
 static int lru_crawler_write(crawler_client_t *c);
 crawler_module_t active_crawler_mod;
 enum crawler_run_type active_crawler_type;
+static crawler_hash_cursor_t hash_cursor;
 
 static crawler crawlers[LARGEST_ID];
 
@@ -262,6 +302,18 @@ static void crawler_expired_eval(crawler_module_t *cm, item *search, uint32_t hv
     pthread_mutex_unlock(&d->lock);
 }
 
+// if resuming a hash walk, tell the client where to pick up next time.
+static void lru_crawler_write_cursor(crawler_client_t *c) {
+    if (!hash_cursor.enabled) {
+        return;
+    }
+    int total = snprintf(c->buf + c->bufused, c->buflen - c->bufused,
+            "CURSOR %llu\r\n", (unsigned long long)hash_cursor.cursor);
+    if (total > 0 && total < c->buflen - c->bufused) {
+        c->bufused += total;
+    }
+}
+
 static int crawler_metadump_init(crawler_module_t *cm, void *data) {
     cm->status = 0;
     return 0;
@@ -311,7 +363,8 @@ static void crawler_metadump_finalize(crawler_module_t *cm) {
                 memcpy(cm->c.buf, errstr, errlen);
                 cm->c.bufused += errlen;
             } else {
-                memcpy(cm->c.buf, "END\r\n", 5);
+                lru_crawler_write_cursor(&cm->c);
+                memcpy(cm->c.buf + cm->c.bufused, "END\r\n", 5);
                 cm->c.bufused += 5;
             }
         }
@@ -363,13 +416,538 @@ static void crawler_mgdump_finalize(crawler_module_t *cm) {
                 memcpy(cm->c.buf, errstr, errlen);
                 cm->c.bufused += errlen;
             } else {
-                memcpy(cm->c.buf, "EN\r\n", 4);
+                lru_crawler_write_cursor(&cm->c);
+                memcpy(cm->c.buf + cm->c.bufused, "EN\r\n", 4);
                 cm->c.bufused += 4;
             }
         }
     }
 }
 
+/* Per-prefix keyspace summary. Aggregates items into a small hash table of
+ * key prefixes (split on settings.prefix_delimiter) so only one line per
+ * prefix has to leave the host instead of one line per key.
+ */
+#define PREFIXSTATS_HASH_SIZE 256
+/* bound memory use: prefixes past this are lumped into one "other" line */
+#define PREFIXSTATS_MAX_PREFIXES 4096
+/* remaining TTL: no exptime, <= 1m, 10m, 1h, 1d, longer */
+#define PREFIXSTATS_TTL_BUCKETS 6
+/* last access age: <= 1m, 10m, 1h, 1d, longer */
+#define PREFIXSTATS_LA_BUCKETS 5
+
+typedef struct {
+    uint64_t items;
+    uint64_t bytes;
+    uint64_t ttl[PREFIXSTATS_TTL_BUCKETS];
+    uint64_t la[PREFIXSTATS_LA_BUCKETS];
+} prefixstats_counts_t;
+
+typedef struct _prefixstats_entry {
+    struct _prefixstats_entry *next;
+    prefixstats_counts_t counts;
+    uint8_t nprefix;
+    char prefix[];
+} prefixstats_entry_t;
+
+struct crawler_prefixstats_data {
+    prefixstats_entry_t *table[PREFIXSTATS_HASH_SIZE];
+    prefixstats_counts_t noprefix; /* keys without a delimiter */
+    prefixstats_counts_t other; /* keys past PREFIXSTATS_MAX_PREFIXES */
+    int nprefixes;
+};
+
+static int crawler_prefixstats_init(crawler_module_t *cm, void *data) {
+    struct crawler_prefixstats_data *d = calloc(1, sizeof(struct crawler_prefixstats_data));
+    if (d == NULL) {
+        return -1;
+    }
+    cm->data = d;
+    cm->status = 0;
+    return 0;
+}
+
+static int prefixstats_bucket(rel_time_t age) {
+    if (age <= 60) {
+        return 0;
+    } else if (age <= 600) {
+        return 1;
+    } else if (age <= 3600) {
+        return 2;
+    } else if (age <= 86400) {
+        return 3;
+    }
+    return 4;
+}
+
+static prefixstats_counts_t *prefixstats_find(struct crawler_prefixstats_data *d,
+        const char *key, const int nkey) {
+    int len;
+    for (len = 0; len < nkey; len++) {
+        if (key[len] == settings.prefix_delimiter) {
+            break;
+        }
+    }
+    if (len == nkey) {
+        return &d->noprefix;
+    }
+
+    uint32_t hv = hash(key, len) % PREFIXSTATS_HASH_SIZE;
+    prefixstats_entry_t *e;
+    for (e = d->table[hv]; e != NULL; e = e->next) {
+        if (e->nprefix == len && memcmp(e->prefix, key, len) == 0) {
+            return &e->counts;
+        }
+    }
+
+    if (d->nprefixes >= PREFIXSTATS_MAX_PREFIXES) {
+        return &d->other;
+    }
+    e = calloc(1, sizeof(prefixstats_entry_t) + len);
+    if (e == NULL) {
+        return &d->other;
+    }
+    memcpy(e->prefix, key, len);
+    e->nprefix = len;
+    e->next = d->table[hv];
+    d->table[hv] = e;
+    d->nprefixes++;
+    return &e->counts;
+}
+
+static void crawler_prefixstats_eval(crawler_module_t *cm, item *it, uint32_t hv, int i) {
+    struct crawler_prefixstats_data *d = cm->data;
+    int is_flushed = item_is_flushed(it);
+    /* Ignore expired content. */
+    if ((it->exptime != 0 && it->exptime < current_time)
+        || is_flushed) {
+        refcount_decr(it);
+        return;
+    }
+
+    prefixstats_counts_t *pc = prefixstats_find(d, ITEM_key(it), it->nkey);
+    pc->items++;
+    pc->bytes += ITEM_ntotal(it);
+    if (it->exptime == 0) {
+        pc->ttl[0]++;
+    } else {
+        pc->ttl[1 + prefixstats_bucket(it->exptime - current_time)]++;
+    }
+    pc->la[prefixstats_bucket(it->time < current_time ? current_time - it->time : 0)]++;
+    refcount_decr(it);
+}
+
+static int prefixstats_write_line(crawler_client_t *c, const char *name,
+        prefixstats_counts_t *pc) {
+    // only ever flush with no locks held, since we're in finalize.
+    while (c->buflen - c->bufused < LRU_CRAWLER_MINBUFSPACE) {
+        if (lru_crawler_write(c) != 0) {
+            return -1;
+        }
+    }
+    int total = snprintf(c->buf + c->bufused, LRU_CRAWLER_MINBUFSPACE,
+            "%s items=%llu bytes=%llu ttl=%llu,%llu,%llu,%llu,%llu,%llu "
+            "la=%llu,%llu,%llu,%llu,%llu\r\n",
+            name,
+            (unsigned long long)pc->items,
+            (unsigned long long)pc->bytes,
+            (unsigned long long)pc->ttl[0], (unsigned long long)pc->ttl[1],
+            (unsigned long long)pc->ttl[2], (unsigned long long)pc->ttl[3],
+            (unsigned long long)pc->ttl[4], (unsigned long long)pc->ttl[5],
+            (unsigned long long)pc->la[0], (unsigned long long)pc->la[1],
+            (unsigned long long)pc->la[2], (unsigned long long)pc->la[3],
+            (unsigned long long)pc->la[4]);
+    if (total >= LRU_CRAWLER_MINBUFSPACE - 1 || total <= 0) {
+        return 0;
+    }
+    c->bufused += total;
+    return 0;
+}
+
+static void crawler_prefixstats_finalize(crawler_module_t *cm) {
+    struct crawler_prefixstats_data *d = cm->data;
+    // "prefix=" + uriencoded key + null
+    char name[KEY_MAX_URI_ENCODED_LENGTH + 8];
+    bool ok = cm->c.c != NULL && cm->status == 0;
+
+    for (int x = 0; x < PREFIXSTATS_HASH_SIZE; x++) {
+        prefixstats_entry_t *e = d->table[x];
+        while (e != NULL) {
+            prefixstats_entry_t *next = e->next;
+            if (ok) {
+                memcpy(name, "prefix=", 7);
+                uriencode(e->prefix, name + 7, e->nprefix, KEY_MAX_URI_ENCODED_LENGTH);
+                if (prefixstats_write_line(&cm->c, name, &e->counts) != 0) {
+                    ok = false;
+                }
+            }
+            free(e);
+            e = next;
+        }
+    }
+
+    if (ok && d->noprefix.items) {
+        ok = prefixstats_write_line(&cm->c, "noprefix", &d->noprefix) == 0;
+    }
+    if (ok && d->other.items) {
+        ok = prefixstats_write_line(&cm->c, "other", &d->other) == 0;
+    }
+    free(d);
+    cm->data = NULL;
+
+    if (cm->c.c != NULL) {
+        // flush any pending data.
+        if (lru_crawler_write(&cm->c) == 0) {
+            if (cm->status != 0) {
+                const char *errstr = "ERROR locked try again later\r\n";
+                size_t errlen = strlen(errstr);
+                memcpy(cm->c.buf + cm->c.bufused, errstr, errlen);
+                cm->c.bufused += errlen;
+            } else {
+                memcpy(cm->c.buf + cm->c.bufused, "END\r\n", 5);
+                cm->c.bufused += 5;
+            }
+        }
+    }
+}
+
+/* Binary snapshot of all live items, written to a local file. Items are
+ * serialized into a buffer while the item lock is held, then written out by
+ * the flush hook once locks are dropped. Items stored in extstore only have
+ * their header in memory: we note their keys and look them up again from
+ * flush, reading the value back with the crawler lock dropped so the LRU
+ * maintainer isn't stuck behind disk IO. A hash walk holds the hash table for
+ * its whole run, so its reads wait until the walk is finished.
+ */
+#define SNAPSHOT_WRITE_SIZE (1024 * 64)
+
+struct crawler_snapshot_data {
+    int fd;
+    char *path; /* final file name */
+    char *tmppath; /* written to this, renamed on completion */
+    char *buf;
+    size_t buflen;
+    size_t bufused;
+    char *pending; /* keys of extstore items to read back: nkey, key */
+    size_t pending_used;
+    size_t pending_len;
+    uint64_t items;
+    uint64_t bytes;
+    uint64_t rate; /* bytes per second, 0 for unlimited */
+    uint64_t window_bytes;
+    struct timeval window_start;
+    bool failed;
+};
+
+static int snapshot_buf_reserve(struct crawler_snapshot_data *d, size_t len) {
+    if (d->buflen - d->bufused >= len) {
+        return 0;
+    }
+    size_t nlen = d->buflen;
+    while (nlen - d->bufused < len) {
+        nlen *= 2;
+    }
+    char *nb = realloc(d->buf, nlen);
+    if (nb == NULL) {
+        return -1;
+    }
+    d->buf = nb;
+    d->buflen = nlen;
+    return 0;
+}
+
+// value is NULL if it should be copied out of the item itself.
+static void snapshot_append(struct crawler_snapshot_data *d, item *it, char *value) {
+    char digits[INCR_MAX_STORAGE_LEN];
+    size_t vlen = it->nbytes - 2;
+    if (it->it_flags & ITEM_COUNTER) {
+        // saved as text, it turns back into a counter on its next incr.
+        vlen = item_counter_render(it, digits);
+        value = digits;
+    }
+    size_t len = SNAPSHOT_REC_HDR_LEN + it->nkey + vlen + 2;
+    if (snapshot_buf_reserve(d, len) != 0) {
+        d->failed = true;
+        return;
+    }
+
+    char *p = d->buf + d->bufused;
+    snapshot_rec_t rec;
+    client_flags_t flags;
+    FLAGS_CONV(it, flags);
+    rec.nbytes = vlen;
+    rec.cas = ITEM_get_cas(it);
+    rec.flags = flags;
+    rec.exptime = (it->exptime == 0) ? 0 : (uint64_t)it->exptime + process_started;
+    rec.rflags = (it->it_flags & ITEM_KEY_BINARY) ? SNAPSHOT_REC_KEY_BINARY : 0;
+    rec.nkey = it->nkey;
+    snapshot_encode_rec_hdr(p, &rec);
+    memcpy(p + SNAPSHOT_REC_HDR_LEN, ITEM_key(it), it->nkey);
+
+    char *v = p + SNAPSHOT_REC_HDR_LEN + it->nkey;
+    if (value != NULL) {
+        memcpy(v, value, vlen);
+    } else if (it->it_flags & ITEM_CHUNKED) {
+        // copy the chunks, including the \r\n which is then dropped. the
+        // header chunk is empty.
+        item_chunk *ch = (item_chunk *) ITEM_schunk(it);
+        int remain = it->nbytes;
+        while (ch != NULL && remain > 0) {
+            int todo = ch->used < remain ? ch->used : remain;
+            memcpy(v, ch->data, todo);
+            v += todo;
+            remain -= todo;
+            ch = ch->next;
+        }
+    } else {
+        memcpy(v, ITEM_data(it), vlen);
+    }
+
+    len -= 2;
+    snapshot_seal_rec(p, len);
+    d->bufused += len;
+    d->items++;
+}
+
+static int snapshot_write(struct crawler_snapshot_data *d) {
+    size_t done = 0;
+    while (done < d->bufused) {
+        ssize_t ret = write(d->fd, d->buf + done, d->bufused - done);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (settings.verbose > 0) {
+                fprintf(stderr, "Failed to write snapshot file %s: %s\n",
+                        d->tmppath, strerror(errno));
+            }
+            d->failed = true;
+            d->bufused = 0;
+            return -1;
+        }
+        done += ret;
+    }
+    d->bytes += d->bufused;
+    d->window_bytes += d->bufused;
+    d->bufused = 0;
+    return 0;
+}
+
+// keep the average write rate under the limit by sleeping out the rest of
+// each one second window once it's used up.
+static void snapshot_throttle(struct crawler_snapshot_data *d) {
+    if (d->rate == 0 || d->window_bytes < d->rate) {
+        return;
+    }
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    int64_t elapsed = (now.tv_sec - d->window_start.tv_sec) * 1000000
+        + (now.tv_usec - d->window_start.tv_usec);
+    int64_t wanted = d->window_bytes * 1000000 / d->rate;
+    if (elapsed < wanted) {
+        pthread_mutex_unlock(&lru_crawler_lock);
+        usleep(wanted - elapsed);
+        pthread_mutex_lock(&lru_crawler_lock);
+        gettimeofday(&now, NULL);
+    }
+    d->window_start = now;
+    d->window_bytes = 0;
+}
+
+static int crawler_snapshot_init(crawler_module_t *cm, void *data) {
+    struct crawler_snapshot_conf *conf = data;
+    struct crawler_snapshot_data *d = calloc(1, sizeof(struct crawler_snapshot_data));
+    if (d == NULL) {
+        return -1;
+    }
+
+    d->path = strdup(conf->path);
+    d->tmppath = malloc(strlen(conf->path) + 5);
+    d->buflen = SNAPSHOT_WRITE_SIZE * 2;
+    d->buf = malloc(d->buflen);
+    d->pending_len = 4096;
+    d->pending = malloc(d->pending_len);
+    if (d->path == NULL || d->tmppath == NULL || d->buf == NULL || d->pending == NULL) {
+        goto error;
+    }
+    sprintf(d->tmppath, "%s.tmp", conf->path);
+
+    d->fd = open(d->tmppath, O_WRONLY|O_CREAT|O_TRUNC, 0600);
+    if (d->fd < 0) {
+        if (settings.verbose > 0) {
+            fprintf(stderr, "Failed to open snapshot file %s: %s\n",
+                    d->tmppath, strerror(errno));
+        }
+        goto error;
+    }
+    d->rate = (uint64_t)conf->rate * 1024;
+    gettimeofday(&d->window_start, NULL);
+    snapshot_encode_file_hdr(d->buf, (uint64_t)time(NULL));
+    d->bufused = SNAPSHOT_FILE_HDR_LEN;
+    cm->data = d;
+    cm->status = 0;
+    return 0;
+error:
+    free(d->path);
+    free(d->tmppath);
+    free(d->buf);
+    free(d->pending);
+    free(d);
+    return -1;
+}
+
+static void crawler_snapshot_eval(crawler_module_t *cm, item *it, uint32_t hv, int i) {
+    struct crawler_snapshot_data *d = cm->data;
+    int is_flushed = item_is_flushed(it);
+    /* Ignore expired content. */
+    if ((it->exptime != 0 && it->exptime < current_time)
+        || is_flushed || d->failed) {
+        refcount_decr(it);
+        return;
+    }
+
+#ifdef EXTSTORE
+    if (it->it_flags & ITEM_HDR) {
+        // don't pin the header: a hash walk could hold many of them.
+        if (d->pending_len - d->pending_used < (size_t)it->nkey + 1) {
+            char *np = realloc(d->pending, d->pending_len * 2);
+            if (np == NULL) {
+                d->failed = true;
+                refcount_decr(it);
+                return;
+            }
+            d->pending = np;
+            d->pending_len *= 2;
+        }
+        d->pending[d->pending_used] = it->nkey;
+        memcpy(d->pending + d->pending_used + 1, ITEM_key(it), it->nkey);
+        d->pending_used += it->nkey + 1;
+        refcount_decr(it);
+        return;
+    }
+#endif
+
+    snapshot_append(d, it, NULL);
+    refcount_decr(it);
+}
+
+#ifdef EXTSTORE
+// called with the crawler lock held and no other locks. The item may have
+// changed or gone away since it was queued.
+static void snapshot_read_pending(struct crawler_snapshot_data *d) {
+    size_t x = 0;
+    while (x < d->pending_used && !d->failed) {
+        int nkey = (uint8_t)d->pending[x];
+        char *key = d->pending + x + 1;
+        x += nkey + 1;
+
+        uint32_t hv = hash(key, nkey);
+        item_lock(hv);
+        item *it = assoc_find(key, nkey, hv);
+        if (it == NULL || (it->exptime != 0 && it->exptime < current_time)
+                || item_is_flushed(it)) {
+            item_unlock(hv);
+            continue;
+        }
+        if ((it->it_flags & ITEM_HDR) == 0) {
+            snapshot_append(d, it, NULL);
+            item_unlock(hv);
+            continue;
+        }
+        refcount_incr(it);
+        item_unlock(hv);
+
+        pthread_mutex_unlock(&lru_crawler_lock);
+        item *read_it = storage_read_item(storage, it);
+        pthread_mutex_lock(&lru_crawler_lock);
+        if (read_it != NULL) {
+            snapshot_append(d, it, (char *)read_it + ITEM_ntotal(it) - it->nbytes);
+            free(read_it);
+        }
+        item_remove(it);
+
+        // a hash walk can leave a lot of these to read at once.
+        if (d->bufused >= SNAPSHOT_WRITE_SIZE && !d->failed) {
+            snapshot_write(d);
+            snapshot_throttle(d);
+        }
+    }
+    d->pending_used = 0;
+}
+#endif
+
+static void crawler_snapshot_flush(crawler_module_t *cm) {
+    struct crawler_snapshot_data *d = cm->data;
+#ifdef EXTSTORE
+    // a hash walk holds the hash table locked until it's done.
+    if (d->pending_used != 0 && crawler_count != -1) {
+        snapshot_read_pending(d);
+    }
+#endif
+    if (d->bufused >= SNAPSHOT_WRITE_SIZE && !d->failed) {
+        snapshot_write(d);
+        snapshot_throttle(d);
+    }
+}
+
+static void crawler_snapshot_finalize(crawler_module_t *cm) {
+    struct crawler_snapshot_data *d = cm->data;
+
+    // anything still pending was read back by the last flush, which ran
+    // before the crawl was marked as finished.
+    if (cm->status != 0) {
+        // couldn't walk the hash table.
+        d->failed = true;
+    }
+
+    if (!d->failed && snapshot_buf_reserve(d, SNAPSHOT_REC_HDR_LEN) == 0) {
+        // trailer record: no key, cas is the item count.
+        snapshot_rec_t rec;
+        memset(&rec, 0, sizeof(rec));
+        rec.cas = d->items;
+        snapshot_encode_rec_hdr(d->buf + d->bufused, &rec);
+        snapshot_seal_rec(d->buf + d->bufused, SNAPSHOT_REC_HDR_LEN);
+        d->bufused += SNAPSHOT_REC_HDR_LEN;
+        snapshot_write(d);
+    } else {
+        d->failed = true;
+    }
+
+    if (!d->failed && fsync(d->fd) != 0) {
+        d->failed = true;
+    }
+    close(d->fd);
+    if (!d->failed && rename(d->tmppath, d->path) != 0) {
+        d->failed = true;
+    }
+    if (d->failed) {
+        unlink(d->tmppath);
+    }
+
+    if (settings.verbose > 1) {
+        fprintf(stderr, "Snapshot %s %s: %llu items, %llu bytes\n", d->path,
+                d->failed ? "failed" : "written",
+                (unsigned long long)d->items, (unsigned long long)d->bytes);
+    }
+
+    STATS_LOCK();
+    if (d->failed) {
+        stats.snapshot_errors++;
+    } else {
+        stats.snapshots_written++;
+        stats.snapshot_items += d->items;
+        stats.snapshot_bytes += d->bytes;
+    }
+    STATS_UNLOCK();
+
+    free(d->path);
+    free(d->tmppath);
+    free(d->buf);
+    free(d->pending);
+    free(d);
+    cm->data = NULL;
+}
+
 // write the whole buffer out to the client socket.
 static int lru_crawler_write(crawler_client_t *c) {
     unsigned int data_size = c->bufused;
@@ -444,10 +1022,12 @@ static void lru_crawler_class_done(int i) {
 static void item_crawl_hash(void) {
     // get iterator from assoc. can hang for a long time.
     // - blocks hash expansion
-    void *iter = assoc_get_iterator();
+    void *iter = hash_cursor.enabled ?
+        assoc_get_iterator_at(hash_cursor.cursor) : assoc_get_iterator();
     int crawls_persleep = settings.crawls_persleep;
     item *it = NULL;
     int items = 0;
+    uint32_t seen = 0;
 
     // Could not get the iterator: probably locked due to hash expansion.
     if (iter == NULL) {
@@ -462,6 +1042,15 @@ static void item_crawl_hash(void) {
         // if iterator returns true but no item, we're inbetween buckets and
         // can do cleanup work without holding an item lock.
         if (it == NULL) {
+            if (active_crawler_mod.mod->flush != NULL) {
+                active_crawler_mod.mod->flush(&active_crawler_mod);
+            }
+            // slice is full: stop here and hand the cursor back.
+            if (hash_cursor.enabled && hash_cursor.limit
+                    && seen >= hash_cursor.limit) {
+                break;
+            }
+
             if (active_crawler_mod.c.c != NULL) {
                 if (items > MIN_ITEMS_PER_WRITE) {
                     int ret = lru_crawler_write(&active_crawler_mod.c);
@@ -513,8 +1102,12 @@ static void item_crawl_hash(void) {
         active_crawler_mod.mod->eval(&active_crawler_mod, it, 0, 0);
         crawls_persleep--;
         items++;
+        seen++;
     }
 
+    if (hash_cursor.enabled) {
+        hash_cursor.cursor = assoc_iterator_cursor(iter);
+    }
     // must finalize or we leave the hash table expansion blocked.
     assoc_iterate_final(iter);
     return;
@@ -545,6 +1138,9 @@ static void *item_crawler_thread(void *arg) {
                 continue;
             }
 
+            if (active_crawler_mod.mod->flush != NULL) {
+                active_crawler_mod.mod->flush(&active_crawler_mod);
+            }
             if (active_crawler_mod.c.c != NULL) {
                 crawler_client_t *c = &active_crawler_mod.c;
                 if (c->buflen - c->bufused < LRU_CRAWLER_MINBUFSPACE) {
@@ -614,6 +1210,20 @@ static void *item_crawler_thread(void *arg) {
     } // while
     } // if crawler_count
 
+    // last flush with the hash table released and the crawl still marked as
+    // running, so modules can drop the crawler lock for slow work.
+    if (active_crawler_mod.mod != NULL && active_crawler_mod.mod->flush != NULL) {
+        active_crawler_mod.mod->flush(&active_crawler_mod);
+    }
+
+    /* Clear before handing the client back so it can immediately start
+     * another crawl (ie; the next slice of a cursor walk). The crawler lock
+     * is still held so a new request can't start until we're done here.
+     */
+    STATS_LOCK();
+    stats_state.lru_crawler_running = false;
+    STATS_UNLOCK();
+
     if (active_crawler_mod.mod != NULL) {
         if (active_crawler_mod.mod->finalize != NULL)
             active_crawler_mod.mod->finalize(&active_crawler_mod);
@@ -629,10 +1239,6 @@ static void *item_crawler_thread(void *arg) {
 
     if (settings.verbose > 2)
         fprintf(stderr, "LRU crawler thread sleeping\n");
-
-    STATS_LOCK();
-    stats_state.lru_crawler_running = false;
-    STATS_UNLOCK();
     }
     pthread_mutex_unlock(&lru_crawler_lock);
     if (settings.verbose > 2)
@@ -754,9 +1360,10 @@ static int lru_crawler_set_client(crawler_module_t *cm, void *c, const int sfd)
     return 0;
 }
 
-int lru_crawler_start(uint8_t *ids, uint32_t remaining,
+static int _lru_crawler_start(uint8_t *ids, uint32_t remaining,
                              const enum crawler_run_type type, void *data,
-                             void *c, const int sfd) {
+                             void *c, const int sfd,
+                             crawler_hash_cursor_t *cursor) {
     int starts = 0;
     bool is_running;
     static rel_time_t block_ae_until = 0;
@@ -781,8 +1388,9 @@ int lru_crawler_start(uint8_t *ids, uint32_t remaining,
         return -1;
     }
 
-    /* hash table walk only supported with metadump for now. */
-    if (ids == NULL && type != CRAWLER_METADUMP && type != CRAWLER_MGDUMP) {
+    /* hash table walk only supported with dump modules for now. */
+    if (ids == NULL && type != CRAWLER_METADUMP && type != CRAWLER_MGDUMP
+            && type != CRAWLER_PREFIXSTATS && type != CRAWLER_SNAPSHOT) {
         pthread_mutex_unlock(&lru_crawler_lock);
         return -2;
     }
@@ -792,9 +1400,6 @@ int lru_crawler_start(uint8_t *ids, uint32_t remaining,
         assert(crawler_mod_regs[type] != NULL);
         active_crawler_mod.mod = crawler_mod_regs[type];
         active_crawler_type = type;
-        if (active_crawler_mod.mod->init != NULL) {
-            active_crawler_mod.mod->init(&active_crawler_mod, data);
-        }
         if (active_crawler_mod.mod->needs_client) {
             if (c == NULL || sfd == 0) {
                 pthread_mutex_unlock(&lru_crawler_lock);
@@ -805,11 +1410,29 @@ int lru_crawler_start(uint8_t *ids, uint32_t remaining,
                 return -2;
             }
         }
+        if (active_crawler_mod.mod->init != NULL) {
+            if (active_crawler_mod.mod->init(&active_crawler_mod, data) != 0) {
+                // caller still owns the connection on failure.
+                if (active_crawler_mod.c.c != NULL) {
+                    active_crawler_mod.c.c = NULL;
+                    free(active_crawler_mod.c.buf);
+                    active_crawler_mod.c.buf = NULL;
+                }
+                active_crawler_mod.mod = NULL;
+                pthread_mutex_unlock(&lru_crawler_lock);
+                return -2;
+            }
+        }
     }
 
     if (ids == NULL) {
         /* NULL ids means to walk the hash table instead. */
         starts = 1;
+        if (cursor != NULL) {
+            hash_cursor = *cursor;
+        } else {
+            hash_cursor.enabled = false;
+        }
         /* FIXME: hack to signal hash mode to the crawler thread.
          * Something more clear would be nice.
          */
@@ -832,10 +1455,29 @@ int lru_crawler_start(uint8_t *ids, uint32_t remaining,
     return starts;
 }
 
+int lru_crawler_start(uint8_t *ids, uint32_t remaining,
+                             const enum crawler_run_type type, void *data,
+                             void *c, const int sfd) {
+    return _lru_crawler_start(ids, remaining, type, data, c, sfd, NULL);
+}
+
+static enum crawler_result_type lru_crawler_result(int starts) {
+    if (starts == -1) {
+        return CRAWLER_RUNNING;
+    } else if (starts == -2) {
+        return CRAWLER_ERROR; /* FIXME: not very helpful. */
+    } else if (starts) {
+        return CRAWLER_OK;
+    } else {
+        return CRAWLER_NOTSTARTED;
+    }
+}
+
 /*
  * Also only clear the crawlerstats once per sid.
  */
-enum crawler_result_type lru_crawler_crawl(char *slabs, const enum crawler_run_type type,
+static enum crawler_result_type _lru_crawler_crawl(char *slabs,
+        const enum crawler_run_type type, void *data,
         void *c, const int sfd, unsigned int remaining) {
     char *b = NULL;
     uint32_t sid = 0;
@@ -867,16 +1509,52 @@ enum crawler_result_type lru_crawler_crawl(char *slabs, const enum crawler_run_t
         }
     }
 
-    starts = lru_crawler_start(hash_crawl ? NULL : tocrawl, remaining, type, NULL, c, sfd);
-    if (starts == -1) {
-        return CRAWLER_RUNNING;
-    } else if (starts == -2) {
-        return CRAWLER_ERROR; /* FIXME: not very helpful. */
-    } else if (starts) {
-        return CRAWLER_OK;
-    } else {
-        return CRAWLER_NOTSTARTED;
+    starts = lru_crawler_start(hash_crawl ? NULL : tocrawl, remaining, type, data, c, sfd);
+    return lru_crawler_result(starts);
+}
+
+enum crawler_result_type lru_crawler_crawl(char *slabs, const enum crawler_run_type type,
+        void *c, const int sfd, unsigned int remaining) {
+    return _lru_crawler_crawl(slabs, type, NULL, c, sfd, remaining);
+}
+
+/*
+ * Writes a binary snapshot of the live items in the requested classes (or
+ * the hash table) to a file under settings.snapshot_dir, in the background.
+ * rate is in kilobytes per second; 0 is unlimited.
+ */
+enum crawler_result_type lru_crawler_snapshot(char *slabs, const char *name, uint32_t rate) {
+    char path[PATH_MAX];
+    if (settings.snapshot_dir == NULL) {
+        return CRAWLER_ERROR;
+    }
+    int len = snprintf(path, sizeof(path), "%s/%s", settings.snapshot_dir, name);
+    if (len <= 0 || len >= sizeof(path) - 4) {
+        return CRAWLER_ERROR;
     }
+    struct crawler_snapshot_conf conf = {
+        .path = path,
+        .rate = rate,
+    };
+    return _lru_crawler_crawl(slabs, CRAWLER_SNAPSHOT, &conf, NULL, 0, 0);
+}
+
+/*
+ * Walks part of the hash table starting from a cursor, stopping at the first
+ * bucket boundary after "limit" items (0 for no limit). The next cursor is
+ * sent to the client before the end marker, and 0 is sent when the walk is
+ * complete. Used to split large dumps into short slices which can be resumed
+ * after a disconnect.
+ */
+enum crawler_result_type lru_crawler_crawl_cursor(const enum crawler_run_type type,
+        void *c, const int sfd, uint64_t cursor, uint32_t limit) {
+    crawler_hash_cursor_t hc = {
+        .enabled = true,
+        .cursor = cursor,
+        .limit = limit,
+    };
+    int starts = _lru_crawler_start(NULL, 0, type, NULL, c, sfd, &hc);
+    return lru_crawler_result(starts);
 }
 
 /* If we hold this lock, crawler can't wake up or move */
@@ -24,6 +24,11 @@ struct crawler_expired_data {
     bool is_external; /* whether this was an alloc local or remote to the module. */
 };
 
+struct crawler_snapshot_conf {
+    const char *path;
+    uint32_t rate; /* kilobytes per second, 0 for unlimited */
+};
+
 enum crawler_result_type {
     CRAWLER_OK=0, CRAWLER_RUNNING, CRAWLER_BADCLASS, CRAWLER_NOTSTARTED, CRAWLER_ERROR
 };
@@ -34,6 +39,9 @@ int stop_item_crawler_thread(bool wait);
 int init_lru_crawler(void *arg);
 enum crawler_result_type lru_crawler_crawl(char *slabs, enum crawler_run_type,
         void *c, const int sfd, unsigned int remaining);
+enum crawler_result_type lru_crawler_snapshot(char *slabs, const char *name, uint32_t rate);
+enum crawler_result_type lru_crawler_crawl_cursor(const enum crawler_run_type type,
+        void *c, const int sfd, uint64_t cursor, uint32_t limit);
 int lru_crawler_start(uint8_t *ids, uint32_t remaining,
                              const enum crawler_run_type type, void *data,
                              void *c, const int sfd);
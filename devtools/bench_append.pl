@@ -0,0 +1,65 @@
+#! /usr/bin/env perl
+#
+# Sequential appends growing one large value, like a log kept in a single
+# key. Prepends are run the same way for comparison, since they always copy
+# the whole value into a new item.
+#
+# The seed value should be bigger than slab_chunk_max so the item is chunked,
+# and the server needs a large enough -I for the final value.
+use warnings;
+use strict;
+
+use IO::Socket::INET;
+use Time::HiRes qw(gettimeofday tv_interval);
+
+use FindBin;
+
+@ARGV >= 1 && @ARGV <= 4
+    or die "Usage: $FindBin::Script HOST:PORT [COUNT] [SIZE] [SEED_SIZE]\n";
+
+my $addr = $ARGV[0];
+my $count = $ARGV[1] || 10_000;
+my $size = $ARGV[2] || 100;
+my $seed = $ARGV[3] || 600 * 1024;
+
+my $sock = IO::Socket::INET->new(PeerAddr => $addr,
+                                 Timeout  => 3);
+die "$!\n" unless $sock;
+
+sub stats {
+    my %s = ();
+    print $sock "stats\r\n";
+    while (my $line = <$sock>) {
+        last if $line =~ /^END/;
+        $s{$1} = $2 if $line =~ /^STAT (\S+) (\S+)/;
+    }
+    return \%s;
+}
+
+my $part = 'x' x $size;
+my $value = 'y' x $seed;
+foreach my $cmd (qw(append prepend)) {
+    print $sock "set bench:$cmd 0 0 $seed\r\n$value\r\n";
+    my $res = <$sock>;
+    die "seed value not stored: $res" unless $res eq "STORED\r\n";
+
+    my $before = stats();
+    my $start = [gettimeofday];
+    foreach (1 .. $count) {
+        print $sock "$cmd bench:$cmd 0 0 $size\r\n$part\r\n";
+        $res = <$sock>;
+        die "$cmd failed: $res" unless $res eq "STORED\r\n";
+    }
+    my $secs = tv_interval($start, [gettimeofday]);
+    my $after = stats();
+    my $cpu = 0;
+    for (qw(rusage_user rusage_system)) {
+        $cpu += $after->{$_} - $before->{$_};
+    }
+    printf("%-8s %d x %d bytes: %.2f secs, %.0f ops/sec, %.1f server usec/op, "
+        . "%d in place\n", $cmd, $count, $size, $secs, $count / $secs,
+        $cpu * 1_000_000 / $count,
+        ($after->{inplace_appends} || 0) - ($before->{inplace_appends} || 0));
+    print $sock "delete bench:$cmd\r\n";
+    scalar <$sock>;
+}
@@ -0,0 +1,84 @@
+#! /usr/bin/env perl
+#
+# Several clients doing pipelined gets of the same key at once, so every
+# worker thread fights over that key's item lock and refcount. Run against
+# servers with and without -o hot_cache_items to compare.
+use warnings;
+use strict;
+
+use IO::Socket::INET;
+use Time::HiRes qw(gettimeofday tv_interval);
+
+use FindBin;
+
+@ARGV >= 1 && @ARGV <= 4
+    or die "Usage: $FindBin::Script HOST:PORT [CLIENTS] [COUNT] [DEPTH]\n";
+
+my $addr = $ARGV[0];
+my $clients = $ARGV[1] || 4;
+my $count = $ARGV[2] || 200_000;
+my $depth = $ARGV[3] || 50;
+
+sub connect_server {
+    my $sock = IO::Socket::INET->new(PeerAddr => $addr,
+                                     Timeout  => 3);
+    die "$!\n" unless $sock;
+    return $sock;
+}
+
+sub stats {
+    my ($sock, $type) = @_;
+    my %s = ();
+    print $sock "stats" . ($type || '') . "\r\n";
+    while (my $line = <$sock>) {
+        last if $line =~ /^END/;
+        $s{$1} = $2 if $line =~ /^STAT (\S+) (\S+)/;
+    }
+    return \%s;
+}
+
+my $sock = connect_server();
+print $sock "set bench:hot 0 0 100\r\n" . ('x' x 100) . "\r\n";
+my $res = <$sock>;
+die "key not stored: $res" unless $res eq "STORED\r\n";
+
+printf("hot_cache_items: %d\n",
+    stats($sock, ' settings')->{hot_cache_items} || 0);
+my $before = stats($sock);
+my $start = [gettimeofday];
+my $rounds = int($count / $depth);
+my @pids = ();
+for (1 .. $clients) {
+    my $pid = fork();
+    die "fork: $!" unless defined $pid;
+    if ($pid == 0) {
+        my $c = connect_server();
+        my $req = "get bench:hot\r\n" x $depth;
+        foreach (1 .. $rounds) {
+            print $c $req;
+            for (1 .. $depth) {
+                my $line = <$c>;
+                die "get failed: $line" unless $line =~ /^VALUE/;
+                scalar <$c> for 1 .. 2;
+            }
+        }
+        exit 0;
+    }
+    push(@pids, $pid);
+}
+waitpid($_, 0) for @pids;
+my $secs = tv_interval($start, [gettimeofday]);
+my $after = stats($sock);
+
+my $ops = $rounds * $depth * $clients;
+my $cpu = 0;
+for (qw(rusage_user rusage_system)) {
+    $cpu += $after->{$_} - $before->{$_};
+}
+printf("%d clients x %d gets: %.2f secs, %.0f gets/sec, "
+    . "%.2f server usec/get, %d from the hot cache\n", $clients,
+    $rounds * $depth, $secs, $ops / $secs, $cpu * 1_000_000 / $ops,
+    ($after->{hot_cache_hits} || 0) - ($before->{hot_cache_hits} || 0));
+
+print $sock "delete bench:hot\r\n";
+scalar <$sock>;
@@ -0,0 +1,77 @@
+#! /usr/bin/env perl
+#
+# Pipelined incr on a single hot key, then the same with a get of the key
+# ahead of each incr. Gets in a pipeline hold their reference until the
+# responses are written, so a text counter gets copied into a new item by
+# the incr behind them. Run against servers with and without
+# -o native_counters to compare.
+use warnings;
+use strict;
+
+use IO::Socket::INET;
+use Time::HiRes qw(gettimeofday tv_interval);
+
+use FindBin;
+
+@ARGV >= 1 && @ARGV <= 3
+    or die "Usage: $FindBin::Script HOST:PORT [COUNT] [DEPTH]\n";
+
+my $addr = $ARGV[0];
+my $count = $ARGV[1] || 200_000;
+my $depth = $ARGV[2] || 50;
+
+my $sock = IO::Socket::INET->new(PeerAddr => $addr,
+                                 Timeout  => 3);
+die "$!\n" unless $sock;
+
+sub stats {
+    my $type = shift || '';
+    my %s = ();
+    print $sock "stats$type\r\n";
+    while (my $line = <$sock>) {
+        last if $line =~ /^END/;
+        $s{$1} = $2 if $line =~ /^STAT (\S+) (\S+)/;
+    }
+    return \%s;
+}
+
+sub run {
+    my ($name, $with_get) = @_;
+    print $sock "set bench:hot 0 0 1\r\n0\r\n";
+    my $res = <$sock>;
+    die "counter not stored: $res" unless $res eq "STORED\r\n";
+
+    my $one = $with_get ? "get bench:hot\r\nincr bench:hot 1\r\n"
+        : "incr bench:hot 1\r\n";
+    my $req = $one x $depth;
+    my $rounds = int($count / $depth);
+    my $before = stats();
+    my $start = [gettimeofday];
+    foreach (1 .. $rounds) {
+        print $sock $req;
+        for (1 .. $depth) {
+            if ($with_get) {
+                scalar <$sock> for 1 .. 3;
+            }
+            $res = <$sock>;
+            die "incr failed: $res" unless $res =~ /^\d+/;
+        }
+    }
+    my $secs = tv_interval($start, [gettimeofday]);
+    my $after = stats();
+    my $ops = $rounds * $depth;
+    my $cpu = 0;
+    for (qw(rusage_user rusage_system)) {
+        $cpu += $after->{$_} - $before->{$_};
+    }
+    printf("%-9s %d x %d: %.2f secs, %.0f incr/sec, %.2f server usec/incr, "
+        . "%d items stored\n", $name, $rounds, $depth, $secs, $ops / $secs,
+        $cpu * 1_000_000 / $ops, $after->{total_items} - $before->{total_items});
+}
+
+printf("native_counters: %s\n", stats(' settings')->{native_counters} || 'no');
+run('incr', 0);
+run('get+incr', 1);
+
+print $sock "delete bench:hot\r\n";
+scalar <$sock>;
@@ -0,0 +1,64 @@
+#! /usr/bin/env perl
+#
+# Pipelined small gets: a multiget, a stack of single key gets, and a stack of
+# meta gets per round trip. Exercises response building and write combining.
+use warnings;
+use strict;
+
+use IO::Socket::INET;
+use Time::HiRes qw(gettimeofday tv_interval);
+
+use FindBin;
+
+@ARGV >= 1 && @ARGV <= 4
+    or die "Usage: $FindBin::Script HOST:PORT [ROUNDS] [DEPTH] [VALUE_SIZE]\n";
+
+my $addr = $ARGV[0];
+my $rounds = $ARGV[1] || 2_000;
+my $depth = $ARGV[2] || 100;
+my $vsize = $ARGV[3] || 32;
+
+my $sock = IO::Socket::INET->new(PeerAddr => $addr,
+                                 Timeout  => 3);
+die "$!\n" unless $sock;
+
+my $value = 'x' x $vsize;
+foreach my $k (1 .. $depth) {
+    print $sock "set bench:$k 0 0 $vsize noreply\r\n$value\r\n";
+}
+print $sock "mn\r\n";
+scalar <$sock>;
+
+my @keys = map { "bench:$_" } 1 .. $depth;
+my %tests = (
+    'multiget' => ["get @keys\r\n", 2 * $depth + 1],
+    'get' => [join('', map { "get $_\r\n" } @keys), 3 * $depth],
+    'mg' => [join('', map { "mg $_ v\r\n" } @keys), 2 * $depth],
+);
+
+# The client is usually slower than the server, so also report the CPU time
+# the server spent.
+sub server_cpu {
+    my $cpu = 0;
+    print $sock "stats\r\n";
+    while (my $line = <$sock>) {
+        last if $line =~ /^END/;
+        $cpu += $1 if $line =~ /^STAT rusage_(?:user|system) ([\d.]+)/;
+    }
+    return $cpu;
+}
+
+foreach my $name (qw(multiget get mg)) {
+    my ($req, $lines) = @{$tests{$name}};
+    my $cpu = server_cpu();
+    my $start = [gettimeofday];
+    foreach (1 .. $rounds) {
+        print $sock $req;
+        scalar <$sock> for 1 .. $lines;
+    }
+    my $secs = tv_interval($start, [gettimeofday]);
+    $cpu = server_cpu() - $cpu;
+    printf("%-8s %d x %d keys: %.2f secs, %.0f keys/sec, %.3f server usec/key\n",
+        $name, $rounds, $depth, $secs, $rounds * $depth / $secs,
+        $cpu * 1_000_000 / ($rounds * $depth));
+}
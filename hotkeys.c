@@ -0,0 +1,158 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Hot key sketches, see hotkeys.h.
+ */
+#include "memcached.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+struct hotkeys *hotkeys_create(const unsigned int slots) {
+    struct hotkeys *h = calloc(1, sizeof(*h) + sizeof(struct hotkey) * slots);
+    if (h == NULL) {
+        return NULL;
+    }
+    pthread_mutex_init(&h->lock, NULL);
+    h->slots = slots;
+    h->started = current_time;
+    return h;
+}
+
+static struct hotkey *hotkeys_find(struct hotkeys *h, const char *key,
+        const size_t nkey, const uint32_t hv, struct hotkey **min) {
+    struct hotkey *least = NULL;
+    for (unsigned int i = 0; i < h->used; i++) {
+        struct hotkey *k = &h->keys[i];
+        if (k->hv == hv && k->nkey == nkey && memcmp(k->key, key, nkey) == 0) {
+            return k;
+        }
+        if (least == NULL || k->count < least->count) {
+            least = k;
+        }
+    }
+    if (min != NULL) {
+        *min = least;
+    }
+    return NULL;
+}
+
+// Counts one sampled lookup. Returns the key's entry.
+static struct hotkey *hotkeys_add(struct hotkeys *h, const char *key,
+        const size_t nkey, const uint32_t hv, const uint64_t count,
+        const uint64_t error, const uint64_t bytes) {
+    struct hotkey *min = NULL;
+    struct hotkey *k = hotkeys_find(h, key, nkey, hv, &min);
+    if (k == NULL) {
+        if (h->used < h->slots) {
+            k = &h->keys[h->used++];
+            k->count = 0;
+            k->error = 0;
+        } else {
+            // evict the least counted key, the newcomer takes over its count.
+            k = min;
+            k->error = k->count;
+        }
+        k->bytes = 0;
+        k->hv = hv;
+        k->nkey = nkey;
+        memcpy(k->key, key, nkey);
+    }
+    k->count += count;
+    k->error += error;
+    k->bytes += bytes;
+    return k;
+}
+
+// Counts one sampled lookup. Returns the slot the key is in.
+int hotkeys_record(struct hotkeys *h, const char *key, const size_t nkey,
+        const uint32_t hv) {
+    pthread_mutex_lock(&h->lock);
+    struct hotkey *k = hotkeys_add(h, key, nkey, hv, 1, 0, 0);
+    pthread_mutex_unlock(&h->lock);
+    return k - h->keys;
+}
+
+// Adds the value bytes sent for a lookup hotkeys_record() put in slot. The
+// table may have been reset in between, so the key is checked again.
+void hotkeys_add_bytes(struct hotkeys *h, const int slot, const char *key,
+        const size_t nkey, const int bytes) {
+    pthread_mutex_lock(&h->lock);
+    if ((unsigned int)slot < h->used) {
+        struct hotkey *k = &h->keys[slot];
+        if (k->nkey == nkey && memcmp(k->key, key, nkey) == 0) {
+            k->bytes += bytes;
+        }
+    }
+    pthread_mutex_unlock(&h->lock);
+}
+
+void hotkeys_reset(struct hotkeys *h) {
+    pthread_mutex_lock(&h->lock);
+    h->used = 0;
+    h->started = current_time;
+    pthread_mutex_unlock(&h->lock);
+}
+
+/* Adds src's keys into dst, which needs enough slots to hold all of them. */
+void hotkeys_merge(struct hotkeys *dst, struct hotkeys *src) {
+    pthread_mutex_lock(&src->lock);
+    for (unsigned int i = 0; i < src->used; i++) {
+        struct hotkey *k = &src->keys[i];
+        assert(dst->used < dst->slots
+                || hotkeys_find(dst, k->key, k->nkey, k->hv, NULL) != NULL);
+        hotkeys_add(dst, k->key, k->nkey, k->hv, k->count, k->error, k->bytes);
+    }
+    if (src->started < dst->started) {
+        dst->started = src->started;
+    }
+    pthread_mutex_unlock(&src->lock);
+}
+
+static int hotkeys_by_count(const void *a, const void *b) {
+    const struct hotkey *ka = a, *kb = b;
+    return (ka->count < kb->count) - (ka->count > kb->count);
+}
+
+static int hotkeys_by_bytes(const void *a, const void *b) {
+    const struct hotkey *ka = a, *kb = b;
+    return (ka->bytes < kb->bytes) - (ka->bytes > kb->bytes);
+}
+
+/* Sorts h and writes out its top keys. Counts are scaled back up by the
+ * sample rate, so they are estimates of the real number of lookups. */
+void hotkeys_stats(struct hotkeys *h, unsigned int top, const bool by_bytes,
+        ADD_STAT add_stats, void *c) {
+    char key_str[STAT_KEY_LEN];
+    char val_str[STAT_VAL_LEN];
+    char enc[KEY_MAX_LENGTH * 3 + 1];
+    int klen, vlen;
+    uint64_t sample = settings.hotkey_sample;
+    rel_time_t secs = current_time > h->started ? current_time - h->started : 1;
+
+    qsort(h->keys, h->used, sizeof(struct hotkey),
+            by_bytes ? hotkeys_by_bytes : hotkeys_by_count);
+    if (top > h->used) {
+        top = h->used;
+    }
+
+    APPEND_STAT("hotkeys_sample", "%llu", (unsigned long long)sample);
+    APPEND_STAT("hotkeys_seconds", "%u", secs);
+    for (unsigned int i = 0; i < top; i++) {
+        struct hotkey *k = &h->keys[i];
+        int rank = i + 1;
+        uriencode(k->key, enc, k->nkey, sizeof(enc));
+        klen = snprintf(key_str, STAT_KEY_LEN, "hotkey:%d:key", rank);
+        add_stats(key_str, klen, enc, strlen(enc), c);
+        APPEND_NUM_FMT_STAT("hotkey:%d:%s", rank, "requests", "%llu",
+                (unsigned long long)(k->count * sample));
+        APPEND_NUM_FMT_STAT("hotkey:%d:%s", rank, "requests_per_sec", "%llu",
+                (unsigned long long)(k->count * sample / secs));
+        APPEND_NUM_FMT_STAT("hotkey:%d:%s", rank, "error", "%llu",
+                (unsigned long long)(k->error * sample));
+        APPEND_NUM_FMT_STAT("hotkey:%d:%s", rank, "bytes", "%llu",
+                (unsigned long long)(k->bytes * sample));
+        APPEND_NUM_FMT_STAT("hotkey:%d:%s", rank, "bytes_per_sec", "%llu",
+                (unsigned long long)(k->bytes * sample / secs));
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef HOTKEYS_H
+#define HOTKEYS_H
+
+/* Hot key tracking. Each worker samples one in hotkey_sample key lookups into
+ * its own Space-Saving sketch: a fixed table of hotkey_slots keys where a new
+ * key evicts the least counted one and inherits its count. Any key seen more
+ * than 1/hotkey_slots of the time is guaranteed to be in the table, and its
+ * count is overestimated by at most its error. "stats hotkeys" sums the
+ * workers' tables.
+ */
+
+struct hotkey {
+    uint64_t count;     /* sampled lookups, including error */
+    uint64_t error;     /* count inherited from the key it replaced */
+    uint64_t bytes;     /* value bytes sent for the sampled lookups */
+    uint32_t hv;
+    uint8_t nkey;
+    char key[KEY_MAX_LENGTH];
+};
+
+struct hotkeys {
+    pthread_mutex_t lock;   /* taken by the worker and by stats */
+    unsigned int slots;
+    unsigned int used;
+    rel_time_t started;     /* when counting started, for rates */
+    struct hotkey keys[];
+};
+
+struct hotkeys *hotkeys_create(const unsigned int slots);
+int hotkeys_record(struct hotkeys *h, const char *key, const size_t nkey,
+        const uint32_t hv);
+void hotkeys_add_bytes(struct hotkeys *h, const int slot, const char *key,
+        const size_t nkey, const int bytes);
+void hotkeys_reset(struct hotkeys *h);
+void hotkeys_merge(struct hotkeys *dst, struct hotkeys *src);
+void hotkeys_stats(struct hotkeys *h, unsigned int top, const bool by_bytes,
+        ADD_STAT add_stats, void *c);
+
+/* Called for every key lookup, records one in hotkey_sample of them. */
+static inline void hotkeys_sample(LIBEVENT_THREAD *t, const char *key,
+        const size_t nkey, const uint32_t hv) {
+    if (t->hotkeys != NULL) {
+        t->hotkeys_last = -1;
+        if (--t->hotkeys_countdown == 0) {
+            t->hotkeys_countdown = settings.hotkey_sample;
+            t->hotkeys_last = hotkeys_record(t->hotkeys, key, nkey, hv);
+        }
+    }
+}
+
+/* Called by commands sending a value right after looking it up. Only lookups
+ * which were sampled count their bytes. */
+static inline void hotkeys_sent(LIBEVENT_THREAD *t, const item *it,
+        const int bytes) {
+    if (t->hotkeys != NULL && t->hotkeys_last >= 0) {
+        hotkeys_add_bytes(t->hotkeys, t->hotkeys_last, ITEM_key(it), it->nkey,
+                bytes);
+        t->hotkeys_last = -1;
+    }
+}
+
+#endif
@@ -119,6 +119,15 @@ void set_cas_id(uint64_t new_cas) {
     pthread_mutex_unlock(&cas_id_lock);
 }
 
+/* Make sure no CAS id handed out from now on is at or below min_cas. */
+void raise_cas_id(uint64_t min_cas) {
+    pthread_mutex_lock(&cas_id_lock);
+    if (cas_id < min_cas) {
+        cas_id = min_cas;
+    }
+    pthread_mutex_unlock(&cas_id_lock);
+}
+
 int item_is_flushed(item *it) {
     rel_time_t oldest_live = settings.oldest_live;
     if (it->time <= oldest_live && oldest_live <= current_time)
@@ -525,6 +534,32 @@ void do_item_unlink(item *it, const uint32_t hv) {
     }
 }
 
+/* Accounts for a linked item whose value was extended in place. The caller
+ * holds the item lock, so the item can't move between LRUs under us. */
+void do_item_grown(item *it, const int delta) {
+    STATS_LOCK();
+    stats_state.curr_bytes += delta;
+    STATS_UNLOCK();
+    pthread_mutex_lock(&lru_locks[it->slabs_clsid]);
+    sizes_bytes[it->slabs_clsid] += delta;
+    pthread_mutex_unlock(&lru_locks[it->slabs_clsid]);
+}
+
+/* Sets up a fresh item of ITEM_COUNTER_NBYTES as a counter. */
+void item_counter_init(item *it, const uint64_t value) {
+    assert(it->nbytes == ITEM_COUNTER_NBYTES);
+    memset(ITEM_data(it), 0, it->nbytes - 2);
+    memcpy(ITEM_data(it) + it->nbytes - 2, "\r\n", 2);
+    ITEM_set_counter(it, value);
+    it->it_flags |= ITEM_COUNTER;
+}
+
+/* Writes a counter's value as digits into buf, which needs to hold
+ * INCR_MAX_STORAGE_LEN bytes. Returns the number of digits. */
+int item_counter_render(item *it, char *buf) {
+    return itoa_u64(ITEM_get_counter(it), buf) - buf;
+}
+
 /* FIXME: Is it necessary to keep this copy/pasted code? */
 void do_item_unlink_nolock(item *it, const uint32_t hv) {
     MEMCACHED_ITEM_UNLINK(ITEM_key(it), it->nkey, it->nbytes);
@@ -1055,6 +1090,7 @@ item *do_item_get(const char *key, const size_t nkey, const uint32_t hv, LIBEVEN
     /* For now this is in addition to the above verbose logging. */
     LOGGER_LOG(t->l, LOG_FETCHERS, LOGGER_ITEM_GET, NULL, was_found, key,
                nkey, (it) ? it->nbytes : 0, (it) ? ITEM_clsid(it) : 0, t->cur_sfd);
+    hotkeys_sample(t, key, nkey, hv);
 
     return it;
 }
@@ -1098,6 +1134,149 @@ item *do_item_touch(const char *key, size_t nkey, uint32_t exptime,
     return it;
 }
 
+/*** PER-WORKER HOT ITEM CACHE ***/
+
+/* With -o hot_cache_items each worker keeps a small direct-mapped table of
+ * the items it serves most, each with a reference held. A plain get that
+ * finds its key there is served without the item lock and without touching
+ * the item's refcount; the response borrows the table's reference instead.
+ *
+ * The table's reference is what keeps a cached item valid: value changes in
+ * place (incr, append) need the hash table's to be the only other one, so a
+ * cached item is only ever replaced or unlinked. Either way it loses
+ * ITEM_LINKED, or its CAS changes, and the entry stops being served. Entries
+ * are also dropped after HOT_CACHE_TTL seconds so the LRU and the slab mover
+ * aren't held up by them, and picked up again if the key is still hot.
+ */
+#define HOT_CACHE_TTL 2
+
+static void hot_cache_release(struct hot_item *h) {
+    item_remove(h->it);
+    h->it = NULL;
+    h->dead = false;
+}
+
+// Stops serving an entry, and releases it once no response is sending it.
+static void hot_cache_drop(struct hot_item *h) {
+    if (h->borrowed == 0) {
+        hot_cache_release(h);
+    } else {
+        h->dead = true;
+    }
+}
+
+static bool hot_cache_valid(struct hot_item *h) {
+    item *it = h->it;
+    if ((__atomic_load_n(&it->it_flags, __ATOMIC_ACQUIRE) & ITEM_LINKED) == 0
+            || ITEM_get_cas(it) != h->cas
+            || item_is_flushed(it)
+            || (it->exptime != 0 && it->exptime <= current_time)
+            || current_time > h->until) {
+        return false;
+    }
+    return true;
+}
+
+static void hot_cache_sweep(evutil_socket_t fd, short which, void *arg) {
+    LIBEVENT_THREAD *t = arg;
+
+    for (unsigned int i = 0; i < settings.hot_cache_items; i++) {
+        struct hot_item *h = &t->hot_cache[i];
+        if (h->it != NULL && !h->dead && !hot_cache_valid(h)) {
+            hot_cache_drop(h);
+        }
+    }
+}
+
+void hot_cache_thread_init(LIBEVENT_THREAD *t) {
+    struct timeval tv = {.tv_sec = 1, .tv_usec = 0};
+
+    if (settings.hot_cache_items == 0)
+        return;
+
+    t->hot_cache = calloc(settings.hot_cache_items, sizeof(struct hot_item));
+    t->hot_cache_timer = event_new(t->base, -1, EV_PERSIST, hot_cache_sweep, t);
+    if (t->hot_cache == NULL || t->hot_cache_timer == NULL) {
+        fprintf(stderr, "Failed to allocate hot item cache\n");
+        exit(EXIT_FAILURE);
+    }
+    evtimer_add(t->hot_cache_timer, &tv);
+}
+
+/* Returns the cached item for a key, or NULL. No reference is taken: *hot is
+ * set to the entry, which must be handed back with hot_cache_return() once
+ * the item is no longer used. */
+item *hot_cache_get(LIBEVENT_THREAD *t, const char *key, const size_t nkey,
+        const uint32_t hv, struct hot_item **hot) {
+    struct hot_item *h = &t->hot_cache[hv % settings.hot_cache_items];
+    item *it = h->it;
+
+    if (it == NULL || h->dead || h->hv != hv) {
+        return NULL;
+    }
+    if (it->nkey != nkey || memcmp(ITEM_key(it), key, nkey) != 0) {
+        return NULL;
+    }
+    if (!hot_cache_valid(h)) {
+        hot_cache_drop(h);
+        return NULL;
+    }
+    h->borrowed++;
+    *hot = h;
+
+    LOGGER_LOG(t->l, LOG_FETCHERS, LOGGER_ITEM_GET, NULL, 1, key,
+               nkey, it->nbytes, ITEM_clsid(it), t->cur_sfd);
+    hotkeys_sample(t, key, nkey, hv);
+    return it;
+}
+
+void hot_cache_return(struct hot_item *h) {
+    assert(h->borrowed > 0);
+    if (--h->borrowed == 0 && h->dead) {
+        hot_cache_release(h);
+    }
+}
+
+/* Counts a hit from the regular lookup path, which the caller holds a
+ * reference for. Each entry counts hits for one key at a time, by majority
+ * vote among the keys mapping to it; a key reaching hot_cache_hits within a
+ * second takes the entry over. */
+void hot_cache_count(LIBEVENT_THREAD *t, item *it, const uint32_t hv) {
+    struct hot_item *h = &t->hot_cache[hv % settings.hot_cache_items];
+
+    if (h->cand_time != current_time) {
+        h->cand_time = current_time;
+        h->cand_hv = hv;
+        h->cand_hits = 0;
+    }
+    if (h->cand_hv != hv) {
+        if (h->cand_hits > 0) {
+            h->cand_hits--;
+            return;
+        }
+        h->cand_hv = hv;
+    }
+    if (++h->cand_hits < settings.hot_cache_hits) {
+        return;
+    }
+
+    if (h->it == it || (it->it_flags & (ITEM_HDR | ITEM_COUNTER))) {
+        return;
+    }
+    if (h->it != NULL) {
+        if (h->borrowed != 0) {
+            return;
+        }
+        hot_cache_release(h);
+    }
+    refcount_incr(it);
+    h->it = it;
+    h->cas = ITEM_get_cas(it);
+    h->hv = hv;
+    h->until = current_time + HOT_CACHE_TTL;
+    h->cand_hits = 0;
+}
+
 /*** LRU MAINTENANCE THREAD ***/
 
 /* Returns number of items remove, expired, or evicted.
@@ -9,6 +9,7 @@
 /* See items.c */
 uint64_t get_cas_id(void);
 void set_cas_id(uint64_t new_cas);
+void raise_cas_id(uint64_t min_cas);
 
 /*@null@*/
 item *do_item_alloc(const char *key, const size_t nkey, const client_flags_t flags, const rel_time_t exptime, const int nbytes);
@@ -23,6 +24,9 @@ void do_item_unlink_nolock(item *it, const uint32_t hv);
 void do_item_remove(item *it);
 void do_item_update(item *it);   /** update LRU time to current and reposition */
 void do_item_update_nolock(item *it);
+void do_item_grown(item *it, const int delta); /** value grew in place by delta bytes */
+void item_counter_init(item *it, const uint64_t value);
+int item_counter_render(item *it, char *buf);
 int  do_item_replace(item *it, item *new_it, const uint32_t hv, const uint64_t cas);
 void do_item_link_fixup(item *it);
 
@@ -70,6 +74,25 @@ typedef struct {
 } item_stats_automove;
 void fill_item_stats_automove(item_stats_automove *am);
 
+/* An entry of a worker's hot item cache. */
+struct hot_item {
+    item *it;               /* cached item, NULL if none; holds a reference */
+    uint64_t cas;           /* CAS of the item when it was cached */
+    uint32_t hv;
+    rel_time_t until;       /* dropped after this */
+    unsigned int borrowed;  /* responses still sending the item */
+    bool dead;              /* no longer served, released once not borrowed */
+    uint32_t cand_hv;       /* key counted for taking the entry over */
+    unsigned int cand_hits; /* its hits this second */
+    rel_time_t cand_time;
+};
+
+void hot_cache_thread_init(LIBEVENT_THREAD *t);
+item *hot_cache_get(LIBEVENT_THREAD *t, const char *key, const size_t nkey,
+        const uint32_t hv, struct hot_item **hot);
+void hot_cache_return(struct hot_item *h);
+void hot_cache_count(LIBEVENT_THREAD *t, item *it, const uint32_t hv);
+
 item *do_item_get(const char *key, const size_t nkey, const uint32_t hv, LIBEVENT_THREAD *t, const bool do_update);
 item *do_item_touch(const char *key, const size_t nkey, uint32_t exptime, const uint32_t hv, LIBEVENT_THREAD *t);
 void do_item_bump(LIBEVENT_THREAD *t, item *it, const uint32_t hv);
@@ -218,9 +218,10 @@ static int _logger_parse_ise(logentry *e, char *scratch) {
     const char * const status_map[] = {
         "not_stored", "stored", "exists", "not_found", "too_large", "no_memory" };
     const char * const cmd_map[] = {
-        "null", "add", "set", "replace", "append", "prepend", "cas", "append", "prepend" };
+        "null", "add", "set", "replace", "append", "prepend", "cas", "append", "prepend",
+        "overwrite" };
 
-    if (le->cmd <= 8)
+    if (le->cmd <= 9)
         cmd = cmd_map[le->cmd];
 
     uriencode(le->key, keybuf, le->nkey, KEY_MAX_URI_ENCODED_LENGTH);
@@ -17,6 +17,7 @@
 #include "storage.h"
 #include "authfile.h"
 #include "restart.h"
+#include "snapshot.h"
 #include <sys/stat.h>
 #include <sys/socket.h>
 #include <sys/un.h>
@@ -54,6 +55,11 @@
 #include "tls.h"
 #endif
 
+#ifdef USE_URING
+#include <sys/eventfd.h>
+#include "uring.h"
+#endif
+
 #include "proto_text.h"
 #include "proto_bin.h"
 #include "proto_proxy.h"
@@ -62,6 +68,16 @@
 #include <sys/sysctl.h>
 #endif
 
+#if defined(__linux__)
+#include <linux/filter.h>
+#endif
+
+#ifdef USE_ZEROCOPY
+#include <linux/errqueue.h>
+#include <linux/sockios.h>
+#include <sys/ioctl.h>
+#endif
+
 /*
  * forward declarations
  */
@@ -84,7 +100,6 @@ static int try_read_command_udp(conn *c);
 static enum try_read_result try_read_network(conn *c);
 static enum try_read_result try_read_udp(conn *c);
 
-static int start_conn_timeout_thread(void);
 
 /* stats */
 static void stats_init(void);
@@ -96,8 +111,13 @@ static void settings_init(void);
 /* event handling, network IO */
 static void event_handler(const evutil_socket_t fd, const short which, void *arg);
 static void conn_close(conn *c);
+#ifdef USE_ZEROCOPY
+static void conn_zc_hold(conn *c, mc_resp *resp);
+static void conn_zc_reap(conn *c);
+static void conn_zc_linger(conn *c);
+#endif
 static void conn_init(void);
-static bool update_event(conn *c, const int new_flags);
+static bool update_event(conn *c, int new_flags);
 static void complete_nread(conn *c);
 
 static void conn_free(conn *c);
@@ -147,6 +167,14 @@ ssize_t tcp_write(conn *c, void *buf, size_t count) {
 
 static enum transmit_result transmit(conn *c);
 
+#ifdef USE_URING
+static ssize_t conn_uring_read(conn *c, void *buf, size_t count);
+static enum transmit_result conn_uring_transmit(conn *c);
+static void conn_uring_release(conn *c);
+static void conn_uring_runq_add(conn *c);
+static bool conn_uring_readable(conn *c);
+#endif
+
 /* This reduces the latency without adding lots of extra wiring to be able to
  * notify the listener thread of when to listen again.
  * Also, the clock timer could be broken out into its own thread and we
@@ -262,6 +290,8 @@ static void settings_init(void) {
     settings.lru_crawler = false;
     settings.lru_crawler_sleep = 100;
     settings.lru_crawler_tocrawl = 0;
+    settings.snapshot_dir = NULL;
+    settings.snapshot_load = NULL;
     settings.lru_maintainer_thread = false;
     settings.lru_segmented = true;
     settings.hot_lru_pct = 20;
@@ -294,114 +324,35 @@ static void settings_init(void) {
 #ifdef SOCK_COOKIE_ID
     settings.sock_cookie_id = 0;
 #endif
+#ifdef USE_URING
+    settings.worker_uring = false;
+#endif
+    settings.worker_listeners = false;
+    settings.worker_listeners_cpu = false;
+    settings.busy_poll = 0;
+    settings.shed_interval = 100000;
+#ifdef USE_CONN_MIGRATION
+    settings.migrate_interval = 3;
+#endif
+#ifdef USE_SHM
+    settings.shm_ring_kb = 0;
+    settings.shm_max_conns = 64;
+#endif
+#ifdef USE_UDP_GSO
+    settings.udp_gso = false;
+#endif
+    settings.native_counters = false;
+    settings.hotkey_sample = 0;
+    settings.hotkey_slots = 64;
+    settings.hot_cache_items = 0;
+    settings.hot_cache_hits = 1000;
+#ifdef USE_ZEROCOPY
+    settings.zerocopy_min_bytes = 0;
+#endif
 }
 
 extern pthread_mutex_t conn_lock;
 
-/* Connection timeout thread bits */
-static pthread_t conn_timeout_tid;
-static int do_run_conn_timeout_thread;
-static pthread_cond_t conn_timeout_cond = PTHREAD_COND_INITIALIZER;
-static pthread_mutex_t conn_timeout_lock = PTHREAD_MUTEX_INITIALIZER;
-
-#define CONNS_PER_SLICE 100
-static void *conn_timeout_thread(void *arg) {
-    int i;
-    conn *c;
-    rel_time_t oldest_last_cmd;
-    int sleep_time;
-    int sleep_slice = max_fds / CONNS_PER_SLICE;
-    if (sleep_slice == 0)
-        sleep_slice = CONNS_PER_SLICE;
-
-    useconds_t timeslice = 1000000 / sleep_slice;
-
-    mutex_lock(&conn_timeout_lock);
-    while(do_run_conn_timeout_thread) {
-        if (settings.verbose > 2)
-            fprintf(stderr, "idle timeout thread at top of connection list\n");
-
-        oldest_last_cmd = current_time;
-
-        for (i = 0; i < max_fds; i++) {
-            if ((i % CONNS_PER_SLICE) == 0) {
-                if (settings.verbose > 2)
-                    fprintf(stderr, "idle timeout thread sleeping for %ulus\n",
-                        (unsigned int)timeslice);
-                usleep(timeslice);
-            }
-
-            if (!conns[i])
-                continue;
-
-            c = conns[i];
-
-            if (!IS_TCP(c->transport))
-                continue;
-
-            if (c->state != conn_new_cmd && c->state != conn_read)
-                continue;
-
-            if ((current_time - c->last_cmd_time) > settings.idle_timeout) {
-                timeout_conn(c);
-            } else {
-                if (c->last_cmd_time < oldest_last_cmd)
-                    oldest_last_cmd = c->last_cmd_time;
-            }
-        }
-
-        /* This is the soonest we could have another connection time out */
-        sleep_time = settings.idle_timeout - (current_time - oldest_last_cmd) + 1;
-        if (sleep_time <= 0)
-            sleep_time = 1;
-
-        if (settings.verbose > 2)
-            fprintf(stderr,
-                    "idle timeout thread finished pass, sleeping for %ds\n",
-                    sleep_time);
-
-        struct timeval now;
-        struct timespec to_sleep;
-        gettimeofday(&now, NULL);
-        to_sleep.tv_sec = now.tv_sec + sleep_time;
-        to_sleep.tv_nsec = 0;
-
-        pthread_cond_timedwait(&conn_timeout_cond, &conn_timeout_lock, &to_sleep);
-    }
-
-    mutex_unlock(&conn_timeout_lock);
-    return NULL;
-}
-
-static int start_conn_timeout_thread(void) {
-    int ret;
-
-    if (settings.idle_timeout == 0)
-        return -1;
-
-    do_run_conn_timeout_thread = 1;
-    if ((ret = pthread_create(&conn_timeout_tid, NULL,
-        conn_timeout_thread, NULL)) != 0) {
-        fprintf(stderr, "Can't create idle connection timeout thread: %s\n",
-            strerror(ret));
-        return -1;
-    }
-    thread_setname(conn_timeout_tid, "mc-idletimeout");
-
-    return 0;
-}
-
-int stop_conn_timeout_thread(void) {
-    if (!do_run_conn_timeout_thread)
-        return -1;
-    mutex_lock(&conn_timeout_lock);
-    do_run_conn_timeout_thread = 0;
-    pthread_cond_signal(&conn_timeout_cond);
-    mutex_unlock(&conn_timeout_lock);
-    pthread_join(conn_timeout_tid, NULL);
-    return 0;
-}
-
 /*
  * read buffer cache helper functions
  */
@@ -537,8 +488,254 @@ void conn_close_idle(conn *c) {
     }
 }
 
+/*
+ * Idle timeouts. Each worker files its client connections on a timing wheel
+ * with a slot per second, under the second they could first time out.
+ * Connections aren't moved around as they do work: when their slot comes up
+ * they're either closed or filed again based on last_cmd_time, so a busy
+ * connection costs one look per idle_timeout. Very long timeouts share a
+ * smaller wheel and go around it more than once.
+ */
+#define IDLE_WHEEL_MAX_SLOTS 3600
+
+static void conn_idle_link(LIBEVENT_THREAD *t, conn *c, rel_time_t when) {
+    conn **head = &t->idle_wheel[when % t->idle_slots];
+    c->idle_at = when;
+    c->idle_prev = NULL;
+    c->idle_next = *head;
+    if (*head)
+        (*head)->idle_prev = c;
+    *head = c;
+}
+
+static void conn_idle_unlink(conn *c) {
+    if (c->idle_at == 0)
+        return;
+    if (c->idle_prev) {
+        c->idle_prev->idle_next = c->idle_next;
+    } else {
+        c->thread->idle_wheel[c->idle_at % c->thread->idle_slots] = c->idle_next;
+    }
+    if (c->idle_next)
+        c->idle_next->idle_prev = c->idle_prev;
+    c->idle_at = 0;
+    c->idle_next = c->idle_prev = NULL;
+}
+
+void conn_idle_add(conn *c) {
+    if (c->thread->idle_wheel == NULL)
+        return;
+    conn_idle_link(c->thread, c, c->last_cmd_time + settings.idle_timeout + 1);
+}
+
+static void conn_idle_sweep(evutil_socket_t fd, short which, void *arg) {
+    LIBEVENT_THREAD *t = arg;
+
+    t->busy_poll_events++;
+    // catch up on any seconds we were too busy to look at.
+    while ((int)(current_time - t->idle_time) > 0) {
+        conn **head;
+        conn *c;
+
+        t->idle_time++;
+        head = &t->idle_wheel[t->idle_time % t->idle_slots];
+        c = *head;
+        *head = NULL;
+        while (c) {
+            conn *next = c->idle_next;
+            rel_time_t at = c->idle_at;
+            rel_time_t when = c->last_cmd_time + settings.idle_timeout + 1;
+
+            c->idle_at = 0;
+            if (at > t->idle_time) {
+                // due on a later trip around the wheel.
+                conn_idle_link(t, c, at);
+            } else if (when <= t->idle_time
+                    && (c->state == conn_new_cmd || c->state == conn_read)) {
+                conn_close_idle(c);
+            } else {
+                // active since it was filed, or busy; look again later.
+                conn_idle_link(t, c, when > t->idle_time ? when : t->idle_time + 1);
+            }
+            c = next;
+        }
+    }
+}
+
+void conn_idle_thread_init(LIBEVENT_THREAD *t) {
+    struct timeval tv = {.tv_sec = 1, .tv_usec = 0};
+
+    if (settings.idle_timeout <= 0)
+        return;
+
+    t->idle_slots = settings.idle_timeout + 2;
+    if (t->idle_slots > IDLE_WHEEL_MAX_SLOTS)
+        t->idle_slots = IDLE_WHEEL_MAX_SLOTS;
+    t->idle_wheel = calloc(t->idle_slots, sizeof(conn *));
+    t->idle_timer = event_new(t->base, -1, EV_PERSIST, conn_idle_sweep, t);
+    if (t->idle_wheel == NULL || t->idle_timer == NULL) {
+        fprintf(stderr, "Failed to allocate idle timeout wheel\n");
+        exit(EXIT_FAILURE);
+    }
+    t->idle_time = current_time;
+    evtimer_add(t->idle_timer, &tv);
+}
+
+/*
+ * QoS scheduling. With -o qos_weights connections are grouped into classes
+ * by the tag of the listener they came in on, and each class may only run
+ * its weight in requests per round of a worker's event loop, shared by all
+ * of its connections on that worker. A connection whose class has used up
+ * its share yields until the next round, so a few bulk clients can't hold
+ * up everyone else on their worker. The first request of every callback is
+ * always run, so nothing is starved outright.
+ */
+static uint8_t conn_qos_class(uint64_t tag) {
+    for (int i = 1; i < settings.qos_classes; i++) {
+        if (settings.qos[i].tag == tag)
+            return i;
+    }
+    return 0;
+}
+
+static void conn_qos_charge(conn *c) {
+    c->thread->qos_credit[c->qos_class]--;
+    pthread_mutex_lock(&c->thread->stats.mutex);
+    c->thread->stats.qos[c->qos_class].requests++;
+    pthread_mutex_unlock(&c->thread->stats.mutex);
+}
+
+// Returns false if the connection's class is out of requests for this round.
+static bool conn_qos_admit(conn *c) {
+    if (settings.qos[c->qos_class].weight == 0
+            || c->thread->qos_credit[c->qos_class] > 0) {
+        return true;
+    }
+
+    pthread_mutex_lock(&c->thread->stats.mutex);
+    c->thread->stats.qos[c->qos_class].yields++;
+    pthread_mutex_unlock(&c->thread->stats.mutex);
+    return false;
+}
+
+/*
+ * Load shedding, after CoDel. Each worker tracks the shortest time
+ * connections with work to do waited to be run over every shed_interval. If
+ * even the shortest wait was over shed_target the worker is falling behind,
+ * rather than working through a burst, and until an interval comes back
+ * under target, requests from connections that waited over twice the target
+ * are answered with a busy error instead of being run.
+ */
+static bool conn_shed_check(conn *c, uint64_t usec, uint32_t delay) {
+    LIBEVENT_THREAD *t = c->thread;
+
+    if (usec >= t->shed_next) {
+        t->shed_overloaded = t->shed_min > settings.shed_target;
+        if (t->shed_overloaded) {
+            pthread_mutex_lock(&t->stats.mutex);
+            t->stats.shed_intervals++;
+            pthread_mutex_unlock(&t->stats.mutex);
+        }
+        t->shed_min = delay;
+        t->shed_next = usec + settings.shed_interval;
+    } else if (delay < t->shed_min) {
+        t->shed_min = delay;
+    }
+
+    if (!t->shed_overloaded || delay <= settings.shed_target * 2) {
+        return false;
+    }
+    if (settings.shed_tag_count == 0) {
+        return true;
+    }
+    for (int i = 0; i < settings.shed_tag_count; i++) {
+        if (settings.shed_tags[i] == c->tag)
+            return true;
+    }
+    return false;
+}
+
+static uint64_t now_usec(void) {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_usec;
+}
+
+// A poll this quick means connections were ready before the round began.
+#define POLL_NOWAIT_US 50
+
+/*
+ * Called before each round of a worker's event loop when QoS or shedding is
+ * on. Queueing delays are estimated per round: a connection that yielded
+ * has been ready since then. Otherwise if the worker had to wait in poll,
+ * its connections became ready just now. If it didn't, they were ready
+ * before the round started, having come in at some point during the last
+ * one, which we call the middle of it.
+ */
+void conn_loop_round(LIBEVENT_THREAD *t) {
+    for (int i = 0; i < settings.qos_classes; i++) {
+        t->qos_credit[i] = settings.qos[i].weight;
+    }
+    t->last_round = t->round_start;
+    t->round_start = 0;
+    t->poll_start = now_usec();
+}
+
+// Remember when a connection stepped aside with work left to do.
+static void conn_mark_ready(conn *c) {
+    c->ready_at = (uint32_t)now_usec();
+    if (c->ready_at == 0)
+        c->ready_at = 1;
+}
+
+// A connection with work to do is about to be run.
+static void conn_queue_start(conn *c) {
+    LIBEVENT_THREAD *t = c->thread;
+    uint64_t now = now_usec();
+    uint64_t waited;
+
+    if (t->round_start == 0) {
+        t->round_start = now;
+        if (t->last_round && t->last_round <= t->poll_start
+                && now - t->poll_start <= POLL_NOWAIT_US) {
+            t->round_ready = t->last_round + (t->poll_start - t->last_round) / 2;
+        } else {
+            t->round_ready = now;
+        }
+    }
+
+    if (c->ready_at) {
+        // microseconds, wrapping.
+        waited = (uint32_t)now - c->ready_at;
+        c->ready_at = 0;
+    } else {
+        waited = now - t->round_ready;
+    }
+    // clock steps show up as huge waits.
+    if (waited > INT32_MAX)
+        waited = 0;
+
+    if (settings.qos_classes) {
+        struct qos_stats *st = &t->stats.qos[c->qos_class];
+        pthread_mutex_lock(&t->stats.mutex);
+        st->queued++;
+        st->queue_time_us += waited;
+        pthread_mutex_unlock(&t->stats.mutex);
+    }
+    if (settings.shed_target) {
+        t->shed_now = conn_shed_check(c, now, waited);
+    }
+}
+
 static void _conn_event_readd(conn *c) {
     c->ev_flags = EV_READ | EV_PERSIST;
+#ifdef USE_URING
+    if (c->ur_active) {
+        conn_uring_return(c);
+        conn_uring_runq_add(c);
+        return;
+    }
+#endif
     event_set(&c->event, c->sfd, c->ev_flags, event_handler, (void *)c);
     event_base_set(c->thread->base, &c->event);
 
@@ -583,6 +780,70 @@ void conn_worker_readd(conn *c) {
 
 }
 
+/* Detach a connection between commands from its worker's event base. */
+void conn_migrate_out(conn *c) {
+    LIBEVENT_THREAD *t = c->thread;
+    event_del(&c->event);
+    conn_idle_unlink(c);
+    c->ready_at = 0;
+    pthread_mutex_lock(&t->stats.mutex);
+    t->client_conns--;
+    t->stats.migrated_out++;
+    pthread_mutex_unlock(&t->stats.mutex);
+}
+
+/* Picks up a connection migrated from another worker. */
+void conn_migrate_in(conn *c, LIBEVENT_THREAD *t) {
+    c->thread = t;
+    conn_io_queue_setup(c);
+#ifdef TLS
+    if (c->ssl) {
+        c->ssl_wbuf = t->ssl_wbuf;
+    }
+#endif
+    c->ev_flags = EV_READ | EV_PERSIST;
+    event_set(&c->event, c->sfd, c->ev_flags, event_handler, (void *)c);
+    event_base_set(t->base, &c->event);
+    THR_STATS_LOCK(t);
+    t->client_conns++;
+    THR_STATS_UNLOCK(t);
+    if (event_add(&c->event, 0) == -1) {
+        perror("event_add");
+        conn_set_state(c, conn_closing);
+        conn_close(c);
+        return;
+    }
+    conn_set_state(c, conn_read);
+    if (IS_TCP(c->transport)) {
+        conn_idle_add(c);
+    }
+    pthread_mutex_lock(&t->stats.mutex);
+    t->stats.migrated_in++;
+    pthread_mutex_unlock(&t->stats.mutex);
+}
+
+/* Only connections with nothing in flight and nothing tied to the worker
+ * they're on can be handed to another one. */
+static bool conn_can_migrate(conn *c) {
+    if (IS_UDP(c->transport) || c->rbuf != NULL || c->resp_head != NULL
+            || c->item != NULL || c->io_queues_submitted != 0) {
+        return false;
+    }
+#ifdef PROXY
+    if (c->protocol == proxy_prot)
+        return false;
+#endif
+#ifdef USE_URING
+    if (c->ur_active)
+        return false;
+#endif
+#ifdef USE_ZEROCOPY
+    if (c->zc_head != NULL)
+        return false;
+#endif
+    return true;
+}
+
 void thread_io_queue_add(LIBEVENT_THREAD *t, int type, void *ctx, io_queue_stack_cb cb) {
     io_queue_cb_t *q = t->io_queues;
     while (q->type != IO_QUEUE_NONE) {
@@ -594,9 +855,30 @@ void thread_io_queue_add(LIBEVENT_THREAD *t, int type, void *ctx, io_queue_stack
     return;
 }
 
+// Shared by connections on threads without any IO queues.
+static io_queue_t conn_io_queues_none[1];
+
 void conn_io_queue_setup(conn *c) {
     io_queue_cb_t *qcb = c->thread->io_queues;
     io_queue_t *q = c->io_queues;
+    if (qcb->type == IO_QUEUE_NONE) {
+        return;
+    }
+    if (q == conn_io_queues_none) {
+        q = calloc(IO_QUEUE_COUNT, sizeof(io_queue_t));
+        if (q == NULL) {
+            STATS_LOCK();
+            stats.malloc_fails++;
+            STATS_UNLOCK();
+            // can't park any IO; hang up on the first event.
+            conn_set_state(c, conn_closing);
+            return;
+        }
+        STATS_LOCK();
+        stats_state.conn_struct_bytes += IO_QUEUE_COUNT * sizeof(io_queue_t);
+        STATS_UNLOCK();
+        c->io_queues = q;
+    }
     while (qcb->type != IO_QUEUE_NONE) {
         q->type = qcb->type;
         q->ctx = qcb->ctx;
@@ -642,6 +924,61 @@ void conn_io_queue_return(io_pending_t *io) {
     io->return_cb(io);
 }
 
+/* State for UDP "connections", which TCP clients don't need to carry. */
+struct conn_udp {
+    int request_id; /* Incoming UDP request ID */
+#ifdef USE_UDP_MMSG
+    /*
+     * Datagrams read ahead by one recvmmsg() call. They're parsed one at a
+     * time, and the responses to all of them are sent together once the batch
+     * has been drained. Buffer pages are only faulted in as large requests
+     * arrive.
+     */
+    int count; /* datagrams received */
+    int next;  /* next datagram to parse */
+    struct mmsghdr msgs[UDP_BATCH];
+    struct iovec iovs[UDP_BATCH];
+    struct sockaddr_in6 addrs[UDP_BATCH];
+    char bufs[UDP_BATCH][UDP_READ_BUFFER_SIZE];
+#endif
+};
+
+static struct conn_udp *conn_udp_new(void) {
+    struct conn_udp *u = calloc(1, sizeof(struct conn_udp));
+
+    if (u == NULL)
+        return NULL;
+#ifdef USE_UDP_MMSG
+    for (int x = 0; x < UDP_BATCH; x++) {
+        u->iovs[x].iov_base = u->bufs[x];
+        u->iovs[x].iov_len = UDP_READ_BUFFER_SIZE;
+        u->msgs[x].msg_hdr.msg_iov = &u->iovs[x];
+        u->msgs[x].msg_hdr.msg_iovlen = 1;
+        u->msgs[x].msg_hdr.msg_name = &u->addrs[x];
+    }
+#endif
+    return u;
+}
+
+// Datagrams from the last UDP read still waiting to be parsed.
+static inline bool udp_batch_pending(conn *c) {
+#ifdef USE_UDP_MMSG
+    return c->udp && c->udp->next < c->udp->count;
+#else
+    return false;
+#endif
+}
+
+// Requests a shared memory client queued that haven't been read yet. If
+// there are none, the client will ring once it queues more.
+static inline bool shm_requests_pending(conn *c) {
+#ifdef USE_SHM
+    return c->shm && !conn_shm_idle(c);
+#else
+    return false;
+#endif
+}
+
 conn *conn_new(const int sfd, enum conn_states init_state,
                 const int event_flags,
                 const int read_buffer_size, enum network_transport transport,
@@ -673,7 +1010,12 @@ conn *conn_new(const int sfd, enum conn_states init_state,
             c->rbuf = (char *)malloc((size_t)c->rsize);
         }
 
-        if (c->rsize && c->rbuf == NULL) {
+        if (IS_UDP(transport)) {
+            c->udp = conn_udp_new();
+        }
+
+        if ((c->rsize && c->rbuf == NULL)
+            || (IS_UDP(transport) && c->udp == NULL)) {
             conn_free(c);
             STATS_LOCK();
             stats.malloc_fails++;
@@ -685,6 +1027,9 @@ conn *conn_new(const int sfd, enum conn_states init_state,
 
         STATS_LOCK();
         stats_state.conn_structs++;
+        stats_state.conn_struct_bytes += sizeof(conn);
+        if (c->udp)
+            stats_state.conn_struct_bytes += sizeof(struct conn_udp);
         STATS_UNLOCK();
 
         c->sfd = sfd;
@@ -694,6 +1039,7 @@ conn *conn_new(const int sfd, enum conn_states init_state,
     c->transport = transport;
     c->protocol = bproto;
     c->tag = conntag;
+    c->qos_class = conn_qos_class(conntag);
 
     /* unix socket mode doesn't need this, so zeroed out.  but why
      * is this done for every command?  presumably for UDP
@@ -760,13 +1106,29 @@ conn *conn_new(const int sfd, enum conn_states init_state,
     c->close_after_write = false;
     c->last_cmd_time = current_time; /* initialize for idle kicker */
     // wipe all queues.
-    memset(c->io_queues, 0, sizeof(c->io_queues));
+    if (c->io_queues == NULL) {
+        c->io_queues = conn_io_queues_none;
+    } else if (c->io_queues != conn_io_queues_none) {
+        memset(c->io_queues, 0, IO_QUEUE_COUNT * sizeof(io_queue_t));
+    }
     c->io_queues_submitted = 0;
 
     c->item = 0;
 
     c->noreply = false;
 
+#ifdef USE_ZEROCOPY
+    // listening sockets have SO_ZEROCOPY set, and the kernel's send ids
+    // start over for each new socket.
+    c->zc_enabled = settings.zerocopy_min_bytes != 0 &&
+        transport == tcp_transport && ssl == NULL;
+    c->zc_next = 0;
+    c->zc_acked = 0;
+    c->zc_done = 0;
+    c->zc_head = NULL;
+    c->zc_tail = NULL;
+#endif
+
 #ifdef TLS
     if (ssl) {
         c->ssl = (SSL*)ssl;
@@ -862,6 +1224,7 @@ void conn_release_items(conn *c) {
                 // If these errors are seen, an abort() can be used instead.
                 c->resp_head = NULL;
                 c->resp = NULL;
+                c->resp_combine = NULL;
                 break;
             }
             resp = resp_finish(c, resp);
@@ -902,6 +1265,14 @@ void conn_free(conn *c) {
         conns[c->sfd] = NULL;
         if (c->rbuf)
             free(c->rbuf);
+        if (c->udp)
+            free(c->udp);
+        if (c->bin)
+            free(c->bin);
+        if (c->stats)
+            free(c->stats);
+        if (c->io_queues != conn_io_queues_none)
+            free(c->io_queues);
 #ifdef TLS
         if (c->ssl_wbuf)
             c->ssl_wbuf = NULL;
@@ -911,9 +1282,28 @@ void conn_free(conn *c) {
     }
 }
 
+static void conn_close_socket(conn *c);
 static void conn_close(conn *c) {
     assert(c != NULL);
 
+#ifdef USE_URING
+    if (c->ur_active) {
+        if (c->ur_sending) {
+            // the kernel still owns our iovecs; finish up once it's done.
+            c->ur_close = true;
+            return;
+        }
+        conn_uring_release(c);
+    }
+#endif
+
+    conn_idle_unlink(c);
+    if (c->thread && !IS_UDP(c->transport)) {
+        THR_STATS_LOCK(c->thread);
+        c->thread->client_conns--;
+        THR_STATS_UNLOCK(c->thread);
+    }
+
     if (c->thread) {
         LOGGER_LOG(c->thread->l, LOG_CONNEVENTS, LOGGER_CONNECTION_CLOSE, NULL,
                 &c->request_addr, c->request_addr_size, c->transport,
@@ -927,6 +1317,9 @@ static void conn_close(conn *c) {
         fprintf(stderr, "<%d connection closed.\n", c->sfd);
 
     conn_cleanup(c);
+#ifdef USE_SHM
+    conn_shm_release(c);
+#endif
 
     // force release of read buffer.
     if (c->thread) {
@@ -942,10 +1335,32 @@ static void conn_close(conn *c) {
         SSL_free(c->ssl);
     }
 #endif
+#ifdef USE_ZEROCOPY
+    if (c->zc_head != NULL) {
+        conn_zc_reap(c);
+        if (c->zc_head != NULL) {
+            conn_zc_linger(c);
+            return;
+        }
+    }
+#endif
+    conn_close_socket(c);
+}
+
+// Last part of closing a connection, once nothing refers to the socket.
+static void conn_close_socket(conn *c) {
     close(c->sfd);
     c->close_reason = 0;
     pthread_mutex_lock(&conn_lock);
     allow_new_conns = true;
+    if (settings.worker_listeners) {
+        STATS_LOCK();
+        bool accepting = stats_state.accepting_conns;
+        STATS_UNLOCK();
+        if (!accepting) {
+            do_accept_new_conns(true);
+        }
+    }
     pthread_mutex_unlock(&conn_lock);
 
     STATS_LOCK();
@@ -1015,10 +1430,20 @@ void conn_set_state(conn *c, enum conn_states state) {
 /*
  * response object helper functions
  */
+// Lets go of the response's item, or hands it back to the hot item cache.
+static void resp_release_item(mc_resp *resp) {
+    if (resp->hot) {
+        hot_cache_return(resp->hot);
+        resp->hot = NULL;
+    } else {
+        item_remove(resp->item);
+    }
+    resp->item = NULL;
+}
+
 void resp_reset(mc_resp *resp) {
     if (resp->item) {
-        item_remove(resp->item);
-        resp->item = NULL;
+        resp_release_item(resp);
     }
     if (resp->write_and_free) {
 #ifdef PROXY
@@ -1058,6 +1483,13 @@ void resp_add_chunked_iov(mc_resp *resp, const void *buf, int len) {
     resp_add_iov(resp, buf, len);
 }
 
+// Sends len bytes of a chunked item's data starting at off. The skipped bytes
+// are counted as already sent, so the transmit code steps over them.
+void resp_add_chunked_iov_off(mc_resp *resp, const void *buf, int off, int len) {
+    resp_add_chunked_iov(resp, buf, len);
+    resp->chunked_total += off;
+}
+
 // resp_allocate and resp_free are a wrapper around read buffers which makes
 // read buffers the only network memory to track.
 // Normally this would be too excessive. In this case it allows end users to
@@ -1173,32 +1605,120 @@ void resp_free(LIBEVENT_THREAD *th, mc_resp *resp) {
     THR_STATS_UNLOCK(th);
 }
 
-bool resp_start(conn *c) {
-    mc_resp *resp = resp_allocate(c);
-    if (!resp) {
-        THR_STATS_LOCK(c->thread);
-        c->thread->stats.response_obj_oom++;
-        THR_STATS_UNLOCK(c->thread);
+/*
+ * Write combining.
+ *
+ * Pipelined small requests each get a response object, and a hit is usually
+ * a header in wbuf plus the item data plus maybe a trailer. Sending those
+ * means handing the kernel long lists of tiny iovecs. Instead, once a small
+ * response is complete its data is copied onto the end of the previous
+ * response's wbuf, item references are dropped right away, and the response
+ * object is reused for the next request. Larger values are still sent
+ * straight from item memory.
+ */
+
+// True if all of the response's data sits at the start of its own wbuf.
+static bool resp_is_flat(mc_resp *resp) {
+    if (resp->skip || resp->item || resp->io_pending || resp->write_and_free
+            || resp->chunked_data_iov) {
         return false;
     }
+    return resp->iovcnt == 0 || (resp->iovcnt == 1
+            && resp->iov[0].iov_base == resp->wbuf
+            && resp->iov[0].iov_len == resp->tosend);
+}
 
-    // handling the stats counters here to simplify testing
-    THR_STATS_LOCK(c->thread);
-    c->thread->stats.response_obj_count++;
-    THR_STATS_UNLOCK(c->thread);
-
-    if (!c->resp_head) {
-        c->resp_head = resp;
+// Appends the response's data to dst's wbuf, starting at off.
+static void resp_copy_data(mc_resp *dst, int off, mc_resp *resp) {
+    char *p = dst->wbuf + off;
+    for (int x = 0; x < resp->iovcnt; x++) {
+        // flattening in place can leave the first iov where it is.
+        if (resp->iov[x].iov_base != p) {
+            memcpy(p, resp->iov[x].iov_base, resp->iov[x].iov_len);
+        }
+        p += resp->iov[x].iov_len;
     }
-    if (!c->resp) {
-        c->resp = resp;
-    } else {
-        c->resp->next = resp;
-        c->resp = resp;
+    dst->tosend = p - dst->wbuf;
+    dst->wbytes = dst->tosend;
+    dst->iov[0].iov_base = dst->wbuf;
+    dst->iov[0].iov_len = dst->tosend;
+    dst->iovcnt = 1;
+    if (resp->item) {
+        resp_release_item(resp);
     }
-    if (IS_UDP(c->transport)) {
-        // need to hold on to some data for async responses.
-        c->resp->request_id = c->request_id;
+}
+
+// Called on the last response when another one is started. Returns true if
+// its data was copied out and the object can be reused.
+static bool resp_combine(conn *c) {
+    mc_resp *resp = c->resp;
+    mc_resp *dst = c->resp_combine;
+
+    // the proxy fills in responses after the fact.
+    bool local = c->protocol == ascii_prot || c->protocol == binary_prot;
+    if (!local || IS_UDP(c->transport) || resp->skip
+            || resp->io_pending || resp->write_and_free
+            || resp->chunked_data_iov || resp->tosend > RESP_COMBINE_MAX) {
+        c->resp_combine = NULL;
+        return false;
+    }
+
+    if (dst != NULL && dst->next == resp && resp_is_flat(dst)
+            && dst->tosend + resp->tosend <= WRITE_BUFFER_SIZE) {
+        resp_copy_data(dst, dst->tosend, resp);
+        return true;
+    }
+
+    // Can't append here, so this response becomes the new target. Its data
+    // has to be moved into its wbuf first, which only works if the wbuf
+    // part leads.
+    c->resp_combine = NULL;
+    for (int x = 0; x < resp->iovcnt; x++) {
+        char *base = resp->iov[x].iov_base;
+        bool in_wbuf = base >= resp->wbuf && base < resp->wbuf + WRITE_BUFFER_SIZE;
+        if (in_wbuf != (x == 0) || (x == 0 && base != resp->wbuf)) {
+            return false;
+        }
+    }
+    resp_copy_data(resp, 0, resp);
+    c->resp_combine = resp;
+    return false;
+}
+
+bool resp_start(conn *c) {
+    if (c->resp && resp_combine(c)) {
+        mc_resp *resp = c->resp;
+        mc_resp_bundle *b = resp->bundle;
+        memset(resp, 0, sizeof(*resp));
+        resp->bundle = b;
+        return true;
+    }
+
+    mc_resp *resp = resp_allocate(c);
+    if (!resp) {
+        THR_STATS_LOCK(c->thread);
+        c->thread->stats.response_obj_oom++;
+        THR_STATS_UNLOCK(c->thread);
+        return false;
+    }
+
+    // handling the stats counters here to simplify testing
+    THR_STATS_LOCK(c->thread);
+    c->thread->stats.response_obj_count++;
+    THR_STATS_UNLOCK(c->thread);
+
+    if (!c->resp_head) {
+        c->resp_head = resp;
+    }
+    if (!c->resp) {
+        c->resp = resp;
+    } else {
+        c->resp->next = resp;
+        c->resp = resp;
+    }
+    if (IS_UDP(c->transport)) {
+        // need to hold on to some data for async responses.
+        c->resp->request_id = c->udp->request_id;
         c->resp->request_addr = c->request_addr;
         c->resp->request_addr_size = c->request_addr_size;
     }
@@ -1221,7 +1741,7 @@ mc_resp *resp_start_unlinked(conn *c) {
 
     if (IS_UDP(c->transport)) {
         // need to hold on to some data for async responses.
-        c->resp->request_id = c->request_id;
+        c->resp->request_id = c->udp->request_id;
         c->resp->request_addr = c->request_addr;
         c->resp->request_addr_size = c->request_addr_size;
     }
@@ -1230,20 +1750,19 @@ mc_resp *resp_start_unlinked(conn *c) {
 }
 
 // returns next response in chain.
-mc_resp* resp_finish(conn *c, mc_resp *resp) {
-    mc_resp *next = resp->next;
+// Releases everything held by a response, and the response itself.
+static void resp_release(LIBEVENT_THREAD *t, mc_resp *resp) {
     if (resp->item) {
         // TODO: cache hash value in resp obj?
-        item_remove(resp->item);
-        resp->item = NULL;
+        resp_release_item(resp);
     }
     if (resp->write_and_free) {
 #ifdef PROXY
         if (resp->proxy_res) {
-            LIBEVENT_THREAD *t = resp->bundle->thread;
-            pthread_mutex_lock(&t->proxy_limit_lock);
-            t->proxy_buffer_memory_used -= resp->wbytes;
-            pthread_mutex_unlock(&t->proxy_limit_lock);
+            LIBEVENT_THREAD *pt = resp->bundle->thread;
+            pthread_mutex_lock(&pt->proxy_limit_lock);
+            pt->proxy_buffer_memory_used -= resp->wbytes;
+            pthread_mutex_unlock(&pt->proxy_limit_lock);
         }
 #endif
         free(resp->write_and_free);
@@ -1253,16 +1772,31 @@ mc_resp* resp_finish(conn *c, mc_resp *resp) {
         // If we had a pending IO, tell it to internally clean up then return
         // the main object back to our thread cache.
         io->finalize_cb(io);
-        do_cache_free(c->thread->io_cache, io);
+        do_cache_free(t->io_cache, io);
         resp->io_pending = NULL;
     }
+    resp_free(t, resp);
+}
+
+mc_resp* resp_finish(conn *c, mc_resp *resp) {
+    mc_resp *next = resp->next;
     if (c->resp_head == resp) {
         c->resp_head = next;
     }
     if (c->resp == resp) {
         c->resp = NULL;
     }
-    resp_free(c->thread, resp);
+    if (c->resp_combine == resp) {
+        c->resp_combine = NULL;
+    }
+#ifdef USE_ZEROCOPY
+    if (resp->zc_hold) {
+        // the kernel may still be sending from this response's memory.
+        conn_zc_hold(c, resp);
+        return next;
+    }
+#endif
+    resp_release(c->thread, resp);
     return next;
 }
 
@@ -1342,7 +1876,7 @@ void out_of_memory(conn *c, char *ascii_error) {
 static void append_bin_stats(const char *key, const uint16_t klen,
                              const char *val, const uint32_t vlen,
                              conn *c) {
-    char *buf = c->stats.buffer + c->stats.offset;
+    char *buf = c->stats->buffer + c->stats->offset;
     uint32_t bodylen = klen + vlen;
     protocol_binary_response_header header = {
         .response.magic = (uint8_t)PROTOCOL_BINARY_RES,
@@ -1350,7 +1884,7 @@ static void append_bin_stats(const char *key, const uint16_t klen,
         .response.keylen = (uint16_t)htons(klen),
         .response.datatype = (uint8_t)PROTOCOL_BINARY_RAW_BYTES,
         .response.bodylen = htonl(bodylen),
-        .response.opaque = c->opaque
+        .response.opaque = c->bin->opaque
     };
 
     memcpy(buf, header.bytes, sizeof(header.response));
@@ -1365,15 +1899,15 @@ static void append_bin_stats(const char *key, const uint16_t klen,
         }
     }
 
-    c->stats.offset += sizeof(header.response) + bodylen;
+    c->stats->offset += sizeof(header.response) + bodylen;
 }
 
 static void append_ascii_stats(const char *key, const uint16_t klen,
                                const char *val, const uint32_t vlen,
                                conn *c) {
-    char *pos = c->stats.buffer + c->stats.offset;
+    char *pos = c->stats->buffer + c->stats->offset;
     uint32_t nbytes = 0;
-    int remaining = c->stats.size - c->stats.offset;
+    int remaining = c->stats->size - c->stats->offset;
     int room = remaining - 1;
 
     if (klen == 0 && vlen == 0) {
@@ -1384,31 +1918,43 @@ static void append_ascii_stats(const char *key, const uint16_t klen,
         nbytes = snprintf(pos, room, "STAT %s %s\r\n", key, val);
     }
 
-    c->stats.offset += nbytes;
+    c->stats->offset += nbytes;
 }
 
 static bool grow_stats_buf(conn *c, size_t needed) {
-    size_t nsize = c->stats.size;
-    size_t available = nsize - c->stats.offset;
+    size_t nsize;
+    size_t available;
     bool rv = true;
 
+    if (c->stats == NULL) {
+        c->stats = calloc(1, sizeof(conn_stats_t));
+        if (c->stats == NULL) {
+            STATS_LOCK();
+            stats.malloc_fails++;
+            STATS_UNLOCK();
+            return false;
+        }
+    }
+    nsize = c->stats->size;
+    available = nsize - c->stats->offset;
+
     /* Special case: No buffer -- need to allocate fresh */
-    if (c->stats.buffer == NULL) {
+    if (c->stats->buffer == NULL) {
         nsize = 1024;
-        available = c->stats.size = c->stats.offset = 0;
+        available = c->stats->size = c->stats->offset = 0;
     }
 
     while (needed > available) {
         assert(nsize > 0);
         nsize = nsize << 1;
-        available = nsize - c->stats.offset;
+        available = nsize - c->stats->offset;
     }
 
-    if (nsize != c->stats.size) {
-        char *ptr = realloc(c->stats.buffer, nsize);
+    if (nsize != c->stats->size) {
+        char *ptr = realloc(c->stats->buffer, nsize);
         if (ptr) {
-            c->stats.buffer = ptr;
-            c->stats.size = nsize;
+            c->stats->buffer = ptr;
+            c->stats->size = nsize;
         } else {
             STATS_LOCK();
             stats.malloc_fails++;
@@ -1445,7 +1991,18 @@ void append_stats(const char *key, const uint16_t klen,
         append_ascii_stats(key, klen, val, vlen, c);
     }
 
-    assert(c->stats.offset <= c->stats.size);
+    assert(c->stats->offset <= c->stats->size);
+}
+
+/* Hands the output gathered by append_stats() to the client. */
+void write_stats(conn *c, char *ascii_error) {
+    if (c->stats == NULL || c->stats->buffer == NULL) {
+        out_of_memory(c, ascii_error);
+    } else {
+        write_and_free(c, c->stats->buffer, c->stats->offset);
+    }
+    free(c->stats);
+    c->stats = NULL;
 }
 
 static void reset_cmd_handler(conn *c) {
@@ -1464,6 +2021,9 @@ static void reset_cmd_handler(conn *c) {
     }
     if (c->rbytes > 0) {
         conn_set_state(c, conn_parse_cmd);
+    } else if (udp_batch_pending(c)) {
+        // parse the rest of the batch so the responses go out together.
+        conn_set_state(c, conn_read);
     } else if (c->resp_head) {
         conn_set_state(c, conn_mwrite);
     } else {
@@ -1494,8 +2054,7 @@ static void complete_nread(conn *c) {
 
 /* Destination must always be chunked */
 /* This should be part of item.c */
-static int _store_item_copy_chunks(item *d_it, item *s_it, const int len) {
-    item_chunk *dch = (item_chunk *) ITEM_schunk(d_it);
+static int _store_item_copy_chunks(item_chunk *dch, item *s_it, const int len) {
     /* Advance dch until we find free space */
     while (dch->size == dch->used) {
         if (dch->next) {
@@ -1523,8 +2082,8 @@ static int _store_item_copy_chunks(item *d_it, item *s_it, const int len) {
             copied += todo;
             remain -= todo;
             assert(dch->used <= dch->size);
-            if (dch->size == dch->used) {
-                item_chunk *tch = do_item_alloc_chunk(dch, remain);
+            if (dch->size == dch->used && remain) {
+                item_chunk *tch = dch->next ? dch->next : do_item_alloc_chunk(dch, remain);
                 if (tch) {
                     dch = tch;
                 } else {
@@ -1550,8 +2109,8 @@ static int _store_item_copy_chunks(item *d_it, item *s_it, const int len) {
             done += todo;
             dch->used += todo;
             assert(dch->used <= dch->size);
-            if (dch->size == dch->used) {
-                item_chunk *tch = do_item_alloc_chunk(dch, len - done);
+            if (dch->size == dch->used && len > done) {
+                item_chunk *tch = dch->next ? dch->next : do_item_alloc_chunk(dch, len - done);
                 if (tch) {
                     dch = tch;
                 } else {
@@ -1567,8 +2126,8 @@ static int _store_item_copy_chunks(item *d_it, item *s_it, const int len) {
 static int _store_item_copy_data(int comm, item *old_it, item *new_it, item *add_it) {
     if (comm == NREAD_APPEND || comm == NREAD_APPENDVIV) {
         if (new_it->it_flags & ITEM_CHUNKED) {
-            if (_store_item_copy_chunks(new_it, old_it, old_it->nbytes - 2) == -1 ||
-                _store_item_copy_chunks(new_it, add_it, add_it->nbytes) == -1) {
+            if (_store_item_copy_chunks((item_chunk *) ITEM_schunk(new_it), old_it, old_it->nbytes - 2) == -1 ||
+                _store_item_copy_chunks((item_chunk *) ITEM_schunk(new_it), add_it, add_it->nbytes) == -1) {
                 return -1;
             }
         } else {
@@ -1578,8 +2137,8 @@ static int _store_item_copy_data(int comm, item *old_it, item *new_it, item *add
     } else {
         /* NREAD_PREPEND */
         if (new_it->it_flags & ITEM_CHUNKED) {
-            if (_store_item_copy_chunks(new_it, add_it, add_it->nbytes - 2) == -1 ||
-                _store_item_copy_chunks(new_it, old_it, old_it->nbytes) == -1) {
+            if (_store_item_copy_chunks((item_chunk *) ITEM_schunk(new_it), add_it, add_it->nbytes - 2) == -1 ||
+                _store_item_copy_chunks((item_chunk *) ITEM_schunk(new_it), old_it, old_it->nbytes) == -1) {
                 return -1;
             }
         } else {
@@ -1590,6 +2149,74 @@ static int _store_item_copy_data(int comm, item *old_it, item *new_it, item *add
     return 0;
 }
 
+/*
+ * Appends to a large item by adding onto its chunk chain rather than copying
+ * the whole value into a new item. Only safe when we hold the only reference
+ * besides the hash table's: anyone else could still be sending the CRLF we
+ * overwrite. The item lock keeps new readers out.
+ *
+ * Chunks are reserved before anything is touched, so running out of memory
+ * leaves the value as it was. They're sized with some slack since a value
+ * that was appended to once usually will be again.
+ *
+ * Returns false if the caller has to fall back to copying.
+ */
+static bool _store_item_append_chunks(item *old_it, item *add_it, const client_flags_t flags, const uint64_t cas_in) {
+    item_chunk *tail = (item_chunk *) ITEM_schunk(old_it);
+    item_chunk *ch;
+    const int grow = add_it->nbytes - 2;
+
+    if ((old_it->it_flags & ITEM_CHUNKED) == 0 || old_it->refcount != 2)
+        return false;
+    if (!item_size_ok(old_it->nkey, flags, old_it->nbytes + grow))
+        return false;
+    while (tail->next) {
+        tail = tail->next;
+    }
+    /* CRLF may be split across the last two chunks */
+    if (tail->used < 2 && (tail->prev == NULL || tail->prev->used < 2 - tail->used))
+        return false;
+
+    int need = add_it->nbytes - (tail->size - tail->used + 2);
+    int slack = old_it->nbytes / 4;
+    ch = tail;
+    while (need > 0) {
+        ch = do_item_alloc_chunk(ch, need < slack ? slack : need);
+        if (ch == NULL) {
+            ch = tail->next;
+            tail->next = NULL;
+            while (ch) {
+                item_chunk *next = ch->next;
+                slabs_free(ch, ch->size + sizeof(item_chunk), ch->slabs_clsid);
+                ch = next;
+            }
+            return false;
+        }
+        need -= ch->size;
+    }
+
+    item_stats_sizes_remove(old_it);
+    ch = tail;
+    if (tail->used < 2) {
+        ch = tail->prev;
+        ch->used -= 2 - tail->used;
+        tail->used = 0;
+    } else {
+        tail->used -= 2;
+    }
+    /* can't fail: every chunk it needs is already linked in */
+    _store_item_copy_chunks(ch, add_it, add_it->nbytes);
+
+    old_it->nbytes += grow;
+    do_item_grown(old_it, grow);
+    /* same as a replace would have done: new CAS, no stale/win state */
+    ITEM_set_cas(old_it, cas_in);
+    old_it->it_flags &= ~(ITEM_STALE | ITEM_TOKEN_SENT);
+    item_stats_sizes_add(old_it);
+    do_item_update(old_it);
+    return true;
+}
+
 /*
  * Stores an item in the cache according to the semantics of one of the set
  * commands. Protected by the item lock.
@@ -1682,8 +2309,24 @@ enum store_item_type do_store_item(item *it, int comm, LIBEVENT_THREAD *t, const
                     break;
                 }
 #endif
-                /* we have it and old_it here - alloc memory to hold both */
+                if ((old_it->it_flags & ITEM_COUNTER) != 0) {
+                    /* counters have no text to add to */
+                    break;
+                }
                 FLAGS_CONV(old_it, flags);
+                if ((comm == NREAD_APPEND || comm == NREAD_APPENDVIV)
+                        && _store_item_append_chunks(old_it, it, flags, cas_in)) {
+                    pthread_mutex_lock(&t->stats.mutex);
+                    t->stats.inplace_appends++;
+                    pthread_mutex_unlock(&t->stats.mutex);
+                    it = old_it;
+                    stored = STORED;
+                    if (nbytes != NULL) {
+                        *nbytes = it->nbytes;
+                    }
+                    break;
+                }
+                /* we have it and old_it here - alloc memory to hold both */
                 new_it = do_item_alloc(key, it->nkey, flags, old_it->exptime, it->nbytes + old_it->nbytes - 2 /* CRLF */);
 
                 // OOM trying to copy.
@@ -1765,6 +2408,138 @@ enum store_item_type do_store_item(item *it, int comm, LIBEVENT_THREAD *t, const
     return stored;
 }
 
+/* Copies s_it's value (minus its CRLF) over d_it's, starting at off. Either
+ * item may be chunked. */
+static void _store_item_write_range(item *d_it, unsigned int off, item *s_it) {
+    int len = s_it->nbytes - 2;
+    item_chunk *sch = NULL;
+    item_chunk *dch = NULL;
+    char *src = NULL;
+    char *dst = NULL;
+    int sleft = 0;
+    int dleft = 0;
+
+    if (s_it->it_flags & ITEM_CHUNKED) {
+        sch = (item_chunk *) ITEM_schunk(s_it);
+    } else {
+        src = ITEM_data(s_it);
+        sleft = len;
+    }
+    if (d_it->it_flags & ITEM_CHUNKED) {
+        dch = (item_chunk *) ITEM_schunk(d_it);
+        while (dch->next && off >= dch->used) {
+            off -= dch->used;
+            dch = dch->next;
+        }
+        dst = dch->data + off;
+        dleft = dch->used - off;
+    } else {
+        dst = ITEM_data(d_it) + off;
+        dleft = d_it->nbytes - off;
+    }
+
+    while (len > 0) {
+        if (sleft == 0) {
+            sch = sch->next;
+            src = sch->data;
+            sleft = sch->used;
+            continue;
+        }
+        if (dleft == 0) {
+            dch = dch->next;
+            dst = dch->data;
+            dleft = dch->used;
+            continue;
+        }
+        int todo = len;
+        if (todo > sleft)
+            todo = sleft;
+        if (todo > dleft)
+            todo = dleft;
+        memcpy(dst, src, todo);
+        src += todo;
+        dst += todo;
+        sleft -= todo;
+        dleft -= todo;
+        len -= todo;
+    }
+}
+
+/*
+ * Overwrites part of an existing value with the value of it, starting at
+ * byte off, without changing its length. Protected by the item lock.
+ *
+ * Like incr, the bytes are changed in place if nobody else holds a reference
+ * to the item. Otherwise a response could be sending the value while we're
+ * writing to it, so the value is copied into a new item which replaces the
+ * old one.
+ */
+enum store_item_type do_store_item_range(item *it, LIBEVENT_THREAD *t, const uint32_t hv, const unsigned int off, int *nbytes, uint64_t *cas, uint64_t cas_in) {
+    char *key = ITEM_key(it);
+    item *old_it = do_item_get(key, it->nkey, hv, t, DONT_UPDATE);
+    item *new_it = NULL;
+    enum store_item_type stored = NOT_STORED;
+    client_flags_t flags;
+
+    if (old_it == NULL) {
+        return NOT_FOUND;
+    }
+
+    if (ITEM_get_cas(it) != 0 && ITEM_get_cas(it) != ITEM_get_cas(old_it)) {
+        stored = EXISTS;
+    } else if (old_it->it_flags & (ITEM_HDR | ITEM_COUNTER)) {
+        /* no partial writes to extstore-d items or counters, same as append */
+    } else if (off > old_it->nbytes - 2
+            || it->nbytes - 2 > old_it->nbytes - 2 - off) {
+        /* has to land inside the old value */
+    } else if (old_it->refcount == 2) {
+        /* refcount == 2 means we are the only ones holding the item, and it
+         * is linked. We hold the item's lock, so refcount cannot increase. */
+        item_stats_sizes_remove(old_it);
+        _store_item_write_range(old_it, off, it);
+        ITEM_set_cas(old_it, cas_in);
+        old_it->it_flags &= ~(ITEM_STALE | ITEM_TOKEN_SENT);
+        item_stats_sizes_add(old_it);
+        do_item_update(old_it);
+        stored = STORED;
+    } else {
+        FLAGS_CONV(old_it, flags);
+        new_it = do_item_alloc(key, it->nkey, flags, old_it->exptime, old_it->nbytes);
+        if (new_it != NULL) {
+            int res = 0;
+            if (new_it->it_flags & ITEM_CHUNKED) {
+                res = _store_item_copy_chunks((item_chunk *) ITEM_schunk(new_it), old_it, old_it->nbytes);
+            } else {
+                memcpy(ITEM_data(new_it), ITEM_data(old_it), old_it->nbytes);
+            }
+            if (res == 0) {
+                _store_item_write_range(new_it, off, it);
+                item_replace(old_it, new_it, hv, cas_in);
+                stored = STORED;
+            }
+        }
+    }
+
+    if (stored == STORED) {
+        item *cur = new_it ? new_it : old_it;
+        if (nbytes != NULL) {
+            *nbytes = cur->nbytes;
+        }
+        if (cas != NULL) {
+            *cas = ITEM_get_cas(cur);
+        }
+    }
+    LOGGER_LOG(t->l, LOG_MUTATIONS, LOGGER_ITEM_STORE, NULL,
+            stored, NREAD_OVERWRITE, key, it->nkey, it->nbytes, old_it->exptime,
+            ITEM_clsid(old_it), t->cur_sfd);
+
+    do_item_remove(old_it);         /* release our reference */
+    if (new_it != NULL) {
+        do_item_remove(new_it);
+    }
+    return stored;
+}
+
 /* set up a connection to write a buffer then free it, used for stats */
 void write_and_free(conn *c, char *buf, int bytes) {
     if (buf) {
@@ -1834,6 +2609,7 @@ void server_stats(ADD_STAT add_stats, void *c) {
         APPEND_STAT("rejected_connections", "%llu", (unsigned long long)stats.rejected_conns);
     }
     APPEND_STAT("connection_structures", "%u", stats_state.conn_structs);
+    APPEND_STAT("connection_structure_bytes", "%llu", (unsigned long long)stats_state.conn_struct_bytes);
     APPEND_STAT("response_obj_oom", "%llu", (unsigned long long)thread_stats.response_obj_oom);
     APPEND_STAT("response_obj_count", "%llu", (unsigned long long)thread_stats.response_obj_count);
     APPEND_STAT("response_obj_bytes", "%llu", (unsigned long long)thread_stats.response_obj_bytes);
@@ -1856,6 +2632,8 @@ void server_stats(ADD_STAT add_stats, void *c) {
     APPEND_STAT("cmd_flush", "%llu", (unsigned long long)thread_stats.flush_cmds);
     APPEND_STAT("cmd_touch", "%llu", (unsigned long long)thread_stats.touch_cmds);
     APPEND_STAT("cmd_meta", "%llu", (unsigned long long)thread_stats.meta_cmds);
+    APPEND_STAT("inplace_appends", "%llu", (unsigned long long)thread_stats.inplace_appends);
+    APPEND_STAT("hot_cache_hits", "%llu", (unsigned long long)thread_stats.hot_cache_hits);
     APPEND_STAT("get_hits", "%llu", (unsigned long long)slab_stats.get_hits);
     APPEND_STAT("get_misses", "%llu", (unsigned long long)thread_stats.get_misses);
     APPEND_STAT("get_expired", "%llu", (unsigned long long)thread_stats.get_expired);
@@ -1896,6 +2674,39 @@ void server_stats(ADD_STAT add_stats, void *c) {
     APPEND_STAT("time_in_listen_disabled_us", "%llu", stats.time_in_listen_disabled_us);
     APPEND_STAT("threads", "%d", settings.num_threads);
     APPEND_STAT("conn_yields", "%llu", (unsigned long long)thread_stats.conn_yields);
+#ifdef USE_ZEROCOPY
+    if (settings.zerocopy_min_bytes) {
+        APPEND_STAT("zerocopy_sends", "%llu", (unsigned long long)thread_stats.zerocopy_sends);
+        APPEND_STAT("zerocopy_copied", "%llu", (unsigned long long)thread_stats.zerocopy_copied);
+        APPEND_STAT("zerocopy_fallbacks", "%llu", (unsigned long long)thread_stats.zerocopy_fallbacks);
+    }
+#endif
+    if (settings.busy_poll) {
+        APPEND_STAT("busy_poll_spin_us", "%llu", (unsigned long long)thread_stats.busy_poll_spin_us);
+        APPEND_STAT("busy_poll_work_us", "%llu", (unsigned long long)thread_stats.busy_poll_work_us);
+        APPEND_STAT("busy_poll_sleeps", "%llu", (unsigned long long)thread_stats.busy_poll_sleeps);
+    }
+    if (settings.udpport) {
+        APPEND_STAT("udp_recv_calls", "%llu", (unsigned long long)thread_stats.udp_recv_calls);
+        APPEND_STAT("udp_recv_packets", "%llu", (unsigned long long)thread_stats.udp_recv_packets);
+        APPEND_STAT("udp_send_calls", "%llu", (unsigned long long)thread_stats.udp_send_calls);
+        APPEND_STAT("udp_send_packets", "%llu", (unsigned long long)thread_stats.udp_send_packets);
+    }
+    if (settings.shed_target) {
+        APPEND_STAT("shed_requests", "%llu", (unsigned long long)thread_stats.shed_requests);
+        APPEND_STAT("shed_intervals", "%llu", (unsigned long long)thread_stats.shed_intervals);
+    }
+#ifdef USE_SHM
+    if (settings.shm_ring_kb) {
+        APPEND_STAT("shm_conns", "%llu", (unsigned long long)thread_stats.shm_conns);
+        APPEND_STAT("shm_curr_conns", "%u", stats_state.shm_curr_conns);
+    }
+#endif
+#ifdef USE_CONN_MIGRATION
+    if (settings.migrate_threshold) {
+        APPEND_STAT("conn_migrations", "%llu", (unsigned long long)thread_stats.migrated_out);
+    }
+#endif
     APPEND_STAT("hash_power_level", "%u", stats_state.hash_power_level);
     APPEND_STAT("hash_bytes", "%llu", (unsigned long long)stats_state.hash_bytes);
     APPEND_STAT("hash_is_expanding", "%u", stats_state.hash_is_expanding);
@@ -1913,6 +2724,16 @@ void server_stats(ADD_STAT add_stats, void *c) {
         APPEND_STAT("lru_crawler_running", "%u", stats_state.lru_crawler_running);
         APPEND_STAT("lru_crawler_starts", "%u", stats.lru_crawler_starts);
     }
+    if (settings.snapshot_dir || settings.snapshot_load) {
+        APPEND_STAT("snapshots_written", "%llu", (unsigned long long)stats.snapshots_written);
+        APPEND_STAT("snapshot_items", "%llu", (unsigned long long)stats.snapshot_items);
+        APPEND_STAT("snapshot_bytes", "%llu", (unsigned long long)stats.snapshot_bytes);
+        APPEND_STAT("snapshot_errors", "%llu", (unsigned long long)stats.snapshot_errors);
+        APPEND_STAT("snapshot_loads", "%llu", (unsigned long long)stats.snapshot_loads);
+        APPEND_STAT("snapshot_loaded_items", "%llu", (unsigned long long)stats.snapshot_loaded_items);
+        APPEND_STAT("snapshot_load_skipped", "%llu", (unsigned long long)stats.snapshot_load_skipped);
+        APPEND_STAT("snapshot_load_errors", "%llu", (unsigned long long)stats.snapshot_load_errors);
+    }
     if (settings.lru_maintainer_thread) {
         APPEND_STAT("lru_maintainer_juggles", "%llu", (unsigned long long)stats.lru_maintainer_juggles);
     }
@@ -1983,6 +2804,7 @@ void process_stat_settings(ADD_STAT add_stats, void *c) {
     APPEND_STAT("lru_crawler", "%s", settings.lru_crawler ? "yes" : "no");
     APPEND_STAT("lru_crawler_sleep", "%d", settings.lru_crawler_sleep);
     APPEND_STAT("lru_crawler_tocrawl", "%lu", (unsigned long)settings.lru_crawler_tocrawl);
+    APPEND_STAT("snapshot_dir", "%s", settings.snapshot_dir ? settings.snapshot_dir : "");
     APPEND_STAT("tail_repair_time", "%d", settings.tail_repair_time);
     APPEND_STAT("flush_enabled", "%s", settings.flush_enabled ? "yes" : "no");
     APPEND_STAT("dump_enabled", "%s", settings.dump_enabled ? "yes" : "no");
@@ -2004,6 +2826,35 @@ void process_stat_settings(ADD_STAT add_stats, void *c) {
 #ifdef HAVE_DROP_PRIVILEGES
     APPEND_STAT("drop_privileges", "%s", settings.drop_privileges ? "yes" : "no");
 #endif
+#ifdef USE_URING
+    APPEND_STAT("worker_uring", "%s", settings.worker_uring ? "yes" : "no");
+#endif
+    APPEND_STAT("worker_listeners", "%s", !settings.worker_listeners ? "no" :
+            settings.worker_listeners_cpu ? "cpu" : "yes");
+#ifdef USE_ZEROCOPY
+    APPEND_STAT("zerocopy_min_bytes", "%u", settings.zerocopy_min_bytes);
+#endif
+    APPEND_STAT("busy_poll", "%u", settings.busy_poll);
+    APPEND_STAT("qos_classes", "%d", settings.qos_classes);
+    APPEND_STAT("shed_target", "%u", settings.shed_target);
+    APPEND_STAT("shed_interval", "%u", settings.shed_interval);
+    APPEND_STAT("shed_tags", "%s", settings.shed_tag_names ? settings.shed_tag_names : "");
+#ifdef USE_CONN_MIGRATION
+    APPEND_STAT("migrate_threshold", "%u", settings.migrate_threshold);
+    APPEND_STAT("migrate_interval", "%u", settings.migrate_interval);
+#endif
+#ifdef USE_SHM
+    APPEND_STAT("shm_ring_kb", "%u", settings.shm_ring_kb);
+    APPEND_STAT("shm_max_conns", "%u", settings.shm_max_conns);
+#endif
+#ifdef USE_UDP_GSO
+    APPEND_STAT("udp_gso", "%s", settings.udp_gso ? "yes" : "no");
+#endif
+    APPEND_STAT("native_counters", "%s", settings.native_counters ? "yes" : "no");
+    APPEND_STAT("hotkey_sample", "%u", settings.hotkey_sample);
+    APPEND_STAT("hotkey_slots", "%u", settings.hotkey_slots);
+    APPEND_STAT("hot_cache_items", "%u", settings.hot_cache_items);
+    APPEND_STAT("hot_cache_hits", "%u", settings.hot_cache_hits);
 #ifdef EXTSTORE
     APPEND_STAT("ext_item_size", "%u", settings.ext_item_size);
     APPEND_STAT("ext_item_age", "%u", settings.ext_item_age);
@@ -2044,6 +2895,26 @@ static int nz_strcmp(int nzlength, const char *nz, const char *z) {
     return (zlength == nzlength) && (strncmp(nz, z, zlength) == 0) ? 0 : -1;
 }
 
+static void process_stats_qos(ADD_STAT add_stats, void *c) {
+    struct thread_stats thread_stats;
+    char key_str[STAT_KEY_LEN];
+    char val_str[STAT_VAL_LEN];
+    int klen = 0, vlen = 0;
+
+    threadlocal_stats_aggregate(&thread_stats);
+    for (int i = 0; i < settings.qos_classes; i++) {
+        const char *name = settings.qos[i].name;
+        APPEND_NUM_FMT_STAT("%s:%s", name, "weight", "%d", settings.qos[i].weight);
+#define X(stat) APPEND_NUM_FMT_STAT("%s:%s", name, #stat, "%llu", \
+        (unsigned long long)thread_stats.qos[i].stat);
+        QOS_STATS_FIELDS
+#undef X
+    }
+
+    /* append terminator */
+    add_stats(NULL, 0, NULL, 0, c);
+}
+
 bool get_stats(const char *stat_type, int nkey, ADD_STAT add_stats, void *c) {
     bool ret = true;
 
@@ -2063,6 +2934,10 @@ bool get_stats(const char *stat_type, int nkey, ADD_STAT add_stats, void *c) {
             slabs_stats(add_stats, c);
         } else if (nz_strcmp(nkey, stat_type, "sizes") == 0) {
             item_stats_sizes(add_stats, c);
+        } else if (nz_strcmp(nkey, stat_type, "qos") == 0) {
+            process_stats_qos(add_stats, c);
+        } else if (nz_strcmp(nkey, stat_type, "threads") == 0) {
+            thread_stats_workers(add_stats, c);
         } else {
             ret = false;
         }
@@ -2262,6 +3137,20 @@ item* limited_get(const char *key, size_t nkey, LIBEVENT_THREAD *t, uint32_t exp
     return it;
 }
 
+// As limited_get() for a plain get, possibly served from the hot item cache.
+// Borrowed items don't count towards the refcount limit.
+item* limited_get_hot(const char *key, size_t nkey, LIBEVENT_THREAD *t, struct hot_item **hot, bool *overflow) {
+    item *it = item_get_hot(key, nkey, t, hot);
+    if (it && *hot == NULL && it->refcount > IT_REFCOUNT_LIMIT) {
+        item_remove(it);
+        it = NULL;
+        *overflow = true;
+    } else {
+        *overflow = false;
+    }
+    return it;
+}
+
 // Semantics are different than limited_get; since the item is returned
 // locked, caller can directly change what it needs.
 // though it might eventually be a better interface to sink it all into
@@ -2322,11 +3211,15 @@ enum delta_result_type do_add_delta(LIBEVENT_THREAD *t, const char *key, const s
         return DELTA_ITEM_CAS_MISMATCH;
     }
 
-    ptr = ITEM_data(it);
+    if (it->it_flags & ITEM_COUNTER) {
+        value = ITEM_get_counter(it);
+    } else {
+        ptr = ITEM_data(it);
 
-    if (!safe_strtoull(ptr, &value)) {
-        do_item_remove(it);
-        return NON_NUMERIC;
+        if (!safe_strtoull(ptr, &value)) {
+            do_item_remove(it);
+            return NON_NUMERIC;
+        }
     }
 
     if (incr) {
@@ -2351,10 +3244,34 @@ enum delta_result_type do_add_delta(LIBEVENT_THREAD *t, const char *key, const s
 
     itoa_u64(value, buf);
     res = strlen(buf);
+    if (it->it_flags & ITEM_COUNTER) {
+        /* Readers copy the value out when they fetch the item instead of
+         * pointing at it, so counters are updated in place no matter who
+         * else is holding them. */
+        item_stats_sizes_remove(it);
+        ITEM_set_cas(it, (settings.use_cas) ? get_cas_id() : 0);
+        item_stats_sizes_add(it);
+        ITEM_set_counter(it, value);
+        do_item_update(it);
+    } else if (settings.native_counters) {
+        /* First delta on a text value: swap in a counter. The item was
+         * found under its lock, so it is linked and we hold a reference. */
+        item *new_it;
+        client_flags_t flags;
+        FLAGS_CONV(it, flags);
+        new_it = do_item_alloc(ITEM_key(it), it->nkey, flags, it->exptime, ITEM_COUNTER_NBYTES);
+        if (new_it == 0) {
+            do_item_remove(it);
+            return EOM;
+        }
+        item_counter_init(new_it, value);
+        item_replace(it, new_it, hv, (settings.use_cas) ? get_cas_id() : 0);
+        ITEM_set_cas(it, (settings.use_cas) ? ITEM_get_cas(new_it) : 0);
+        do_item_remove(new_it);
     /* refcount == 2 means we are the only ones holding the item, and it is
      * linked. We hold the item's lock in this function, so refcount cannot
      * increase. */
-    if (res + 2 <= it->nbytes && it->refcount == 2) { /* replace in-place */
+    } else if (res + 2 <= it->nbytes && it->refcount == 2) { /* replace in-place */
         /* When changing the value without replacing the item, we
            need to update the CAS on the existing item. */
         /* We also need to fiddle it in the sizes tracker in case the tracking
@@ -2444,6 +3361,70 @@ static int try_read_command_udp(conn *c) {
 /*
  * read a UDP request.
  */
+#ifdef USE_UDP_MMSG
+static enum try_read_result try_read_udp(conn *c) {
+    struct conn_udp *b = c->udp;
+
+    assert(c != NULL);
+
+    // Only go back to the socket once everything from the last read has
+    // been handed out.
+    if (b->next == b->count) {
+        uint64_t bytes = 0;
+        int res;
+        int x;
+
+        for (x = 0; x < UDP_BATCH; x++) {
+            b->msgs[x].msg_hdr.msg_namelen = sizeof(b->addrs[x]);
+        }
+        res = recvmmsg(c->sfd, b->msgs, UDP_BATCH, 0, NULL);
+        b->next = 0;
+        b->count = res > 0 ? res : 0;
+        if (res <= 0) {
+            return READ_NO_DATA_RECEIVED;
+        }
+
+        for (x = 0; x < res; x++) {
+            bytes += b->msgs[x].msg_len;
+        }
+        pthread_mutex_lock(&c->thread->stats.mutex);
+        c->thread->stats.bytes_read += bytes;
+        c->thread->stats.udp_recv_calls++;
+        c->thread->stats.udp_recv_packets += res;
+        pthread_mutex_unlock(&c->thread->stats.mutex);
+    }
+
+    while (b->next < b->count) {
+        struct msghdr *msg = &b->msgs[b->next].msg_hdr;
+        unsigned char *buf = (unsigned char *)b->bufs[b->next];
+        int res = b->msgs[b->next].msg_len;
+        b->next++;
+
+        if (res <= 8)
+            continue;
+
+        /* Beginning of UDP packet is the request ID; save it. */
+        c->udp->request_id = buf[0] * 256 + buf[1];
+
+        /* If this is a multi-packet request, drop it. */
+        if (buf[4] != 0 || buf[5] != 1) {
+            continue;
+        }
+
+        memcpy(&c->request_addr, msg->msg_name, msg->msg_namelen);
+        c->request_addr_size = msg->msg_namelen;
+
+        /* Don't care about any of the rest of the header. */
+        res -= 8;
+        memcpy(c->rbuf, buf + 8, res);
+
+        c->rbytes = res;
+        c->rcurr = c->rbuf;
+        return READ_DATA_RECEIVED;
+    }
+    return READ_NO_DATA_RECEIVED;
+}
+#else
 static enum try_read_result try_read_udp(conn *c) {
     int res;
 
@@ -2457,10 +3438,12 @@ static enum try_read_result try_read_udp(conn *c) {
         unsigned char *buf = (unsigned char *)c->rbuf;
         pthread_mutex_lock(&c->thread->stats.mutex);
         c->thread->stats.bytes_read += res;
+        c->thread->stats.udp_recv_calls++;
+        c->thread->stats.udp_recv_packets++;
         pthread_mutex_unlock(&c->thread->stats.mutex);
 
         /* Beginning of UDP packet is the request ID; save it. */
-        c->request_id = buf[0] * 256 + buf[1];
+        c->udp->request_id = buf[0] * 256 + buf[1];
 
         /* If this is a multi-packet request, drop it. */
         if (buf[4] != 0 || buf[5] != 1) {
@@ -2477,6 +3460,7 @@ static enum try_read_result try_read_udp(conn *c) {
     }
     return READ_NO_DATA_RECEIVED;
 }
+#endif
 
 /*
  * read from network as much as we can, handle buffer overflow and connection
@@ -2555,9 +3539,26 @@ static enum try_read_result try_read_network(conn *c) {
     return gotdata;
 }
 
-static bool update_event(conn *c, const int new_flags) {
+static bool update_event(conn *c, int new_flags) {
     assert(c != NULL);
 
+#ifdef USE_SHM
+    if (conn_shm_blocked(c)) {
+        // room in the ring is announced with a doorbell on the socket.
+        new_flags = EV_READ | EV_PERSIST;
+    }
+#endif
+
+#ifdef USE_URING
+    if (c->ur_active) {
+        // no socket events to juggle, just see if there's work to do.
+        c->ev_flags = new_flags;
+        if ((new_flags & EV_WRITE) || conn_uring_readable(c)) {
+            conn_uring_runq_add(c);
+        }
+        return true;
+    }
+#endif
     struct event_base *base = c->event.ev_base;
     if (c->ev_flags == new_flags)
         return true;
@@ -2575,18 +3576,24 @@ static bool update_event(conn *c, const int new_flags) {
 void do_accept_new_conns(const bool do_accept) {
     conn *next;
 
+    // worker listeners can hit the limit from several threads at once.
+    if (settings.worker_listeners) {
+        STATS_LOCK();
+        bool accepting = stats_state.accepting_conns;
+        STATS_UNLOCK();
+        if (do_accept == accepting) {
+            return;
+        }
+    }
+
     for (next = listen_conn; next; next = next->next) {
-        if (do_accept) {
-            update_event(next, EV_READ | EV_PERSIST);
-            if (listen(next->sfd, settings.backlog) != 0) {
-                perror("listen");
-            }
+        if (next->thread != NULL) {
+            listen_conn_notify(next, do_accept);
+        } else {
+            listen_conn_update(next, do_accept);
         }
-        else {
-            update_event(next, 0);
-            if (listen(next->sfd, 0) != 0) {
-                perror("listen");
-            }
+        if (listen(next->sfd, do_accept ? settings.backlog : 0) != 0) {
+            perror("listen");
         }
     }
 
@@ -2608,67 +3615,257 @@ void do_accept_new_conns(const bool do_accept) {
         stats.listen_disabled_num++;
         STATS_UNLOCK();
         allow_new_conns = false;
-        maxconns_handler(-42, 0, 0);
+        // worker listeners are turned back on by conn_close(), as the main
+        // thread's timer can't be armed from a worker.
+        if (!settings.worker_listeners) {
+            maxconns_handler(-42, 0, 0);
+        }
     }
 }
 
-#define TRANSMIT_ONE_RESP true
-#define TRANSMIT_ALL_RESP false
-static int _transmit_pre(conn *c, struct iovec *iovs, int iovused, bool one_resp) {
-    mc_resp *resp = c->resp_head;
-    while (resp && iovused + resp->iovcnt < IOV_MAX-1) {
-        if (resp->skip) {
-            // Don't actually unchain the resp obj here since it's singly-linked.
-            // Just let the post function handle it linearly.
-            resp = resp->next;
-            continue;
-        }
-        if (resp->chunked_data_iov) {
-            // Handle chunked items specially.
-            // They spend much more time in send so we can be a bit wasteful
-            // in rebuilding iovecs for them.
-            item_chunk *ch = (item_chunk *)ITEM_schunk((item *)resp->iov[resp->chunked_data_iov].iov_base);
-            int x;
-            for (x = 0; x < resp->iovcnt; x++) {
-                // This iov is tracking how far we've copied so far.
-                if (x == resp->chunked_data_iov) {
-                    int done = resp->chunked_total - resp->iov[x].iov_len;
-                    // Start from the len to allow binprot to cut the \r\n
-                    int todo = resp->iov[x].iov_len;
-                    while (ch && todo > 0 && iovused < IOV_MAX-1) {
-                        int skip = 0;
-                        if (!ch->used) {
-                            ch = ch->next;
-                            continue;
-                        }
-                        // Skip parts we've already sent.
-                        if (done >= ch->used) {
-                            done -= ch->used;
-                            ch = ch->next;
-                            continue;
-                        } else if (done) {
-                            skip = done;
-                            done = 0;
-                        }
-                        iovs[iovused].iov_base = ch->data + skip;
-                        // Stupid binary protocol makes this go negative.
-                        iovs[iovused].iov_len = ch->used - skip > todo ? todo : ch->used - skip;
-                        iovused++;
-                        todo -= ch->used - skip;
+void listen_conn_update(conn *c, const bool do_accept) {
+    if (!update_event(c, do_accept ? EV_READ | EV_PERSIST : 0)) {
+        if (settings.verbose > 0)
+            fprintf(stderr, "Couldn't update listener event\n");
+    }
+}
+
+#ifdef USE_ZEROCOPY
+/*
+ * MSG_ZEROCOPY sends.
+ *
+ * With -o zerocopy_min_bytes large responses are sent without copying item
+ * memory into the socket. The kernel reads from our memory until the data
+ * is acknowledged, so finished responses that took part in a zerocopy send
+ * keep their item references and buffers until the completion for that send
+ * shows up on the socket's error queue.
+ *
+ * Every zerocopy send gets the next id from a per-socket counter, and
+ * completions come back as ranges of ids. Completions are usually but not
+ * always in order, so they're tracked with a small window.
+ */
+
+#define ZEROCOPY_MAX_INFLIGHT 64
+#define ZEROCOPY_LINGER_MS 10
+#define ZEROCOPY_LINGER_MAX 500
+
+static void conn_zc_hold(conn *c, mc_resp *resp) {
+    resp->next = NULL;
+    if (c->zc_tail) {
+        c->zc_tail->next = resp;
+    } else {
+        c->zc_head = resp;
+    }
+    c->zc_tail = resp;
+}
+
+static void conn_zc_complete(conn *c, uint32_t lo, uint32_t hi) {
+    for (uint32_t id = lo; (int32_t)(hi - id) >= 0; id++) {
+        int32_t off = id - c->zc_acked;
+        if (off >= 0 && off < ZEROCOPY_MAX_INFLIGHT) {
+            c->zc_done |= 1ULL << off;
+        }
+    }
+    while (c->zc_done & 1) {
+        c->zc_done >>= 1;
+        c->zc_acked++;
+    }
+}
+
+// Reads completions off the error queue and releases any responses the
+// kernel is done with.
+static void conn_zc_reap(conn *c) {
+    char control[CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(struct sockaddr_in6))];
+    struct msghdr msg;
+    uint64_t copied = 0;
+
+    while (c->zc_acked != c->zc_next) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(c->sfd, &msg, MSG_ERRQUEUE) == -1) {
+            break;
+        }
+
+        struct cmsghdr *cm;
+        for (cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+            if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) &&
+                !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)) {
+                continue;
+            }
+            struct sock_extended_err *serr = (struct sock_extended_err *)CMSG_DATA(cm);
+            if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+            if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                // the kernel couldn't avoid the copy (loopback, no
+                // scatter-gather, etc), so zerocopy only adds overhead.
+                copied += serr->ee_data - serr->ee_info + 1;
+                c->zc_enabled = false;
+            }
+            conn_zc_complete(c, serr->ee_info, serr->ee_data);
+        }
+    }
+
+    if (copied) {
+        THR_STATS_LOCK(c->thread);
+        c->thread->stats.zerocopy_copied += copied;
+        THR_STATS_UNLOCK(c->thread);
+    }
+
+    while (c->zc_head && (int32_t)(c->zc_head->zc_id - c->zc_acked) < 0) {
+        mc_resp *resp = c->zc_head;
+        c->zc_head = resp->next;
+        resp_release(c->thread, resp);
+    }
+    if (c->zc_head == NULL) {
+        c->zc_tail = NULL;
+    }
+}
+
+// Returns MSG_ZEROCOPY if this send should avoid the copy.
+static int conn_zc_flags(conn *c, struct iovec *iovs, int iovused) {
+    size_t len = 0;
+    for (int x = 0; x < iovused; x++) {
+        len += iovs[x].iov_len;
+    }
+    if (len < settings.zerocopy_min_bytes) {
+        return 0;
+    }
+    if (c->zc_next - c->zc_acked >= ZEROCOPY_MAX_INFLIGHT) {
+        THR_STATS_LOCK(c->thread);
+        c->thread->stats.zerocopy_fallbacks++;
+        THR_STATS_UNLOCK(c->thread);
+        return 0;
+    }
+    return MSG_ZEROCOPY;
+}
+
+// Marks the responses covered by a zerocopy send of res bytes.
+static void conn_zc_sent(conn *c, ssize_t res) {
+    uint32_t id = c->zc_next++;
+    mc_resp *resp;
+    for (resp = c->resp_head; resp && res > 0; resp = resp->next) {
+        if (resp->skip) {
+            continue;
+        }
+        resp->zc_hold = true;
+        resp->zc_id = id;
+        res -= resp->tosend;
+    }
+}
+
+static void conn_zc_linger_handler(evutil_socket_t fd, short which, void *arg) {
+    conn *c = arg;
+    struct timeval t = {.tv_sec = 0, .tv_usec = ZEROCOPY_LINGER_MS * 1000};
+
+    conn_zc_reap(c);
+    if (c->zc_head != NULL) {
+        // only count time where the client isn't draining the socket.
+        int outq = 0;
+        if (ioctl(c->sfd, SIOCOUTQ, &outq) == 0 && outq < c->zc_outq) {
+            c->zc_lingers = 0;
+        }
+        c->zc_outq = outq;
+        if (++c->zc_lingers < ZEROCOPY_LINGER_MAX) {
+            evtimer_add(&c->event, &t);
+            return;
+        }
+        // the client stopped reading. Reset the connection so the kernel
+        // drops what it has queued, then let go of the memory.
+        struct linger ling = {1, 0};
+        setsockopt(c->sfd, SOL_SOCKET, SO_LINGER, (void *)&ling, sizeof(ling));
+        while (c->zc_head) {
+            mc_resp *resp = c->zc_head;
+            c->zc_head = resp->next;
+            resp_release(c->thread, resp);
+        }
+        c->zc_tail = NULL;
+    }
+
+    conn_close_socket(c);
+}
+
+// A closed connection still has data in flight that points at our memory,
+// so the socket is kept open until the kernel is done with it. Gives up if
+// the client reads nothing for about five seconds.
+static void conn_zc_linger(conn *c) {
+    struct timeval t = {.tv_sec = 0, .tv_usec = ZEROCOPY_LINGER_MS * 1000};
+
+    c->zc_lingers = 0;
+    c->zc_outq = INT_MAX;
+    evtimer_set(&c->event, conn_zc_linger_handler, c);
+    event_base_set(c->thread->base, &c->event);
+    evtimer_add(&c->event, &t);
+}
+#endif
+
+#define TRANSMIT_ONE_RESP true
+#define TRANSMIT_ALL_RESP false
+/*
+ * Adds the unsent data of a single response to iovs. Chunked items may be
+ * cut short if we run out of iovecs.
+ */
+static int _transmit_resp_iovs(mc_resp *resp, struct iovec *iovs, int iovused) {
+    if (resp->chunked_data_iov) {
+        // Handle chunked items specially.
+        // They spend much more time in send so we can be a bit wasteful
+        // in rebuilding iovecs for them.
+        item_chunk *ch = (item_chunk *)ITEM_schunk((item *)resp->iov[resp->chunked_data_iov].iov_base);
+        int x;
+        for (x = 0; x < resp->iovcnt; x++) {
+            // This iov is tracking how far we've copied so far.
+            if (x == resp->chunked_data_iov) {
+                int done = resp->chunked_total - resp->iov[x].iov_len;
+                // Start from the len to allow binprot to cut the \r\n
+                int todo = resp->iov[x].iov_len;
+                while (ch && todo > 0 && iovused < IOV_MAX-1) {
+                    int skip = 0;
+                    if (!ch->used) {
                         ch = ch->next;
+                        continue;
                     }
-                } else {
-                    iovs[iovused].iov_base = resp->iov[x].iov_base;
-                    iovs[iovused].iov_len = resp->iov[x].iov_len;
+                    // Skip parts we've already sent.
+                    if (done >= ch->used) {
+                        done -= ch->used;
+                        ch = ch->next;
+                        continue;
+                    } else if (done) {
+                        skip = done;
+                        done = 0;
+                    }
+                    iovs[iovused].iov_base = ch->data + skip;
+                    // Stupid binary protocol makes this go negative.
+                    iovs[iovused].iov_len = ch->used - skip > todo ? todo : ch->used - skip;
                     iovused++;
+                    todo -= ch->used - skip;
+                    ch = ch->next;
                 }
-                if (iovused >= IOV_MAX-1)
-                    break;
+            } else {
+                iovs[iovused].iov_base = resp->iov[x].iov_base;
+                iovs[iovused].iov_len = resp->iov[x].iov_len;
+                iovused++;
             }
-        } else {
-            memcpy(&iovs[iovused], resp->iov, sizeof(struct iovec)*resp->iovcnt);
-            iovused += resp->iovcnt;
+            if (iovused >= IOV_MAX-1)
+                break;
         }
+    } else {
+        memcpy(&iovs[iovused], resp->iov, sizeof(struct iovec)*resp->iovcnt);
+        iovused += resp->iovcnt;
+    }
+    return iovused;
+}
+
+static int _transmit_pre(conn *c, struct iovec *iovs, int iovused, bool one_resp) {
+    mc_resp *resp = c->resp_head;
+    while (resp && iovused + resp->iovcnt < IOV_MAX-1) {
+        if (resp->skip) {
+            // Don't actually unchain the resp obj here since it's singly-linked.
+            // Just let the post function handle it linearly.
+            resp = resp->next;
+            continue;
+        }
+        iovused = _transmit_resp_iovs(resp, iovs, iovused);
 
         // done looking at first response, walk down the chain.
         resp = resp->next;
@@ -2748,6 +3945,12 @@ static enum transmit_result transmit(conn *c) {
     struct msghdr msg;
     int iovused = 0;
 
+#ifdef USE_URING
+    if (c->ur_active) {
+        return conn_uring_transmit(c);
+    }
+#endif
+
     // init the msg.
     memset(&msg, 0, sizeof(struct msghdr));
     msg.msg_iov = iovs;
@@ -2762,13 +3965,41 @@ static enum transmit_result transmit(conn *c) {
 
     // Alright, send.
     ssize_t res;
+    int flags = 0;
     msg.msg_iovlen = iovused;
-    res = c->sendmsg(c, &msg, 0);
+#ifdef USE_ZEROCOPY
+    if (c->zc_acked != c->zc_next) {
+        conn_zc_reap(c);
+    }
+    if (c->zc_enabled) {
+        flags = conn_zc_flags(c, iovs, iovused);
+    }
+    res = c->sendmsg(c, &msg, flags);
+    if (res == -1 && flags && errno == ENOBUFS) {
+        // out of memory for pinning pages, copy this one.
+        flags = 0;
+        THR_STATS_LOCK(c->thread);
+        c->thread->stats.zerocopy_fallbacks++;
+        THR_STATS_UNLOCK(c->thread);
+        res = c->sendmsg(c, &msg, flags);
+    }
+#else
+    res = c->sendmsg(c, &msg, flags);
+#endif
     if (res >= 0) {
         pthread_mutex_lock(&c->thread->stats.mutex);
         c->thread->stats.bytes_written += res;
+        if (flags) {
+            c->thread->stats.zerocopy_sends++;
+        }
         pthread_mutex_unlock(&c->thread->stats.mutex);
 
+#ifdef USE_ZEROCOPY
+        if (flags && res > 0) {
+            conn_zc_sent(c, res);
+        }
+#endif
+
         // Decrement any partial IOV's and complete any finished resp's.
         _transmit_post(c, res);
 
@@ -2797,6 +4028,566 @@ static enum transmit_result transmit(conn *c) {
     return TRANSMIT_HARD_ERROR;
 }
 
+#ifdef USE_URING
+/*
+ * io_uring worker event loop.
+ *
+ * With -o worker_uring each worker thread owns a ring. Client sockets keep a
+ * single multishot receive outstanding, which fills buffers from a
+ * per-thread provided buffer ring, and responses go out with async sendmsg.
+ * The ring's eventfd is watched by libevent, so everything else (notify
+ * pipes, timers, UDP and TLS connections) works as before.
+ *
+ * Completions don't drive connections directly. Ready connections are put
+ * on a run queue instead, which conn_uring_flush() processes between event
+ * loop iterations. New requests are submitted from there too, so a whole
+ * batch of sends and receive rearms costs a single syscall.
+ */
+
+#define URING_ENTRIES 1024
+#define URING_BUFS 512
+#define URING_BUF_SIZE 8192
+#define URING_BGID 0
+#define URING_FLUSH_LOOPS 4
+#define URING_NO_BUF 0xffff
+
+enum uring_op {
+    URING_OP_RECV = 1,
+    URING_OP_SEND,
+    URING_OP_CANCEL
+};
+
+// completions are tagged with the operation, the connection's generation
+// and its fd. stale completions for a closed connection only recycle their
+// buffers.
+#define URING_UD(op, gen, fd) (((uint64_t)(op) << 56) | \
+        ((uint64_t)((gen) & 0xffffff) << 32) | (uint32_t)(fd))
+#define URING_UD_OP(ud) ((ud) >> 56)
+#define URING_UD_GEN(ud) (((ud) >> 32) & 0xffffff)
+#define URING_UD_FD(ud) ((int)((ud) & 0xffffffff))
+
+typedef struct {
+    mc_uring_t ring;
+    mc_uring_bufs_t bufs;
+    struct event event;
+    int efd;
+    unsigned int bufs_free;
+    uint16_t *buf_next; // queued receive buffers, linked by buffer id
+    uint32_t *buf_len;
+    conn *runq;
+    conn *runq_tail;
+    conn *rearmq;
+    struct iovec *iov_free; // spare iovec arrays for in-flight sends
+} conn_uring_t;
+
+static void conn_uring_event_handler(evutil_socket_t fd, short which, void *arg) {
+    LIBEVENT_THREAD *t = arg;
+    uint64_t count;
+    t->busy_poll_events++;
+    // the actual work happens in conn_uring_flush() once the event loop
+    // has run all of the callbacks.
+    if (read(fd, &count, sizeof(count)) != sizeof(count)) {
+        return;
+    }
+}
+
+void conn_uring_thread_init(LIBEVENT_THREAD *t) {
+    conn_uring_t *u = calloc(1, sizeof(conn_uring_t));
+    if (u == NULL) {
+        fprintf(stderr, "Failed to allocate io_uring state, using libevent\n");
+        return;
+    }
+    u->efd = -1;
+
+    if (mc_uring_init(&u->ring, URING_ENTRIES) != 0) {
+        perror("io_uring_setup");
+        free(u);
+        fprintf(stderr, "io_uring unavailable for worker thread, using libevent\n");
+        return;
+    }
+
+    if (mc_uring_bufs_init(&u->ring, &u->bufs, URING_BGID, URING_BUFS, URING_BUF_SIZE) != 0) {
+        perror("io_uring provided buffers");
+        goto error;
+    }
+    u->bufs_free = URING_BUFS;
+    u->buf_next = calloc(URING_BUFS, sizeof(uint16_t));
+    u->buf_len = calloc(URING_BUFS, sizeof(uint32_t));
+    if (u->buf_next == NULL || u->buf_len == NULL) {
+        fprintf(stderr, "Failed to allocate io_uring buffer lists\n");
+        goto error;
+    }
+
+    u->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (u->efd == -1 || mc_uring_register_eventfd(&u->ring, u->efd) != 0) {
+        perror("io_uring eventfd");
+        goto error;
+    }
+
+    event_set(&u->event, u->efd, EV_READ | EV_PERSIST,
+            conn_uring_event_handler, t);
+    event_base_set(t->base, &u->event);
+    if (event_add(&u->event, 0) == -1) {
+        fprintf(stderr, "Can't monitor io_uring eventfd\n");
+        goto error;
+    }
+
+    t->uring = u;
+    return;
+error:
+    if (u->efd != -1) {
+        close(u->efd);
+    }
+    free(u->buf_next);
+    free(u->buf_len);
+    if (u->bufs.bufs) {
+        mc_uring_bufs_free(&u->ring, &u->bufs);
+    }
+    mc_uring_exit(&u->ring);
+    free(u);
+    fprintf(stderr, "io_uring unavailable for worker thread, using libevent\n");
+}
+
+static struct io_uring_sqe *conn_uring_sqe(conn_uring_t *u) {
+    struct io_uring_sqe *sqe = mc_uring_get_sqe(&u->ring);
+    if (sqe == NULL) {
+        // submission queue is full; push it out and try again.
+        mc_uring_submit(&u->ring);
+        sqe = mc_uring_get_sqe(&u->ring);
+    }
+    return sqe;
+}
+
+static void conn_uring_buf_put(conn_uring_t *u, uint16_t bid) {
+    mc_uring_bufs_put(&u->bufs, bid);
+    u->bufs_free++;
+}
+
+static void conn_uring_runq_add(conn *c) {
+    conn_uring_t *u = c->thread->uring;
+    if (c->ur_queued) {
+        return;
+    }
+    c->ur_queued = true;
+    c->ur_next = NULL;
+    if (u->runq_tail) {
+        u->runq_tail->ur_next = c;
+    } else {
+        u->runq = c;
+    }
+    u->runq_tail = c;
+}
+
+static bool conn_uring_readable(conn *c) {
+    return c->ur_bhead != -1 || c->ur_eof || c->ur_err;
+}
+
+static void conn_uring_rearm_later(conn *c) {
+    conn_uring_t *u = c->thread->uring;
+    if (c->ur_rearm) {
+        return;
+    }
+    c->ur_rearm = true;
+    c->ur_rnext = u->rearmq;
+    u->rearmq = c;
+}
+
+static void conn_uring_arm(conn *c) {
+    conn_uring_t *u = c->thread->uring;
+    struct io_uring_sqe *sqe = NULL;
+
+    if (u->bufs_free != 0) {
+        sqe = conn_uring_sqe(u);
+    }
+    if (sqe == NULL) {
+        conn_uring_rearm_later(c);
+        return;
+    }
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = c->sfd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BGID;
+    sqe->user_data = URING_UD(URING_OP_RECV, c->ur_gen, c->sfd);
+    c->ur_armed = true;
+}
+
+static void conn_uring_cancel(conn *c) {
+    conn_uring_t *u = c->thread->uring;
+    struct io_uring_sqe *sqe = conn_uring_sqe(u);
+    // if the queue is wedged the receive ends once the socket errors or
+    // sees EOF; its completions will be stale by then.
+    if (sqe == NULL) {
+        return;
+    }
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = URING_UD(URING_OP_RECV, c->ur_gen, c->sfd);
+    sqe->user_data = URING_UD(URING_OP_CANCEL, 0, 0);
+}
+
+void conn_uring_attach(conn *c) {
+    if (c->state == conn_listening || IS_UDP(c->transport)) {
+        return;
+    }
+#ifdef TLS
+    if (c->ssl) {
+        return;
+    }
+#endif
+
+    // conn_new() armed a libevent event which we don't need.
+    event_del(&c->event);
+    c->ur_active = true;
+    c->ur_armed = false;
+    c->ur_sending = false;
+    c->ur_close = false;
+    c->ur_eof = false;
+    c->ur_err = 0;
+    c->ur_bhead = -1;
+    c->ur_btail = -1;
+    c->ur_boff = 0;
+    c->ur_iovs = NULL;
+    c->ur_nreqs = settings.reqs_per_event;
+    c->read = conn_uring_read;
+    conn_uring_arm(c);
+    // get it into a read state; libevent would do this on the first event.
+    conn_uring_runq_add(c);
+}
+
+static void conn_uring_release(conn *c) {
+    conn_uring_t *u = c->thread->uring;
+    if (c->ur_armed) {
+        conn_uring_cancel(c);
+        c->ur_armed = false;
+    }
+    while (c->ur_bhead != -1) {
+        int bid = c->ur_bhead;
+        c->ur_bhead = u->buf_next[bid] == URING_NO_BUF ? -1 : u->buf_next[bid];
+        conn_uring_buf_put(u, bid);
+    }
+    c->ur_btail = -1;
+    c->ur_boff = 0;
+    c->ur_active = false;
+    c->ur_eof = false;
+    c->ur_err = 0;
+    c->ur_gen++;
+    c->read = tcp_read;
+}
+
+/* Connections handed off to a side thread (log watchers, crawler dumps) are
+ * read with plain syscalls while they're away. Must be called before the
+ * side thread can see the connection.
+ */
+void conn_uring_handoff(conn *c) {
+    if (!c->ur_active) {
+        return;
+    }
+    c->read = tcp_read;
+    if (c->ur_armed) {
+        conn_uring_cancel(c);
+    }
+}
+
+void conn_uring_return(conn *c) {
+    if (!c->ur_active) {
+        return;
+    }
+    c->read = conn_uring_read;
+    // if a cancel is still in flight the receive is rearmed once it lands.
+    if (!c->ur_armed) {
+        conn_uring_arm(c);
+    }
+}
+
+static ssize_t conn_uring_read(conn *c, void *buf, size_t count) {
+    conn_uring_t *u = c->thread->uring;
+    size_t done = 0;
+
+    while (c->ur_bhead != -1 && done < count) {
+        int bid = c->ur_bhead;
+        size_t avail = u->buf_len[bid] - c->ur_boff;
+        size_t todo = count - done < avail ? count - done : avail;
+
+        memcpy((char *)buf + done, mc_uring_buf(&u->bufs, bid) + c->ur_boff, todo);
+        done += todo;
+        c->ur_boff += todo;
+        if (c->ur_boff == u->buf_len[bid]) {
+            c->ur_bhead = u->buf_next[bid] == URING_NO_BUF ? -1 : u->buf_next[bid];
+            if (c->ur_bhead == -1) {
+                c->ur_btail = -1;
+            }
+            c->ur_boff = 0;
+            conn_uring_buf_put(u, bid);
+        }
+    }
+
+    if (done) {
+        return done;
+    }
+    if (c->ur_err) {
+        errno = c->ur_err;
+        return -1;
+    }
+    if (c->ur_eof) {
+        return 0;
+    }
+    errno = EAGAIN;
+    return -1;
+}
+
+static void conn_uring_recv_done(conn_uring_t *u, struct io_uring_cqe *cqe) {
+    int fd = URING_UD_FD(cqe->user_data);
+    conn *c = fd < max_fds ? conns[fd] : NULL;
+    int bid = -1;
+
+    if (cqe->flags & IORING_CQE_F_BUFFER) {
+        bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        u->bufs_free--;
+    }
+
+    if (c == NULL || !c->ur_active
+            || (c->ur_gen & 0xffffff) != URING_UD_GEN(cqe->user_data)) {
+        if (bid != -1) {
+            conn_uring_buf_put(u, bid);
+        }
+        return;
+    }
+
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        c->ur_armed = false;
+    }
+
+    if (cqe->res > 0 && bid != -1) {
+        u->buf_next[bid] = URING_NO_BUF;
+        u->buf_len[bid] = cqe->res;
+        if (c->ur_btail == -1) {
+            c->ur_bhead = bid;
+        } else {
+            u->buf_next[c->ur_btail] = bid;
+        }
+        c->ur_btail = bid;
+    } else {
+        if (bid != -1) {
+            conn_uring_buf_put(u, bid);
+        }
+        if (cqe->res == 0) {
+            c->ur_eof = true;
+        } else if (cqe->res == -ENOBUFS) {
+            // out of receive buffers; try again once some are returned.
+            conn_uring_rearm_later(c);
+        } else if (cqe->res != -ECANCELED) {
+            c->ur_err = -cqe->res;
+        }
+    }
+
+    // the kernel can end a multishot receive on its own, so if we're still
+    // responsible for the socket put a new one in.
+    if (!c->ur_armed && !c->ur_rearm && c->read == conn_uring_read
+            && !c->ur_eof && !c->ur_err) {
+        conn_uring_arm(c);
+    }
+
+    if (c->read == conn_uring_read && conn_uring_readable(c)) {
+        switch (c->state) {
+            case conn_new_cmd: // yielded with nothing left to parse
+            case conn_read:
+            case conn_nread:
+            case conn_swallow:
+                conn_uring_runq_add(c);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+static enum transmit_result conn_uring_transmit(conn *c) {
+    conn_uring_t *u = c->thread->uring;
+    struct iovec *iovs;
+    int iovused;
+
+    if (c->ur_sending) {
+        return TRANSMIT_SOFT_ERROR;
+    }
+
+    if (u->iov_free) {
+        iovs = u->iov_free;
+        u->iov_free = iovs[0].iov_base;
+    } else {
+        iovs = malloc(sizeof(struct iovec) * IOV_MAX);
+        if (iovs == NULL) {
+            STATS_LOCK();
+            stats.malloc_fails++;
+            STATS_UNLOCK();
+            conn_set_state(c, conn_closing);
+            return TRANSMIT_HARD_ERROR;
+        }
+    }
+
+    iovused = _transmit_pre(c, iovs, 0, TRANSMIT_ALL_RESP);
+    struct io_uring_sqe *sqe = iovused ? conn_uring_sqe(u) : NULL;
+    if (sqe == NULL) {
+        iovs[0].iov_base = u->iov_free;
+        u->iov_free = iovs;
+        if (iovused == 0) {
+            // Only handling a noreply.
+            _transmit_post(c, 0);
+            return TRANSMIT_COMPLETE;
+        }
+        // no room to submit; come back around on the next flush.
+        conn_uring_runq_add(c);
+        return TRANSMIT_SOFT_ERROR;
+    }
+
+    memset(&c->ur_msg, 0, sizeof(struct msghdr));
+    c->ur_msg.msg_iov = iovs;
+    c->ur_msg.msg_iovlen = iovused;
+    c->ur_iovs = iovs;
+
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = c->sfd;
+    sqe->addr = (uint64_t)(uintptr_t)&c->ur_msg;
+    sqe->len = 1;
+    sqe->user_data = URING_UD(URING_OP_SEND, c->ur_gen, c->sfd);
+    c->ur_sending = true;
+
+    return TRANSMIT_SOFT_ERROR;
+}
+
+static void conn_uring_send_done(conn_uring_t *u, struct io_uring_cqe *cqe) {
+    int fd = URING_UD_FD(cqe->user_data);
+    conn *c = fd < max_fds ? conns[fd] : NULL;
+
+    // closes wait for sends to finish, so this should always match.
+    if (c == NULL || !c->ur_sending
+            || (c->ur_gen & 0xffffff) != URING_UD_GEN(cqe->user_data)) {
+        return;
+    }
+
+    c->ur_sending = false;
+    c->ur_iovs[0].iov_base = u->iov_free;
+    u->iov_free = c->ur_iovs;
+    c->ur_iovs = NULL;
+
+    if (c->ur_close) {
+        c->ur_close = false;
+        conn_close(c);
+        return;
+    }
+
+    if (cqe->res >= 0) {
+        pthread_mutex_lock(&c->thread->stats.mutex);
+        c->thread->stats.bytes_written += cqe->res;
+        pthread_mutex_unlock(&c->thread->stats.mutex);
+
+        // Decrement any partial IOV's and complete any finished resp's.
+        _transmit_post(c, cqe->res);
+    } else {
+        if (settings.verbose > 0)
+            fprintf(stderr, "Failed to write: %s\n", strerror(-cqe->res));
+        conn_set_state(c, conn_closing);
+    }
+
+    conn_uring_runq_add(c);
+}
+
+static int conn_uring_reap(conn_uring_t *u) {
+    struct io_uring_cqe *p;
+    int count = 0;
+
+    do {
+        while ((p = mc_uring_peek_cqe(&u->ring)) != NULL) {
+            struct io_uring_cqe cqe = *p;
+            mc_uring_cqe_seen(&u->ring);
+            count++;
+
+            switch (URING_UD_OP(cqe.user_data)) {
+                case URING_OP_RECV:
+                    conn_uring_recv_done(u, &cqe);
+                    break;
+                case URING_OP_SEND:
+                    conn_uring_send_done(u, &cqe);
+                    break;
+                default:
+                    break;
+            }
+        }
+    } while (mc_uring_cq_overflow(&u->ring));
+
+    return count;
+}
+
+static void conn_uring_run(conn_uring_t *u) {
+    conn *c = u->runq;
+    u->runq = u->runq_tail = NULL;
+
+    while (c) {
+        conn *next = c->ur_next;
+        c->ur_next = NULL;
+        c->ur_queued = false;
+
+        if (c->ur_active && !c->ur_sending && c->read == conn_uring_read) {
+            switch (c->state) {
+                case conn_closed:
+                case conn_watch:
+                case conn_io_queue:
+                case conn_io_pending:
+                    break;
+                default:
+                    drive_machine(c);
+                    break;
+            }
+        }
+        c = next;
+    }
+}
+
+static void conn_uring_rearm(conn_uring_t *u) {
+    conn *c = u->rearmq;
+    u->rearmq = NULL;
+
+    while (c) {
+        conn *next = c->ur_rnext;
+        c->ur_rnext = NULL;
+        c->ur_rearm = false;
+        if (c->ur_active && !c->ur_armed && c->read == conn_uring_read
+                && !c->ur_eof && !c->ur_err) {
+            conn_uring_arm(c);
+        }
+        c = next;
+    }
+}
+
+/* Reap completions, run ready connections and submit whatever they queued.
+ * Called by the worker between event loop iterations.
+ */
+void conn_uring_flush(LIBEVENT_THREAD *t) {
+    conn_uring_t *u = t->uring;
+
+    for (int x = 0; x < URING_FLUSH_LOOPS; x++) {
+        int reaped = conn_uring_reap(u);
+        conn_uring_run(u);
+        if (u->rearmq && u->bufs_free) {
+            conn_uring_rearm(u);
+        }
+        bool pending = mc_uring_sq_pending(&u->ring);
+        if (pending) {
+            mc_uring_submit(&u->ring);
+        }
+        if (!reaped && !pending && u->runq == NULL) {
+            return;
+        }
+    }
+
+    // still busy; make sure the event loop comes straight back to us.
+    if (u->runq || mc_uring_sq_pending(&u->ring) || mc_uring_peek_cqe(&u->ring)) {
+        event_active(&u->event, EV_READ, 0);
+    }
+}
+#endif
+
 static void build_udp_header(unsigned char *hdr, mc_resp *resp) {
     // We need to communicate the total number of packets
     // If this isn't set, it's the first time this response is building a udp
@@ -2827,10 +4618,211 @@ static void build_udp_header(unsigned char *hdr, mc_resp *resp) {
     resp->udp_sequence++;
 }
 
+#ifdef USE_UDP_MMSG
+/*
+ * UDP specific transmit function. Cuts as many packets as fit in one batch
+ * out of the pending responses, which can belong to different requests, and
+ * hands them to the kernel with a single sendmmsg(). With -o udp_gso the
+ * packets of a large response are sent as one UDP_SEGMENT message instead.
+ * Does not use TLS.
+ *
+ * Returns:
+ *   TRANSMIT_COMPLETE   All done writing.
+ *   TRANSMIT_INCOMPLETE More data remaining to write.
+ *   TRANSMIT_SOFT_ERROR Can't write any more right now.
+ *   TRANSMIT_HARD_ERROR Can't write (c->state is set to conn_closing)
+ */
+static enum transmit_result transmit_udp(conn *c) {
+    assert(c != NULL);
+    struct iovec riovs[IOV_MAX]; // what's left of the current response
+    struct iovec iovs[IOV_MAX];  // packets: a header, then a slice of riovs
+    struct mmsghdr msgs[UDP_BATCH];
+    unsigned char hdrs[UDP_BATCH * UDP_GSO_SEGS][UDP_HEADER_SIZE];
+    struct {
+        mc_resp *resp;
+        uint16_t sequence; // resp->udp_sequence before this message
+        int len;           // response bytes in this message
+        int packets;
+    } sent[UDP_BATCH];
+#ifdef USE_UDP_GSO
+    char ctrl[UDP_BATCH][CMSG_SPACE(sizeof(uint16_t))];
+    bool gso = settings.udp_gso && !c->thread->udp_gso_failed;
+#endif
+    mc_resp *resp = c->resp_head;
+    int nmsg = 0;
+    int npkt = 0;
+    int iovused = 0;
+    bool full = false;
+    int x;
+
+    while (resp && !full && nmsg < UDP_BATCH) {
+        int rcnt;
+        int r = 0;
+        int left = resp->tosend;
+
+        // Empty responses don't get a packet; the post function will
+        // clear them out along with the skipped ones.
+        if (resp->skip || left == 0) {
+            resp = resp->next;
+            continue;
+        }
+
+        rcnt = _transmit_resp_iovs(resp, riovs, 0);
+        while (left > 0 && nmsg < UDP_BATCH) {
+            struct msghdr *msg = &msgs[nmsg].msg_hdr;
+            int segs = 0;
+            int len = 0;
+
+            memset(msg, 0, sizeof(*msg));
+            msg->msg_iov = &iovs[iovused];
+            // the UDP source to return to.
+            msg->msg_name = &resp->request_addr;
+            msg->msg_namelen = resp->request_addr_size;
+            sent[nmsg].resp = resp;
+            sent[nmsg].sequence = resp->udp_sequence;
+
+            while (left > 0) {
+                int want = left < UDP_DATA_SIZE ? left : UDP_DATA_SIZE;
+                int got = 0;
+                // leave room for the header.
+                int n = iovused + 1;
+
+                while (got < want && r < rcnt && n < IOV_MAX) {
+                    struct iovec *v = &riovs[r];
+                    size_t take = want - got;
+                    if (v->iov_len == 0) {
+                        r++;
+                        continue;
+                    }
+                    if (take > v->iov_len)
+                        take = v->iov_len;
+                    iovs[n].iov_base = v->iov_base;
+                    iovs[n].iov_len = take;
+                    n++;
+                    got += take;
+                    v->iov_base = (char *)v->iov_base + take;
+                    v->iov_len -= take;
+                }
+
+                if (got < want) {
+                    // Ran out of iovecs. Packets can't be short, so the rest
+                    // of this one goes out next time.
+                    full = true;
+                    break;
+                }
+
+                iovs[iovused].iov_base = hdrs[npkt];
+                iovs[iovused].iov_len = UDP_HEADER_SIZE;
+                build_udp_header(hdrs[npkt], resp);
+                msg->msg_iovlen += n - iovused;
+                iovused = n;
+                npkt++;
+                segs++;
+                len += got;
+                left -= got;
+#ifdef USE_UDP_GSO
+                // All but the last segment of a GSO send must be full sized.
+                if (gso && got == UDP_DATA_SIZE && segs < UDP_GSO_SEGS)
+                    continue;
+#endif
+                break;
+            }
+
+            if (segs == 0)
+                break;
+#ifdef USE_UDP_GSO
+            if (segs > 1) {
+                struct cmsghdr *cm;
+                msg->msg_control = ctrl[nmsg];
+                msg->msg_controllen = sizeof(ctrl[nmsg]);
+                cm = CMSG_FIRSTHDR(msg);
+                cm->cmsg_level = SOL_UDP;
+                cm->cmsg_type = UDP_SEGMENT;
+                cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                *((uint16_t *)CMSG_DATA(cm)) = UDP_MAX_PAYLOAD_SIZE;
+            }
+#endif
+            sent[nmsg].len = len;
+            sent[nmsg].packets = segs;
+            nmsg++;
+            if (full)
+                break;
+        }
+
+        resp = resp->next;
+    }
+
+    if (nmsg == 0) {
+        // Only skipped or empty responses.
+        _transmit_post(c, 0);
+        return c->resp_head ? TRANSMIT_INCOMPLETE : TRANSMIT_COMPLETE;
+    }
+
+    // NOTE: uses system sendmmsg since we have no support for indirect UDP.
+    int res = sendmmsg(c->sfd, msgs, nmsg, 0);
+
+    // Messages that didn't go out get their headers rebuilt next time.
+    for (x = nmsg - 1; x >= (res > 0 ? res : 0); x--) {
+        sent[x].resp->udp_sequence = sent[x].sequence;
+    }
+
+    if (res > 0) {
+        uint64_t bytes = 0;
+        uint64_t packets = 0;
+        ssize_t done = 0;
+        for (x = 0; x < res; x++) {
+            bytes += msgs[x].msg_len;
+            packets += sent[x].packets;
+            done += sent[x].len;
+        }
+        pthread_mutex_lock(&c->thread->stats.mutex);
+        c->thread->stats.bytes_written += bytes;
+        c->thread->stats.udp_send_calls++;
+        c->thread->stats.udp_send_packets += packets;
+        pthread_mutex_unlock(&c->thread->stats.mutex);
+
+        // Decrement any partial IOV's and complete any finished resp's.
+        _transmit_post(c, done);
+
+        if (c->resp_head) {
+            return TRANSMIT_INCOMPLETE;
+        } else {
+            return TRANSMIT_COMPLETE;
+        }
+    }
+
+    if (res == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        if (!update_event(c, EV_WRITE | EV_PERSIST)) {
+            if (settings.verbose > 0)
+                fprintf(stderr, "Couldn't update event\n");
+            conn_set_state(c, conn_closing);
+            return TRANSMIT_HARD_ERROR;
+        }
+        return TRANSMIT_SOFT_ERROR;
+    }
+#ifdef USE_UDP_GSO
+    // Kernels or devices that can't segment for us fail the whole send.
+    if (gso && (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT
+                || errno == EOPNOTSUPP)) {
+        if (settings.verbose > 0)
+            perror("UDP GSO send failed, disabling udp_gso on this worker");
+        // settings are shared with the other workers: only stop here.
+        c->thread->udp_gso_failed = true;
+        return TRANSMIT_INCOMPLETE;
+    }
+#endif
+    /* if res == -1 and error is not EAGAIN or EWOULDBLOCK,
+       we have a real error, on which we close the connection */
+    if (settings.verbose > 0)
+        perror("Failed to write, and not due to blocking");
+
+    conn_set_state(c, conn_read);
+    return TRANSMIT_HARD_ERROR;
+}
+#else
 /*
  * UDP specific transmit function. Uses its own function rather than check
- * IS_UDP() five times. If we ever implement sendmmsg or similar support they
- * will diverge even more.
+ * IS_UDP() five times. Sends one packet per call.
  * Does not use TLS.
  *
  * Returns:
@@ -2880,7 +4872,6 @@ static enum transmit_result transmit_udp(conn *c) {
     iovused = _transmit_pre(c, iovs, iovused, TRANSMIT_ONE_RESP);
 
     // Clip the IOV's to the max UDP packet size.
-    // If we add support for send_mmsg, this can be where we split msg's.
     {
         int x = 0;
         int len = 0;
@@ -2903,6 +4894,8 @@ static enum transmit_result transmit_udp(conn *c) {
     if (res >= 0) {
         pthread_mutex_lock(&c->thread->stats.mutex);
         c->thread->stats.bytes_written += res;
+        c->thread->stats.udp_send_calls++;
+        c->thread->stats.udp_send_packets++;
         pthread_mutex_unlock(&c->thread->stats.mutex);
 
         // Ignore the header size from forwarding the IOV's
@@ -2935,6 +4928,7 @@ static enum transmit_result transmit_udp(conn *c) {
     conn_set_state(c, conn_read);
     return TRANSMIT_HARD_ERROR;
 }
+#endif
 
 
 /* Does a looped read to fill data chunks */
@@ -3026,6 +5020,7 @@ static void drive_machine(conn *c) {
     socklen_t addrlen;
     struct sockaddr_storage addr;
     int nreqs = settings.reqs_per_event;
+    bool served = false;
     int res;
     const char *str;
 #ifdef HAVE_ACCEPT4
@@ -3034,6 +5029,14 @@ static void drive_machine(conn *c) {
     static int  use_accept4 = 0;
 #endif
 
+#ifdef USE_URING
+    // sends complete asynchronously and call back in here, so a turn of
+    // reqs_per_event requests carries over until the connection yields.
+    if (c->ur_active) {
+        nreqs = c->ur_nreqs;
+    }
+#endif
+
     assert(c != NULL);
 
     while (!stop) {
@@ -3138,8 +5141,14 @@ static void drive_machine(conn *c) {
                 ssl_v = (void*) ssl;
 #endif
 
-                dispatch_conn_new(sfd, conn_new_cmd, EV_READ | EV_PERSIST,
-                                     READ_BUFFER_CACHED, c->transport, ssl_v, c->tag, c->protocol);
+                if (c->thread != NULL) {
+                    // per-worker listener: the connection stays here.
+                    dispatch_conn_local(c->thread, sfd, conn_new_cmd, EV_READ | EV_PERSIST,
+                                        READ_BUFFER_CACHED, c->transport, ssl_v, c->tag, c->protocol);
+                } else {
+                    dispatch_conn_new(sfd, conn_new_cmd, EV_READ | EV_PERSIST,
+                                      READ_BUFFER_CACHED, c->transport, ssl_v, c->tag, c->protocol);
+                }
             }
 
             stop = true;
@@ -3147,6 +5156,24 @@ static void drive_machine(conn *c) {
 
         case conn_waiting:
             rbuf_release(c);
+            if (udp_batch_pending(c)) {
+                // datagrams from the last read are still waiting.
+                conn_set_state(c, conn_read);
+                break;
+            }
+            if (shm_requests_pending(c)) {
+                // the client queued more while we were busy.
+                conn_set_state(c, conn_read);
+                break;
+            }
+            if (c->thread->migrate_to >= 0 && conn_can_migrate(c)) {
+                int tid = c->thread->migrate_to;
+                c->thread->migrate_to = -1;
+                if (migrate_conn(c, tid)) {
+                    stop = true;
+                    break;
+                }
+            }
             if (!update_event(c, EV_READ | EV_PERSIST)) {
                 if (settings.verbose > 0)
                     fprintf(stderr, "Couldn't update event\n");
@@ -3155,6 +5182,8 @@ static void drive_machine(conn *c) {
             }
 
             conn_set_state(c, conn_read);
+            // out of input; the next request starts a new turn.
+            nreqs = settings.reqs_per_event;
             stop = true;
             break;
 
@@ -3174,7 +5203,12 @@ static void drive_machine(conn *c) {
 
             switch (res) {
             case READ_NO_DATA_RECEIVED:
-                conn_set_state(c, conn_waiting);
+                if (c->resp_head) {
+                    // rest of a UDP batch was dropped, flush what we have.
+                    conn_set_state(c, conn_mwrite);
+                } else {
+                    conn_set_state(c, conn_waiting);
+                }
                 break;
             case READ_DATA_RECEIVED:
                 conn_set_state(c, conn_parse_cmd);
@@ -3198,6 +5232,9 @@ static void drive_machine(conn *c) {
                 } else {
                     conn_set_state(c, conn_waiting);
                 }
+            } else if (settings.qos_classes) {
+                conn_qos_charge(c);
+                served = true;
             }
 
             break;
@@ -3207,6 +5244,11 @@ static void drive_machine(conn *c) {
                connections */
 
             --nreqs;
+            if (nreqs >= 0 && served && settings.qos_classes
+                    && !conn_qos_admit(c)) {
+                // the rest of the class gets a turn first.
+                nreqs = -1;
+            }
             if (nreqs >= 0) {
                 reset_cmd_handler(c);
             } else if (c->resp_head) {
@@ -3216,7 +5258,11 @@ static void drive_machine(conn *c) {
                 pthread_mutex_lock(&c->thread->stats.mutex);
                 c->thread->stats.conn_yields++;
                 pthread_mutex_unlock(&c->thread->stats.mutex);
-                if (c->rbytes > 0) {
+                if (c->rbytes > 0 || udp_batch_pending(c)
+                        || shm_requests_pending(c)) {
+                    if (settings.qos_classes || settings.shed_target) {
+                        conn_mark_ready(c);
+                    }
                     /* We have already read in data into the input buffer,
                        so libevent will most likely not signal read events
                        on the socket (unless more data is available. As a
@@ -3230,6 +5276,13 @@ static void drive_machine(conn *c) {
                         break;
                     }
                 }
+#ifdef USE_URING
+                if (c->ur_active && conn_uring_readable(c)) {
+                    // received while we were busy; nothing else will wake us.
+                    conn_uring_runq_add(c);
+                }
+#endif
+                nreqs = settings.reqs_per_event;
                 stop = true;
             }
             break;
@@ -3418,10 +5471,14 @@ static void drive_machine(conn *c) {
             break;
 
         case conn_closing:
-            if (IS_UDP(c->transport))
+            if (IS_UDP(c->transport)) {
                 conn_cleanup(c);
-            else
+                // other datagrams in the batch are unrelated requests.
+                if (udp_batch_pending(c))
+                    break;
+            } else {
                 conn_close(c);
+            }
             stop = true;
             break;
 
@@ -3454,6 +5511,11 @@ static void drive_machine(conn *c) {
         }
     }
 
+#ifdef USE_URING
+    if (c->ur_active) {
+        c->ur_nreqs = nreqs;
+    }
+#endif
     return;
 }
 
@@ -3464,6 +5526,9 @@ void event_handler(const evutil_socket_t fd, const short which, void *arg) {
     assert(c != NULL);
 
     c->which = which;
+    if (c->thread) {
+        c->thread->busy_poll_events++;
+    }
 
     /* sanity */
     if (fd != c->sfd) {
@@ -3473,7 +5538,22 @@ void event_handler(const evutil_socket_t fd, const short which, void *arg) {
         return;
     }
 
+#ifdef USE_ZEROCOPY
+    if (c->zc_acked != c->zc_next) {
+        conn_zc_reap(c);
+    }
+#endif
+
+    LIBEVENT_THREAD *t = c->thread;
+    if ((settings.qos_classes || settings.shed_target) && t
+            && (c->state == conn_read || c->state == conn_new_cmd)) {
+        conn_queue_start(c);
+    }
+
     drive_machine(c);
+    if (t) {
+        t->shed_now = false;
+    }
 
     /* wait for next event */
     return;
@@ -3517,23 +5597,155 @@ static void maximize_sndbuf(const int sfd) {
         return;
     }
 
-    /* Binary-search for the real maximum. */
-    min = old_size;
-    max = MAX_SENDBUF_SIZE;
+    /* Binary-search for the real maximum. */
+    min = old_size;
+    max = MAX_SENDBUF_SIZE;
+
+    while (min <= max) {
+        avg = ((unsigned int)(min + max)) / 2;
+        if (setsockopt(sfd, SOL_SOCKET, SO_SNDBUF, (void *)&avg, intsize) == 0) {
+            last_good = avg;
+            min = avg + 1;
+        } else {
+            max = avg - 1;
+        }
+    }
+
+    if (settings.verbose > 1)
+        fprintf(stderr, "<%d send buffer was %d, now %d\n", sfd, old_size, last_good);
+}
+
+/*
+ * Options set on TCP listening sockets. Accepted connections inherit them.
+ */
+static void tcp_listen_sockopts(int sfd) {
+    struct linger ling = {0, 0};
+    int flags = 1;
+    int error;
+
+    error = setsockopt(sfd, SOL_SOCKET, SO_KEEPALIVE, (void *)&flags, sizeof(flags));
+    if (error != 0)
+        perror("setsockopt");
+
+    error = setsockopt(sfd, SOL_SOCKET, SO_LINGER, (void *)&ling, sizeof(ling));
+    if (error != 0)
+        perror("setsockopt");
+
+    error = setsockopt(sfd, IPPROTO_TCP, TCP_NODELAY, (void *)&flags, sizeof(flags));
+    if (error != 0)
+        perror("setsockopt");
+
+#ifdef USE_ZEROCOPY
+    if (settings.zerocopy_min_bytes) {
+        error = setsockopt(sfd, SOL_SOCKET, SO_ZEROCOPY, (void *)&flags, sizeof(flags));
+        if (error != 0) {
+            perror("setsockopt(SO_ZEROCOPY), zerocopy sends disabled");
+            settings.zerocopy_min_bytes = 0;
+        }
+    }
+#endif
+
+#ifdef SO_BUSY_POLL
+    // accepted sockets inherit this. Lets the kernel poll the NIC queue for
+    // reads and epoll instead of waiting for an interrupt.
+    if (settings.busy_poll) {
+        int usecs = settings.busy_poll;
+        error = setsockopt(sfd, SOL_SOCKET, SO_BUSY_POLL, (void *)&usecs, sizeof(usecs));
+        if (error != 0)
+            perror("setsockopt(SO_BUSY_POLL)");
+    }
+#endif
+}
+
+#ifdef SO_REUSEPORT
+/*
+ * With -o worker_listeners each worker thread gets its own SO_REUSEPORT
+ * listening socket for every TCP address, and accepts its own connections
+ * instead of having the main thread accept and hand them over. The kernel
+ * spreads new connections over the sockets in the group.
+ *
+ * sfd is the already listening socket for the first worker.
+ */
+static int worker_listen_sockets(int sfd, struct addrinfo *ai,
+        enum network_transport transport, bool ssl_enabled,
+        uint64_t conntag, enum protocol bproto) {
+    struct sockaddr_storage addr;
+    socklen_t addrlen = sizeof(addr);
+    int flags = 1;
+
+    // the first socket may have been given an ephemeral port.
+    if (getsockname(sfd, (struct sockaddr *)&addr, &addrlen) != 0) {
+        perror("getsockname()");
+        return 1;
+    }
+
+    for (int tid = 0; tid < settings.num_threads; tid++) {
+        int lfd = sfd;
+        if (tid != 0) {
+            if ((lfd = new_socket(ai)) == -1) {
+                perror("socket()");
+                return 1;
+            }
+#ifdef IPV6_V6ONLY
+            if (ai->ai_family == AF_INET6) {
+                setsockopt(lfd, IPPROTO_IPV6, IPV6_V6ONLY, (char *) &flags, sizeof(flags));
+            }
+#endif
+#ifdef SOCK_COOKIE_ID
+            if (settings.sock_cookie_id != 0) {
+                if (setsockopt(lfd, SOL_SOCKET, SOCK_COOKIE_ID, (void *)&settings.sock_cookie_id, sizeof(uint32_t)) != 0)
+                    perror("setsockopt");
+            }
+#endif
+            setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, (void *)&flags, sizeof(flags));
+            setsockopt(lfd, SOL_SOCKET, SO_REUSEPORT, (void *)&flags, sizeof(flags));
+            tcp_listen_sockopts(lfd);
+            if (bind(lfd, (struct sockaddr *)&addr, addrlen) == -1 ||
+                    listen(lfd, settings.backlog) == -1) {
+                perror("worker listener");
+                close(lfd);
+                return 1;
+            }
+        }
 
-    while (min <= max) {
-        avg = ((unsigned int)(min + max)) / 2;
-        if (setsockopt(sfd, SOL_SOCKET, SO_SNDBUF, (void *)&avg, intsize) == 0) {
-            last_good = avg;
-            min = avg + 1;
-        } else {
-            max = avg - 1;
+        // sockets join the reuseport group in order, so the group index of
+        // each socket matches the worker id.
+        conn *c = dispatch_listen_conn(tid, lfd, transport, ssl_enabled,
+                conntag, bproto);
+        pthread_mutex_lock(&conn_lock);
+        c->next = listen_conn;
+        listen_conn = c;
+        pthread_mutex_unlock(&conn_lock);
+
+        if (tid != 0) {
+            // count the extra sockets as reserved, so curr_connections
+            // reads the same as with a single listener.
+            STATS_LOCK();
+            stats_state.curr_conns--;
+            stats_state.reserved_fds++;
+            STATS_UNLOCK();
         }
     }
 
-    if (settings.verbose > 1)
-        fprintf(stderr, "<%d send buffer was %d, now %d\n", sfd, old_size, last_good);
+#ifdef SO_ATTACH_REUSEPORT_CBPF
+    if (settings.worker_listeners_cpu) {
+        // pick the socket by the CPU that received the SYN. Combined with
+        // RSS and pinned workers this keeps a connection on one core.
+        struct sock_filter code[] = {
+            { BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU },
+            { BPF_ALU | BPF_MOD | BPF_K, 0, 0, settings.num_threads },
+            { BPF_RET | BPF_A, 0, 0, 0 },
+        };
+        struct sock_fprog prog = { .len = 3, .filter = code };
+        if (setsockopt(sfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) != 0) {
+            perror("setsockopt(SO_ATTACH_REUSEPORT_CBPF)");
+        }
+    }
+#endif
+
+    return 0;
 }
+#endif
 
 /**
  * Create a socket and bind it to a specific port number
@@ -3551,7 +5763,6 @@ static int server_socket(const char *interface,
                          uint64_t conntag,
                          enum protocol bproto) {
     int sfd;
-    struct linger ling = {0, 0};
     struct addrinfo *ai;
     struct addrinfo *next;
     struct addrinfo hints = { .ai_flags = AI_PASSIVE,
@@ -3621,18 +5832,30 @@ static int server_socket(const char *interface,
         setsockopt(sfd, SOL_SOCKET, SO_REUSEADDR, (void *)&flags, sizeof(flags));
         if (IS_UDP(transport)) {
             maximize_sndbuf(sfd);
+#ifdef USE_UDP_GSO
+            if (settings.udp_gso) {
+                // check the kernel knows about it. The segment size is set
+                // per send.
+                int zero = 0;
+                error = setsockopt(sfd, SOL_UDP, UDP_SEGMENT, (void *)&zero, sizeof(zero));
+                if (error != 0) {
+                    perror("setsockopt(UDP_SEGMENT), udp_gso disabled");
+                    settings.udp_gso = false;
+                }
+            }
+#endif
         } else {
-            error = setsockopt(sfd, SOL_SOCKET, SO_KEEPALIVE, (void *)&flags, sizeof(flags));
-            if (error != 0)
-                perror("setsockopt");
-
-            error = setsockopt(sfd, SOL_SOCKET, SO_LINGER, (void *)&ling, sizeof(ling));
-            if (error != 0)
-                perror("setsockopt");
-
-            error = setsockopt(sfd, IPPROTO_TCP, TCP_NODELAY, (void *)&flags, sizeof(flags));
-            if (error != 0)
-                perror("setsockopt");
+            tcp_listen_sockopts(sfd);
+#ifdef SO_REUSEPORT
+            if (settings.worker_listeners) {
+                error = setsockopt(sfd, SOL_SOCKET, SO_REUSEPORT, (void *)&flags, sizeof(flags));
+                if (error != 0) {
+                    perror("setsockopt(SO_REUSEPORT)");
+                    close(sfd);
+                    continue;
+                }
+            }
+#endif
         }
 
         if (bind(sfd, next->ai_addr, next->ai_addrlen) == -1) {
@@ -3700,6 +5923,14 @@ static int server_socket(const char *interface,
                                   EV_READ | EV_PERSIST,
                                   UDP_READ_BUFFER_SIZE, transport, NULL, conntag, bproto);
             }
+#ifdef SO_REUSEPORT
+        } else if (settings.worker_listeners) {
+            if (worker_listen_sockets(sfd, next, transport, ssl_enabled,
+                        conntag, bproto) != 0) {
+                freeaddrinfo(ai);
+                return 1;
+            }
+#endif
         } else {
             if (!(listen_conn_add = conn_new(sfd, conn_listening,
                                              EV_READ | EV_PERSIST, 1,
@@ -4020,6 +6251,10 @@ static void clock_handler(const evutil_socket_t fd, const short which, void *arg
 #endif
     }
 
+#ifdef USE_CONN_MIGRATION
+    threads_cpu_check();
+#endif
+
     evtimer_set(&clockevent, clock_handler, 0);
     event_base_set(main_base, &clockevent);
     evtimer_add(&clockevent, &t);
@@ -4153,6 +6388,9 @@ static void usage(void) {
            "                          do not adjust unless you have high (20k+) conn. limits.\n"
            "                          0 means unlimited (default: %u)\n",
            settings.read_buf_mem_limit);
+    printf("   - snapshot_dir:        directory for \"lru_crawler snapshot\" files.\n"
+           "                          snapshots are disabled if unset (default)\n"
+           "   - snapshot_load:       snapshot file to load before accepting connections.\n");
     verify_default("read_buf_mem_limit", settings.read_buf_mem_limit == 0);
     printf("   - no_lru_maintainer:   disable new LRU system + background thread.\n"
            "   - hot_lru_pct:         pct of slab memory to reserve for hot lru.\n"
@@ -4195,6 +6433,79 @@ static void usage(void) {
 #ifdef SOCK_COOKIE_ID
     printf("   - sock_cookie_id:      attributes an ID to a socket for ip filtering/firewalls \n");
 #endif
+#ifdef USE_URING
+    printf("   - worker_uring:        use io_uring for worker client connections.\n"
+           "                          UDP and TLS connections still use libevent.\n"
+           "                          Can't be combined with qos_weights,\n"
+           "                          shed_target, migrate_threshold or\n"
+           "                          zerocopy_min_bytes.\n"
+           "                          EXPERIMENTAL (default: %s)\n",
+           flag_enabled_disabled(settings.worker_uring));
+#endif
+#ifdef USE_ZEROCOPY
+    printf("   - zerocopy_min_bytes:  send TCP responses of at least this many bytes\n"
+           "                          with MSG_ZEROCOPY. 0 to disable. (default: %u)\n",
+           settings.zerocopy_min_bytes);
+#endif
+    printf("   - busy_poll:           microseconds worker threads keep polling for\n"
+           "                          work before blocking. Also sets SO_BUSY_POLL on\n"
+           "                          TCP sockets. Burns CPU. 0 to disable. (default: %u)\n",
+           settings.busy_poll);
+    printf("   - qos_weights:         share request processing on each worker between\n"
+           "                          listener tags, by requests per event loop round.\n"
+           "                          ie: qos_weights=online:100-batch:5. \"default\"\n"
+           "                          covers all other connections (default: no limit)\n");
+    printf("   - shed_target:         microseconds of worker queueing delay before\n"
+           "                          answering requests with SERVER_ERROR busy.\n"
+           "                          0 to disable. (default: %u)\n"
+           "   - shed_interval:       microseconds the delay must stay over target\n"
+           "                          before shedding starts. (default: %u)\n"
+           "   - shed_tags:           only shed connections from listeners with these\n"
+           "                          tags. ie: shed_tags=batch-bulk (default: all)\n",
+           settings.shed_target, settings.shed_interval);
+#ifdef USE_CONN_MIGRATION
+    printf("   - migrate_threshold:   move connections off a worker thread using this\n"
+           "                          many percent more CPU than the idlest one.\n"
+           "                          0 to disable. (default: %u)\n"
+           "   - migrate_interval:    seconds the imbalance must last before a\n"
+           "                          connection is moved. (default: %u)\n",
+           settings.migrate_threshold, settings.migrate_interval);
+#endif
+#ifdef USE_SHM
+    printf("   - shm_ring_kb:         let unix socket clients switch to shared memory\n"
+           "                          rings of this many kilobytes each way with the\n"
+           "                          \"shm\" command. 0 to disable, at most 16384.\n"
+           "                          (default: %u)\n"
+           "   - shm_max_conns:       connections using shared memory rings at once.\n"
+           "                          (default: %u)\n",
+           settings.shm_ring_kb, settings.shm_max_conns);
+#endif
+#ifdef USE_UDP_GSO
+    printf("   - udp_gso:             send UDP responses larger than one packet with\n"
+           "                          UDP_SEGMENT, letting the kernel split them.\n"
+           "                          (default: %s)\n",
+           flag_enabled_disabled(settings.udp_gso));
+#endif
+    printf("   - native_counters:     incr/decr turn numeric values into counters that\n"
+           "                          are updated in place and never reallocated.\n"
+           "                          Counters can't be appended to. (default: %s)\n",
+           flag_enabled_disabled(settings.native_counters));
+    printf("   - hotkey_sample:       track one in this many key lookups per worker\n"
+           "                          for \"stats hotkeys\". 0 to disable. (default: %u)\n"
+           "   - hotkey_slots:        keys each worker tracks. (default: %u)\n",
+           settings.hotkey_sample, settings.hotkey_slots);
+    printf("   - hot_cache_items:     items each worker caches to serve hot keys to\n"
+           "                          plain gets without locking. 0 to disable.\n"
+           "                          (default: %u)\n"
+           "   - hot_cache_hits:      hits per second for a worker to cache an item.\n"
+           "                          (default: %u)\n",
+           settings.hot_cache_items, settings.hot_cache_hits);
+#ifdef SO_REUSEPORT
+    printf("   - worker_listeners:    each worker thread accepts TCP connections on\n"
+           "                          its own SO_REUSEPORT socket. \"=cpu\" steers\n"
+           "                          connections by receiving CPU (default: %s)\n",
+           flag_enabled_disabled(settings.worker_listeners));
+#endif
 #ifdef EXTSTORE
     printf("\n   - External storage (ext_*) related options (see: https://memcached.org/extstore)\n");
     printf("   - ext_path:            file to write to for external storage.\n"
@@ -4468,6 +6779,92 @@ static bool sanitycheck(void) {
     return true;
 }
 
+// "tag:weight-tag:weight-..." where the tag "default" sets class 0.
+static bool _parse_qos_weights(char *s) {
+    char *b = NULL;
+    struct qos_class *qc;
+
+    memset(settings.qos, 0, sizeof(settings.qos));
+    strcpy(settings.qos[0].name, "default");
+    settings.qos_classes = 1;
+
+    for (char *p = strtok_r(s, "-", &b);
+         p != NULL;
+         p = strtok_r(NULL, "-", &b)) {
+        char *w = strchr(p, ':');
+        int32_t weight = 0;
+        size_t len;
+
+        if (w == NULL || !safe_strtol(w + 1, &weight) || weight < 0) {
+            fprintf(stderr, "qos_weights entries must be tag:weight: \"%s\"\n", p);
+            return false;
+        }
+        len = w - p;
+        if (len > 8 || len < 1) {
+            fprintf(stderr, "Listener tags must be between 1 and 8 characters: \"%s\"\n", p);
+            return false;
+        }
+        *w = '\0';
+
+        if (strcmp(p, "default") == 0) {
+            qc = &settings.qos[0];
+        } else {
+            uint64_t tag = 0;
+            memcpy(&tag, p, len);
+            for (int i = 1; i < settings.qos_classes; i++) {
+                if (settings.qos[i].tag == tag) {
+                    fprintf(stderr, "Duplicate tag in qos_weights: \"%s\"\n", p);
+                    return false;
+                }
+            }
+            if (settings.qos_classes >= QOS_MAX_CLASSES) {
+                fprintf(stderr, "Too many qos_weights classes, at most %d\n",
+                        QOS_MAX_CLASSES - 1);
+                return false;
+            }
+            qc = &settings.qos[settings.qos_classes++];
+            memcpy(qc->name, p, len);
+            qc->tag = tag;
+        }
+        qc->weight = weight;
+    }
+
+    return true;
+}
+
+// "tag-tag-..."
+static bool _parse_shed_tags(char *s) {
+    char *b = NULL;
+
+    settings.shed_tag_count = 0;
+    free(settings.shed_tag_names);
+    settings.shed_tag_names = strdup(s);
+
+    for (char *p = strtok_r(s, "-", &b);
+         p != NULL;
+         p = strtok_r(NULL, "-", &b)) {
+        size_t len = strlen(p);
+        uint64_t tag = 0;
+
+        if (len > 8 || len < 1) {
+            fprintf(stderr, "Listener tags must be between 1 and 8 characters: \"%s\"\n", p);
+            return false;
+        }
+        if (settings.shed_tag_count >= QOS_MAX_CLASSES) {
+            fprintf(stderr, "Too many shed_tags, at most %d\n", QOS_MAX_CLASSES);
+            return false;
+        }
+        memcpy(&tag, p, len);
+        settings.shed_tags[settings.shed_tag_count++] = tag;
+    }
+
+    if (settings.shed_tag_count == 0) {
+        fprintf(stderr, "Missing shed_tags argument\n");
+        return false;
+    }
+    return true;
+}
+
 static bool _parse_slab_sizes(char *s, uint32_t *slab_sizes) {
     char *b = NULL;
     uint32_t size = 0;
@@ -4857,6 +7254,8 @@ int main (int argc, char **argv) {
         DROP_PRIVILEGES,
         RESP_OBJ_MEM_LIMIT,
         READ_BUF_MEM_LIMIT,
+        SNAPSHOT_DIR,
+        SNAPSHOT_LOAD,
 #ifdef TLS
         SSL_CERT,
         SSL_KEY,
@@ -4881,6 +7280,36 @@ int main (int argc, char **argv) {
 #ifdef SOCK_COOKIE_ID
         COOKIE_ID,
 #endif
+#ifdef USE_URING
+        WORKER_URING,
+#endif
+#ifdef SO_REUSEPORT
+        WORKER_LISTENERS,
+#endif
+#ifdef USE_ZEROCOPY
+        ZEROCOPY_MIN_BYTES,
+#endif
+        BUSY_POLL,
+        QOS_WEIGHTS,
+        SHED_TARGET,
+        SHED_INTERVAL,
+        SHED_TAGS,
+#ifdef USE_CONN_MIGRATION
+        MIGRATE_THRESHOLD,
+        MIGRATE_INTERVAL,
+#endif
+#ifdef USE_SHM
+        SHM_RING_KB,
+        SHM_MAX_CONNS,
+#endif
+#ifdef USE_UDP_GSO
+        UDP_GSO,
+#endif
+        NATIVE_COUNTERS,
+        HOTKEY_SAMPLE,
+        HOTKEY_SLOTS,
+        HOT_CACHE_ITEMS,
+        HOT_CACHE_HITS,
     };
     char *const subopts_tokens[] = {
         [MAXCONNS_FAST] = "maxconns_fast",
@@ -4921,6 +7350,8 @@ int main (int argc, char **argv) {
         [DROP_PRIVILEGES] = "drop_privileges",
         [RESP_OBJ_MEM_LIMIT] = "resp_obj_mem_limit",
         [READ_BUF_MEM_LIMIT] = "read_buf_mem_limit",
+        [SNAPSHOT_DIR] = "snapshot_dir",
+        [SNAPSHOT_LOAD] = "snapshot_load",
 #ifdef TLS
         [SSL_CERT] = "ssl_chain_cert",
         [SSL_KEY] = "ssl_key",
@@ -4945,6 +7376,36 @@ int main (int argc, char **argv) {
 #ifdef SOCK_COOKIE_ID
         [COOKIE_ID] = "sock_cookie_id",
 #endif
+#ifdef USE_URING
+        [WORKER_URING] = "worker_uring",
+#endif
+#ifdef SO_REUSEPORT
+        [WORKER_LISTENERS] = "worker_listeners",
+#endif
+#ifdef USE_ZEROCOPY
+        [ZEROCOPY_MIN_BYTES] = "zerocopy_min_bytes",
+#endif
+        [BUSY_POLL] = "busy_poll",
+        [QOS_WEIGHTS] = "qos_weights",
+        [SHED_TARGET] = "shed_target",
+        [SHED_INTERVAL] = "shed_interval",
+        [SHED_TAGS] = "shed_tags",
+#ifdef USE_CONN_MIGRATION
+        [MIGRATE_THRESHOLD] = "migrate_threshold",
+        [MIGRATE_INTERVAL] = "migrate_interval",
+#endif
+#ifdef USE_SHM
+        [SHM_RING_KB] = "shm_ring_kb",
+        [SHM_MAX_CONNS] = "shm_max_conns",
+#endif
+#ifdef USE_UDP_GSO
+        [UDP_GSO] = "udp_gso",
+#endif
+        [NATIVE_COUNTERS] = "native_counters",
+        [HOTKEY_SAMPLE] = "hotkey_sample",
+        [HOTKEY_SLOTS] = "hotkey_slots",
+        [HOT_CACHE_ITEMS] = "hot_cache_items",
+        [HOT_CACHE_HITS] = "hot_cache_hits",
         NULL
     };
 
@@ -5693,6 +8154,20 @@ int main (int argc, char **argv) {
                 }
                 settings.read_buf_mem_limit *= 1024 * 1024; /* megabytes */
                 break;
+            case SNAPSHOT_DIR:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing snapshot_dir argument\n");
+                    return 1;
+                }
+                settings.snapshot_dir = strdup(subopts_value);
+                break;
+            case SNAPSHOT_LOAD:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing snapshot_load argument\n");
+                    return 1;
+                }
+                settings.snapshot_load = strdup(subopts_value);
+                break;
 #ifdef PROXY
             case PROXY_CONFIG:
                 if (subopts_value == NULL) {
@@ -5728,6 +8203,200 @@ int main (int argc, char **argv) {
                 (void)safe_strtoul(subopts_value, &settings.sock_cookie_id);
                 break;
 #endif
+#ifdef USE_URING
+            case WORKER_URING:
+                settings.worker_uring = true;
+                break;
+#endif
+#ifdef SO_REUSEPORT
+            case WORKER_LISTENERS:
+                settings.worker_listeners = true;
+                if (subopts_value == NULL) {
+                    break;
+                }
+                if (strcmp(subopts_value, "cpu") != 0) {
+                    fprintf(stderr, "worker_listeners only accepts \"cpu\" as an argument\n");
+                    return 1;
+                }
+#ifdef SO_ATTACH_REUSEPORT_CBPF
+                settings.worker_listeners_cpu = true;
+#else
+                fprintf(stderr, "worker_listeners=cpu is not supported on this platform\n");
+                return 1;
+#endif
+                break;
+#endif
+#ifdef USE_ZEROCOPY
+            case ZEROCOPY_MIN_BYTES:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing zerocopy_min_bytes argument\n");
+                    return 1;
+                }
+                if (!safe_strtoul(subopts_value, &settings.zerocopy_min_bytes)) {
+                    fprintf(stderr, "could not parse argument to zerocopy_min_bytes\n");
+                    return 1;
+                }
+                break;
+#endif
+            case BUSY_POLL:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing busy_poll argument\n");
+                    return 1;
+                }
+                if (!safe_strtoul(subopts_value, &settings.busy_poll)) {
+                    fprintf(stderr, "could not parse argument to busy_poll\n");
+                    return 1;
+                }
+                if (settings.busy_poll > 1000000) {
+                    fprintf(stderr, "busy_poll must be at most 1000000 microseconds\n");
+                    return 1;
+                }
+                break;
+            case QOS_WEIGHTS:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing qos_weights argument\n");
+                    return 1;
+                }
+                if (!_parse_qos_weights(subopts_value)) {
+                    return 1;
+                }
+                break;
+            case SHED_TARGET:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing shed_target argument\n");
+                    return 1;
+                }
+                if (!safe_strtoul(subopts_value, &settings.shed_target)) {
+                    fprintf(stderr, "could not parse argument to shed_target\n");
+                    return 1;
+                }
+                break;
+            case SHED_INTERVAL:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing shed_interval argument\n");
+                    return 1;
+                }
+                if (!safe_strtoul(subopts_value, &settings.shed_interval)
+                        || settings.shed_interval == 0) {
+                    fprintf(stderr, "could not parse argument to shed_interval\n");
+                    return 1;
+                }
+                break;
+            case SHED_TAGS:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing shed_tags argument\n");
+                    return 1;
+                }
+                if (!_parse_shed_tags(subopts_value)) {
+                    return 1;
+                }
+                break;
+#ifdef USE_CONN_MIGRATION
+            case MIGRATE_THRESHOLD:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing migrate_threshold argument\n");
+                    return 1;
+                }
+                if (!safe_strtoul(subopts_value, &settings.migrate_threshold)
+                        || settings.migrate_threshold > 100) {
+                    fprintf(stderr, "could not parse argument to migrate_threshold\n");
+                    return 1;
+                }
+                break;
+            case MIGRATE_INTERVAL:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing migrate_interval argument\n");
+                    return 1;
+                }
+                if (!safe_strtoul(subopts_value, &settings.migrate_interval)
+                        || settings.migrate_interval == 0) {
+                    fprintf(stderr, "could not parse argument to migrate_interval\n");
+                    return 1;
+                }
+                break;
+#endif
+#ifdef USE_SHM
+            case SHM_RING_KB:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing shm_ring_kb argument\n");
+                    return 1;
+                }
+                if (!safe_strtoul(subopts_value, &settings.shm_ring_kb)
+                        || settings.shm_ring_kb > 16384) {
+                    fprintf(stderr, "could not parse argument to shm_ring_kb\n");
+                    return 1;
+                }
+                // the rings wrap with a mask.
+                if (settings.shm_ring_kb) {
+                    unsigned int kb = 4;
+                    while (kb < settings.shm_ring_kb)
+                        kb <<= 1;
+                    settings.shm_ring_kb = kb;
+                }
+                break;
+            case SHM_MAX_CONNS:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing shm_max_conns argument\n");
+                    return 1;
+                }
+                if (!safe_strtoul(subopts_value, &settings.shm_max_conns)) {
+                    fprintf(stderr, "could not parse argument to shm_max_conns\n");
+                    return 1;
+                }
+                break;
+#endif
+#ifdef USE_UDP_GSO
+            case UDP_GSO:
+                settings.udp_gso = true;
+                break;
+#endif
+            case NATIVE_COUNTERS:
+                settings.native_counters = true;
+                break;
+            case HOTKEY_SAMPLE:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing hotkey_sample argument\n");
+                    return 1;
+                }
+                if (!safe_strtoul(subopts_value, &settings.hotkey_sample)) {
+                    fprintf(stderr, "could not parse argument to hotkey_sample\n");
+                    return 1;
+                }
+                break;
+            case HOTKEY_SLOTS:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing hotkey_slots argument\n");
+                    return 1;
+                }
+                if (!safe_strtoul(subopts_value, &settings.hotkey_slots)
+                        || settings.hotkey_slots == 0
+                        || settings.hotkey_slots > 4096) {
+                    fprintf(stderr, "hotkey_slots must be between 1 and 4096\n");
+                    return 1;
+                }
+                break;
+            case HOT_CACHE_ITEMS:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing hot_cache_items argument\n");
+                    return 1;
+                }
+                if (!safe_strtoul(subopts_value, &settings.hot_cache_items)
+                        || settings.hot_cache_items > 4096) {
+                    fprintf(stderr, "hot_cache_items must be between 0 and 4096\n");
+                    return 1;
+                }
+                break;
+            case HOT_CACHE_HITS:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing hot_cache_hits argument\n");
+                    return 1;
+                }
+                if (!safe_strtoul(subopts_value, &settings.hot_cache_hits)
+                        || settings.hot_cache_hits == 0) {
+                    fprintf(stderr, "hot_cache_hits must be at least 1\n");
+                    return 1;
+                }
+                break;
             default:
 #ifdef EXTSTORE
                 // TODO: differentiating response code.
@@ -5758,6 +8427,54 @@ int main (int argc, char **argv) {
         exit(EX_USAGE);
     }
 
+    if (settings.worker_listeners && settings.num_napi_ids) {
+        fprintf(stderr, "worker_listeners cannot be used with -N, workers accept their own connections\n");
+        exit(EX_USAGE);
+    }
+
+#ifdef USE_CONN_MIGRATION
+    if (settings.migrate_threshold && (settings.busy_poll || settings.num_napi_ids)) {
+        fprintf(stderr, "migrate_threshold cannot be used with busy_poll or -N\n");
+        exit(EX_USAGE);
+    }
+#endif
+
+#ifdef PROXY
+    if (settings.native_counters && settings.proxy_enabled) {
+        fprintf(stderr, "native_counters cannot be used with the proxy\n");
+        exit(EX_USAGE);
+    }
+#endif
+
+#ifdef USE_URING
+    // ring-driven connections don't go through these schedulers.
+    if (settings.worker_uring) {
+        const char *other = NULL;
+        if (settings.qos_classes) {
+            other = "qos_weights";
+        } else if (settings.shed_target) {
+            other = "shed_target";
+#ifdef USE_CONN_MIGRATION
+        } else if (settings.migrate_threshold) {
+            other = "migrate_threshold";
+#endif
+#ifdef USE_ZEROCOPY
+        } else if (settings.zerocopy_min_bytes) {
+            other = "zerocopy_min_bytes";
+#endif
+        }
+        if (other != NULL) {
+            fprintf(stderr, "worker_uring cannot be used with %s\n", other);
+            exit(EX_USAGE);
+        }
+    }
+#endif
+
+    if (settings.worker_listeners && settings.socketpath != NULL) {
+        fprintf(stderr, "worker_listeners only applies to TCP ports and cannot be used with -s\n");
+        exit(EX_USAGE);
+    }
+
     if (settings.item_size_max < ITEM_SIZE_MAX_LOWER_LIMIT) {
         fprintf(stderr, "Item max size cannot be less than 1024 bytes.\n");
         exit(EX_USAGE);
@@ -5841,6 +8558,8 @@ int main (int argc, char **argv) {
         fprintf(stderr, "Failed to initialize hash_algorithm!\n");
         exit(EX_USAGE);
     }
+    // snapshot files are checksummed even without extstore.
+    crc32c_init();
 
     /*
      * Use one workerthread to serve each UDP port if the user specified
@@ -6181,10 +8900,6 @@ int main (int argc, char **argv) {
         exit(EXIT_FAILURE);
     }
 
-    if (settings.idle_timeout && start_conn_timeout_thread() == -1) {
-        exit(EXIT_FAILURE);
-    }
-
     /* initialise clock event */
 #if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
     {
@@ -6207,6 +8922,12 @@ int main (int argc, char **argv) {
 #endif
     clock_handler(0, 0, 0);
 
+    /* warm the cache before accepting connections. if the snapshot can't be
+     * read we carry on with whatever we have. */
+    if (settings.snapshot_load) {
+        snapshot_load(settings.snapshot_load, settings.num_threads);
+    }
+
     /* create unix mode sockets after dropping privileges */
     if (settings.socketpath != NULL) {
         errno = 0;
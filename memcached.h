@@ -13,6 +13,7 @@
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>
 #include <event.h>
 #include <netdb.h>
 #include <pthread.h>
@@ -45,16 +46,34 @@
 # define SOCK_COOKIE_ID SO_RTABLE
 #endif
 
+#if defined(__linux__) && defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY)
+# define USE_ZEROCOPY
+#endif
+
+#if defined(HAVE_RECVMMSG) && defined(HAVE_SENDMMSG)
+# define USE_UDP_MMSG
+# ifdef UDP_SEGMENT
+#  define USE_UDP_GSO
+# endif
+#endif
+
+/* Moving connections between workers goes by their CPU usage. */
+#if defined(HAVE_PTHREAD_GETCPUCLOCKID) && defined(HAVE_CLOCK_GETTIME)
+# define USE_CONN_MIGRATION
+#endif
+
+/* Shared memory rings for local clients are handed over as a memfd. */
+#if defined(HAVE_MEMFD_CREATE)
+# define USE_SHM
+#endif
+
 #include "itoa_ljust.h"
 #include "protocol_binary.h"
 #include "cache.h"
 #include "logger.h"
 #include "queue.h"
 #include "util.h"
-
-#ifdef EXTSTORE
 #include "crc32c.h"
-#endif
 
 #include "sasl_defs.h"
 #ifdef TLS
@@ -76,12 +95,17 @@
 #define INCR_MAX_STORAGE_LEN 24
 
 #define WRITE_BUFFER_SIZE 1024
+/* Finished responses up to this size are copied into the previous response's
+ * write buffer instead of being sent from their own iovecs. */
+#define RESP_COMBINE_MAX 256
 #define READ_BUFFER_SIZE 16384
 #define READ_BUFFER_CACHED 0
 #define UDP_READ_BUFFER_SIZE 65536
 #define UDP_MAX_PAYLOAD_SIZE 1400
 #define UDP_HEADER_SIZE 8
 #define UDP_DATA_SIZE 1392 // UDP_MAX_PAYLOAD_SIZE - UDP_HEADER_SIZE
+#define UDP_BATCH 16 // datagrams per recvmmsg/sendmmsg call
+#define UDP_GSO_SEGS 32 // packets per UDP_SEGMENT send
 #define MAX_SENDBUF_SIZE (256 * 1024 * 1024)
 
 /* Binary protocol stuff */
@@ -145,6 +169,15 @@ typedef uint32_t client_flags_t;
          + (((item)->it_flags & ITEM_CFLAGS) ? sizeof(client_flags_t) : 0) \
          + (((item)->it_flags & ITEM_CAS) ? sizeof(uint64_t) : 0))
 
+/* Counter items hold a uint64_t at the first 8 byte aligned spot of their
+ * data, so it can be read without the item lock. Items start 8 byte aligned,
+ * so the spot doesn't move when the slab mover copies one. */
+#define ITEM_COUNTER_NBYTES (sizeof(uint64_t) * 2 - 1 + 2)
+#define ITEM_counter(item) ((uint64_t *) (((uintptr_t) ITEM_data(item) \
+         + sizeof(uint64_t) - 1) & ~(uintptr_t) (sizeof(uint64_t) - 1)))
+#define ITEM_get_counter(i) __atomic_load_n(ITEM_counter(i), __ATOMIC_RELAXED)
+#define ITEM_set_counter(i,v) __atomic_store_n(ITEM_counter(i), v, __ATOMIC_RELAXED)
+
 #define ITEM_ntotal(item) (sizeof(struct _stritem) + (item)->nkey + 1 \
          + (item)->nbytes \
          + (((item)->it_flags & ITEM_CFLAGS) ? sizeof(client_flags_t) : 0) \
@@ -281,6 +314,7 @@ enum close_reasons {
 #define NREAD_CAS 6
 #define NREAD_APPENDVIV 7 // specific to meta
 #define NREAD_PREPENDVIV 8 // specific to meta
+#define NREAD_OVERWRITE 9 // meta: replace a range of the value in place
 
 #define CAS_ALLOW_STALE true
 #define CAS_NO_STALE false
@@ -345,7 +379,24 @@ struct slab_stats {
     X(response_obj_bytes) \
     X(read_buf_oom) \
     X(store_too_large) \
-    X(store_no_memory)
+    X(store_no_memory) \
+    X(zerocopy_sends) /* sends made with MSG_ZEROCOPY */ \
+    X(zerocopy_copied) /* ... which the kernel copied anyway */ \
+    X(zerocopy_fallbacks) /* large sends made without MSG_ZEROCOPY */ \
+    X(busy_poll_spin_us) /* time spent polling without finding work */ \
+    X(busy_poll_work_us) /* time spent on work found while polling */ \
+    X(busy_poll_sleeps) /* times the budget ran out and a worker blocked */ \
+    X(udp_recv_calls) /* UDP receive syscalls that returned data */ \
+    X(udp_recv_packets) \
+    X(udp_send_calls) /* UDP send syscalls */ \
+    X(udp_send_packets) \
+    X(shed_requests) /* requests answered busy by load shedding */ \
+    X(shed_intervals) /* intervals a worker ended overloaded */ \
+    X(migrated_in) /* connections handed to this worker */ \
+    X(migrated_out) /* connections handed off by this worker */ \
+    X(shm_conns) /* connections switched to shared memory rings */ \
+    X(inplace_appends) /* appends that grew a chunked item without a copy */ \
+    X(hot_cache_hits) /* gets served from the worker's hot item cache */
 
 #ifdef EXTSTORE
 #define EXTSTORE_THREAD_STATS_FIELDS \
@@ -366,6 +417,29 @@ struct slab_stats {
     X(proxy_await_active)
 #endif
 
+/* Stats for each QoS class (-o qos_weights), per thread. */
+#define QOS_STATS_FIELDS \
+    X(requests) \
+    X(yields) /* times a connection waited for the next round */ \
+    X(queued) /* times a ready connection waited to be run */ \
+    X(queue_time_us) /* total time spent waiting */
+
+struct qos_stats {
+#define X(name) uint64_t    name;
+    QOS_STATS_FIELDS
+#undef X
+};
+
+/* Class 0 is the default, for connections from untagged listeners or tags
+ * without a class of their own. */
+#define QOS_MAX_CLASSES 8
+
+struct qos_class {
+    char name[9];
+    uint64_t tag; /* listener tag, as stored in conn->tag */
+    int weight; /* requests per scheduling round, 0 for no limit */
+};
+
 /**
  * Stats stored per-thread.
  */
@@ -382,6 +456,7 @@ struct thread_stats {
 #undef X
     struct slab_stats slab_stats[MAX_NUMBER_OF_SLAB_CLASSES];
     uint64_t lru_hits[POWER_LARGEST];
+    struct qos_stats qos[QOS_MAX_CLASSES];
     uint64_t read_buf_count;
     uint64_t read_buf_bytes;
     uint64_t read_buf_bytes_free;
@@ -404,6 +479,14 @@ struct stats {
     uint64_t      slab_reassign_busy_items; /* valid temporarily unmovable */
     uint64_t      slab_reassign_busy_deletes; /* refcounted items killed */
     uint64_t      lru_crawler_starts; /* Number of item crawlers kicked off */
+    uint64_t      snapshots_written; /* completed snapshot files */
+    uint64_t      snapshot_items; /* items written to snapshot files */
+    uint64_t      snapshot_bytes; /* bytes written to snapshot files */
+    uint64_t      snapshot_errors; /* snapshots which failed */
+    uint64_t      snapshot_loads; /* snapshot files loaded */
+    uint64_t      snapshot_loaded_items; /* items linked from snapshot files */
+    uint64_t      snapshot_load_skipped; /* expired or already present */
+    uint64_t      snapshot_load_errors; /* bad records or failed loads */
     uint64_t      lru_maintainer_juggles; /* number of LRU bg pokes */
     uint64_t      time_in_listen_disabled_us;  /* elapsed time in microseconds while server unable to process new connections */
     uint64_t      log_worker_dropped; /* logs dropped by worker threads */
@@ -435,10 +518,12 @@ struct stats_state {
     uint64_t      curr_bytes;
     uint64_t      curr_conns;
     uint64_t      hash_bytes;       /* size used for hash tables */
+    uint64_t      conn_struct_bytes; /* conn objects and their lazily allocated parts */
     unsigned int  conn_structs;
     unsigned int  reserved_fds;
     unsigned int  hash_power_level; /* Better hope it's not over 9000 */
     unsigned int  log_watchers; /* number of currently active watchers */
+    unsigned int  shm_curr_conns; /* connections using shared memory rings */
     bool          hash_is_expanding; /* If the hash table is being expanded */
     bool          accepting_conns;  /* whether we are currently accepting */
     bool          slab_reassign_running; /* slab reassign in progress */
@@ -495,6 +580,8 @@ struct settings {
     char *hash_algorithm;     /* Hash algorithm in use */
     int lru_crawler_sleep;  /* Microsecond sleep between items */
     uint32_t lru_crawler_tocrawl; /* Number of items to crawl per run */
+    char *snapshot_dir; /* directory for binary item snapshots */
+    char *snapshot_load; /* snapshot file to load at startup */
     int hot_lru_pct; /* percentage of slab space for HOT_LRU */
     int warm_lru_pct; /* percentage of slab space for WARM_LRU */
     double hot_max_factor; /* HOT tail age relative to COLD tail */
@@ -509,6 +596,38 @@ struct settings {
     bool drop_privileges;   /* Whether or not to drop unnecessary process privileges */
     bool watch_enabled; /* allows watch commands to be dropped */
     bool relaxed_privileges;   /* Relax process restrictions when running testapp */
+#ifdef USE_URING
+    bool worker_uring; /* drive client sockets from a per-worker io_uring */
+#endif
+    bool worker_listeners; /* each worker accepts on its own SO_REUSEPORT socket */
+#ifdef USE_ZEROCOPY
+    unsigned int zerocopy_min_bytes; /* send at least this much with MSG_ZEROCOPY */
+#endif
+    bool worker_listeners_cpu; /* steer new connections by receiving CPU */
+    unsigned int busy_poll; /* microseconds workers poll for work before blocking */
+    int qos_classes; /* number of QoS classes, 0 if QoS scheduling is off */
+    struct qos_class qos[QOS_MAX_CLASSES];
+    unsigned int shed_target; /* microseconds of queueing before shedding, 0 if off */
+    unsigned int shed_interval; /* microseconds over which the target must be missed */
+    int shed_tag_count; /* only shed listeners with these tags, if any */
+    uint64_t shed_tags[QOS_MAX_CLASSES];
+    char *shed_tag_names;
+#ifdef USE_CONN_MIGRATION
+    unsigned int migrate_threshold; /* CPU % between workers that moves conns, 0 if off */
+    unsigned int migrate_interval; /* seconds the imbalance must last */
+#endif
+#ifdef USE_SHM
+    unsigned int shm_ring_kb; /* size of each shared memory ring, 0 if off */
+    unsigned int shm_max_conns; /* connections that may use rings at once */
+#endif
+#ifdef USE_UDP_GSO
+    bool udp_gso; /* send multi-packet UDP responses with UDP_SEGMENT */
+#endif
+    bool native_counters; /* incr/decr keep values as counter items */
+    unsigned int hotkey_sample; /* track one in this many key lookups, 0 if off */
+    unsigned int hotkey_slots; /* keys tracked by each worker */
+    unsigned int hot_cache_items; /* per-worker hot item cache size, 0 if off */
+    unsigned int hot_cache_hits; /* hits per second for an item to be cached */
 #ifdef EXTSTORE
     unsigned int ext_io_threadcount; /* number of IO threads to run. */
     unsigned int ext_page_size; /* size in megabytes of storage pages. */
@@ -586,6 +705,8 @@ extern struct settings settings;
 #define ITEM_STALE 2048
 /* if item key was sent in binary */
 #define ITEM_KEY_BINARY 4096
+/* value is a native 64bit integer, rendered as digits on read */
+#define ITEM_COUNTER 8192
 
 /**
  * Structure for storing items within memcached.
@@ -617,7 +738,8 @@ typedef struct _stritem {
 
 // TODO: If we eventually want user loaded modules, we can't use an enum :(
 enum crawler_run_type {
-    CRAWLER_AUTOEXPIRE=0, CRAWLER_EXPIRED, CRAWLER_METADUMP, CRAWLER_MGDUMP
+    CRAWLER_AUTOEXPIRE=0, CRAWLER_EXPIRED, CRAWLER_METADUMP, CRAWLER_MGDUMP,
+    CRAWLER_PREFIXSTATS, CRAWLER_SNAPSHOT
 };
 
 typedef struct {
@@ -742,6 +864,35 @@ typedef struct {
     char   *ssl_wbuf;
 #endif
     int napi_id;                /* napi id associated with this thread */
+    uint64_t busy_poll_events;  /* callbacks run, to tell if polling found work */
+    struct event *idle_timer;   /* runs the idle timeout wheel every second */
+    struct conn **idle_wheel;   /* client conns by the second they're checked */
+    unsigned int idle_slots;
+    rel_time_t idle_time;       /* last second the wheel was run for */
+    int qos_credit[QOS_MAX_CLASSES]; /* requests left in this round by class */
+    uint64_t poll_start;        /* when this event loop round started, usec */
+    uint64_t round_start;       /* when it ran its first connection, 0 if not yet */
+    uint64_t last_round;        /* ... and the same for the round before */
+    uint64_t round_ready;       /* when this round's connections became ready */
+    uint64_t shed_next;         /* end of the current shedding interval, usec */
+    uint32_t shed_min;          /* shortest queueing delay seen in it */
+    bool shed_overloaded;       /* last interval's shortest delay was too long */
+    bool shed_now;              /* the connection being run sheds requests */
+    volatile int migrate_to;    /* worker to hand a connection to, -1 if none */
+    int client_conns;           /* client conns owned by this worker, under stats.mutex */
+    unsigned int cpu_pct;       /* CPU used over the last second */
+    uint64_t cpu_ns;            /* CPU time as of then */
+    struct hotkeys *hotkeys;    /* sampled key lookups, NULL if off */
+    unsigned int hotkeys_countdown; /* lookups until the next sample */
+    int hotkeys_last;           /* slot of the last lookup if sampled, or -1 */
+    struct hot_item *hot_cache; /* hot item cache, NULL if off */
+    struct event *hot_cache_timer; /* drops stale entries every second */
+#ifdef USE_URING
+    void *uring;                /* io_uring state, NULL if not in use */
+#endif
+#ifdef USE_UDP_GSO
+    bool udp_gso_failed;        /* GSO sends failed here, send plain packets */
+#endif
 #ifdef PROXY
     void *proxy_ctx; // proxy global context
     void *L; // lua VM
@@ -777,6 +928,7 @@ typedef struct _mc_resp {
     io_pending_t *io_pending; /* pending IO descriptor for this response */
 
     item *item; /* item associated with this response object, with reference held */
+    struct hot_item *hot; /* set if item is borrowed from the hot item cache */
     struct iovec iov[MC_RESP_IOVCOUNT]; /* built-in iovecs to simplify network code */
     int chunked_total; /* total amount of chunked item data to send. */
     uint8_t iovcnt;
@@ -787,6 +939,10 @@ typedef struct _mc_resp {
      */
     bool skip;
     bool free; // double free detection.
+#ifdef USE_ZEROCOPY
+    bool zc_hold; // memory is in use by zerocopy sends up to zc_id.
+    uint32_t zc_id;
+#endif
 #ifdef PROXY
     bool proxy_res; // we're handling a proxied response buffer.
 #endif
@@ -823,12 +979,41 @@ struct _io_pending_t {
     char data[120];
 };
 
+/* Binary protocol state, allocated on a connection's first binary request. */
+typedef struct {
+    /* This is where the binary header goes */
+    protocol_binary_request_header header;
+    int opaque;
+    int keylen;
+} conn_bin_t;
+
+/* Output of the stats command being built. Freed once it's handed off. */
+typedef struct {
+    char *buffer;
+    size_t size;
+    size_t offset;
+} conn_stats_t;
+
 /**
  * The structure representing a connection into memcached.
+ *
+ * There can be millions of these, mostly idle. State that only some clients
+ * need hangs off a pointer and is allocated on first use, and fields are
+ * ordered to avoid padding.
  */
 struct conn {
     sasl_conn_t *sasl_conn;
     int    sfd;
+    enum conn_states  state;
+    enum bin_substates substate;
+    rel_time_t last_cmd_time;
+    rel_time_t idle_at; /* slot on the idle timeout wheel, 0 if not on it */
+    uint32_t ready_at; /* when it yielded with work left, in microseconds */
+    struct event event;
+    short  ev_flags;
+    short  which;   /** which events were just triggered */
+    short cmd; /* current command being processed */
+    uint32_t set_offset; /* where a range overwrite lands in the value */
     bool sasl_started;
     bool authenticated;
     bool set_stale;
@@ -836,17 +1021,13 @@ struct conn {
     bool close_after_write; /** flush write then move to close connection */
     bool rbuf_malloced; /** read buffer was malloc'ed for ascii mget, needs free() */
     bool item_malloced; /** item for conn_nread state is a temporary malloc */
+    bool   noreply;   /* True if the reply should not be sent. */
+    uint8_t qos_class; /* index into settings.qos */
 #ifdef TLS
+    bool ssl_enabled;
     SSL    *ssl;
     char   *ssl_wbuf;
-    bool ssl_enabled;
 #endif
-    enum conn_states  state;
-    enum bin_substates substate;
-    rel_time_t last_cmd_time;
-    struct event event;
-    short  ev_flags;
-    short  which;   /** which events were just triggered */
 
     char   *rbuf;   /** buffer to read commands into */
     char   *rcurr;  /** but if we parsed some already, this is where we stopped */
@@ -855,9 +1036,13 @@ struct conn {
 
     mc_resp *resp; // tail response.
     mc_resp *resp_head; // first response in current stack.
+    mc_resp *resp_combine; // small responses are being copied into this one.
     char   *ritem;  /** when we read in an item's value, it goes here */
     int    rlbytes;
 
+    /* data for the swallow state */
+    int    sbytes;    /* how many bytes to swallow */
+
     /**
      * item is used to hold an item structure created after reading the command
      * line of set/add/replace commands, but before we finished reading the actual
@@ -866,48 +1051,67 @@ struct conn {
 
     void   *item;     /* for commands set/add/replace  */
 
-    /* data for the swallow state */
-    int    sbytes;    /* how many bytes to swallow */
-
     int io_queues_submitted; /* see notes on io_queue_t */
-    io_queue_t io_queues[IO_QUEUE_COUNT]; /* set of deferred IO queues. */
-#ifdef PROXY
-    void *proxy_rctx; /* pointer to active request context */
-#endif
 #ifdef EXTSTORE
     unsigned int recache_counter;
+#endif
+    io_queue_t *io_queues; /* set of deferred IO queues. */
+#ifdef PROXY
+    void *proxy_rctx; /* pointer to active request context */
 #endif
     enum protocol protocol;   /* which protocol this connection speaks */
     enum network_transport transport; /* what transport is used by this connection */
     enum close_reasons close_reason; /* reason for transition into conn_closing */
 
-    /* data for UDP clients */
-    int    request_id; /* Incoming UDP request ID, if this is a UDP "connection" */
-    struct sockaddr_in6 request_addr; /* udp: Who sent the most recent request */
     socklen_t request_addr_size;
+    struct sockaddr_in6 request_addr; /* Peer, or who sent the most recent UDP request */
+    struct conn_udp *udp; /* UDP request state, for UDP "connections" only */
+    struct conn_shm *shm; /* shared memory rings, for local clients using them */
+    conn_stats_t *stats; /* current stats command */
+    conn_bin_t *bin; /* binary protocol state */
 
-    bool   noreply;   /* True if the reply should not be sent. */
-    /* current stats command */
-    struct {
-        char *buffer;
-        size_t size;
-        size_t offset;
-    } stats;
-
-    /* Binary protocol stuff */
-    /* This is where the binary header goes */
-    protocol_binary_request_header binary_header;
     uint64_t cas; /* the cas to return */
     uint64_t tag; /* listener stocket tag */
-    short cmd; /* current command being processed */
-    int opaque;
-    int keylen;
     conn   *next;     /* Used for generating a list of conn structures */
+    conn   *idle_next; /* idle timeout wheel slot */
+    conn   *idle_prev;
     LIBEVENT_THREAD *thread; /* Pointer to the thread object serving this connection */
     int (*try_read_command)(conn *c); /* pointer for top level input parser */
     ssize_t (*read)(conn  *c, void *buf, size_t count);
     ssize_t (*sendmsg)(conn *c, struct msghdr *msg, int flags);
     ssize_t (*write)(conn *c, void *buf, size_t count);
+#ifdef USE_URING
+    /* io_uring worker state */
+    bool ur_active;   /* socket is driven by the worker's ring */
+    bool ur_armed;    /* multishot receive outstanding */
+    bool ur_sending;  /* sendmsg in flight */
+    bool ur_close;    /* close once the send completes */
+    bool ur_queued;   /* on the worker's run queue */
+    bool ur_rearm;    /* waiting for receive buffers */
+    bool ur_eof;
+    int ur_err;
+    uint32_t ur_gen;  /* tags completions, bumped on close */
+    int ur_nreqs;     /* requests left in this turn, which spans sends */
+    int ur_bhead;     /* queued receive buffers, -1 if none */
+    int ur_btail;
+    unsigned int ur_boff; /* bytes already read from the head buffer */
+    struct msghdr ur_msg;
+    struct iovec *ur_iovs;
+    conn *ur_next;    /* run queue */
+    conn *ur_rnext;   /* rearm queue */
+#endif
+#ifdef USE_ZEROCOPY
+    /* MSG_ZEROCOPY state. Sent responses are held until the kernel reports
+     * it's done with their memory. */
+    bool zc_enabled;  /* large responses use MSG_ZEROCOPY */
+    uint32_t zc_next; /* id of the next zerocopy send */
+    uint32_t zc_acked; /* all sends before this id have completed */
+    uint64_t zc_done; /* completions after zc_acked, as a bitmap */
+    mc_resp *zc_head; /* finished responses waiting on completions */
+    mc_resp *zc_tail;
+    int zc_lingers;   /* timeouts waited while closing */
+    int zc_outq;      /* unsent bytes at the last linger check */
+#endif
 };
 
 /* array of conn structures, indexed by file descriptor */
@@ -949,12 +1153,14 @@ extern void *ext_storage;
  * Functions
  */
 void do_accept_new_conns(const bool do_accept);
+void listen_conn_update(conn *c, const bool do_accept);
 enum delta_result_type do_add_delta(LIBEVENT_THREAD *t, const char *key,
                                     const size_t nkey, const bool incr,
                                     const int64_t delta, char *buf,
                                     uint64_t *cas, const uint32_t hv,
                                     item **it_ret);
 enum store_item_type do_store_item(item *item, int comm, LIBEVENT_THREAD *t, const uint32_t hv, int *nbytes, uint64_t *cas, const uint64_t cas_in, bool cas_stale);
+enum store_item_type do_store_item_range(item *item, LIBEVENT_THREAD *t, const uint32_t hv, const unsigned int off, int *nbytes, uint64_t *cas, const uint64_t cas_in);
 void thread_io_queue_add(LIBEVENT_THREAD *t, int type, void *ctx, io_queue_stack_cb cb);
 void conn_io_queue_setup(conn *c);
 io_queue_t *conn_io_queue_get(conn *c, int type);
@@ -964,6 +1170,16 @@ conn *conn_new(const int sfd, const enum conn_states init_state, const int event
     enum network_transport transport, struct event_base *base, void *ssl, uint64_t conntag, enum protocol bproto);
 
 void conn_worker_readd(conn *c);
+#ifdef USE_URING
+void conn_uring_thread_init(LIBEVENT_THREAD *t);
+void conn_uring_attach(conn *c);
+void conn_uring_flush(LIBEVENT_THREAD *t);
+void conn_uring_handoff(conn *c);
+void conn_uring_return(conn *c);
+#else
+#define conn_uring_handoff(c)
+#define conn_uring_return(c)
+#endif
 extern int daemonize(int nochdir, int noclose);
 
 #define mutex_lock(x) pthread_mutex_lock(x)
@@ -974,6 +1190,7 @@ extern int daemonize(int nochdir, int noclose);
 #include "slabs.h"
 #include "assoc.h"
 #include "items.h"
+#include "hotkeys.h"
 #include "crawler.h"
 #include "trace.h"
 #include "hash.h"
@@ -986,14 +1203,21 @@ extern int daemonize(int nochdir, int noclose);
  */
 void memcached_thread_init(int nthreads, void *arg);
 void redispatch_conn(conn *c);
-void timeout_conn(conn *c);
 #ifdef PROXY
 void proxy_reload_notify(LIBEVENT_THREAD *t);
 #endif
 void return_io_pending(io_pending_t *io);
 void dispatch_conn_new(int sfd, enum conn_states init_state, int event_flags, int read_buffer_size,
     enum network_transport transport, void *ssl, uint64_t conntag, enum protocol bproto);
+void dispatch_conn_local(LIBEVENT_THREAD *t, int sfd, enum conn_states init_state, int event_flags,
+    int read_buffer_size, enum network_transport transport, void *ssl, uint64_t conntag, enum protocol bproto);
+conn *dispatch_listen_conn(int tid, int sfd, enum network_transport transport, bool ssl_enabled,
+    uint64_t conntag, enum protocol bproto);
+void listen_conn_notify(conn *c, const bool do_accept);
 void sidethread_conn_close(conn *c);
+bool migrate_conn(conn *c, int tid);
+void threads_cpu_check(void);
+void thread_stats_workers(ADD_STAT add_stats, void *c);
 
 /* Lock wrappers for cache functions that are called from main loop. */
 enum delta_result_type add_delta(LIBEVENT_THREAD *t, const char *key,
@@ -1002,12 +1226,24 @@ enum delta_result_type add_delta(LIBEVENT_THREAD *t, const char *key,
                                  uint64_t *cas);
 void accept_new_conns(const bool do_accept);
 void  conn_close_idle(conn *c);
+void  conn_idle_thread_init(LIBEVENT_THREAD *t);
+void  conn_idle_add(conn *c);
+void  conn_loop_round(LIBEVENT_THREAD *t);
+void  conn_migrate_out(conn *c);
+void  conn_migrate_in(conn *c, LIBEVENT_THREAD *t);
+#ifdef USE_SHM
+int   conn_shm_attach(conn *c);
+bool  conn_shm_idle(conn *c);
+bool  conn_shm_blocked(conn *c);
+void  conn_shm_release(conn *c);
+#endif
 void  conn_close_all(void);
 item *item_alloc(const char *key, size_t nkey, client_flags_t flags, rel_time_t exptime, int nbytes);
 #define DO_UPDATE true
 #define DONT_UPDATE false
 item *item_get(const char *key, const size_t nkey, LIBEVENT_THREAD *t, const bool do_update);
 item *item_get_locked(const char *key, const size_t nkey, LIBEVENT_THREAD *t, const bool do_update, uint32_t *hv);
+item *item_get_hot(const char *key, const size_t nkey, LIBEVENT_THREAD *t, struct hot_item **hot);
 item *item_touch(const char *key, const size_t nkey, uint32_t exptime, LIBEVENT_THREAD *t);
 int   item_link(item *it);
 void  item_remove(item *it);
@@ -1020,7 +1256,6 @@ void item_trylock_unlock(void *arg);
 void item_unlock(uint32_t hv);
 void pause_threads(enum pause_thread_types type);
 void stop_threads(void);
-int stop_conn_timeout_thread(void);
 #define refcount_incr(it) ++(it->refcount)
 #define refcount_decr(it) --(it->refcount)
 void STATS_LOCK(void);
@@ -1029,6 +1264,8 @@ void STATS_UNLOCK(void);
 #define THR_STATS_UNLOCK(t) pthread_mutex_unlock(&t->stats.mutex)
 void threadlocal_stats_reset(void);
 void threadlocal_stats_aggregate(struct thread_stats *stats);
+bool threadlocal_hotkeys_stats(const unsigned int top, const bool by_bytes,
+        ADD_STAT add_stats, void *c);
 void slab_stats_aggregate(struct thread_stats *stats, struct slab_stats *out);
 void thread_setname(pthread_t thread, const char *name);
 LIBEVENT_THREAD *get_worker_thread(int id);
@@ -1038,6 +1275,7 @@ void append_stat(const char *name, ADD_STAT add_stats, conn *c,
                  const char *fmt, ...);
 
 enum store_item_type store_item(item *item, int comm, LIBEVENT_THREAD *t, int *nbytes, uint64_t *cas, const uint64_t cas_in, bool cas_stale);
+enum store_item_type store_item_range(item *item, unsigned int off, LIBEVENT_THREAD *t, int *nbytes, uint64_t *cas, const uint64_t cas_in);
 
 /* Protocol related code */
 void out_string(conn *c, const char *str);
@@ -1050,10 +1288,12 @@ void out_string(conn *c, const char *str);
 rel_time_t realtime(const time_t exptime);
 item* limited_get(const char *key, size_t nkey, LIBEVENT_THREAD *t, uint32_t exptime, bool should_touch, bool do_update, bool *overflow);
 item* limited_get_locked(const char *key, size_t nkey, LIBEVENT_THREAD *t, bool do_update, uint32_t *hv, bool *overflow);
+item* limited_get_hot(const char *key, size_t nkey, LIBEVENT_THREAD *t, struct hot_item **hot, bool *overflow);
 // Read/Response object handlers.
 void resp_reset(mc_resp *resp);
 void resp_add_iov(mc_resp *resp, const void *buf, int len);
 void resp_add_chunked_iov(mc_resp *resp, const void *buf, int len);
+void resp_add_chunked_iov_off(mc_resp *resp, const void *buf, int off, int len);
 bool resp_start(conn *c);
 mc_resp *resp_start_unlinked(conn *c);
 mc_resp* resp_finish(conn *c, mc_resp *resp);
@@ -1063,6 +1303,7 @@ bool rbuf_switch_to_malloc(conn *c);
 void conn_release_items(conn *c);
 void conn_set_state(conn *c, enum conn_states state);
 void out_of_memory(conn *c, char *ascii_error);
+void write_stats(conn *c, char *ascii_error);
 void out_errstring(conn *c, const char *str);
 void write_and_free(conn *c, char *buf, int bytes);
 void server_stats(ADD_STAT add_stats, void *c);
@@ -50,14 +50,30 @@ void complete_nread_binary(conn *c) {
 }
 
 int try_read_command_binary(conn *c) {
+    // Binary protocol state is only allocated for clients that use it.
+    if (c->bin == NULL) {
+        c->bin = calloc(1, sizeof(conn_bin_t));
+        STATS_LOCK();
+        if (c->bin == NULL) {
+            stats.malloc_fails++;
+        } else {
+            stats_state.conn_struct_bytes += sizeof(conn_bin_t);
+        }
+        STATS_UNLOCK();
+        if (c->bin == NULL) {
+            conn_set_state(c, conn_closing);
+            return -1;
+        }
+    }
+
     /* Do we have the complete packet header? */
-    if (c->rbytes < sizeof(c->binary_header)) {
+    if (c->rbytes < sizeof(c->bin->header)) {
         /* need more data! */
         return 0;
     } else {
-        memcpy(&c->binary_header, c->rcurr, sizeof(c->binary_header));
+        memcpy(&c->bin->header, c->rcurr, sizeof(c->bin->header));
         protocol_binary_request_header* req;
-        req = &c->binary_header;
+        req = &c->bin->header;
 
         if (settings.verbose > 1) {
             /* Dump the packet before we convert it to host order */
@@ -72,23 +88,23 @@ int try_read_command_binary(conn *c) {
             fprintf(stderr, "\n");
         }
 
-        c->binary_header = *req;
-        c->binary_header.request.keylen = ntohs(req->request.keylen);
-        c->binary_header.request.bodylen = ntohl(req->request.bodylen);
-        c->binary_header.request.cas = ntohll(req->request.cas);
+        c->bin->header = *req;
+        c->bin->header.request.keylen = ntohs(req->request.keylen);
+        c->bin->header.request.bodylen = ntohl(req->request.bodylen);
+        c->bin->header.request.cas = ntohll(req->request.cas);
 
-        if (c->binary_header.request.magic != PROTOCOL_BINARY_REQ) {
+        if (c->bin->header.request.magic != PROTOCOL_BINARY_REQ) {
             if (settings.verbose) {
                 fprintf(stderr, "Invalid magic:  %x\n",
-                        c->binary_header.request.magic);
+                        c->bin->header.request.magic);
             }
             conn_set_state(c, conn_closing);
             return -1;
         }
 
-        uint8_t extlen = c->binary_header.request.extlen;
-        uint16_t keylen = c->binary_header.request.keylen;
-        if (c->rbytes < keylen + extlen + sizeof(c->binary_header)) {
+        uint8_t extlen = c->bin->header.request.extlen;
+        uint16_t keylen = c->bin->header.request.keylen;
+        if (c->rbytes < keylen + extlen + sizeof(c->bin->header)) {
             // Still need more bytes. Let try_read_network() realign the
             // read-buffer and fetch more data as necessary.
             return 0;
@@ -99,25 +115,25 @@ int try_read_command_binary(conn *c) {
             return -1;
         }
 
-        c->cmd = c->binary_header.request.opcode;
-        c->keylen = c->binary_header.request.keylen;
-        c->opaque = c->binary_header.request.opaque;
+        c->cmd = c->bin->header.request.opcode;
+        c->bin->keylen = c->bin->header.request.keylen;
+        c->bin->opaque = c->bin->header.request.opaque;
         /* clear the returned cas value */
         c->cas = 0;
 
         c->last_cmd_time = current_time;
         // sigh. binprot has no "largest possible extlen" define, and I don't
         // want to refactor a ton of code either. Header is only ever used out
-        // of c->binary_header, but the extlen stuff is used for the latter
+        // of c->bin->header, but the extlen stuff is used for the latter
         // bytes. Just wastes 24 bytes on the stack this way.
 
         // +4 need to be here because extbuf is used for protocol_binary_request_incr
         // and its member message is alligned to 48 bytes intead of 44
-        char extbuf[sizeof(c->binary_header) + BIN_MAX_EXTLEN+4];
-        memcpy(extbuf + sizeof(c->binary_header), c->rcurr + sizeof(c->binary_header),
+        char extbuf[sizeof(c->bin->header) + BIN_MAX_EXTLEN+4];
+        memcpy(extbuf + sizeof(c->bin->header), c->rcurr + sizeof(c->bin->header),
                 extlen > BIN_MAX_EXTLEN ? BIN_MAX_EXTLEN : extlen);
-        c->rbytes -= sizeof(c->binary_header) + extlen + keylen;
-        c->rcurr += sizeof(c->binary_header) + extlen + keylen;
+        c->rbytes -= sizeof(c->bin->header) + extlen + keylen;
+        c->rcurr += sizeof(c->bin->header) + extlen + keylen;
 
         dispatch_bin_command(c, extbuf);
     }
@@ -129,7 +145,7 @@ int try_read_command_binary(conn *c) {
  * get a pointer to the key in this request
  */
 static char* binary_get_key(conn *c) {
-    return c->rcurr - (c->binary_header.request.keylen);
+    return c->rcurr - (c->bin->header.request.keylen);
 }
 
 static void add_bin_header(conn *c, uint16_t err, uint8_t hdr_len, uint16_t key_len, uint32_t body_len) {
@@ -143,7 +159,7 @@ static void add_bin_header(conn *c, uint16_t err, uint8_t hdr_len, uint16_t key_
     header = (protocol_binary_response_header *)resp->wbuf;
 
     header->response.magic = (uint8_t)PROTOCOL_BINARY_RES;
-    header->response.opcode = c->binary_header.request.opcode;
+    header->response.opcode = c->bin->header.request.opcode;
     header->response.keylen = (uint16_t)htons(key_len);
 
     header->response.extlen = (uint8_t)hdr_len;
@@ -151,7 +167,7 @@ static void add_bin_header(conn *c, uint16_t err, uint8_t hdr_len, uint16_t key_
     header->response.status = (uint16_t)htons(err);
 
     header->response.bodylen = htonl(body_len);
-    header->response.opaque = c->opaque;
+    header->response.opaque = c->bin->opaque;
     header->response.cas = htonll(c->cas);
 
     if (settings.verbose > 1) {
@@ -238,7 +254,7 @@ static void handle_binary_protocol_error(conn *c) {
     write_bin_error(c, PROTOCOL_BINARY_RESPONSE_EINVAL, NULL, 0);
     if (settings.verbose) {
         fprintf(stderr, "Protocol error (opcode %02x), close connection %d\n",
-                c->binary_header.request.opcode, c->sfd);
+                c->bin->header.request.opcode, c->sfd);
     }
     c->close_after_write = true;
 }
@@ -276,7 +292,7 @@ static void complete_incr_bin(conn *c, char *extbuf) {
     req->message.body.initial = ntohll(req->message.body.initial);
     req->message.body.expiration = ntohl(req->message.body.expiration);
     key = binary_get_key(c);
-    nkey = c->binary_header.request.keylen;
+    nkey = c->bin->header.request.keylen;
 
     if (settings.verbose > 1) {
         int i;
@@ -291,8 +307,8 @@ static void complete_incr_bin(conn *c, char *extbuf) {
                 req->message.body.expiration);
     }
 
-    if (c->binary_header.request.cas != 0) {
-        cas = c->binary_header.request.cas;
+    if (c->bin->header.request.cas != 0) {
+        cas = c->bin->header.request.cas;
     }
     switch(add_delta(c->thread, key, nkey, c->cmd == PROTOCOL_BINARY_CMD_INCREMENT,
                      req->message.body.delta, tmpbuf,
@@ -320,12 +336,16 @@ static void complete_incr_bin(conn *c, char *extbuf) {
                 (unsigned long long)req->message.body.initial);
             int res = strlen(tmpbuf);
             it = item_alloc(key, nkey, 0, realtime(req->message.body.expiration),
-                            res + 2);
+                            settings.native_counters ? ITEM_COUNTER_NBYTES : res + 2);
 
             if (it != NULL) {
                 uint64_t cas = 0;
-                memcpy(ITEM_data(it), tmpbuf, res);
-                memcpy(ITEM_data(it) + res, "\r\n", 2);
+                if (settings.native_counters) {
+                    item_counter_init(it, req->message.body.initial);
+                } else {
+                    memcpy(ITEM_data(it), tmpbuf, res);
+                    memcpy(ITEM_data(it) + res, "\r\n", 2);
+                }
                 c->thread->cur_sfd = c->sfd; // for store_item logging.
 
                 if (store_item(it, NREAD_ADD, c->thread, NULL, &cas, (settings.use_cas) ? get_cas_id() : 0, CAS_NO_STALE)) {
@@ -461,7 +481,7 @@ static void process_bin_get_or_touch(conn *c, char *extbuf) {
 
     protocol_binary_response_get* rsp = (protocol_binary_response_get*)c->resp->wbuf;
     char* key = binary_get_key(c);
-    size_t nkey = c->binary_header.request.keylen;
+    size_t nkey = c->bin->header.request.keylen;
     int should_touch = (c->cmd == PROTOCOL_BINARY_CMD_TOUCH ||
                         c->cmd == PROTOCOL_BINARY_CMD_GAT ||
                         c->cmd == PROTOCOL_BINARY_CMD_GATK);
@@ -488,7 +508,14 @@ static void process_bin_get_or_touch(conn *c, char *extbuf) {
     if (it) {
         /* the length has two unnecessary bytes ("\r\n") */
         uint16_t keylen = 0;
-        uint32_t bodylen = sizeof(rsp->message.body) + (it->nbytes - 2);
+        int vlen = it->nbytes - 2;
+        char *digits = NULL;
+        if (it->it_flags & ITEM_COUNTER) {
+            /* counters are sent from a copy so incr can keep changing them */
+            digits = c->resp->wbuf + sizeof(*rsp);
+            vlen = item_counter_render(it, digits);
+        }
+        uint32_t bodylen = sizeof(rsp->message.body) + vlen;
 
         pthread_mutex_lock(&c->thread->stats.mutex);
         if (should_touch) {
@@ -509,7 +536,7 @@ static void process_bin_get_or_touch(conn *c, char *extbuf) {
         }
 
         if (c->cmd == PROTOCOL_BINARY_CMD_TOUCH) {
-            bodylen -= it->nbytes - 2;
+            bodylen -= vlen;
         } else if (should_return_key) {
             bodylen += nkey;
             keylen = nkey;
@@ -528,9 +555,12 @@ static void process_bin_get_or_touch(conn *c, char *extbuf) {
         }
 
         if (should_return_value) {
+            hotkeys_sent(c->thread, it, vlen);
             /* Add the data minus the CRLF */
+            if (digits != NULL) {
+                resp_add_iov(c->resp, digits, vlen);
 #ifdef EXTSTORE
-            if (it->it_flags & ITEM_HDR) {
+            } else if (it->it_flags & ITEM_HDR) {
                 if (storage_get_item(c, it, c->resp) != 0) {
                     pthread_mutex_lock(&c->thread->stats.mutex);
                     c->thread->stats.get_oom_extstore++;
@@ -545,7 +575,7 @@ static void process_bin_get_or_touch(conn *c, char *extbuf) {
                 resp_add_chunked_iov(c->resp, it, it->nbytes - 2);
             }
 #else
-            if ((it->it_flags & ITEM_CHUNKED) == 0) {
+            } else if ((it->it_flags & ITEM_CHUNKED) == 0) {
                 resp_add_iov(c->resp, ITEM_data(it), it->nbytes - 2);
             } else {
                 resp_add_chunked_iov(c->resp, it, it->nbytes - 2);
@@ -608,7 +638,7 @@ static void process_bin_get_or_touch(conn *c, char *extbuf) {
 
 static void process_bin_stat(conn *c) {
     char *subcommand = binary_get_key(c);
-    size_t nkey = c->binary_header.request.keylen;
+    size_t nkey = c->bin->header.request.keylen;
 
     if (settings.verbose > 1) {
         int ii;
@@ -651,12 +681,7 @@ static void process_bin_stat(conn *c) {
         }
     } else {
         if (get_stats(subcommand, nkey, &append_stats, c)) {
-            if (c->stats.buffer == NULL) {
-                out_of_memory(c, "SERVER_ERROR Out of memory generating stats");
-            } else {
-                write_and_free(c, c->stats.buffer, c->stats.offset);
-                c->stats.buffer = NULL;
-            }
+            write_stats(c, "SERVER_ERROR Out of memory generating stats");
         } else {
             write_bin_error(c, PROTOCOL_BINARY_RESPONSE_KEY_ENOENT, NULL, 0);
         }
@@ -666,12 +691,7 @@ static void process_bin_stat(conn *c) {
 
     /* Append termination package and start the transfer */
     append_stats(NULL, 0, NULL, 0, c);
-    if (c->stats.buffer == NULL) {
-        out_of_memory(c, "SERVER_ERROR Out of memory preparing to send stats");
-    } else {
-        write_and_free(c, c->stats.buffer, c->stats.offset);
-        c->stats.buffer = NULL;
-    }
+    write_stats(c, "SERVER_ERROR Out of memory preparing to send stats");
 }
 
 static void init_sasl_conn(conn *c) {
@@ -701,8 +721,8 @@ static void bin_list_sasl_mechs(conn *c) {
     // Guard against a disabled SASL.
     if (!settings.sasl) {
         write_bin_error(c, PROTOCOL_BINARY_RESPONSE_UNKNOWN_COMMAND, NULL,
-                        c->binary_header.request.bodylen
-                        - c->binary_header.request.keylen);
+                        c->bin->header.request.bodylen
+                        - c->bin->header.request.keylen);
         return;
     }
 
@@ -730,15 +750,15 @@ static void process_bin_sasl_auth(conn *c) {
     // Guard for handling disabled SASL on the server.
     if (!settings.sasl) {
         write_bin_error(c, PROTOCOL_BINARY_RESPONSE_UNKNOWN_COMMAND, NULL,
-                        c->binary_header.request.bodylen
-                        - c->binary_header.request.keylen);
+                        c->bin->header.request.bodylen
+                        - c->bin->header.request.keylen);
         return;
     }
 
-    assert(c->binary_header.request.extlen == 0);
+    assert(c->bin->header.request.extlen == 0);
 
-    uint16_t nkey = c->binary_header.request.keylen;
-    int vlen = c->binary_header.request.bodylen - nkey;
+    uint16_t nkey = c->bin->header.request.keylen;
+    int vlen = c->bin->header.request.bodylen - nkey;
 
     if (nkey > MAX_SASL_MECH_LEN) {
         write_bin_error(c, PROTOCOL_BINARY_RESPONSE_EINVAL, NULL, vlen);
@@ -776,8 +796,8 @@ static void process_bin_complete_sasl_auth(conn *c) {
     assert(c->item);
     init_sasl_conn(c);
 
-    uint16_t nkey = c->binary_header.request.keylen;
-    int vlen = c->binary_header.request.bodylen - nkey;
+    uint16_t nkey = c->bin->header.request.keylen;
+    int vlen = c->bin->header.request.bodylen - nkey;
 
     if (nkey > ((item*) c->item)->nkey) {
         write_bin_error(c, PROTOCOL_BINARY_RESPONSE_EINVAL, NULL, vlen);
@@ -889,9 +909,9 @@ static bool authenticated(conn *c) {
 static void dispatch_bin_command(conn *c, char *extbuf) {
     int protocol_error = 0;
 
-    uint8_t extlen = c->binary_header.request.extlen;
-    uint16_t keylen = c->binary_header.request.keylen;
-    uint32_t bodylen = c->binary_header.request.bodylen;
+    uint8_t extlen = c->bin->header.request.extlen;
+    uint16_t keylen = c->bin->header.request.keylen;
+    uint32_t bodylen = c->bin->header.request.bodylen;
     c->thread->cur_sfd = c->sfd; // cuddle sfd for logging.
 
     if (keylen > bodylen || keylen + extlen > bodylen) {
@@ -1090,13 +1110,13 @@ static void process_bin_update(conn *c, char *extbuf) {
     assert(c != NULL);
 
     key = binary_get_key(c);
-    nkey = c->binary_header.request.keylen;
+    nkey = c->bin->header.request.keylen;
 
     /* fix byteorder in the request */
     req->message.body.flags = ntohl(req->message.body.flags);
     req->message.body.expiration = ntohl(req->message.body.expiration);
 
-    vlen = c->binary_header.request.bodylen - (nkey + c->binary_header.request.extlen);
+    vlen = c->bin->header.request.bodylen - (nkey + c->bin->header.request.extlen);
 
     if (settings.verbose > 1) {
         int ii;
@@ -1154,7 +1174,7 @@ static void process_bin_update(conn *c, char *extbuf) {
         return;
     }
 
-    ITEM_set_cas(it, c->binary_header.request.cas);
+    ITEM_set_cas(it, c->bin->header.request.cas);
 
     switch (c->cmd) {
         case PROTOCOL_BINARY_CMD_ADD:
@@ -1198,8 +1218,8 @@ static void process_bin_append_prepend(conn *c) {
     assert(c != NULL);
 
     key = binary_get_key(c);
-    nkey = c->binary_header.request.keylen;
-    vlen = c->binary_header.request.bodylen - nkey;
+    nkey = c->bin->header.request.keylen;
+    vlen = c->bin->header.request.bodylen - nkey;
 
     if (settings.verbose > 1) {
         fprintf(stderr, "Value len is %d\n", vlen);
@@ -1224,7 +1244,7 @@ static void process_bin_append_prepend(conn *c) {
         return;
     }
 
-    ITEM_set_cas(it, c->binary_header.request.cas);
+    ITEM_set_cas(it, c->bin->header.request.cas);
 
     switch (c->cmd) {
         case PROTOCOL_BINARY_CMD_APPEND:
@@ -1263,7 +1283,7 @@ static void process_bin_flush(conn *c, char *extbuf) {
       return;
     }
 
-    if (c->binary_header.request.extlen == sizeof(req->message.body)) {
+    if (c->bin->header.request.extlen == sizeof(req->message.body)) {
         exptime = ntohl(req->message.body.expiration);
     }
 
@@ -1288,7 +1308,7 @@ static void process_bin_delete(conn *c) {
 
     assert(c != NULL);
     char* key = binary_get_key(c);
-    size_t nkey = c->binary_header.request.keylen;
+    size_t nkey = c->bin->header.request.keylen;
 
     if (settings.verbose > 1) {
         int ii;
@@ -1305,7 +1325,7 @@ static void process_bin_delete(conn *c) {
 
     it = item_get_locked(key, nkey, c->thread, DONT_UPDATE, &hv);
     if (it) {
-        uint64_t cas = c->binary_header.request.cas;
+        uint64_t cas = c->bin->header.request.cas;
         if (cas == 0 || cas == ITEM_get_cas(it)) {
             MEMCACHED_COMMAND_DELETE(c->sfd, ITEM_key(it), it->nkey);
             pthread_mutex_lock(&c->thread->stats.mutex);
@@ -12,6 +12,8 @@
 #include "authfile.h"
 #include "storage.h"
 #include "base64.h"
+#include "snapshot.h"
+#include "tokenize.h"
 #ifdef TLS
 #include "tls.h"
 #endif
@@ -181,7 +183,11 @@ void complete_nread_ascii(conn *c) {
     } else {
       uint64_t cas = 0;
       c->thread->cur_sfd = c->sfd; // cuddle sfd for logging.
-      ret = store_item(it, comm, c->thread, &nbytes, &cas, c->cas ? c->cas : get_cas_id(), c->set_stale);
+      if (comm == NREAD_OVERWRITE) {
+          ret = store_item_range(it, c->set_offset, c->thread, &nbytes, &cas, c->cas ? c->cas : get_cas_id());
+      } else {
+          ret = store_item(it, comm, c->thread, &nbytes, &cas, c->cas ? c->cas : get_cas_id(), c->set_stale);
+      }
       c->cas = 0;
 
 #ifdef ENABLE_DTRACE
@@ -290,41 +296,27 @@ void complete_nread_ascii(conn *c) {
  *   }
  */
 static size_t tokenize_command(char *command, token_t *tokens, const size_t max_tokens) {
-    char *s, *e;
-    size_t ntokens = 0;
-    assert(command != NULL && tokens != NULL && max_tokens > 1);
+    mc_token_t found[MAX_TOKENS];
+    size_t stop;
+    assert(command != NULL && tokens != NULL && max_tokens > 1
+            && max_tokens <= MAX_TOKENS);
     size_t len = strlen(command);
-    unsigned int i = 0;
-
-    s = e = command;
-    for (i = 0; i < len; i++) {
-        if (*e == ' ') {
-            if (s != e) {
-                tokens[ntokens].value = s;
-                tokens[ntokens].length = e - s;
-                ntokens++;
-                *e = '\0';
-                if (ntokens == max_tokens - 1) {
-                    e++;
-                    s = e; /* so we don't add an extra token */
-                    break;
-                }
-            }
-            s = e + 1;
-        }
-        e++;
-    }
 
-    if (s != e) {
-        tokens[ntokens].value = s;
-        tokens[ntokens].length = e - s;
-        ntokens++;
+    int ntokens = mc_tokenize(command, len, found, max_tokens - 1, &stop);
+    for (int i = 0; i < ntokens; i++) {
+        tokens[i].value = command + found[i].start;
+        tokens[i].length = found[i].len;
+        command[found[i].start + found[i].len] = '\0';
     }
 
     /*
      * If we scanned the whole string, the terminal value pointer is null,
      * otherwise it is the first unprocessed character.
      */
+    char *e = command + stop;
+    if (stop < len) {
+        e++; /* past the space ending the last token */
+    }
     tokens[ntokens].value =  *e == '\0' ? NULL : e;
     tokens[ntokens].length = 0;
     ntokens++;
@@ -463,7 +455,8 @@ int try_read_command_ascii(conn *c) {
             }
 
             if (ptr - c->rcurr > 100 ||
-                (strncmp(ptr, "get ", 4) && strncmp(ptr, "gets ", 5))) {
+                (strncmp(ptr, "get ", 4) && strncmp(ptr, "gets ", 5)
+                 && strncmp(ptr, "mgm ", 4))) {
 
                 conn_set_state(c, conn_closing);
                 return 1;
@@ -556,6 +549,7 @@ static inline void process_get_command(conn *c, token_t *tokens, size_t ntokens,
     bool fail_length = false;
     assert(c != NULL);
     mc_resp *resp = c->resp;
+    struct hot_item *hot = NULL;
 
     if (should_touch) {
         // For get and touch commands, use first token as exptime
@@ -578,7 +572,11 @@ static inline void process_get_command(conn *c, token_t *tokens, size_t ntokens,
                 goto stop;
             }
 
-            it = limited_get(key, nkey, c->thread, exptime, should_touch, DO_UPDATE, &overflow);
+            if (c->thread->hot_cache != NULL && !should_touch) {
+                it = limited_get_hot(key, nkey, c->thread, &hot, &overflow);
+            } else {
+                it = limited_get(key, nkey, c->thread, exptime, should_touch, DO_UPDATE, &overflow);
+            }
             if (settings.detail_enabled) {
                 stats_prefix_record_get(key, nkey, NULL != it);
             }
@@ -595,16 +593,30 @@ static inline void process_get_command(conn *c, token_t *tokens, size_t ntokens,
                   MEMCACHED_COMMAND_GET(c->sfd, ITEM_key(it), it->nkey,
                                         it->nbytes, ITEM_get_cas(it));
                   int nbytes = it->nbytes;
+                  char digits[INCR_MAX_STORAGE_LEN];
+                  bool counter = (it->it_flags & ITEM_COUNTER) != 0;
+                  if (counter) {
+                      nbytes = item_counter_render(it, digits) + 2;
+                  }
                   char *p = resp->wbuf;
                   memcpy(p, "VALUE ", 6);
                   p += 6;
                   memcpy(p, ITEM_key(it), it->nkey);
                   p += it->nkey;
                   p += make_ascii_get_suffix(p, it, return_cas, nbytes);
+                  hotkeys_sent(c->thread, it, nbytes - 2);
+                  if (counter) {
+                      // a copy of the value goes out with the header.
+                      memcpy(p, digits, nbytes - 2);
+                      memcpy(p + nbytes - 2, "\r\n", 2);
+                      p += nbytes;
+                  }
                   resp_add_iov(resp, resp->wbuf, p - resp->wbuf);
 
+                  if (counter) {
+                      // already sent.
 #ifdef EXTSTORE
-                  if (it->it_flags & ITEM_HDR) {
+                  } else if (it->it_flags & ITEM_HDR) {
                       if (storage_get_item(c, it, resp) != 0) {
                           pthread_mutex_lock(&c->thread->stats.mutex);
                           c->thread->stats.get_oom_extstore++;
@@ -619,7 +631,7 @@ static inline void process_get_command(conn *c, token_t *tokens, size_t ntokens,
                       resp_add_chunked_iov(resp, it, it->nbytes);
                   }
 #else
-                  if ((it->it_flags & ITEM_CHUNKED) == 0) {
+                  } else if ((it->it_flags & ITEM_CHUNKED) == 0) {
                       resp_add_iov(resp, ITEM_data(it), it->nbytes);
                   } else {
                       resp_add_chunked_iov(resp, it, it->nbytes);
@@ -644,15 +656,20 @@ static inline void process_get_command(conn *c, token_t *tokens, size_t ntokens,
                 } else {
                     c->thread->stats.lru_hits[it->slabs_clsid]++;
                     c->thread->stats.get_cmds++;
+                    if (hot) {
+                        c->thread->stats.hot_cache_hits++;
+                    }
                 }
                 pthread_mutex_unlock(&c->thread->stats.mutex);
 #ifdef EXTSTORE
                 /* If ITEM_HDR, an io_wrap owns the reference. */
                 if ((it->it_flags & ITEM_HDR) == 0) {
                     resp->item = it;
+                    resp->hot = hot;
                 }
 #else
                 resp->item = it;
+                resp->hot = hot;
 #endif
             } else {
                 pthread_mutex_lock(&c->thread->stats.mutex);
@@ -716,7 +733,10 @@ stop:
     } else {
         // Tag the end token onto the most recent response object.
         resp_add_iov(resp, "END\r\n", 5);
-        conn_set_state(c, conn_mwrite);
+        // Like the meta commands, let pipelined gets stack up so their
+        // responses can be combined; the stack is flushed once the read
+        // buffer runs dry.
+        conn_set_state(c, conn_new_cmd);
     }
 }
 
@@ -797,6 +817,25 @@ static void process_stat(conn *c, token_t *tokens, const size_t ntokens) {
         return;
     } else if (strcmp(subcommand, "conns") == 0) {
         process_stats_conns(&append_stats, c);
+    } else if (strcmp(subcommand, "hotkeys") == 0) {
+        unsigned int top = 10;
+        bool by_bytes = false;
+        for (int i = 2; i < ntokens - 1; i++) {
+            if (strcmp(tokens[i].value, "bytes") == 0) {
+                by_bytes = true;
+            } else if (!safe_strtoul(tokens[i].value, &top) || top == 0) {
+                out_string(c, "CLIENT_ERROR bad command line format");
+                return;
+            }
+        }
+        if (settings.hotkey_sample == 0) {
+            out_string(c, "CLIENT_ERROR hot key tracking not enabled");
+            return;
+        }
+        if (!threadlocal_hotkeys_stats(top, by_bytes, &append_stats, c)) {
+            out_string(c, "SERVER_ERROR out of memory");
+            return;
+        }
 #ifdef EXTSTORE
     } else if (strcmp(subcommand, "extstore") == 0) {
         process_extstore_stats(&append_stats, c);
@@ -813,12 +852,7 @@ static void process_stat(conn *c, token_t *tokens, const size_t ntokens) {
         /* getting here means that the subcommand is either engine specific or
            is invalid. query the engine and see. */
         if (get_stats(subcommand, strlen(subcommand), &append_stats, c)) {
-            if (c->stats.buffer == NULL) {
-                out_of_memory(c, "SERVER_ERROR out of memory writing stats");
-            } else {
-                write_and_free(c, c->stats.buffer, c->stats.offset);
-                c->stats.buffer = NULL;
-            }
+            write_stats(c, "SERVER_ERROR out of memory writing stats");
         } else {
             out_string(c, "ERROR");
         }
@@ -828,12 +862,7 @@ static void process_stat(conn *c, token_t *tokens, const size_t ntokens) {
     /* append terminator and start the transfer */
     append_stats(NULL, 0, NULL, 0, c);
 
-    if (c->stats.buffer == NULL) {
-        out_of_memory(c, "SERVER_ERROR out of memory writing stats");
-    } else {
-        write_and_free(c, c->stats.buffer, c->stats.offset);
-        c->stats.buffer = NULL;
-    }
+    write_stats(c, "SERVER_ERROR out of memory writing stats");
 }
 
 // slow snprintf for debugging purposes.
@@ -919,6 +948,8 @@ struct _meta_flags {
     unsigned int new_ttl :1;
     unsigned int key_binary:1;
     unsigned int remove_val:1;
+    unsigned int range:1;
+    unsigned int range_len_set:1;
     char mode; // single character mode switch, common to ms/ma
     rel_time_t exptime;
     rel_time_t autoviv_exptime;
@@ -928,6 +959,8 @@ struct _meta_flags {
     uint64_t cas_id_in; // client supplied next-CAS
     uint64_t delta; // ma
     uint64_t initial; // ma
+    uint32_t range_off; // mg value window
+    uint32_t range_len;
 };
 
 static int _meta_flag_preparse(token_t *tokens, const size_t start,
@@ -949,6 +982,11 @@ static int _meta_flag_preparse(token_t *tokens, const size_t start,
             // base64 decode the key in-place, as the binary should always be
             // shorter and the conversion code buffers bytes.
             case 'b':
+                if (tokens[KEY_TOKEN].value == NULL) {
+                    // mgm decodes each of its keys itself.
+                    of->key_binary = 1;
+                    break;
+                }
                 ret = base64_decode((unsigned char *)tokens[KEY_TOKEN].value, tokens[KEY_TOKEN].length,
                             (unsigned char *)tokens[KEY_TOKEN].value, tokens[KEY_TOKEN].length);
                 if (ret == 0) {
@@ -1065,6 +1103,23 @@ static int _meta_flag_preparse(token_t *tokens, const size_t start,
             case 'I':
                 of->set_stale = 1;
                 break;
+            case 'r': // mg value window offset
+                if (!safe_strtoul(tokens[i].value+1, &of->range_off)) {
+                    *errstr = "CLIENT_ERROR bad token in command line format";
+                    of->has_error = 1;
+                } else {
+                    of->range = 1;
+                }
+                break;
+            case 'n': // mg value window length
+                if (!safe_strtoul(tokens[i].value+1, &of->range_len)) {
+                    *errstr = "CLIENT_ERROR bad token in command line format";
+                    of->has_error = 1;
+                } else {
+                    of->range = 1;
+                    of->range_len_set = 1;
+                }
+                break;
             default: // unknown flag, bail.
                 *errstr = "CLIENT_ERROR invalid flag";
                 return -1;
@@ -1074,56 +1129,60 @@ static int _meta_flag_preparse(token_t *tokens, const size_t start,
     return of->has_error ? -1 : 0;
 }
 
-static void process_mget_command(conn *c, token_t *tokens, const size_t ntokens) {
-    char *key;
-    size_t nkey;
+// Adds len bytes of the value starting at off, then the line end.
+static int _meta_add_range(conn *c, item *it, mc_resp *resp, uint32_t off,
+        uint32_t len) {
+    // a window running to the end can send the stored "\r\n" along with it.
+    bool tail = off + len == (uint32_t)it->nbytes - 2;
+#ifdef EXTSTORE
+    if (it->it_flags & ITEM_HDR) {
+        if (len != 0 && storage_get_range(c, it, resp, off, len) != 0) {
+            return -1;
+        }
+        resp_add_iov(resp, "\r\n", 2);
+        return 0;
+    }
+#endif
+    int n = tail ? len + 2 : len;
+    if (n != 0) {
+        if ((it->it_flags & ITEM_CHUNKED) == 0) {
+            resp_add_iov(resp, ITEM_data(it) + off, n);
+        } else {
+            resp_add_chunked_iov_off(resp, it, off, n);
+        }
+    }
+    if (!tail) {
+        resp_add_iov(resp, "\r\n", 2);
+    }
+    return 0;
+}
+
+// Looks up one key for mg or mgm. tokens is laid out as for mg: command, key,
+// then flags; the key itself is passed in already decoded.
+static void _process_mget_key(conn *c, token_t *tokens, const size_t ntokens,
+        const struct _meta_flags *of, char *key, size_t nkey) {
     item *it;
     unsigned int i = 0;
-    struct _meta_flags of = {0}; // option bitflags.
     uint32_t hv; // cached hash value for unlocking an item.
     bool failed = false;
     bool item_created = false;
     bool won_token = false;
     bool ttl_set = false;
+    uint32_t roff = 0; // value window
+    uint32_t rlen = 0;
+    uint32_t vlen = 0;
+    bool send_value = false;
+    bool counter = false;
+    char digits[INCR_MAX_STORAGE_LEN];
     char *errstr = "CLIENT_ERROR bad command line format";
-    assert(c != NULL);
     mc_resp *resp = c->resp;
     char *p = resp->wbuf;
 
-    WANT_TOKENS_MIN(ntokens, 3);
-
-    // FIXME: do we move this check to after preparse?
-    if (tokens[KEY_TOKEN].length > KEY_MAX_LENGTH) {
-        out_errstring(c, "CLIENT_ERROR bad command line format");
-        return;
-    }
-
-    // NOTE: final token has length == 0.
-    // KEY_TOKEN == 1. 0 is command.
-
-    if (ntokens > MFLAG_MAX_OPT_LENGTH) {
-        // TODO: ensure the command tokenizer gives us at least this many
-        out_errstring(c, "CLIENT_ERROR options flags are too long");
-        return;
-    }
-
-    // scrubs duplicated options and sets flags for how to load the item.
-    // we pass in the first token that should be a flag.
-    if (_meta_flag_preparse(tokens, 2, &of, &errstr) != 0) {
-        out_errstring(c, errstr);
-        return;
-    }
-    c->noreply = of.no_reply;
-
-    // Grab key and length after meta preparsing in case it was decoded.
-    key = tokens[KEY_TOKEN].value;
-    nkey = tokens[KEY_TOKEN].length;
-
     // TODO: need to indicate if the item was overflowed or not?
     // I think we do, since an overflow shouldn't trigger an alloc/replace.
     bool overflow = false;
-    if (!of.locked) {
-        it = limited_get(key, nkey, c->thread, 0, false, !of.no_update, &overflow);
+    if (!of->locked) {
+        it = limited_get(key, nkey, c->thread, 0, false, !of->no_update, &overflow);
     } else {
         // If we had to lock the item, we're doing our own bump later.
         it = limited_get_locked(key, nkey, c->thread, DONT_UPDATE, &hv, &overflow);
@@ -1138,7 +1197,7 @@ static void process_mget_command(conn *c, token_t *tokens, const size_t ntokens)
         return;
     }
 
-    if (it == NULL && of.vivify) {
+    if (it == NULL && of->vivify) {
         // Fill in the exptime during parsing later.
         it = item_alloc(key, nkey, 0, realtime(0), 2);
         // We don't actually need any of do_store_item's logic:
@@ -1150,7 +1209,7 @@ static void process_mget_command(conn *c, token_t *tokens, const size_t ntokens)
             // I look forward to the day I get rid of this :)
             memcpy(ITEM_data(it), "\r\n", 2);
             // NOTE: This initializes the CAS value.
-            do_item_link(it, hv, of.has_cas_in ? of.cas_id_in : get_cas_id());
+            do_item_link(it, hv, of->has_cas_in ? of->cas_id_in : get_cas_id());
             item_created = true;
         }
     }
@@ -1158,9 +1217,28 @@ static void process_mget_command(conn *c, token_t *tokens, const size_t ntokens)
     // don't have to check result of add_iov() since the iov size defaults are
     // enough.
     if (it) {
-        if (of.value) {
+        vlen = it->nbytes - 2;
+        if (it->it_flags & ITEM_COUNTER) {
+            counter = true;
+            vlen = item_counter_render(it, digits);
+        }
+        // C(token): the client already has this version of the value.
+        // with -C every CAS is 0, so there's no version to match against.
+        send_value = of->value && !(settings.use_cas && of->has_cas
+                && ITEM_get_cas(it) == of->req_cas_id);
+        if (send_value) {
+            rlen = vlen;
+            if (of->range) {
+                // clamp the window to the value.
+                roff = of->range_off < rlen ? of->range_off : rlen;
+                rlen -= roff;
+                if (of->range_len_set && of->range_len < rlen) {
+                    rlen = of->range_len;
+                }
+            }
             memcpy(p, "VA ", 3);
-            p = itoa_u32(it->nbytes-2, p+3);
+            p = itoa_u32(rlen, p+3);
+            hotkeys_sent(c->thread, it, rlen);
         } else {
             memcpy(p, "HD", 2);
             p += 2;
@@ -1170,11 +1248,11 @@ static void process_mget_command(conn *c, token_t *tokens, const size_t ntokens)
             switch (tokens[i].value[0]) {
                 case 'T':
                     ttl_set = true;
-                    it->exptime = of.exptime;
+                    it->exptime = of->exptime;
                     break;
                 case 'N':
                     if (item_created) {
-                        it->exptime = of.autoviv_exptime;
+                        it->exptime = of->autoviv_exptime;
                         won_token = true;
                     }
                     break;
@@ -1184,13 +1262,13 @@ static void process_mget_command(conn *c, token_t *tokens, const size_t ntokens)
                     if ((it->it_flags & ITEM_TOKEN_SENT) == 0
                             && !item_created
                             && it->exptime != 0
-                            && it->exptime < of.recache_time) {
+                            && it->exptime < of->recache_time) {
                         won_token = true;
                     }
                     break;
                 case 's':
                     META_CHAR(p, 's');
-                    p = itoa_u32(it->nbytes-2, p);
+                    p = itoa_u32(vlen, p);
                     break;
                 case 't':
                     // TTL remaining as of this request.
@@ -1270,10 +1348,26 @@ static void process_mget_command(conn *c, token_t *tokens, const size_t ntokens)
         *(p+1) = '\n';
         *(p+2) = '\0';
         p += 2;
+        if (send_value && counter) {
+            // a copy of the value goes out with the header.
+            memcpy(p, digits + roff, rlen);
+            memcpy(p + rlen, "\r\n", 2);
+            p += rlen + 2;
+        }
         // finally, chain in the buffer.
         resp_add_iov(resp, resp->wbuf, p - resp->wbuf);
 
-        if (of.value) {
+        if (counter) {
+            // value already sent, if asked for.
+        } else if (send_value && of->range) {
+            if (_meta_add_range(c, it, resp, roff, rlen) != 0) {
+                pthread_mutex_lock(&c->thread->stats.mutex);
+                c->thread->stats.get_oom_extstore++;
+                pthread_mutex_unlock(&c->thread->stats.mutex);
+
+                failed = true;
+            }
+        } else if (send_value) {
 #ifdef EXTSTORE
             if (it->it_flags & ITEM_HDR) {
                 if (storage_get_item(c, it, resp) != 0) {
@@ -1300,15 +1394,18 @@ static void process_mget_command(conn *c, token_t *tokens, const size_t ntokens)
         // need to hold the ref at least because of the key above.
 #ifdef EXTSTORE
         if (!failed) {
-            if ((it->it_flags & ITEM_HDR) != 0 && of.value) {
-                // Only have extstore clean if header and returning value.
+            if (resp->io_pending != NULL) {
+                // Only have extstore clean if it's reading the value.
                 resp->item = NULL;
             } else {
                 resp->item = it;
             }
         } else {
-            // Failed to set up extstore fetch.
-            if (of.locked) {
+            // Failed to set up extstore fetch. Drop the header we built,
+            // this goes out as a miss.
+            resp_reset(resp);
+            p = resp->wbuf;
+            if (of->locked) {
                 do_item_remove(it);
             } else {
                 item_remove(it);
@@ -1321,9 +1418,9 @@ static void process_mget_command(conn *c, token_t *tokens, const size_t ntokens)
         failed = true;
     }
 
-    if (of.locked) {
+    if (of->locked) {
         // Delayed bump so we could get fetched/last access time pre-update.
-        if (!of.no_update && it != NULL) {
+        if (!of->no_update && it != NULL) {
             do_item_bump(c->thread, it, hv);
         }
         item_unlock(hv);
@@ -1373,7 +1470,7 @@ static void process_mget_command(conn *c, token_t *tokens, const size_t ntokens)
                     p += tokens[i].length;
                     break;
                 case 'k':
-                    META_KEY(p, key, nkey, of.key_binary);
+                    META_KEY(p, key, nkey, of->key_binary);
                     break;
             }
         }
@@ -1387,13 +1484,143 @@ static void process_mget_command(conn *c, token_t *tokens, const size_t ntokens)
 error:
     if (it) {
         do_item_remove(it);
-        if (of.locked) {
+        if (of->locked) {
             item_unlock(hv);
         }
     }
     out_errstring(c, errstr);
 }
 
+static void process_mget_command(conn *c, token_t *tokens, const size_t ntokens) {
+    struct _meta_flags of = {0}; // option bitflags.
+    char *errstr = "CLIENT_ERROR bad command line format";
+    assert(c != NULL);
+
+    WANT_TOKENS_MIN(ntokens, 3);
+
+    // FIXME: do we move this check to after preparse?
+    if (tokens[KEY_TOKEN].length > KEY_MAX_LENGTH) {
+        out_errstring(c, "CLIENT_ERROR bad command line format");
+        return;
+    }
+
+    // NOTE: final token has length == 0.
+    // KEY_TOKEN == 1. 0 is command.
+
+    if (ntokens > MFLAG_MAX_OPT_LENGTH) {
+        // TODO: ensure the command tokenizer gives us at least this many
+        out_errstring(c, "CLIENT_ERROR options flags are too long");
+        return;
+    }
+
+    // scrubs duplicated options and sets flags for how to load the item.
+    // we pass in the first token that should be a flag.
+    if (_meta_flag_preparse(tokens, 2, &of, &errstr) != 0) {
+        out_errstring(c, errstr);
+        return;
+    }
+    c->noreply = of.no_reply;
+
+    // Grab key and length after meta preparsing in case it was decoded.
+    _process_mget_key(c, tokens, ntokens, &of, tokens[KEY_TOKEN].value,
+            tokens[KEY_TOKEN].length);
+}
+
+// mgm <flags>* -- <key>*
+// Same as one mg per key, but the flags are only parsed once. Each key gets
+// its own response, in order.
+static void process_mgetmulti_command(conn *c, token_t *tokens, size_t ntokens) {
+    token_t ktokens[MFLAG_MAX_OPT_LENGTH];
+    struct _meta_flags of = {0};
+    char *errstr = "CLIENT_ERROR bad command line format";
+    size_t sep, nflags, kntokens, i;
+    int nkeys = 0;
+    assert(c != NULL);
+
+    for (sep = 1; sep < ntokens - 1; sep++) {
+        if (tokens[sep].length == 2 && tokens[sep].value[0] == '-'
+                && tokens[sep].value[1] == '-') {
+            break;
+        }
+    }
+    if (sep == ntokens - 1) {
+        out_errstring(c, errstr);
+        return;
+    }
+
+    // lay the flags out as mg would see them. the key slot stays empty:
+    // keys are decoded one at a time below.
+    nflags = sep - 1;
+    kntokens = nflags + 3;
+    if (kntokens > MFLAG_MAX_OPT_LENGTH) {
+        out_errstring(c, "CLIENT_ERROR options flags are too long");
+        return;
+    }
+    ktokens[COMMAND_TOKEN] = tokens[COMMAND_TOKEN];
+    ktokens[KEY_TOKEN].value = NULL;
+    ktokens[KEY_TOKEN].length = 0;
+    for (i = 0; i < nflags; i++) {
+        ktokens[KEY_TOKEN + 1 + i] = tokens[1 + i];
+    }
+    ktokens[kntokens - 1].value = NULL;
+    ktokens[kntokens - 1].length = 0;
+
+    if (_meta_flag_preparse(ktokens, 2, &of, &errstr) != 0) {
+        out_errstring(c, errstr);
+        return;
+    }
+    // checked per key by mg; catch it before any key is looked up.
+    for (i = KEY_TOKEN + 1; i < kntokens - 1; i++) {
+        if (ktokens[i].value[0] == 'O'
+                && ktokens[i].length > MFLAG_MAX_OPAQUE_LENGTH) {
+            out_errstring(c, "CLIENT_ERROR opaque token too long");
+            return;
+        }
+    }
+
+    token_t *key_token = &tokens[sep + 1];
+    do {
+        while (key_token->length != 0) {
+            char *key = key_token->value;
+            size_t nkey = key_token->length;
+
+            if (nkeys++ != 0 && !resp_start(c)) {
+                // drop what we have and try to make room for the error.
+                conn_release_items(c);
+                if (!resp_start(c)) {
+                    conn_set_state(c, conn_closing);
+                    return;
+                }
+                out_of_memory(c, "SERVER_ERROR out of memory writing get response");
+                return;
+            }
+            // errors below clear noreply for their own response only.
+            c->noreply = of.no_reply;
+
+            if (nkey > KEY_MAX_LENGTH) {
+                out_errstring(c, "CLIENT_ERROR bad command line format");
+            } else if (of.key_binary && (nkey = base64_decode(
+                            (unsigned char *)key, nkey,
+                            (unsigned char *)key, nkey)) == 0) {
+                out_errstring(c, "CLIENT_ERROR error decoding key");
+            } else {
+                _process_mget_key(c, ktokens, kntokens, &of, key, nkey);
+            }
+            key_token++;
+        }
+
+        // more keys than fit in one pass of the tokenizer.
+        if (key_token->value != NULL) {
+            ntokens = tokenize_command(key_token->value, tokens, MAX_TOKENS);
+            key_token = tokens;
+        }
+    } while (key_token->value != NULL);
+
+    if (nkeys == 0) {
+        out_errstring(c, errstr);
+    }
+}
+
 static void process_mset_command(conn *c, token_t *tokens, const size_t ntokens) {
     char *key;
     size_t nkey;
@@ -1515,11 +1742,20 @@ static void process_mset_command(conn *c, token_t *tokens, const size_t ntokens)
         case 'S': // Set. Default.
             comm = NREAD_SET;
             break;
+        case 'W': // Overwrite part of the value.
+            comm = NREAD_OVERWRITE;
+            break;
         default:
             errstr = "CLIENT_ERROR invalid mode for ms M token";
             goto error;
     }
 
+    // an offset only makes sense when writing into the old value.
+    if ((of.range && comm != NREAD_OVERWRITE) || of.range_len_set) {
+        errstr = "CLIENT_ERROR invalid flag";
+        goto error;
+    }
+
     // The item storage function doesn't exactly map to mset.
     // If a CAS value is supplied, upgrade default SET mode to CAS mode.
     // Also allows REPLACE to work, as REPLACE + CAS works the same as CAS.
@@ -1592,6 +1828,7 @@ static void process_mset_command(conn *c, token_t *tokens, const size_t ntokens)
     if (of.set_stale && comm == NREAD_CAS) {
         c->set_stale = true;
     }
+    c->set_offset = of.range_off;
     resp->wbytes = p - resp->wbuf;
     // we don't set up the iov here, instead after complete_nread_ascii when
     // we have the full status code and item data.
@@ -1642,6 +1879,11 @@ static void process_mdelete_command(conn *c, token_t *tokens, const size_t ntoke
         out_errstring(c, "CLIENT_ERROR invalid or duplicate flag");
         return;
     }
+    // value windows are only for mg and ms.
+    if (of.range) {
+        out_errstring(c, "CLIENT_ERROR invalid flag");
+        return;
+    }
     assert(c != NULL);
     c->noreply = of.no_reply;
 
@@ -1799,6 +2041,11 @@ static void process_marithmetic_command(conn *c, token_t *tokens, const size_t n
         out_errstring(c, "CLIENT_ERROR invalid or duplicate flag");
         return;
     }
+    // value windows are only for mg and ms.
+    if (of.range) {
+        out_errstring(c, "CLIENT_ERROR invalid flag");
+        return;
+    }
     assert(c != NULL);
     c->noreply = of.no_reply;
 
@@ -1857,10 +2104,15 @@ static void process_marithmetic_command(conn *c, token_t *tokens, const size_t n
             itoa_u64(of.initial, tmpbuf);
             int vlen = strlen(tmpbuf);
 
-            it = item_alloc(key, nkey, 0, 0, vlen+2);
+            it = item_alloc(key, nkey, 0, 0, settings.native_counters ?
+                    ITEM_COUNTER_NBYTES : vlen+2);
             if (it != NULL) {
-                memcpy(ITEM_data(it), tmpbuf, vlen);
-                memcpy(ITEM_data(it) + vlen, "\r\n", 2);
+                if (settings.native_counters) {
+                    item_counter_init(it, of.initial);
+                } else {
+                    memcpy(ITEM_data(it), tmpbuf, vlen);
+                    memcpy(ITEM_data(it) + vlen, "\r\n", 2);
+                }
                 if (do_store_item(it, NREAD_ADD, c->thread, hv, NULL, NULL,
                             of.has_cas_in ? of.cas_id_in : get_cas_id(), CAS_NO_STALE)) {
                     item_created = true;
@@ -2385,7 +2637,13 @@ static void process_watch_command(conn *c, token_t *tokens, const size_t ntokens
         f |= LOG_FETCHERS;
     }
 
-    switch(logger_add_watcher(c, c->sfd, f)) {
+    // the logger thread reads from the socket directly once added.
+    conn_uring_handoff(c);
+    int rv = logger_add_watcher(c, c->sfd, f);
+    if (rv != LOGGER_ADD_WATCHER_OK) {
+        conn_uring_return(c);
+    }
+    switch(rv) {
         case LOGGER_ADD_WATCHER_TOO_MANY:
             out_string(c, "WATCHER_TOO_MANY log watcher limit reached");
             break;
@@ -2593,6 +2851,51 @@ static void process_quit_command(conn *c) {
     c->close_reason = NORMAL_CLOSE;
 }
 
+#ifdef USE_SHM
+static void process_shm_command(conn *c) {
+    if (settings.shm_ring_kb == 0) {
+        out_string(c, "ERROR");
+        return;
+    }
+    if (c->transport != local_transport || c->shm != NULL
+#ifdef TLS
+            || c->ssl
+#endif
+#ifdef USE_URING
+            || c->ur_active
+#endif
+            ) {
+        out_string(c, "CLIENT_ERROR shm not available on this connection");
+        return;
+    }
+    // the reply carries the ring's fd so it can't wait its turn, and
+    // anything after the command would have come in the wrong way. The
+    // line's end has already been replaced with a '\0'; a '\n' after that
+    // means it ended in "\r\n".
+    size_t len = strlen(c->rcurr) + 1;
+    if (len < c->rbytes && c->rcurr[len] == '\n') {
+        len++;
+    }
+    if (c->resp_head != c->resp || len != c->rbytes) {
+        out_string(c, "CLIENT_ERROR shm must be sent on its own");
+        return;
+    }
+    switch (conn_shm_attach(c)) {
+    case 0:
+        break;
+    case -1:
+        out_string(c, "SERVER_ERROR too many shared memory connections");
+        return;
+    default:
+        out_string(c, "SERVER_ERROR failed to set up shared memory");
+        return;
+    }
+    resp_reset(c->resp);
+    c->resp->skip = true;
+    conn_set_state(c, conn_new_cmd);
+}
+#endif
+
 static void process_shutdown_command(conn *c, token_t *tokens, const size_t ntokens) {
     if (!settings.shutdown_command) {
         out_string(c, "ERROR: shutdown not enabled");
@@ -2654,6 +2957,64 @@ static void process_slabs_command(conn *c, token_t *tokens, const size_t ntokens
     }
 }
 
+// snapshot load <name> [threads]
+static void process_snapshot_command(conn *c, token_t *tokens, const size_t ntokens) {
+    if ((ntokens == 4 || ntokens == 5)
+            && strcmp(tokens[COMMAND_TOKEN + 1].value, "load") == 0) {
+        char path[PATH_MAX];
+        uint32_t threads = settings.num_threads;
+        if (!settings.dump_enabled || settings.snapshot_dir == NULL) {
+            out_string(c, "ERROR snapshot not allowed");
+            return;
+        }
+        // files may only be read directly from the snapshot directory.
+        if (tokens[2].value[0] == '.' || strchr(tokens[2].value, '/') != NULL
+                || (ntokens == 5 && !safe_strtoul(tokens[3].value, &threads))) {
+            out_string(c, "CLIENT_ERROR bad command line format");
+            return;
+        }
+        int len = snprintf(path, sizeof(path), "%s/%s", settings.snapshot_dir,
+                tokens[2].value);
+        if (len <= 0 || len >= sizeof(path)) {
+            out_string(c, "CLIENT_ERROR bad command line format");
+            return;
+        }
+
+        switch (snapshot_load_start(path, threads)) {
+        case 0:
+            out_string(c, "OK");
+            break;
+        case -1:
+            out_string(c, "BUSY currently loading a snapshot");
+            break;
+        default:
+            out_string(c, "ERROR failed to start snapshot load");
+            break;
+        }
+    } else {
+        out_string(c, "ERROR");
+    }
+}
+
+// lru_crawler <metadump|mgdump> <classes|all|hash> [cursor] [limit]
+// returns -1 on a bad command line.
+static int process_lru_crawler_dump(conn *c, token_t *tokens, const size_t ntokens,
+        const enum crawler_run_type type) {
+    if (ntokens == 4) {
+        return lru_crawler_crawl(tokens[2].value, type,
+                c, c->sfd, LRU_CRAWLER_CAP_REMAINING);
+    }
+
+    uint64_t cursor = 0;
+    uint32_t limit = 0;
+    if (strcmp(tokens[2].value, "hash") != 0
+            || !safe_strtoull(tokens[3].value, &cursor)
+            || (ntokens == 6 && !safe_strtoul(tokens[4].value, &limit))) {
+        return -1;
+    }
+    return lru_crawler_crawl_cursor(type, c, c->sfd, cursor, limit);
+}
+
 static void process_lru_crawler_command(conn *c, token_t *tokens, const size_t ntokens) {
     if (ntokens == 4 && strcmp(tokens[COMMAND_TOKEN + 1].value, "crawl") == 0) {
         int rv;
@@ -2682,7 +3043,7 @@ static void process_lru_crawler_command(conn *c, token_t *tokens, const size_t n
             break;
         }
         return;
-    } else if (ntokens == 4 && strcmp(tokens[COMMAND_TOKEN + 1].value, "metadump") == 0) {
+    } else if (ntokens >= 4 && ntokens <= 6 && strcmp(tokens[COMMAND_TOKEN + 1].value, "metadump") == 0) {
         if (settings.lru_crawler == false) {
             out_string(c, "CLIENT_ERROR lru crawler disabled");
             return;
@@ -2696,9 +3057,15 @@ static void process_lru_crawler_command(conn *c, token_t *tokens, const size_t n
             return;
         }
 
-        int rv = lru_crawler_crawl(tokens[2].value, CRAWLER_METADUMP,
-                c, c->sfd, LRU_CRAWLER_CAP_REMAINING);
+        conn_uring_handoff(c);
+        int rv = process_lru_crawler_dump(c, tokens, ntokens, CRAWLER_METADUMP);
+        if (rv != CRAWLER_OK) {
+            conn_uring_return(c);
+        }
         switch(rv) {
+            case -1:
+                out_string(c, "CLIENT_ERROR bad command line format");
+                break;
             case CRAWLER_OK:
                 // TODO: documentation says this string is returned, but
                 // it never was before. We never switch to conn_write so
@@ -2723,7 +3090,7 @@ static void process_lru_crawler_command(conn *c, token_t *tokens, const size_t n
                 break;
         }
         return;
-    } else if (ntokens == 4 && strcmp(tokens[COMMAND_TOKEN + 1].value, "mgdump") == 0) {
+    } else if (ntokens >= 4 && ntokens <= 6 && strcmp(tokens[COMMAND_TOKEN + 1].value, "mgdump") == 0) {
         if (settings.lru_crawler == false) {
             out_string(c, "CLIENT_ERROR lru crawler disabled");
             return;
@@ -2737,8 +3104,53 @@ static void process_lru_crawler_command(conn *c, token_t *tokens, const size_t n
             return;
         }
 
-        int rv = lru_crawler_crawl(tokens[2].value, CRAWLER_MGDUMP,
+        conn_uring_handoff(c);
+        int rv = process_lru_crawler_dump(c, tokens, ntokens, CRAWLER_MGDUMP);
+        if (rv != CRAWLER_OK) {
+            conn_uring_return(c);
+        }
+        switch(rv) {
+            case -1:
+                out_string(c, "CLIENT_ERROR bad command line format");
+                break;
+            case CRAWLER_OK:
+                conn_set_state(c, conn_watch);
+                event_del(&c->event);
+                break;
+            case CRAWLER_RUNNING:
+                out_string(c, "BUSY currently processing crawler request");
+                break;
+            case CRAWLER_BADCLASS:
+                out_string(c, "BADCLASS invalid class id");
+                break;
+            case CRAWLER_NOTSTARTED:
+                out_string(c, "NOTSTARTED no items to crawl");
+                break;
+            case CRAWLER_ERROR:
+                out_string(c, "ERROR an unknown error happened");
+                break;
+        }
+        return;
+    } else if (ntokens == 4 && strcmp(tokens[COMMAND_TOKEN + 1].value, "prefixstats") == 0) {
+        if (settings.lru_crawler == false) {
+            out_string(c, "CLIENT_ERROR lru crawler disabled");
+            return;
+        }
+        if (!settings.dump_enabled) {
+            out_string(c, "ERROR prefixstats not allowed");
+            return;
+        }
+        if (resp_has_stack(c)) {
+            out_string(c, "ERROR cannot pipeline other commands before prefixstats");
+            return;
+        }
+
+        conn_uring_handoff(c);
+        int rv = lru_crawler_crawl(tokens[2].value, CRAWLER_PREFIXSTATS,
                 c, c->sfd, LRU_CRAWLER_CAP_REMAINING);
+        if (rv != CRAWLER_OK) {
+            conn_uring_return(c);
+        }
         switch(rv) {
             case CRAWLER_OK:
                 conn_set_state(c, conn_watch);
@@ -2758,6 +3170,42 @@ static void process_lru_crawler_command(conn *c, token_t *tokens, const size_t n
                 break;
         }
         return;
+    } else if ((ntokens == 5 || ntokens == 6) && strcmp(tokens[COMMAND_TOKEN + 1].value, "snapshot") == 0) {
+        uint32_t rate = 0;
+        if (settings.lru_crawler == false) {
+            out_string(c, "CLIENT_ERROR lru crawler disabled");
+            return;
+        }
+        if (!settings.dump_enabled || settings.snapshot_dir == NULL) {
+            out_string(c, "ERROR snapshot not allowed");
+            return;
+        }
+        // files may only be written directly into the snapshot directory.
+        if (tokens[3].value[0] == '.' || strchr(tokens[3].value, '/') != NULL
+                || (ntokens == 6 && !safe_strtoul(tokens[4].value, &rate))) {
+            out_string(c, "CLIENT_ERROR bad command line format");
+            return;
+        }
+
+        int rv = lru_crawler_snapshot(tokens[2].value, tokens[3].value, rate);
+        switch(rv) {
+            case CRAWLER_OK:
+                out_string(c, "OK");
+                break;
+            case CRAWLER_RUNNING:
+                out_string(c, "BUSY currently processing crawler request");
+                break;
+            case CRAWLER_BADCLASS:
+                out_string(c, "BADCLASS invalid class id");
+                break;
+            case CRAWLER_NOTSTARTED:
+                out_string(c, "NOTSTARTED no items to crawl");
+                break;
+            case CRAWLER_ERROR:
+                out_string(c, "ERROR failed to start snapshot");
+                break;
+        }
+        return;
     } else if (ntokens == 4 && strcmp(tokens[COMMAND_TOKEN + 1].value, "tocrawl") == 0) {
         uint32_t tocrawl;
          if (!safe_strtoul(tokens[2].value, &tocrawl)) {
@@ -2814,6 +3262,48 @@ static void process_refresh_certs_command(conn *c, token_t *tokens, const size_t
 }
 #endif
 
+// The worker is overloaded (-o shed_target): answer data commands with a
+// fast error instead of running them. Storage commands have their data
+// swallowed. Anything else, or anything malformed, runs as usual.
+static bool process_shed_command(conn *c, token_t *tokens, const size_t ntokens) {
+    const char *cmd = tokens[COMMAND_TOKEN].value;
+    int vtoken = 0;
+    int32_t vlen = 0;
+
+    if (strcmp(cmd, "set") == 0 || strcmp(cmd, "add") == 0
+            || strcmp(cmd, "replace") == 0 || strcmp(cmd, "append") == 0
+            || strcmp(cmd, "prepend") == 0 || strcmp(cmd, "cas") == 0) {
+        vtoken = 4;
+    } else if (strcmp(cmd, "ms") == 0) {
+        vtoken = 2;
+    } else if (strcmp(cmd, "get") != 0 && strcmp(cmd, "gets") != 0
+            && strcmp(cmd, "gat") != 0 && strcmp(cmd, "gats") != 0
+            && strcmp(cmd, "mg") != 0 && strcmp(cmd, "md") != 0
+            && strcmp(cmd, "ma") != 0 && strcmp(cmd, "delete") != 0
+            && strcmp(cmd, "incr") != 0 && strcmp(cmd, "decr") != 0
+            && strcmp(cmd, "touch") != 0) {
+        return false;
+    }
+
+    if (vtoken) {
+        if (ntokens < vtoken + 2 || !safe_strtol(tokens[vtoken].value, &vlen)
+                || vlen < 0 || vlen > (INT_MAX - 2)) {
+            return false;
+        }
+    }
+
+    pthread_mutex_lock(&c->thread->stats.mutex);
+    c->thread->stats.shed_requests++;
+    pthread_mutex_unlock(&c->thread->stats.mutex);
+
+    out_errstring(c, "SERVER_ERROR busy");
+    if (vtoken) {
+        c->sbytes = vlen + 2;
+        conn_set_state(c, conn_swallow);
+    }
+    return true;
+}
+
 // TODO: pipelined commands are incompatible with shifting connections to a
 // side thread. Given this only happens in two instances (watch and
 // lru_crawler metadump) it should be fine for things to bail. It _should_ be
@@ -2855,6 +3345,10 @@ void process_command_ascii(conn *c, char *command) {
         return;
     }
 
+    if (c->thread->shed_now && process_shed_command(c, tokens, ntokens)) {
+        return;
+    }
+
     // Meta commands are all 2-char in length.
     char first = tokens[COMMAND_TOKEN].value[0];
     if (first == 'm' && tokens[COMMAND_TOKEN].length == 2) {
@@ -2883,6 +3377,8 @@ void process_command_ascii(conn *c, char *command) {
                 out_string(c, "ERROR");
                 break;
         }
+    } else if (first == 'm' && strcmp(tokens[COMMAND_TOKEN].value, "mgm") == 0) {
+        process_mgetmulti_command(c, tokens, ntokens);
     } else if (first == 'g') {
         // Various get commands are very common.
         WANT_TOKENS_MIN(ntokens, 3);
@@ -2915,6 +3411,14 @@ void process_command_ascii(conn *c, char *command) {
         } else if (strcmp(tokens[COMMAND_TOKEN].value, "slabs") == 0) {
 
             process_slabs_command(c, tokens, ntokens);
+        } else if (strcmp(tokens[COMMAND_TOKEN].value, "snapshot") == 0) {
+
+            process_snapshot_command(c, tokens, ntokens);
+#ifdef USE_SHM
+        } else if (strcmp(tokens[COMMAND_TOKEN].value, "shm") == 0) {
+
+            process_shm_command(c);
+#endif
         } else {
             out_string(c, "ERROR");
         }
@@ -755,6 +755,7 @@ static void process_mget_cmd(LIBEVENT_THREAD *t, mcp_parser_t *pr, mc_resp *resp
     bool item_created = false;
     bool won_token = false;
     bool ttl_set = false;
+    bool send_value = false;
     char *errstr = "CLIENT_ERROR bad command line format";
     assert(t != NULL);
     char *p = resp->wbuf;
@@ -818,9 +819,13 @@ static void process_mget_cmd(LIBEVENT_THREAD *t, mcp_parser_t *pr, mc_resp *resp
     // don't have to check result of add_iov() since the iov size defaults are
     // enough.
     if (it) {
-        if (of.value) {
+        // skip the value if the client already holds this version of it.
+        send_value = of.value && !(settings.use_cas && of.has_cas
+                && ITEM_get_cas(it) == of.req_cas_id);
+        if (send_value) {
             memcpy(p, "VA ", 3);
             p = itoa_u32(it->nbytes-2, p+3);
+            hotkeys_sent(t, it, it->nbytes - 2);
         } else {
             memcpy(p, "HD", 2);
             p += 2;
@@ -934,7 +939,7 @@ static void process_mget_cmd(LIBEVENT_THREAD *t, mcp_parser_t *pr, mc_resp *resp
         // finally, chain in the buffer.
         resp_add_iov(resp, resp->wbuf, p - resp->wbuf);
 
-        if (of.value) {
+        if (send_value) {
 #ifdef EXTSTORE
             if (it->it_flags & ITEM_HDR) {
                 if (proxy_storage_get(t, it, resp, PROXY_STORAGE_MG) != 0) {
@@ -961,7 +966,7 @@ static void process_mget_cmd(LIBEVENT_THREAD *t, mcp_parser_t *pr, mc_resp *resp
         // need to hold the ref at least because of the key above.
 #ifdef EXTSTORE
         if (!failed) {
-            if ((it->it_flags & ITEM_HDR) != 0 && of.value) {
+            if ((it->it_flags & ITEM_HDR) != 0 && send_value) {
                 // Only have extstore clean if header and returning value.
                 resp->item = NULL;
             } else {
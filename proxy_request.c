@@ -1,6 +1,7 @@
 /* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
 
 #include "proxy.h"
+#include "tokenize.h"
 
 #define PARSER_MAXLEN USHRT_MAX-1
 
@@ -8,56 +9,27 @@
 // This creates a fast small (<= cacheline) index into the request,
 // where we later scan or directly feed data into API's.
 static int _process_tokenize(mcp_parser_t *pr, const size_t max) {
-    const char *s = pr->request;
-    int len = pr->endlen;
+    mc_token_t found[PARSER_MAX_TOKENS];
+    size_t len = pr->endlen;
+    size_t stop;
+    assert(max <= PARSER_MAX_TOKENS);
 
     // since multigets can be huge, we can't purely judge reqlen against this
     // limit, but we also can't index past it since the tokens are shorts.
     if (len > PARSER_MAXLEN) {
         len = PARSER_MAXLEN;
     }
-    const char *end = s + len;
-    int curtoken = 0;
 
-    int state = 0;
-    while (s != end) {
-        switch (state) {
-            case 0:
-                // scanning for first non-space to find a token.
-                if (*s != ' ') {
-                    pr->tokens[curtoken] = s - pr->request;
-                    if (++curtoken == max) {
-                        s++;
-                        state = 2;
-                        break;
-                    }
-                    state = 1;
-                }
-                s++;
-                break;
-            case 1:
-                // advance over a token
-                if (*s != ' ') {
-                    s++;
-                } else {
-                    state = 0;
-                }
-                break;
-            case 2:
-                // hit max tokens before end of the line.
-                // keep advancing so we can place endcap token.
-                if (*s == ' ') {
-                    goto endloop;
-                }
-                s++;
-                break;
-        }
+    // if we hit max tokens before the end of the line, the scan stops at the
+    // end of the last token.
+    int curtoken = mc_tokenize(pr->request, len, found, max, &stop);
+    for (int i = 0; i < curtoken; i++) {
+        pr->tokens[i] = found[i].start;
     }
-endloop:
 
     // endcap token so we can quickly find the length of any token by looking
     // at the next one.
-    pr->tokens[curtoken] = s - pr->request;
+    pr->tokens[curtoken] = stop;
     pr->ntokens = curtoken;
     P_DEBUG("%s: cur_tokens: %d\n", __func__, curtoken);
 
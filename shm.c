@@ -0,0 +1,248 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Shared memory transport for clients on the same host.
+ *
+ * A unix socket connection is switched over by swapping its read and write
+ * methods: the state machine and the protocol parsers never know the bytes
+ * came from a ring instead of the socket. See shm.h for the ring layout and
+ * the doorbell rules.
+ */
+#include "memcached.h"
+
+#ifdef USE_SHM
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "shm.h"
+
+struct conn_shm {
+    struct shm_header *hdr;
+    char *req;      /* request ring data */
+    char *resp;     /* response ring data */
+    uint32_t size;  /* our copy, the client can write to the header */
+    bool armed;     /* went to sleep, the socket may have a doorbell on it */
+    bool blocked;   /* response ring was full */
+};
+
+static void shm_doorbell(conn *c) {
+    char b = 0;
+    // if the socket buffer is full of doorbells the client will wake anyway.
+    send(c->sfd, &b, 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+}
+
+// Eats doorbells. Returns 0 if the client went away, -1 on error.
+static int shm_drain(conn *c) {
+    char buf[64];
+    c->shm->armed = false;
+    while (1) {
+        ssize_t res = recv(c->sfd, buf, sizeof(buf), MSG_DONTWAIT);
+        if (res == sizeof(buf))
+            continue;
+        if (res > 0)
+            return 1;
+        if (res == 0)
+            return 0;
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 1 : -1;
+    }
+}
+
+static ssize_t shm_read(conn *c, void *buf, size_t count) {
+    struct conn_shm *s = c->shm;
+    struct shm_ring *r = &s->hdr->req;
+
+    if (s->armed) {
+        int res = shm_drain(c);
+        if (res <= 0)
+            return res;
+    }
+
+    size_t n = shm_ring_get(r, s->req, s->size, buf, count);
+    if (n == 0 && !shm_ring_sleep_reader(r)) {
+        n = shm_ring_get(r, s->req, s->size, buf, count);
+    }
+    if (n == SHM_RING_BROKEN) {
+        errno = EPROTO;
+        return -1;
+    }
+    if (n == 0) {
+        s->armed = true;
+        errno = EAGAIN;
+        return -1;
+    }
+
+    if (shm_ring_wake_writer(r)) {
+        shm_doorbell(c);
+    }
+    return n;
+}
+
+static ssize_t shm_sendmsg(conn *c, struct msghdr *msg, int flags) {
+    struct conn_shm *s = c->shm;
+    struct shm_ring *r = &s->hdr->resp;
+    ssize_t sent = 0;
+
+    if (s->armed && shm_drain(c) <= 0) {
+        errno = ECONNRESET;
+        return -1;
+    }
+
+    do {
+        for (size_t i = 0; i < msg->msg_iovlen; i++) {
+            struct iovec *iov = &msg->msg_iov[i];
+            size_t n = shm_ring_put(r, s->resp, s->size, iov->iov_base,
+                    iov->iov_len);
+            if (n == SHM_RING_BROKEN) {
+                errno = EPROTO;
+                return -1;
+            }
+            sent += n;
+            if (n < iov->iov_len)
+                break;
+        }
+    } while (sent == 0 && !shm_ring_sleep_writer(r, s->size));
+
+    if (sent == 0) {
+        s->armed = true;
+        s->blocked = true;
+        errno = EAGAIN;
+        return -1;
+    }
+
+    s->blocked = false;
+    if (shm_ring_wake_reader(r)) {
+        shm_doorbell(c);
+    }
+    return sent;
+}
+
+static ssize_t shm_write(conn *c, void *buf, size_t count) {
+    struct iovec iov = { .iov_base = buf, .iov_len = count };
+    struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1 };
+    return shm_sendmsg(c, &msg, 0);
+}
+
+/*
+ * Hands a new pair of rings to the client, along with the reply to its
+ * "shm" command. The reply has to go out right away since the fd rides on
+ * it, so nothing else may be queued ahead of it. Returns 0 on success, -1 if
+ * shm_max_conns connections already use rings, -2 on other errors.
+ */
+int conn_shm_attach(conn *c) {
+    uint32_t size = settings.shm_ring_kb * 1024;
+    size_t len = shm_map_size(size);
+    struct conn_shm *s = NULL;
+    void *map = MAP_FAILED;
+    char line[32];
+    char cbuf[CMSG_SPACE(sizeof(int))];
+    struct iovec iov;
+    struct msghdr msg;
+    struct cmsghdr *cm;
+
+    STATS_LOCK();
+    if (stats_state.shm_curr_conns >= settings.shm_max_conns) {
+        STATS_UNLOCK();
+        return -1;
+    }
+    stats_state.shm_curr_conns++;
+    STATS_UNLOCK();
+
+    int fd = memfd_create("memcached-shm", MFD_CLOEXEC);
+    if (fd == -1) {
+        perror("memfd_create");
+        goto fail;
+    }
+    if (ftruncate(fd, len) != 0) {
+        perror("ftruncate");
+        goto fail;
+    }
+    map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        goto fail;
+    }
+    if ((s = calloc(1, sizeof(*s))) == NULL) {
+        goto fail;
+    }
+
+    s->hdr = map;
+    s->size = size;
+    s->req = (char *)map + SHM_DATA_OFFSET;
+    s->resp = s->req + size;
+    s->hdr->magic = SHM_MAGIC;
+    s->hdr->version = SHM_VERSION;
+    s->hdr->ring_size = size;
+
+    iov.iov_base = line;
+    iov.iov_len = snprintf(line, sizeof(line), "SHM %u\r\n", size);
+    memset(&msg, 0, sizeof(msg));
+    memset(cbuf, 0, sizeof(cbuf));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+    cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cm), &fd, sizeof(int));
+
+    if (sendmsg(c->sfd, &msg, MSG_NOSIGNAL) != (ssize_t)iov.iov_len) {
+        goto fail;
+    }
+    close(fd);
+
+    c->shm = s;
+    c->read = shm_read;
+    c->sendmsg = shm_sendmsg;
+    c->write = shm_write;
+    pthread_mutex_lock(&c->thread->stats.mutex);
+    c->thread->stats.shm_conns++;
+    pthread_mutex_unlock(&c->thread->stats.mutex);
+    return 0;
+
+fail:
+    if (map != MAP_FAILED)
+        munmap(map, len);
+    free(s);
+    if (fd != -1)
+        close(fd);
+    STATS_LOCK();
+    stats_state.shm_curr_conns--;
+    STATS_UNLOCK();
+    return -2;
+}
+
+/*
+ * Returns true if the connection can sleep until the client rings, false if
+ * requests are waiting in the ring.
+ */
+bool conn_shm_idle(conn *c) {
+    if (!shm_ring_sleep_reader(&c->shm->hdr->req)) {
+        return false;
+    }
+    c->shm->armed = true;
+    return true;
+}
+
+/* Waiting for the client to make room: the wakeup is a doorbell. */
+bool conn_shm_blocked(conn *c) {
+    return c->shm && c->shm->blocked;
+}
+
+void conn_shm_release(conn *c) {
+    struct conn_shm *s = c->shm;
+    if (s == NULL)
+        return;
+    munmap(s->hdr, shm_map_size(s->size));
+    free(s);
+    c->shm = NULL;
+    STATS_LOCK();
+    stats_state.shm_curr_conns--;
+    STATS_UNLOCK();
+}
+#endif
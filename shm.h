@@ -0,0 +1,156 @@
+#ifndef SHM_H
+#define SHM_H
+
+/* Shared memory transport for clients on the same host.
+ *
+ * A client connected over the unix socket sends "shm\r\n". The server
+ * answers with "SHM <ring size>\r\n" and, as SCM_RIGHTS ancillary data, a
+ * memfd laid out as a shm_header followed by two byte rings: requests from
+ * the client, then responses from the server. From then on the rings carry
+ * the same text protocol the socket would have, and the socket is only used
+ * as a doorbell and to tell when the other side goes away.
+ *
+ * Each ring has a single producer and a single consumer. Before going to
+ * sleep on the socket, a side sets the waiting flag of the ring it's stuck
+ * on and looks at the ring once more. After moving data the other side
+ * clears the flag and, if it was set, writes a byte to the socket. While
+ * both sides are busy nothing goes through the kernel at all.
+ *
+ * This header is shared with the reference client, so it only depends on
+ * libc.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdbool.h>
+
+#define SHM_MAGIC 0x6d637368 /* "mcsh" */
+#define SHM_VERSION 1
+#define SHM_DATA_OFFSET 4096
+#define SHM_CACHELINE 64
+
+struct shm_ring {
+    /* producer side */
+    uint32_t head;           /* bytes ever added */
+    uint32_t writer_waiting; /* producer sleeps until there's room */
+    char pad1[SHM_CACHELINE - 8];
+    /* consumer side */
+    uint32_t tail;           /* bytes ever removed */
+    uint32_t reader_waiting; /* consumer sleeps until there's data */
+    char pad2[SHM_CACHELINE - 8];
+};
+
+struct shm_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t ring_size; /* bytes in each ring, a power of two */
+    char pad[SHM_CACHELINE - 12];
+    struct shm_ring req;  /* client -> server */
+    struct shm_ring resp; /* server -> client */
+};
+
+/* Returned by the ring calls when head and tail are further apart than the
+ * ring is long: the other side wrote garbage into the control block, and
+ * the session can't go on. */
+#define SHM_RING_BROKEN ((size_t)-1)
+
+static inline size_t shm_map_size(uint32_t ring_size) {
+    return SHM_DATA_OFFSET + (size_t)ring_size * 2;
+}
+
+static inline char *shm_req_data(struct shm_header *h) {
+    return (char *)h + SHM_DATA_OFFSET;
+}
+
+static inline char *shm_resp_data(struct shm_header *h) {
+    return (char *)h + SHM_DATA_OFFSET + h->ring_size;
+}
+
+/* Copies up to len bytes into the ring, returns how many fit or
+ * SHM_RING_BROKEN. */
+static inline size_t shm_ring_put(struct shm_ring *r, char *data,
+        uint32_t size, const void *src, size_t len) {
+    uint32_t head = r->head;
+    uint32_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+    if (head - tail > size)
+        return SHM_RING_BROKEN;
+    size_t room = size - (head - tail);
+    if (len > room)
+        len = room;
+    if (len == 0)
+        return 0;
+
+    uint32_t off = head & (size - 1);
+    size_t first = size - off;
+    if (first > len)
+        first = len;
+    memcpy(data + off, src, first);
+    memcpy(data, (const char *)src + first, len - first);
+    __atomic_store_n(&r->head, head + (uint32_t)len, __ATOMIC_SEQ_CST);
+    return len;
+}
+
+/* Copies up to len bytes out of the ring, returns how many there were or
+ * SHM_RING_BROKEN. */
+static inline size_t shm_ring_get(struct shm_ring *r, char *data,
+        uint32_t size, void *dst, size_t len) {
+    uint32_t tail = r->tail;
+    uint32_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    size_t avail = head - tail;
+    if (avail > size)
+        return SHM_RING_BROKEN;
+    if (len > avail)
+        len = avail;
+    if (len == 0)
+        return 0;
+
+    uint32_t off = tail & (size - 1);
+    size_t first = size - off;
+    if (first > len)
+        first = len;
+    memcpy(dst, data + off, first);
+    memcpy((char *)dst + first, data, len - first);
+    __atomic_store_n(&r->tail, tail + (uint32_t)len, __ATOMIC_SEQ_CST);
+    return len;
+}
+
+static inline size_t shm_ring_used(struct shm_ring *r) {
+    return __atomic_load_n(&r->head, __ATOMIC_SEQ_CST)
+        - __atomic_load_n(&r->tail, __ATOMIC_SEQ_CST);
+}
+
+/* Consumer: returns true if it's safe to sleep until the doorbell rings. A
+ * broken ring isn't empty, so the next get reports it. */
+static inline bool shm_ring_sleep_reader(struct shm_ring *r) {
+    __atomic_store_n(&r->reader_waiting, 1, __ATOMIC_SEQ_CST);
+    if (shm_ring_used(r) != 0) {
+        __atomic_store_n(&r->reader_waiting, 0, __ATOMIC_RELAXED);
+        return false;
+    }
+    return true;
+}
+
+/* Producer: returns true if it's safe to sleep until the doorbell rings. */
+static inline bool shm_ring_sleep_writer(struct shm_ring *r, uint32_t size) {
+    __atomic_store_n(&r->writer_waiting, 1, __ATOMIC_SEQ_CST);
+    if (shm_ring_used(r) != size) {
+        __atomic_store_n(&r->writer_waiting, 0, __ATOMIC_RELAXED);
+        return false;
+    }
+    return true;
+}
+
+/* After putting data in: true if the consumer needs a doorbell. */
+static inline bool shm_ring_wake_reader(struct shm_ring *r) {
+    return __atomic_load_n(&r->reader_waiting, __ATOMIC_SEQ_CST)
+        && __atomic_exchange_n(&r->reader_waiting, 0, __ATOMIC_SEQ_CST);
+}
+
+/* After taking data out: true if the producer needs a doorbell. */
+static inline bool shm_ring_wake_writer(struct shm_ring *r) {
+    return __atomic_load_n(&r->writer_waiting, __ATOMIC_SEQ_CST)
+        && __atomic_exchange_n(&r->writer_waiting, 0, __ATOMIC_SEQ_CST);
+}
+
+#endif
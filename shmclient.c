@@ -0,0 +1,365 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Reference client for the shared memory transport described in shm.h.
+ *
+ *   shmclient SOCKET
+ *       Sends stdin to the server over the rings and writes the responses to
+ *       stdout. End the input with "quit" so the server hangs up.
+ *
+ *   shmclient -b ROUNDS [-d DEPTH] [-s VALUE_SIZE] SOCKET
+ *       Times ROUNDS round trips of DEPTH pipelined "mg" requests over a
+ *       plain unix socket connection and over the rings.
+ *
+ *   shmclient -c SOCKET
+ *       Corrupts the request ring's head and rings the doorbell. Exits 0 if
+ *       the server hangs up within a few seconds. For tests.
+ */
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "shm.h"
+
+#define SPIN_LOOPS 2000
+
+struct shm_client {
+    int fd;
+    struct shm_header *h;
+    char *req;
+    char *resp;
+    uint32_t size;
+};
+
+static int unix_connect(const char *path) {
+    struct sockaddr_un addr;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1) {
+        perror("socket");
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        perror("connect");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int shm_connect(const char *path, struct shm_client *sc) {
+    char line[64];
+    char cbuf[CMSG_SPACE(sizeof(int))];
+    struct iovec iov = { .iov_base = line, .iov_len = sizeof(line) - 1 };
+    struct msghdr msg;
+    struct cmsghdr *cm;
+    unsigned int size;
+    int mfd = -1;
+
+    if ((sc->fd = unix_connect(path)) == -1)
+        return -1;
+    if (write(sc->fd, "shm\r\n", 5) != 5) {
+        perror("write");
+        return -1;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+    ssize_t res = recvmsg(sc->fd, &msg, 0);
+    if (res <= 0) {
+        fprintf(stderr, "no reply to shm command\n");
+        return -1;
+    }
+    line[res] = '\0';
+    for (cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS)
+            memcpy(&mfd, CMSG_DATA(cm), sizeof(int));
+    }
+    if (sscanf(line, "SHM %u\r\n", &size) != 1 || mfd == -1) {
+        fprintf(stderr, "shm refused: %s", line);
+        return -1;
+    }
+
+    sc->h = mmap(NULL, shm_map_size(size), PROT_READ | PROT_WRITE, MAP_SHARED,
+            mfd, 0);
+    close(mfd);
+    if (sc->h == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    if (sc->h->magic != SHM_MAGIC || sc->h->version != SHM_VERSION
+            || sc->h->ring_size != size) {
+        fprintf(stderr, "unexpected shared memory layout\n");
+        return -1;
+    }
+    sc->size = size;
+    sc->req = shm_req_data(sc->h);
+    sc->resp = shm_resp_data(sc->h);
+    return 0;
+}
+
+static void doorbell(struct shm_client *sc) {
+    char b = 0;
+    if (write(sc->fd, &b, 1) == -1 && errno != EAGAIN) {
+        perror("write");
+    }
+}
+
+// Waits for the server to ring. Returns false once it has hung up.
+static bool wait_doorbell(struct shm_client *sc) {
+    struct pollfd pfd = { .fd = sc->fd, .events = POLLIN };
+    char buf[64];
+    if (poll(&pfd, 1, -1) == -1)
+        return errno == EINTR;
+    ssize_t res = recv(sc->fd, buf, sizeof(buf), MSG_DONTWAIT);
+    return res != 0 && !(res == -1 && errno != EAGAIN);
+}
+
+static void ring_check(size_t n) {
+    if (n == SHM_RING_BROKEN) {
+        fprintf(stderr, "shared memory ring is broken\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static size_t shm_put(struct shm_client *sc, const char *buf, size_t len) {
+    size_t n = shm_ring_put(&sc->h->req, sc->req, sc->size, buf, len);
+    ring_check(n);
+    if (n && shm_ring_wake_reader(&sc->h->req))
+        doorbell(sc);
+    return n;
+}
+
+static size_t shm_get(struct shm_client *sc, char *buf, size_t len) {
+    size_t n = shm_ring_get(&sc->h->resp, sc->resp, sc->size, buf, len);
+    ring_check(n);
+    if (n && shm_ring_wake_writer(&sc->h->resp))
+        doorbell(sc);
+    return n;
+}
+
+static int run_pipe(struct shm_client *sc) {
+    size_t len = 0, size = 65536, off = 0;
+    char *in = malloc(size);
+    char out[65536];
+    bool eof = false;
+    ssize_t res;
+
+    while (in && (res = read(STDIN_FILENO, in + len, size - len)) > 0) {
+        len += res;
+        if (len == size)
+            in = realloc(in, size *= 2);
+    }
+    if (in == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    while (1) {
+        bool moved = false;
+        size_t n;
+        if (off < len && (n = shm_put(sc, in + off, len - off)) > 0) {
+            off += n;
+            moved = true;
+        }
+        if ((n = shm_get(sc, out, sizeof(out))) > 0) {
+            fwrite(out, 1, n, stdout);
+            moved = true;
+        }
+        if (moved)
+            continue;
+        if (eof)
+            break;
+        // nothing to do until the server moves.
+        if (!shm_ring_sleep_reader(&sc->h->resp))
+            continue;
+        if (off < len && !shm_ring_sleep_writer(&sc->h->req, sc->size))
+            continue;
+        if (!wait_doorbell(sc))
+            eof = true;
+    }
+    free(in);
+    return 0;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool sock_roundtrip(int fd, const char *req, size_t reqlen, char *buf,
+        size_t resplen) {
+    size_t got = 0;
+    if (write(fd, req, reqlen) != (ssize_t)reqlen)
+        return false;
+    while (got < resplen) {
+        ssize_t res = read(fd, buf + got, resplen - got);
+        if (res <= 0)
+            return false;
+        got += res;
+    }
+    return true;
+}
+
+static bool shm_roundtrip(struct shm_client *sc, const char *req,
+        size_t reqlen, char *buf, size_t resplen) {
+    size_t got = 0;
+    int spins = 0;
+    if (shm_put(sc, req, reqlen) != reqlen)
+        return false;
+    while (got < resplen) {
+        size_t n = shm_get(sc, buf + got, resplen - got);
+        if (n) {
+            got += n;
+            spins = 0;
+        } else if (++spins > SPIN_LOOPS && shm_ring_sleep_reader(&sc->h->resp)) {
+            if (!wait_doorbell(sc))
+                return false;
+            spins = 0;
+        }
+    }
+    return true;
+}
+
+static int run_bench(const char *path, int rounds, int depth, int vsize) {
+    struct shm_client sc;
+    char *value = malloc(vsize + 1);
+    char hdr[64];
+    size_t reqlen, resplen;
+    char *req, *resp, *expect;
+    double start;
+    int fd;
+
+    memset(value, 'x', vsize);
+    value[vsize] = '\0';
+    reqlen = strlen("mg shmbench v\r\n") * depth;
+    snprintf(hdr, sizeof(hdr), "VA %d\r\n", vsize);
+    resplen = (strlen(hdr) + vsize + 2) * depth;
+    req = malloc(reqlen + 1);
+    resp = malloc(resplen);
+    expect = malloc(resplen + 1);
+    req[0] = expect[0] = '\0';
+    for (int i = 0; i < depth; i++) {
+        strcat(req, "mg shmbench v\r\n");
+        strcat(expect, hdr);
+        strcat(expect, value);
+        strcat(expect, "\r\n");
+    }
+
+    if ((fd = unix_connect(path)) == -1)
+        return 1;
+    dprintf(fd, "set shmbench 0 0 %d\r\n%s\r\n", vsize, value);
+    if (read(fd, hdr, 8) != 8 || memcmp(hdr, "STORED\r\n", 8) != 0) {
+        fprintf(stderr, "failed to store test value\n");
+        return 1;
+    }
+
+    start = now();
+    for (int i = 0; i < rounds; i++) {
+        if (!sock_roundtrip(fd, req, reqlen, resp, resplen)
+                || memcmp(resp, expect, resplen) != 0) {
+            fprintf(stderr, "bad response over the socket\n");
+            return 1;
+        }
+    }
+    double secs = now() - start;
+    printf("unix %d x %d: %.3f secs, %.0f reqs/sec\n", rounds, depth, secs,
+            rounds * depth / secs);
+    fflush(stdout);
+    close(fd);
+
+    if (shm_connect(path, &sc) != 0)
+        return 1;
+    if (reqlen > sc.size || resplen > sc.size) {
+        fprintf(stderr, "requests don't fit in the rings\n");
+        return 1;
+    }
+    start = now();
+    for (int i = 0; i < rounds; i++) {
+        if (!shm_roundtrip(&sc, req, reqlen, resp, resplen)
+                || memcmp(resp, expect, resplen) != 0) {
+            fprintf(stderr, "bad response over the rings\n");
+            return 1;
+        }
+    }
+    secs = now() - start;
+    printf("shm  %d x %d: %.3f secs, %.0f reqs/sec\n", rounds, depth, secs,
+            rounds * depth / secs);
+    return 0;
+}
+
+static int run_corrupt(struct shm_client *sc) {
+    struct pollfd pfd = { .fd = sc->fd, .events = POLLIN };
+    char buf[64];
+    uint32_t tail = __atomic_load_n(&sc->h->req.tail, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&sc->h->req.head, tail + sc->size + 100, __ATOMIC_SEQ_CST);
+    doorbell(sc);
+    while (poll(&pfd, 1, 5000) == 1) {
+        ssize_t res = recv(sc->fd, buf, sizeof(buf), 0);
+        if (res == 0 || (res == -1 && errno == ECONNRESET)) {
+            printf("closed\n");
+            return 0;
+        }
+        if (res == -1 && errno != EINTR)
+            break;
+    }
+    printf("still open\n");
+    return 1;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-c | -b ROUNDS [-d DEPTH] [-s VALUE_SIZE]] SOCKET\n",
+            name);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+    int rounds = 0, depth = 1, vsize = 32;
+    bool corrupt = false;
+    struct shm_client sc;
+    int c;
+
+    while ((c = getopt(argc, argv, "b:cd:s:")) != -1) {
+        switch (c) {
+        case 'b':
+            rounds = atoi(optarg);
+            break;
+        case 'c':
+            corrupt = true;
+            break;
+        case 'd':
+            depth = atoi(optarg);
+            break;
+        case 's':
+            vsize = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1 || depth < 1 || vsize < 0)
+        usage(argv[0]);
+
+    if (rounds > 0)
+        return run_bench(argv[optind], rounds, depth, vsize);
+
+    if (shm_connect(argv[optind], &sc) != 0)
+        return EXIT_FAILURE;
+    if (corrupt)
+        return run_corrupt(&sc);
+    return run_pipe(&sc);
+}
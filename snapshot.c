@@ -0,0 +1,422 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Encoding and bulk loading of binary item snapshot files. See snapshot.h
+ * for the format.
+ */
+#include "memcached.h"
+#include "snapshot.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static char *_put16(char *p, uint16_t v) {
+    v = htons(v);
+    memcpy(p, &v, sizeof(v));
+    return p + sizeof(v);
+}
+
+static char *_put32(char *p, uint32_t v) {
+    v = htonl(v);
+    memcpy(p, &v, sizeof(v));
+    return p + sizeof(v);
+}
+
+static char *_put64(char *p, uint64_t v) {
+    v = htonll(v);
+    memcpy(p, &v, sizeof(v));
+    return p + sizeof(v);
+}
+
+static uint16_t _get16(const char *p) {
+    uint16_t v;
+    memcpy(&v, p, sizeof(v));
+    return ntohs(v);
+}
+
+static uint32_t _get32(const char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return ntohl(v);
+}
+
+static uint64_t _get64(const char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return ntohll(v);
+}
+
+void snapshot_encode_file_hdr(char *buf, uint64_t created) {
+    char *p = buf;
+    memcpy(p, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_LEN);
+    p += SNAPSHOT_MAGIC_LEN;
+    p = _put16(p, SNAPSHOT_VERSION);
+    p = _put64(p, created);
+    p = _put32(p, 0);
+    _put32(p, crc32c(0, buf, p - buf));
+}
+
+// leaves the crc blank; see snapshot_seal_rec()
+void snapshot_encode_rec_hdr(char *buf, const snapshot_rec_t *rec) {
+    char *p = buf + sizeof(uint32_t);
+    p = _put32(p, rec->nbytes);
+    p = _put64(p, rec->cas);
+    p = _put64(p, rec->flags);
+    p = _put64(p, rec->exptime);
+    p = _put16(p, rec->rflags);
+    *p++ = rec->nkey;
+    *p = 0;
+}
+
+// crc a fully written record (header, key and value) in place.
+void snapshot_seal_rec(char *buf, size_t len) {
+    _put32(buf, crc32c(0, buf + sizeof(uint32_t), len - sizeof(uint32_t)));
+}
+
+// returns 0 if the file header is valid.
+int snapshot_check_file_hdr(const char *buf) {
+    if (memcmp(buf, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_LEN) != 0) {
+        return -1;
+    }
+    if (_get16(buf + SNAPSHOT_MAGIC_LEN) != SNAPSHOT_VERSION) {
+        return -1;
+    }
+    uint32_t crc = _get32(buf + SNAPSHOT_FILE_HDR_LEN - sizeof(uint32_t));
+    if (crc != crc32c(0, buf, SNAPSHOT_FILE_HDR_LEN - sizeof(uint32_t))) {
+        return -1;
+    }
+    return 0;
+}
+
+void snapshot_decode_rec_hdr(const char *buf, snapshot_rec_t *rec) {
+    rec->crc = _get32(buf);
+    rec->nbytes = _get32(buf + 4);
+    rec->cas = _get64(buf + 8);
+    rec->flags = _get64(buf + 16);
+    rec->exptime = _get64(buf + 24);
+    rec->rflags = _get16(buf + 32);
+    rec->nkey = (uint8_t)buf[34];
+}
+
+/* Bulk loader.
+ *
+ * The file is mapped into memory and split into contiguous ranges of
+ * records, one per thread. Each thread allocates and fills items without
+ * holding any locks, then links them under the item lock for their hash
+ * bucket. Keys which already exist are left alone, so anything written to
+ * the cache since startup wins over the snapshot.
+ */
+
+struct snapshot_load_range {
+    pthread_t tid;
+    int id;
+    bool started;
+    const char *start;
+    const char *end;
+    time_t now;
+    uint64_t loaded;
+    uint64_t skipped;
+    uint64_t errors;
+};
+
+// copy a flat value plus the trailing \r\n into a (possibly chunked) item.
+static int _load_value(item *it, const char *val, const int vlen) {
+    if ((it->it_flags & ITEM_CHUNKED) == 0) {
+        memcpy(ITEM_data(it), val, vlen);
+        memcpy(ITEM_data(it) + vlen, "\r\n", 2);
+        return 0;
+    }
+
+    item_chunk *ch = (item_chunk *) ITEM_schunk(it);
+    const int total = vlen + 2;
+    int done = 0;
+    while (done < total) {
+        if (ch->size == ch->used) {
+            ch = do_item_alloc_chunk(ch, total - done);
+            if (ch == NULL) {
+                return -1;
+            }
+            continue;
+        }
+        int todo = (ch->size - ch->used < total - done)
+            ? ch->size - ch->used : total - done;
+        int fromval = (done < vlen) ? ((todo < vlen - done) ? todo : vlen - done) : 0;
+        memcpy(ch->data + ch->used, val + done, fromval);
+        if (todo > fromval) {
+            memcpy(ch->data + ch->used + fromval,
+                    "\r\n" + (done + fromval - vlen), todo - fromval);
+        }
+        ch->used += todo;
+        done += todo;
+    }
+    return 0;
+}
+
+static void _load_rec(struct snapshot_load_range *r, const char *p) {
+    snapshot_rec_t rec;
+    snapshot_decode_rec_hdr(p, &rec);
+    size_t len = SNAPSHOT_REC_HDR_LEN + rec.nkey + rec.nbytes;
+    if (rec.nkey > KEY_MAX_LENGTH
+            || rec.crc != crc32c(0, p + sizeof(uint32_t), len - sizeof(uint32_t))) {
+        r->errors++;
+        return;
+    }
+
+    rel_time_t exptime = 0;
+    if (rec.exptime != 0) {
+        if ((time_t)rec.exptime <= r->now) {
+            r->skipped++;
+            return;
+        }
+        exptime = realtime(rec.exptime);
+    }
+
+    const char *key = p + SNAPSHOT_REC_HDR_LEN;
+    item *it = item_alloc(key, rec.nkey, (client_flags_t)rec.flags, exptime,
+            rec.nbytes + 2);
+    if (it == NULL) {
+        r->errors++;
+        return;
+    }
+    if (rec.rflags & SNAPSHOT_REC_KEY_BINARY) {
+        it->it_flags |= ITEM_KEY_BINARY;
+    }
+    if (_load_value(it, key + rec.nkey, rec.nbytes) != 0) {
+        item_remove(it);
+        r->errors++;
+        return;
+    }
+
+    uint32_t hv = hash(key, rec.nkey);
+    item_lock(hv);
+    if (assoc_find(key, rec.nkey, hv) == NULL) {
+        // keep the CAS clients may already hold. snapshot_load() has moved
+        // the counter past every CAS in the file.
+        uint64_t cas = 0;
+        if (settings.use_cas) {
+            cas = rec.cas != 0 ? rec.cas : get_cas_id();
+        }
+        do_item_link(it, hv, cas);
+        r->loaded++;
+    } else {
+        r->skipped++;
+    }
+    item_unlock(hv);
+    item_remove(it);
+}
+
+/* Allocating items can evict, which logs from the allocating thread. Loader
+ * threads come and go with each load while loggers can't be unlinked, so
+ * each range reuses the logger made for it by an earlier load. Loads don't
+ * overlap.
+ */
+static logger *load_loggers[SNAPSHOT_LOAD_MAX_THREADS];
+
+static void *_load_thread(void *arg) {
+    struct snapshot_load_range *r = arg;
+    const char *p = r->start;
+    if (load_loggers[r->id] == NULL) {
+        load_loggers[r->id] = logger_create();
+        if (load_loggers[r->id] == NULL) {
+            fprintf(stderr, "Failed to allocate logger for snapshot load\n");
+            r->errors++;
+            return NULL;
+        }
+    } else {
+        pthread_setspecific(logger_key, load_loggers[r->id]);
+    }
+    while (p < r->end) {
+        _load_rec(r, p);
+        p += SNAPSHOT_REC_HDR_LEN + (uint8_t)p[34] + _get32(p + 4);
+    }
+    return NULL;
+}
+
+/*
+ * Loads every unexpired item from a snapshot file into the cache, using up
+ * to "threads" threads. Blocks until the load is complete. Returns 0 on
+ * success, or -1 if the file couldn't be read or wasn't a complete snapshot.
+ */
+int snapshot_load(const char *path, int threads) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to open snapshot %s: %s\n", path, strerror(errno));
+        goto error;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < SNAPSHOT_FILE_HDR_LEN + SNAPSHOT_REC_HDR_LEN) {
+        fprintf(stderr, "Snapshot %s is too short\n", path);
+        close(fd);
+        goto error;
+    }
+    size_t size = st.st_size;
+    char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Failed to map snapshot %s: %s\n", path, strerror(errno));
+        goto error;
+    }
+    madvise(map, size, MADV_SEQUENTIAL);
+
+    if (snapshot_check_file_hdr(map) != 0) {
+        fprintf(stderr, "Snapshot %s has a bad header\n", path);
+        munmap(map, size);
+        goto error;
+    }
+
+    if (threads < 1) {
+        threads = 1;
+    } else if (threads > SNAPSHOT_LOAD_MAX_THREADS) {
+        threads = SNAPSHOT_LOAD_MAX_THREADS;
+    }
+    struct snapshot_load_range ranges[SNAPSHOT_LOAD_MAX_THREADS];
+    memset(ranges, 0, sizeof(ranges));
+
+    /* Walk the record headers to find the trailer and split the records
+     * into roughly equal sized ranges. This only touches the headers; the
+     * threads do the real work.
+     */
+    const char *p = map + SNAPSHOT_FILE_HDR_LEN;
+    const char *end = map + size;
+    const char *trailer = NULL;
+    uint64_t max_cas = 0;
+    size_t split = (size - SNAPSHOT_FILE_HDR_LEN) / threads + 1;
+    int nranges = 0;
+    ranges[0].start = p;
+    while (end - p >= SNAPSHOT_REC_HDR_LEN) {
+        uint8_t nkey = (uint8_t)p[34];
+        if (nkey == 0) {
+            trailer = p;
+            break;
+        }
+        size_t len = SNAPSHOT_REC_HDR_LEN + nkey + (size_t)_get32(p + 4);
+        if ((size_t)(end - p) < len) {
+            break;
+        }
+        uint64_t cas = _get64(p + 8);
+        if (cas > max_cas) {
+            max_cas = cas;
+        }
+        p += len;
+        if ((size_t)(p - ranges[nranges].start) >= split && nranges < threads - 1) {
+            ranges[nranges].end = p;
+            ranges[++nranges].start = p;
+        }
+    }
+    if (trailer == NULL) {
+        fprintf(stderr, "Snapshot %s is truncated\n", path);
+        munmap(map, size);
+        goto error;
+    }
+    ranges[nranges].end = trailer;
+    nranges++;
+    // items stored while we load must not reuse a CAS from the file.
+    if (settings.use_cas) {
+        raise_cas_id(max_cas);
+    }
+
+    time_t now = time(NULL);
+    for (int x = 0; x < nranges; x++) {
+        ranges[x].id = x;
+        ranges[x].now = now;
+    }
+    // the calling thread takes the first range.
+    for (int x = 1; x < nranges; x++) {
+        if (pthread_create(&ranges[x].tid, NULL, _load_thread, &ranges[x]) == 0) {
+            ranges[x].started = true;
+        } else {
+            // just do it ourselves.
+            _load_thread(&ranges[x]);
+        }
+    }
+    _load_thread(&ranges[0]);
+
+    uint64_t loaded = 0, skipped = 0, errors = 0;
+    for (int x = 0; x < nranges; x++) {
+        if (ranges[x].started) {
+            pthread_join(ranges[x].tid, NULL);
+        }
+        loaded += ranges[x].loaded;
+        skipped += ranges[x].skipped;
+        errors += ranges[x].errors;
+    }
+    munmap(map, size);
+
+    if (settings.verbose > 0) {
+        fprintf(stderr, "Snapshot %s loaded: %llu items, %llu skipped, %llu errors\n",
+                path, (unsigned long long)loaded, (unsigned long long)skipped,
+                (unsigned long long)errors);
+    }
+
+    STATS_LOCK();
+    stats.snapshot_loads++;
+    stats.snapshot_loaded_items += loaded;
+    stats.snapshot_load_skipped += skipped;
+    stats.snapshot_load_errors += errors;
+    STATS_UNLOCK();
+    return 0;
+error:
+    STATS_LOCK();
+    stats.snapshot_load_errors++;
+    STATS_UNLOCK();
+    return -1;
+}
+
+/* Loads triggered by the "snapshot load" command run in the background, one
+ * at a time.
+ */
+struct snapshot_load_args {
+    char *path;
+    int threads;
+};
+
+static pthread_mutex_t snapshot_load_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool snapshot_loading = false;
+
+static void *_load_bg_thread(void *arg) {
+    struct snapshot_load_args *a = arg;
+    snapshot_load(a->path, a->threads);
+    free(a->path);
+    free(a);
+    pthread_mutex_lock(&snapshot_load_lock);
+    snapshot_loading = false;
+    pthread_mutex_unlock(&snapshot_load_lock);
+    return NULL;
+}
+
+// returns -1 if a load is already running, -2 on other errors.
+int snapshot_load_start(const char *path, int threads) {
+    pthread_mutex_lock(&snapshot_load_lock);
+    if (snapshot_loading) {
+        pthread_mutex_unlock(&snapshot_load_lock);
+        return -1;
+    }
+
+    struct snapshot_load_args *a = calloc(1, sizeof(*a));
+    if (a == NULL || (a->path = strdup(path)) == NULL) {
+        free(a);
+        pthread_mutex_unlock(&snapshot_load_lock);
+        return -2;
+    }
+    a->threads = threads;
+    snapshot_loading = true;
+
+    pthread_t tid;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&tid, &attr, _load_bg_thread, a) != 0) {
+        pthread_attr_destroy(&attr);
+        free(a->path);
+        free(a);
+        snapshot_loading = false;
+        pthread_mutex_unlock(&snapshot_load_lock);
+        return -2;
+    }
+    pthread_attr_destroy(&attr);
+    pthread_mutex_unlock(&snapshot_load_lock);
+    return 0;
+}
@@ -0,0 +1,59 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+/* Binary item snapshot files.
+ *
+ * Written by the "lru_crawler snapshot" crawler module to pre-warm other
+ * nodes. All integers are stored in network byte order.
+ *
+ * The file starts with a header:
+ *   magic "MCSNAP", uint16 version, uint64 creation time (unix),
+ *   uint32 reserved, uint32 crc32c of the preceding bytes.
+ *
+ * Followed by one record per item:
+ *   uint32 crc32c of the rest of the record, including key and value
+ *   uint32 value length (without the trailing \r\n)
+ *   uint64 cas
+ *   uint64 client flags
+ *   uint64 expiration time (unix), 0 for none
+ *   uint16 record flags (SNAPSHOT_REC_*)
+ *   uint8  key length
+ *   uint8  reserved
+ *   key, value
+ *
+ * The file ends with a record with a key length of zero, whose cas field
+ * holds the number of items written. A snapshot without this trailer was
+ * not completed.
+ */
+
+#define SNAPSHOT_MAGIC "MCSNAP"
+#define SNAPSHOT_MAGIC_LEN 6
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_FILE_HDR_LEN 24
+#define SNAPSHOT_REC_HDR_LEN 36
+
+/* record flags */
+#define SNAPSHOT_REC_KEY_BINARY 1
+
+typedef struct {
+    uint32_t crc;
+    uint32_t nbytes;
+    uint64_t cas;
+    uint64_t flags;
+    uint64_t exptime;
+    uint16_t rflags;
+    uint8_t nkey;
+} snapshot_rec_t;
+
+void snapshot_encode_file_hdr(char *buf, uint64_t created);
+void snapshot_encode_rec_hdr(char *buf, const snapshot_rec_t *rec);
+void snapshot_seal_rec(char *buf, size_t len);
+int snapshot_check_file_hdr(const char *buf);
+void snapshot_decode_rec_hdr(const char *buf, snapshot_rec_t *rec);
+
+#define SNAPSHOT_LOAD_MAX_THREADS 64
+
+int snapshot_load(const char *path, int threads);
+int snapshot_load_start(const char *path, int threads);
+
+#endif
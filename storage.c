@@ -44,6 +44,7 @@ typedef struct _io_pending_storage_t {
     bool miss;                /* signal a miss to unlink hdr_it */
     bool badcrc;              /* signal a crc failure */
     bool active;              /* tells if IO was dispatched or not */
+    bool range;               /* read part of the value into its own item */
 } io_pending_storage_t;
 
 static pthread_t storage_compact_tid;
@@ -68,6 +69,69 @@ void storage_delete(void *e, item *it) {
     }
 }
 
+struct storage_read_wrap {
+    obj_io io;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool done;
+    bool miss;
+};
+
+static void _storage_read_item_cb(void *e, obj_io *io, int ret) {
+    struct storage_read_wrap *wrap = (struct storage_read_wrap *)io->data;
+    pthread_mutex_lock(&wrap->lock);
+    wrap->miss = (ret < 1);
+    wrap->done = true;
+    pthread_cond_signal(&wrap->cond);
+    pthread_mutex_unlock(&wrap->lock);
+}
+
+// Synchronously read back the full item for a header item into a flat
+// malloc'ed buffer, validating the crc. Returns NULL if the item was lost.
+// This blocks on the background IO thread, so it is only for use by
+// background threads; the caller must hold a reference to the header.
+item *storage_read_item(void *e, item *it) {
+    struct storage_read_wrap wrap;
+    item_hdr hdr;
+    memcpy(&hdr, ITEM_data(it), sizeof(hdr));
+    size_t ntotal = ITEM_ntotal(it);
+    char *buf = malloc(ntotal);
+    if (buf == NULL) {
+        return NULL;
+    }
+
+    memset(&wrap, 0, sizeof(wrap));
+    pthread_mutex_init(&wrap.lock, NULL);
+    pthread_cond_init(&wrap.cond, NULL);
+    wrap.io.data = &wrap;
+    wrap.io.buf = buf;
+    wrap.io.len = ntotal;
+    wrap.io.page_version = hdr.page_version;
+    wrap.io.page_id = hdr.page_id;
+    wrap.io.offset = hdr.offset;
+    wrap.io.mode = OBJ_IO_READ;
+    wrap.io.cb = _storage_read_item_cb;
+
+    pthread_mutex_lock(&wrap.lock);
+    extstore_submit_bg(e, &wrap.io);
+    while (!wrap.done) {
+        pthread_cond_wait(&wrap.cond, &wrap.lock);
+    }
+    pthread_mutex_unlock(&wrap.lock);
+    pthread_mutex_destroy(&wrap.lock);
+    pthread_cond_destroy(&wrap.cond);
+
+    if (!wrap.miss) {
+        item *read_it = (item *)buf;
+        uint32_t crc = (uint32_t) read_it->exptime;
+        if (crc == crc32c(0, buf+STORE_OFFSET, ntotal-STORE_OFFSET)) {
+            return read_it;
+        }
+    }
+    free(buf);
+    return NULL;
+}
+
 // Function for the extra stats called from a protocol.
 // NOTE: This either needs a name change or a wrapper, perhaps?
 // it's defined here to reduce exposure of extstore.h to the rest of memcached
@@ -153,6 +217,8 @@ static void _storage_get_item_cb(void *e, obj_io *io, int ret) {
     // TODO: How to do counters for hit/misses?
     if (ret < 1) {
         miss = true;
+    } else if (p->range) {
+        // the crc covers the whole object; a range read can't check it.
     } else {
         uint32_t crc2;
         uint32_t crc = (uint32_t) read_it->exptime;
@@ -246,14 +312,78 @@ static void _storage_get_item_cb(void *e, obj_io *io, int ret) {
     return_io_pending((io_pending_t *)p);
 }
 
-int storage_get_item(conn *c, item *it, mc_resp *resp) {
+static io_pending_storage_t *_storage_pending_new(conn *c, item *it,
+        mc_resp *resp) {
+    io_pending_storage_t *p = do_cache_alloc(c->thread->io_cache);
+    // this is a re-cast structure, so assert that we never outsize it.
+    assert(sizeof(io_pending_t) >= sizeof(io_pending_storage_t));
+    if (p == NULL)
+        return NULL;
+    memset(p, 0, sizeof(io_pending_storage_t));
+    p->active = true;
+    p->miss = false;
+    p->badcrc = false;
+    p->noreply = c->noreply;
+    p->thread = c->thread;
+    p->return_cb = storage_return_cb;
+    p->finalize_cb = storage_finalize_cb;
+    // io_pending owns the reference for this object now.
+    p->hdr_it = it;
+    p->resp = resp;
+    p->io_queue_type = IO_QUEUE_EXTSTORE;
+    return p;
+}
+
+// Stacks the read for submission. Once called, mc_resp owns the IO.
+static void _storage_pending_queue(conn *c, io_pending_storage_t *p,
+        item *buf_it, unsigned int off, unsigned int len) {
+    io_queue_t *q = conn_io_queue_get(c, IO_QUEUE_EXTSTORE);
+    obj_io *eio = &p->io_ctx;
 #ifdef NEED_ALIGN
     item_hdr hdr;
-    memcpy(&hdr, ITEM_data(it), sizeof(hdr));
+    memcpy(&hdr, ITEM_data(p->hdr_it), sizeof(hdr));
 #else
-    item_hdr *hdr = (item_hdr *)ITEM_data(it);
+    item_hdr *hdr = (item_hdr *)ITEM_data(p->hdr_it);
 #endif
-    io_queue_t *q = conn_io_queue_get(c, IO_QUEUE_EXTSTORE);
+
+    p->resp->io_pending = (io_pending_t *)p;
+
+    eio->buf = (void *)buf_it;
+    p->c = c;
+
+    // We need to stack the sub-struct IO's together for submission.
+    eio->next = q->stack_ctx;
+    q->stack_ctx = eio;
+
+    // No need to stack the io_pending's together as they live on mc_resp's.
+    assert(q->count >= 0);
+    q->count++;
+    // reference ourselves for the callback.
+    eio->data = (void *)p;
+
+    // Now, fill in io->io based on what was in our header.
+#ifdef NEED_ALIGN
+    eio->page_version = hdr.page_version;
+    eio->page_id = hdr.page_id;
+    eio->offset = hdr.offset + off;
+#else
+    eio->page_version = hdr->page_version;
+    eio->page_id = hdr->page_id;
+    eio->offset = hdr->offset + off;
+#endif
+    eio->len = len;
+    eio->mode = OBJ_IO_READ;
+    eio->cb = _storage_get_item_cb;
+
+    // FIXME: This stat needs to move to reflect # of flash hits vs misses
+    // for now it's a good gauge on how often we request out to flash at
+    // least.
+    pthread_mutex_lock(&c->thread->stats.mutex);
+    c->thread->stats.get_extstore++;
+    pthread_mutex_unlock(&c->thread->stats.mutex);
+}
+
+int storage_get_item(conn *c, item *it, mc_resp *resp) {
     size_t ntotal = ITEM_ntotal(it);
     unsigned int clsid = slabs_clsid(ntotal);
     item *new_it;
@@ -273,21 +403,15 @@ int storage_get_item(conn *c, item *it, mc_resp *resp) {
     // so we can free the chunk on a miss
     new_it->slabs_clsid = clsid;
 
-    io_pending_storage_t *p = do_cache_alloc(c->thread->io_cache);
-    // this is a re-cast structure, so assert that we never outsize it.
-    assert(sizeof(io_pending_t) >= sizeof(io_pending_storage_t));
-    memset(p, 0, sizeof(io_pending_storage_t));
-    p->active = true;
-    p->miss = false;
-    p->badcrc = false;
-    p->noreply = c->noreply;
-    p->thread = c->thread;
-    p->return_cb = storage_return_cb;
-    p->finalize_cb = storage_finalize_cb;
-    // io_pending owns the reference for this object now.
-    p->hdr_it = it;
-    p->resp = resp;
-    p->io_queue_type = IO_QUEUE_EXTSTORE;
+    io_pending_storage_t *p = _storage_pending_new(c, it, resp);
+    if (p == NULL) {
+        if (chunked) {
+            item_remove(new_it);
+        } else {
+            slabs_free(new_it, ntotal, clsid);
+        }
+        return -1;
+    }
     obj_io *eio = &p->io_ctx;
 
     // FIXME: error handling.
@@ -342,43 +466,80 @@ int storage_get_item(conn *c, item *it, mc_resp *resp) {
     }
 
     // We can't bail out anymore, so mc_resp owns the IO from here.
-    resp->io_pending = (io_pending_t *)p;
+    _storage_pending_queue(c, p, new_it, 0, ntotal);
 
-    eio->buf = (void *)new_it;
-    p->c = c;
+    return 0;
+}
 
-    // We need to stack the sub-struct IO's together for submission.
-    eio->next = q->stack_ctx;
-    q->stack_ctx = eio;
+/*
+ * Reads len bytes of the value starting at off, without the line end. Only
+ * that slice is read from flash, into a temporary item of its own size, so
+ * the object's crc can't be checked.
+ */
+int storage_get_range(conn *c, item *it, mc_resp *resp, unsigned int off,
+        unsigned int len) {
+    client_flags_t flags;
+    unsigned int ciovcnt = 0;
+    item *new_it;
 
-    // No need to stack the io_pending's together as they live on mc_resp's.
-    assert(q->count >= 0);
-    q->count++;
-    // reference ourselves for the callback.
-    eio->data = (void *)p;
+    assert(len > 0 && off + len <= (unsigned int)it->nbytes - 2);
+    FLAGS_CONV(it, flags);
+    // items can't be smaller than a line end; the extra room goes unused.
+    new_it = item_alloc(ITEM_key(it), it->nkey, flags, it->exptime, len + 2);
+    if (new_it == NULL)
+        return -1;
 
-    // Now, fill in io->io based on what was in our header.
-#ifdef NEED_ALIGN
-    eio->page_version = hdr.page_version;
-    eio->page_id = hdr.page_id;
-    eio->offset = hdr.offset;
-#else
-    eio->page_version = hdr->page_version;
-    eio->page_id = hdr->page_id;
-    eio->offset = hdr->offset;
-#endif
-    eio->len = ntotal;
-    eio->mode = OBJ_IO_READ;
-    eio->cb = _storage_get_item_cb;
+    io_pending_storage_t *p = _storage_pending_new(c, it, resp);
+    if (p == NULL) {
+        item_remove(new_it);
+        return -1;
+    }
+    p->range = true;
+    obj_io *eio = &p->io_ctx;
 
-    // FIXME: This stat needs to move to reflect # of flash hits vs misses
-    // for now it's a good gauge on how often we request out to flash at
-    // least.
-    pthread_mutex_lock(&c->thread->stats.mutex);
-    c->thread->stats.get_extstore++;
-    pthread_mutex_unlock(&c->thread->stats.mutex);
+    if (new_it->it_flags & ITEM_CHUNKED) {
+        size_t remain = len;
+        item_chunk *chunk = (item_chunk *) ITEM_schunk(new_it);
+        eio->iov = malloc(sizeof(struct iovec) * IOV_MAX);
+        if (eio->iov == NULL)
+            goto fail;
+        while (remain > 0) {
+            chunk = do_item_alloc_chunk(chunk, remain);
+            if (chunk == NULL || ciovcnt > IOV_MAX-1)
+                goto fail;
+            eio->iov[ciovcnt].iov_base = chunk->data;
+            eio->iov[ciovcnt].iov_len = (remain < chunk->size) ? remain : chunk->size;
+            chunk->used = eio->iov[ciovcnt].iov_len;
+            remain -= chunk->used;
+            ciovcnt++;
+        }
+    } else {
+        eio->iov = malloc(sizeof(struct iovec));
+        if (eio->iov == NULL)
+            goto fail;
+        eio->iov[0].iov_base = ITEM_data(new_it);
+        eio->iov[0].iov_len = len;
+        ciovcnt++;
+    }
+    eio->iovcnt = ciovcnt;
 
+    p->iovec_data = resp->iovcnt;
+    if (new_it->it_flags & ITEM_CHUNKED) {
+        resp_add_chunked_iov(resp, new_it, len);
+    } else {
+        resp_add_iov(resp, "", len);
+    }
+
+    // the value starts after the stored item's header.
+    _storage_pending_queue(c, p, new_it,
+            ITEM_ntotal(it) - it->nbytes + off, len);
     return 0;
+fail:
+    free(eio->iov);
+    eio->iov = NULL;
+    item_remove(new_it);
+    do_cache_free(c->thread->io_cache, p);
+    return -1;
 }
 
 void storage_submit_cb(io_queue_t *q) {
@@ -400,7 +561,22 @@ static void recache_or_free(io_pending_t *pending) {
     item *it = (item *)io->buf;
     assert(c != NULL);
     bool do_free = true;
-    if (p->active) {
+    if (p->range) {
+        // never recache a partial value.
+        if (p->active) {
+            io_queue_t *q = conn_io_queue_get(c, p->io_queue_type);
+            q->count--;
+            assert(q->count >= 0);
+            pthread_mutex_lock(&c->thread->stats.mutex);
+            c->thread->stats.get_aborted_extstore++;
+            pthread_mutex_unlock(&c->thread->stats.mutex);
+        } else if (p->miss) {
+            item_unlink(p->hdr_it);
+            pthread_mutex_lock(&c->thread->stats.mutex);
+            c->thread->stats.miss_from_extstore++;
+            pthread_mutex_unlock(&c->thread->stats.mutex);
+        }
+    } else if (p->active) {
         // If request never dispatched, free the read buffer but leave the
         // item header alone.
         do_free = false;
@@ -505,7 +681,7 @@ static int storage_write(void *storage, const int clsid, const int item_age) {
     /* First, storage for the header object */
     size_t orig_ntotal = ITEM_ntotal(it);
     client_flags_t flags;
-    if ((it->it_flags & ITEM_HDR) == 0 &&
+    if ((it->it_flags & (ITEM_HDR | ITEM_COUNTER)) == 0 &&
             (item_age == 0 || current_time - it->time > item_age)) {
         FLAGS_CONV(it, flags);
         item *hdr_it = do_item_alloc(ITEM_key(it), it->nkey, flags, it->exptime, sizeof(item_hdr));
@@ -16,6 +16,9 @@ void storage_stats(ADD_STAT add_stats, void *c);
 void process_extstore_stats(ADD_STAT add_stats, void *c);
 bool storage_validate_item(void *e, item *it);
 int storage_get_item(conn *c, item *it, mc_resp *resp);
+int storage_get_range(conn *c, item *it, mc_resp *resp, unsigned int off,
+        unsigned int len);
+item *storage_read_item(void *e, item *it);
 
 // callback for the IO queue subsystem.
 void storage_submit_cb(io_queue_t *q);
@@ -0,0 +1,139 @@
+#!/usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+# Appends to chunked items extend the chunk chain instead of copying the value
+# into a new item, unless someone else is still reading the old value.
+
+my $server = new_memcached('-m 128 -I 8m -o slab_chunk_max=16');
+my $sock = $server->sock;
+
+sub inplace {
+    return mem_stats($sock)->{inplace_appends};
+}
+
+sub gets_cas {
+    my $key = shift;
+    print $sock "gets $key\r\n";
+    my $hdr = scalar <$sock>;
+    my ($len, $cas) = $hdr =~ /^VALUE \S+ \d+ (\d+) (\d+)/;
+    read($sock, my $buf, $len + 7);
+    return $cas;
+}
+
+is(inplace(), 0, "no in-place appends yet");
+
+# small items are always copied.
+{
+    print $sock "set small 0 0 3\r\nfoo\r\n";
+    is(scalar <$sock>, "STORED\r\n", "stored small item");
+    print $sock "append small 0 0 3\r\nbar\r\n";
+    is(scalar <$sock>, "STORED\r\n", "appended to small item");
+    mem_get_is($sock, "small", "foobar");
+    is(inplace(), 0, "small item copied");
+}
+
+{
+    my $str = join(':', 1 .. 5000);
+    my $len = length($str);
+    print $sock "set log 5 0 $len\r\n$str\r\n";
+    is(scalar <$sock>, "STORED\r\n", "stored chunked item");
+    my $cas = gets_cas("log");
+
+    my $bad = 0;
+    for my $n (1 .. 2000) {
+        # vary the size so appends land on and across chunk boundaries.
+        my $part = "<$n>" . ("z" x ($n % 37));
+        $str .= $part;
+        my $plen = length($part);
+        print $sock "append log 0 0 $plen\r\n$part\r\n";
+        $bad++ unless scalar <$sock> eq "STORED\r\n";
+        if ($n % 100 == 0) {
+            print $sock "get log\r\n";
+            $bad++ unless scalar <$sock> eq "VALUE log 5 " . length($str) . "\r\n";
+            $bad++ unless scalar <$sock> eq "$str\r\n";
+            $bad++ unless scalar <$sock> eq "END\r\n";
+        }
+    }
+    is($bad, 0, "appends all stored and read back intact");
+    mem_get_is({ sock => $sock, flags => 5 }, "log", $str, "log value");
+    # reads leave the item queued for an LRU bump for a moment, holding a
+    # reference, so a few appends right after them get copied.
+    cmp_ok(inplace(), '>', 1900, "appends were done in place");
+
+    my $newcas = gets_cas("log");
+    isnt($newcas, $cas, "CAS changed");
+    print $sock "cas log 0 0 3 $cas\r\nabc\r\n";
+    is(scalar <$sock>, "EXISTS\r\n", "old CAS rejected");
+    print $sock "mg log c\r\n";
+    like(scalar <$sock>, qr/^HD c$newcas\r\n/, "mg sees the new CAS");
+    print $sock "ms log 4 MA C$newcas c\r\ntail\r\n";
+    like(scalar <$sock>, qr/^HD c(\d+)\r\n/, "meta append with CAS");
+    $str .= "tail";
+    mem_get_is({ sock => $sock, flags => 5 }, "log", $str, "log value");
+
+    # a chunked payload onto a chunked item.
+    my $big = "Q" x 40000;
+    print $sock "append log 0 0 40000\r\n$big\r\n";
+    is(scalar <$sock>, "STORED\r\n", "appended chunked payload");
+    $str .= $big;
+    mem_get_is({ sock => $sock, flags => 5 }, "log", $str, "log value");
+
+    # prepend still copies.
+    my $n = inplace();
+    print $sock "prepend log 0 0 4\r\nhead\r\n";
+    is(scalar <$sock>, "STORED\r\n", "prepended");
+    $str = "head" . $str;
+    mem_get_is({ sock => $sock, flags => 5 }, "log", $str, "log value");
+    is(inplace(), $n, "prepend not done in place");
+
+    print $sock "delete log\r\n";
+    is(scalar <$sock>, "DELETED\r\n", "deleted log");
+    print $sock "delete small\r\n";
+    is(scalar <$sock>, "DELETED\r\n", "deleted small");
+    is(mem_stats($sock)->{bytes}, 0, "byte counts add up after growing");
+}
+
+# going past the item size limit fails the same way as a copy would.
+{
+    my $val = "L" x (8 * 1024 * 1024 - 1024);
+    print $sock "set nearmax 0 0 " . length($val) . "\r\n$val\r\n";
+    is(scalar <$sock>, "STORED\r\n", "stored item near the size limit");
+    my $part = "M" x 2048;
+    print $sock "append nearmax 0 0 2048\r\n$part\r\n";
+    like(scalar <$sock>, qr/^SERVER_ERROR|^NOT_STORED/, "append over the limit refused");
+    print $sock "mg nearmax s\r\n";
+    is(scalar <$sock>, "HD s" . length($val) . "\r\n", "value unchanged");
+}
+
+# while another connection is still sending the old value, the append must
+# not touch it.
+{
+    my $val = join('', map { chr(65 + $_ % 26) } 1 .. 6 * 1024 * 1024);
+    my $len = length($val);
+    print $sock "set busy 0 0 $len\r\n$val\r\n";
+    is(scalar <$sock>, "STORED\r\n", "stored large item");
+
+    my $reader = $server->new_sock;
+    print $reader "get busy\r\n";
+    # let the server fill the socket buffers and stall on the rest.
+    select(undef, undef, undef, 0.3);
+
+    my $n = inplace();
+    print $sock "append busy 0 0 5\r\nextra\r\n";
+    is(scalar <$sock>, "STORED\r\n", "appended while being read");
+    is(inplace(), $n, "copied since the item was in use");
+
+    is(scalar <$reader>, "VALUE busy 0 $len\r\n", "reader got the old header");
+    read($reader, my $got, $len + 2);
+    ok($got eq "$val\r\n", "reader got the old value intact");
+    is(scalar <$reader>, "END\r\n", "reader got END");
+    mem_get_is($sock, "busy", $val . "extra", "append landed in a new item");
+}
+
+done_testing();
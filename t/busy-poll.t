@@ -0,0 +1,63 @@
+#!/usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached("-t 2 -o busy_poll=200");
+my $sock = $server->sock;
+
+my $stats = mem_stats($sock, ' settings');
+is($stats->{busy_poll}, 200, "busy_poll set");
+
+for my $k (1 .. 100) {
+    print $sock "set bp$k 0 0 " . length($k) . "\r\n$k\r\n";
+    is(scalar <$sock>, "STORED\r\n", "stored bp$k");
+}
+
+# requests spaced out further than the budget put the worker back to sleep.
+my $hits = 0;
+for my $k (1 .. 10) {
+    print $sock "get bp$k\r\n";
+    $hits++ if scalar <$sock> eq "VALUE bp$k 0 " . length($k) . "\r\n"
+        && scalar <$sock> eq "$k\r\n" && scalar <$sock> eq "END\r\n";
+    select(undef, undef, undef, 0.01);
+}
+is($hits, 10, "fetched while polling");
+
+# other connections and the notify queue still work.
+{
+    my @socks = map { $server->new_sock } 1 .. 10;
+    my $ok = 0;
+    for my $s (@socks) {
+        print $s "mg bp5 v\r\n";
+    }
+    for my $s (@socks) {
+        $ok++ if scalar <$s> eq "VA 1\r\n" && scalar <$s> eq "5\r\n";
+    }
+    is($ok, 10, "new connections served");
+}
+
+$stats = mem_stats($sock);
+cmp_ok($stats->{busy_poll_sleeps}, '>', 0, "workers went back to sleep");
+cmp_ok($stats->{busy_poll_spin_us}, '>', 0, "spin time counted");
+ok(exists $stats->{busy_poll_work_us}, "work time counted");
+
+# idle workers stop spinning once the budget runs out. A worker that kept
+# spinning would add close to a second of spin time per worker here. This
+# is counted in wall time, so it doesn't depend on how busy the host is.
+{
+    sleep 0.5;
+    my $before = mem_stats($sock);
+    sleep 1;
+    my $after = mem_stats($sock);
+    cmp_ok($after->{busy_poll_spin_us} - $before->{busy_poll_spin_us}, '<',
+        250_000, "idle server isn't spinning");
+    cmp_ok($after->{busy_poll_sleeps}, '>', $before->{busy_poll_sleeps},
+        "worker went back to sleep after the stats request");
+}
+
+done_testing();
@@ -15,6 +15,12 @@ my $sock = $server->sock;
 # worker threads, which ends up being a lot of memory for a quick test.
 # So we use a high worker thread count to split them down more.
 
+# small responses get copied together into one response object, so use a
+# value too large for that.
+my $val = 'x' x 512;
+print $sock "set foo 0 0 512\r\n$val\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored foo");
+
 {
     # easiest method is an ascii multiget.
     my $key = 'foo';
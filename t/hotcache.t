@@ -0,0 +1,143 @@
+#!/usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+# -o hot_cache_items=N lets each worker serve the keys it gets hit hardest on
+# from its own cache, which must never return anything a regular get wouldn't.
+
+my $server = new_memcached('-t 1 -o hot_cache_items=16,hot_cache_hits=5,'
+    . 'slab_chunk_max=16');
+my $sock = $server->sock;
+
+my $settings = mem_stats($sock, ' settings');
+is($settings->{hot_cache_items}, 16, "hot_cache_items set");
+is($settings->{hot_cache_hits}, 5, "hot_cache_hits set");
+
+sub hot_hits {
+    return mem_stats($sock)->{hot_cache_hits};
+}
+
+# gets the key often enough to have it cached.
+sub heat {
+    my $key = shift;
+    my $before = hot_hits();
+    print $sock "get $key\r\n" x 10;
+    for (1 .. 10) {
+        while (my $line = <$sock>) {
+            last if $line eq "END\r\n";
+        }
+    }
+    cmp_ok(hot_hits(), '>', $before, "$key cached");
+}
+
+{
+    print $sock "set foo 3 0 3\r\nbar\r\n";
+    is(scalar <$sock>, "STORED\r\n", "stored foo");
+    is(hot_hits(), 0, "nothing cached yet");
+    heat("foo");
+    cmp_ok(hot_hits(), '>', 0, "served from the cache");
+
+    my $before = hot_hits();
+    mem_get_is({ sock => $sock, flags => 3 }, 'foo', 'bar',
+        "cached value");
+    is(hot_hits(), $before + 1, "one more hit");
+
+    print $sock "gets foo\r\n";
+    my ($cas) = (scalar <$sock>) =~ /^VALUE foo 3 3 (\d+)/;
+    ok($cas, "gets from the cache has a CAS");
+    is(scalar <$sock>, "bar\r\n", "gets value");
+    is(scalar <$sock>, "END\r\n", "gets end");
+    print $sock "mg foo c\r\n";
+    is(scalar <$sock>, "HD c$cas\r\n", "same CAS as the item");
+    is(hot_hits(), $before + 2, "mg isn't served from the cache");
+
+    print $sock "set foo 3 0 3\r\nbaz\r\n";
+    is(scalar <$sock>, "STORED\r\n", "replaced foo");
+    mem_get_is({ sock => $sock, flags => 3 }, 'foo', 'baz',
+        "replaced value");
+
+    # responses still sending the old item when it's replaced.
+    heat("foo");
+    print $sock "get foo\r\n" x 5 . "set foo 3 0 3\r\nnew\r\n"
+        . "get foo\r\n" x 5;
+    my $old = "VALUE foo 3 3\r\nbaz\r\nEND\r\n";
+    my $new = "VALUE foo 3 3\r\nnew\r\nEND\r\n";
+    my $want = $old x 5 . "STORED\r\n" . $new x 5;
+    read($sock, my $got, length($want));
+    is($got, $want, "old value, then the new one");
+
+    print $sock "delete foo\r\n";
+    is(scalar <$sock>, "DELETED\r\n", "deleted foo");
+    mem_get_is($sock, 'foo', undef, "deleted item not served");
+}
+
+# changes made to the value in place must not be hidden by the cache.
+{
+    print $sock "set num 0 0 2\r\n10\r\n";
+    is(scalar <$sock>, "STORED\r\n", "stored num");
+    heat("num");
+    print $sock "incr num 5\r\n";
+    is(scalar <$sock>, "15\r\n", "incr");
+    mem_get_is($sock, 'num', 15, "incremented value");
+
+    my $val = 'x' x 50000;
+    print $sock "set big 0 0 50000\r\n$val\r\n";
+    is(scalar <$sock>, "STORED\r\n", "stored chunked item");
+    heat("big");
+    print $sock "append big 0 0 3\r\nend\r\n";
+    is(scalar <$sock>, "STORED\r\n", "appended");
+    mem_get_is($sock, 'big', $val . 'end', "appended value");
+
+    print $sock "set tmp 0 0 3\r\ntmp\r\n";
+    is(scalar <$sock>, "STORED\r\n", "stored tmp");
+    heat("tmp");
+    print $sock "touch tmp -1\r\n";
+    is(scalar <$sock>, "TOUCHED\r\n", "expired by touch");
+    mem_get_is($sock, 'tmp', undef, "expired item not served");
+
+    print $sock "set gone 0 0 4\r\ngone\r\n";
+    is(scalar <$sock>, "STORED\r\n", "stored gone");
+    heat("gone");
+    print $sock "flush_all\r\n";
+    is(scalar <$sock>, "OK\r\n", "flushed");
+    mem_get_is($sock, 'gone', undef, "flushed item not served");
+}
+
+# cached items are let go of after a couple of seconds.
+{
+    print $sock "set short 0 2 5\r\nshort\r\n";
+    is(scalar <$sock>, "STORED\r\n", "stored short lived item");
+    heat("short");
+    mem_get_is($sock, 'short', 'short', "cached");
+    sleep(3.2);
+    mem_get_is($sock, 'short', undef, "expired");
+    print $sock "set long 0 0 4\r\nlong\r\n";
+    is(scalar <$sock>, "STORED\r\n", "stored long");
+    heat("long");
+    sleep(4);
+    my $before = hot_hits();
+    mem_get_is($sock, 'long', 'long', "still there");
+    is(hot_hits(), $before, "dropped from the cache");
+}
+
+# stats reset
+{
+    print $sock "stats reset\r\n";
+    is(scalar <$sock>, "RESET\r\n", "stats reset");
+    is(hot_hits(), 0, "hits reset");
+}
+
+{
+    my $off = new_memcached();
+    my $s = mem_stats($off->sock, ' settings');
+    is($s->{hot_cache_items}, 0, "off by default");
+    eval { new_memcached('-o hot_cache_items=5000') };
+    ok($@, "too many entries refused");
+}
+
+done_testing();
@@ -0,0 +1,125 @@
+#!/usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+# -o hotkey_sample=N tracks the most looked up keys per worker, merged by
+# "stats hotkeys".
+
+my $server = new_memcached('-t 2 -o hotkey_sample=1,hotkey_slots=16');
+my $sock = $server->sock;
+my $other = $server->new_sock;
+
+my $settings = mem_stats($sock, ' settings');
+is($settings->{hotkey_sample}, 1, "hotkey_sample set");
+is($settings->{hotkey_slots}, 16, "hotkey_slots set");
+
+for my $k (qw(hot warm big)) {
+    my $val = $k eq 'big' ? 'B' x 10000 : $k;
+    print $sock "set $k 0 0 " . length($val) . "\r\n$val\r\n";
+    is(scalar <$sock>, "STORED\r\n", "stored $k");
+}
+
+sub gets {
+    my ($s, $key, $n) = @_;
+    print $s "mg $key v\r\n" x $n . "mn\r\n";
+    while (my $line = <$s>) {
+        last if $line eq "MN\r\n";
+    }
+}
+
+# two connections, so the counts are likely spread over both workers.
+gets($sock, "hot", 300);
+gets($other, "hot", 300);
+gets($sock, "warm", 200);
+gets($other, "big", 50);
+# a long tail of keys seen once churns through the table.
+for my $n (1 .. 500) {
+    gets($n % 2 ? $sock : $other, "cold$n", 1);
+}
+
+{
+    my $s = mem_stats($sock, ' hotkeys 3');
+    is($s->{hotkeys_sample}, 1, "sample rate reported");
+    is($s->{'hotkey:1:key'}, 'hot', "hottest key first");
+    cmp_ok($s->{'hotkey:1:requests'}, '>=', 601, "hot requests counted");
+    cmp_ok($s->{'hotkey:1:requests'} - $s->{'hotkey:1:error'}, '<=', 601,
+        "error bounds the overcount");
+    is($s->{'hotkey:1:bytes'}, 600 * 3, "bytes of the hits");
+    is($s->{'hotkey:2:key'}, 'warm', "second key");
+    is($s->{'hotkey:3:key'}, 'big', "third key");
+    ok(!exists $s->{'hotkey:4:key'}, "only the top 3");
+
+    $s = mem_stats($sock, ' hotkeys 1 bytes');
+    is($s->{'hotkey:1:key'}, 'big', "sorted by bytes");
+    cmp_ok($s->{'hotkey:1:bytes'}, '>=', 50 * 10000, "big bytes counted");
+    cmp_ok($s->{'hotkey:1:bytes_per_sec'}, '>', 0, "byte rate");
+    ok(!exists $s->{'hotkey:2:key'}, "only the top 1");
+
+    print $sock "stats hotkeys zero\r\n";
+    is(scalar <$sock>, "CLIENT_ERROR bad command line format\r\n",
+        "bad argument");
+}
+
+{
+    print $sock "stats reset\r\n";
+    is(scalar <$sock>, "RESET\r\n", "stats reset");
+    my $s = mem_stats($sock, ' hotkeys');
+    ok(!exists $s->{'hotkey:1:key'}, "reset clears the keys");
+    gets($sock, "warm", 5);
+    $s = mem_stats($sock, ' hotkeys');
+    is($s->{'hotkey:1:key'}, 'warm', "counting again");
+    is($s->{'hotkey:1:requests'}, 5, "counted from the reset");
+}
+
+# only lookups that send a value add bytes.
+{
+    print $sock "stats reset\r\n";
+    is(scalar <$sock>, "RESET\r\n", "stats reset");
+    print $sock "set hot 0 0 3\r\nhot\r\n" x 5 . "mg hot s\r\n"
+        . "mg hot v\r\n" . "delete hot\r\n";
+    my $want = "STORED\r\n" x 5 . "HD s3\r\n" . "VA 3\r\nhot\r\n"
+        . "DELETED\r\n";
+    read($sock, my $got, length($want));
+    is($got, $want, "writes and reads");
+    my $s = mem_stats($sock, ' hotkeys');
+    is($s->{'hotkey:1:key'}, 'hot', "writes are counted as requests");
+    is($s->{'hotkey:1:requests'}, 8, "every lookup counted");
+    is($s->{'hotkey:1:bytes'}, 3, "only the value sent counted");
+}
+
+# counters count the digits sent.
+{
+    my $server = new_memcached('-o hotkey_sample=1,native_counters');
+    my $s = $server->sock;
+    print $s "ma num N0 J99999\r\n";
+    is(scalar <$s>, "HD\r\n", "created counter");
+    mem_get_is($s, "num", 99999);
+    my $st = mem_stats($s, ' hotkeys');
+    is($st->{'hotkey:1:bytes'}, 5, "rendered counter length");
+}
+
+# sampling scales the counts back up.
+{
+    my $sampled = new_memcached('-o hotkey_sample=10');
+    my $s = $sampled->sock;
+    gets($s, "foo", 1000);
+    my $st = mem_stats($s, ' hotkeys');
+    is($st->{hotkeys_sample}, 10, "sample rate reported");
+    is($st->{'hotkey:1:key'}, 'foo', "sampled key found");
+    is($st->{'hotkey:1:requests'}, 1000, "requests estimated");
+}
+
+{
+    my $off = new_memcached();
+    my $s = $off->sock;
+    print $s "stats hotkeys\r\n";
+    is(scalar <$s>, "CLIENT_ERROR hot key tracking not enabled\r\n",
+        "disabled by default");
+}
+
+done_testing();
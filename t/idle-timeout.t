@@ -3,7 +3,7 @@
 use strict;
 use warnings;
 
-use Test::More tests => 11;
+use Test::More tests => 13;
 
 use FindBin qw($Bin);
 use lib "$Bin/lib";
@@ -41,3 +41,17 @@ if (enabled_tls_testing()) {
 $sock = $server->sock;
 $stats = mem_stats($sock);
 isnt($stats->{idle_kicks}, 0, "check stats timeout");
+
+# Lots of idle connections all get kicked around the same time.
+{
+    my @socks = map { $server->new_sock } 1 .. 50;
+    print $_ "version\r\n" for @socks;
+    scalar <$_> for @socks;
+    my $kicks = mem_stats($sock)->{idle_kicks};
+    sleep(6);
+    $sock = $server->sock;
+    $stats = mem_stats($sock);
+    cmp_ok($stats->{idle_kicks} - $kicks, '>=', 50, "idle connections kicked");
+    my $closed = grep { !defined scalar <$_> } @socks;
+    is($closed, 50, "all idle connections closed");
+}
@@ -0,0 +1,176 @@
+#!/usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+# With -o native_counters incr/decr keep the value as a 64bit integer that is
+# updated in place. Every read path has to render it back into digits.
+
+my $server = new_memcached('-m 128 -I 8m -o native_counters');
+my $sock = $server->sock;
+
+is(mem_stats($sock, ' settings')->{native_counters}, 'yes',
+    "native_counters enabled");
+
+sub cmd {
+    my $line = shift;
+    print $sock "$line\r\n";
+    return scalar <$sock>;
+}
+
+sub cas_of {
+    my $key = shift;
+    my ($cas) = cmd("mg $key c") =~ /^HD c(\d+)/;
+    return $cas;
+}
+
+{
+    print $sock "set num 7 0 1\r\n1\r\n";
+    is(scalar <$sock>, "STORED\r\n", "stored a number");
+    is(cmd("incr num 1"), "2\r\n", "first incr converts it");
+    is(cmd("incr num 98"), "100\r\n", "incr");
+    is(cmd("decr num 1"), "99\r\n", "decr shrinks the digits");
+    mem_get_is({ sock => $sock, flags => 7 }, "num", "99");
+    is(cmd("decr num 1000"), "0\r\n", "decr floors at zero");
+    is(cmd("incr num 18446744073709551615"), "18446744073709551615\r\n",
+        "largest value");
+    is(cmd("incr num 2"), "1\r\n", "incr wraps around");
+    is(cmd("incr num 122"), "123\r\n", "incr");
+
+    print $sock "gets num\r\n";
+    like(scalar <$sock>, qr/^VALUE num 7 3 \d+\r\n/, "gets header");
+    is(scalar <$sock>, "123\r\n", "gets value");
+    is(scalar <$sock>, "END\r\n", "gets end");
+
+    print $sock "gat 0 num\r\n";
+    is(scalar <$sock>, "VALUE num 7 3\r\n", "gat header");
+    is(scalar <$sock>, "123\r\n", "gat value");
+    is(scalar <$sock>, "END\r\n", "gat end");
+
+    is(cmd("mg num s v f"), "VA 3 s3 f7\r\n", "mg header");
+    is(scalar <$sock>, "123\r\n", "mg value");
+    is(cmd("mg num v r1"), "VA 2\r\n", "mg range header");
+    is(scalar <$sock>, "23\r\n", "mg range value");
+    is(cmd("mg num v r1 n1"), "VA 1\r\n", "mg window header");
+    is(scalar <$sock>, "2\r\n", "mg window value");
+    is(cmd("mg num v r9"), "VA 0\r\n", "mg window past the end");
+    is(scalar <$sock>, "\r\n", "empty value");
+
+    my $cas = cas_of("num");
+    is(cmd("ma num v"), "VA 3\r\n", "ma");
+    is(scalar <$sock>, "124\r\n", "ma value");
+    isnt(cas_of("num"), $cas, "CAS changed");
+    is(cmd("ma num C$cas"), "EX\r\n", "stale CAS refused");
+    $cas = cas_of("num");
+    is(cmd("ma num C$cas MD D4 v"), "VA 3\r\n", "ma decr with CAS");
+    is(scalar <$sock>, "120\r\n", "ma decr value");
+
+    print $sock "append num 0 0 1\r\n5\r\n";
+    is(scalar <$sock>, "NOT_STORED\r\n", "append refused");
+    print $sock "prepend num 0 0 1\r\n5\r\n";
+    is(scalar <$sock>, "NOT_STORED\r\n", "prepend refused");
+    print $sock "ms num 1 MW r0\r\n5\r\n";
+    is(scalar <$sock>, "NS\r\n", "overwrite refused");
+    mem_get_is({ sock => $sock, flags => 7 }, "num", "120");
+
+    print $sock "set num 0 0 3\r\nabc\r\n";
+    is(scalar <$sock>, "STORED\r\n", "set over a counter");
+    mem_get_is($sock, "num", "abc");
+    is(cmd("incr num 1"),
+        "CLIENT_ERROR cannot increment or decrement non-numeric value\r\n",
+        "text again");
+}
+
+# counters created by ma autovivify.
+{
+    is(cmd("ma viv N0 J41 v"), "VA 2\r\n", "autovivified");
+    is(scalar <$sock>, "41\r\n", "initial value");
+    is(cmd("ma viv v"), "VA 2\r\n", "incr autovivified counter");
+    is(scalar <$sock>, "42\r\n", "value");
+    mem_get_is($sock, "viv", "42");
+}
+
+# binary protocol get and incr.
+{
+    my $bin = $server->new_sock;
+    sub bin_req {
+        my ($s, $op, $key, $extra) = @_;
+        my $body = $extra . $key;
+        print $s pack("CCnCCnNNNN", 0x80, $op, length($key), length($extra),
+            0, 0, length($body), 0, 0, 0) . $body;
+        read($s, my $hdr, 24);
+        my ($magic, $rop, $keylen, $extlen, $dt, $status, $bodylen) =
+            unpack("CCnCCnN", $hdr);
+        read($s, my $rbody, $bodylen) if $bodylen;
+        return ($status, $extlen, $rbody);
+    }
+
+    print $sock "set bnum 3 0 2\r\n10\r\n";
+    is(scalar <$sock>, "STORED\r\n", "stored bnum");
+    is(cmd("incr bnum 5"), "15\r\n", "converted bnum");
+
+    my ($status, $extlen, $body) = bin_req($bin, 0x00, "bnum", "");
+    is($status, 0, "binary get hit");
+    is(unpack("N", substr($body, 0, 4)), 3, "binary get flags");
+    is(substr($body, $extlen), "15", "binary get value");
+
+    # delta 2, initial 500, expiration 0.
+    my $extra = pack("NNNNN", 0, 2, 0, 500, 0);
+    ($status, $extlen, $body) = bin_req($bin, 0x05, "bviv", $extra);
+    is($status, 0, "binary incr autovivified");
+    is(join(',', unpack("NN", $body)), "0,500", "initial value");
+    ($status, $extlen, $body) = bin_req($bin, 0x05, "bviv", $extra);
+    is(join(',', unpack("NN", $body)), "0,502", "incremented");
+    mem_get_is($sock, "bviv", "502");
+}
+
+# a read still being sent doesn't force a copy of the counter.
+{
+    my $big = "B" x (4 * 1024 * 1024);
+    print $sock "set big 0 0 " . length($big) . "\r\n$big\r\n";
+    is(scalar <$sock>, "STORED\r\n", "stored large item");
+    is(cmd("incr hot 1"), "NOT_FOUND\r\n", "hot missing");
+    print $sock "set hot 0 0 1\r\n0\r\n";
+    is(scalar <$sock>, "STORED\r\n", "stored hot");
+    is(cmd("incr hot 1"), "1\r\n", "converted hot");
+
+    # the reader stalls on the large value with its reference to hot held.
+    my $reader = $server->new_sock;
+    print $reader "get hot big\r\n";
+    select(undef, undef, undef, 0.3);
+
+    my $items = mem_stats($sock)->{total_items};
+    my $bad = 0;
+    for my $n (2 .. 1001) {
+        $bad++ unless cmd("incr hot 1") eq "$n\r\n";
+    }
+    is($bad, 0, "incrs while being read");
+    is(mem_stats($sock)->{total_items}, $items, "no new items stored");
+
+    is(scalar <$reader>, "VALUE hot 0 1\r\n", "reader got the old header");
+    is(scalar <$reader>, "1\r\n", "reader got the old value");
+    is(scalar <$reader>, "VALUE big 0 " . length($big) . "\r\n", "big header");
+    read($reader, my $got, length($big) + 2);
+    ok($got eq "$big\r\n", "big value intact");
+    is(scalar <$reader>, "END\r\n", "reader got END");
+    mem_get_is($sock, "hot", "1001");
+}
+
+# without the option values stay text.
+{
+    my $plain = new_memcached();
+    my $s = $plain->sock;
+    print $s "set num 0 0 1\r\n9\r\n";
+    is(scalar <$s>, "STORED\r\n", "stored");
+    print $s "incr num 1\r\n";
+    is(scalar <$s>, "10\r\n", "incr");
+    print $s "append num 0 0 1\r\n0\r\n";
+    is(scalar <$s>, "STORED\r\n", "append still works");
+    mem_get_is($s, "num", "100");
+}
+
+done_testing();
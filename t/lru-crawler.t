@@ -2,7 +2,7 @@
 
 use strict;
 use warnings;
-use Test::More tests => 70257;
+use Test::More tests => 70274;
 use FindBin qw($Bin);
 use lib "$Bin/lib";
 use MemcachedTest;
@@ -123,6 +123,76 @@ for (1 .. 70000) {
     is ((keys %bfoo), 0, "metadump found all bfoo keys");
 }
 
+# Walk the hash table in resumable slices via a cursor.
+{
+    my $cursor = 0;
+    my $slices = 0;
+    my %seen = ();
+    do {
+        print $sock "lru_crawler metadump hash $cursor 5000\r\n";
+        $slices++;
+        $cursor = undef;
+        while (<$sock>) {
+            last if /^(\.|END)/;
+            if (/^CURSOR (\d+)/) {
+                $cursor = $1;
+            } elsif (/^key=(\S+)/) {
+                $seen{$1} = 1;
+            }
+        }
+    } while (defined $cursor && $cursor != 0);
+    is($cursor, 0, "cursor walk completed");
+    cmp_ok($slices, '>', 1, "cursor walk took multiple slices");
+    is(scalar(keys %seen), 70090, "cursor walk returned all items");
+}
+
+{
+    print $sock "lru_crawler mgdump hash 0 1\r\n";
+    my $count = 0;
+    my $cursor;
+    while (<$sock>) {
+        last if /^EN/;
+        if (/^CURSOR (\d+)/) {
+            $cursor = $1;
+        } else {
+            $count++;
+        }
+    }
+    ok($count >= 1 && $cursor > 0, "mgdump cursor slice stops early");
+    print $sock "lru_crawler mgdump hash foo\r\n";
+    is(scalar <$sock>, "CLIENT_ERROR bad command line format\r\n", "bad cursor rejected");
+}
+
+# Per-prefix summaries.
+{
+    for (1 .. 5) {
+        print $sock "set pa:$_ 0 0 2\r\nok\r\n";
+        is(scalar <$sock>, "STORED\r\n", "stored pa key");
+    }
+    for (1 .. 3) {
+        print $sock "set pb:$_ 0 7200 2\r\nok\r\n";
+        is(scalar <$sock>, "STORED\r\n", "stored pb key");
+    }
+    print $sock "lru_crawler prefixstats hash\r\n";
+    my %pfx = ();
+    while (<$sock>) {
+        last if /^END/;
+        if (/^(?:prefix=(\S+)|(noprefix)) items=(\d+) bytes=\d+ ttl=(\S+) la=\S+/) {
+            $pfx{defined $1 ? $1 : $2} = [$3, $4];
+        }
+    }
+    is_deeply($pfx{pa}, [5, "5,0,0,0,0,0"], "prefix pa summarized");
+    is_deeply($pfx{pb}, [3, "0,0,0,0,3,0"], "prefix pb summarized");
+    is($pfx{noprefix}->[0], 70090, "keys without prefix summarized");
+    print $sock "lru_crawler prefixstats 1\r\n";
+    my $items = 0;
+    while (<$sock>) {
+        last if /^END/;
+        $items += $1 if /items=(\d+)/;
+    }
+    cmp_ok($items, '>', 0, "prefixstats by slab class");
+}
+
 print $sock "lru_crawler disable\r\n";
 is(scalar <$sock>, "OK\r\n", "disabled lru crawler");
 my $settings_match = 0;
@@ -0,0 +1,91 @@
+#!/usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+# mg C(cas): skip the value when the client already has this version.
+
+my $server = new_memcached('-m 64 -o slab_chunk_max=16');
+my $sock = $server->sock;
+
+sub cmd {
+    my $line = shift;
+    print $sock "$line\r\n";
+    return scalar <$sock>;
+}
+
+sub cas_of {
+    my $key = shift;
+    my ($cas) = cmd("mg $key c") =~ /^HD c(\d+)/;
+    return $cas;
+}
+
+{
+    print $sock "set foo 3 0 5\r\nhello\r\n";
+    is(scalar <$sock>, "STORED\r\n", "stored foo");
+    my $cas = cas_of("foo");
+    my $old = $cas - 1;
+
+    is(cmd("mg foo v C$cas"), "HD\r\n", "matching CAS skips the value");
+    is(cmd("mg foo v C$cas c s f"), "HD c$cas s5 f3\r\n",
+        "other flags still returned");
+    is(cmd("mg foo C$cas"), "HD\r\n", "no value asked for");
+
+    is(cmd("mg foo v C$old c"), "VA 5 c$cas\r\n", "stale CAS gets the value");
+    is(scalar <$sock>, "hello\r\n", "value");
+    is(cmd("mg foo v C$old r1 n3"), "VA 3\r\n", "stale CAS with a window");
+    is(scalar <$sock>, "ell\r\n", "window");
+
+    is(cmd("mg missing v C$cas"), "EN\r\n", "miss");
+    print $sock "mg missing v q C$cas\r\nmg foo v q C$cas\r\nmn\r\n";
+    is(scalar <$sock>, "HD\r\n", "q hides the miss but not the match");
+    is(scalar <$sock>, "MN\r\n", "end of pipeline");
+
+    print $sock "set foo 3 0 5\r\nworld\r\n";
+    is(scalar <$sock>, "STORED\r\n", "updated foo");
+    is(cmd("mg foo v C$cas"), "VA 5\r\n", "changed value returned");
+    is(scalar <$sock>, "world\r\n", "new value");
+    $cas = cas_of("foo");
+    is(cmd("mg foo v C$cas"), "HD\r\n", "new CAS matches");
+
+    print $sock "set bar 0 0 3\r\nbar\r\n";
+    is(scalar <$sock>, "STORED\r\n", "stored bar");
+    my $barcas = cas_of("bar");
+    print $sock "mgm v k C$barcas -- foo bar\r\n";
+    is(scalar <$sock>, "VA 5 kfoo\r\n", "mgm returns the changed value");
+    is(scalar <$sock>, "world\r\n", "mgm value");
+    is(scalar <$sock>, "HD kbar\r\n", "mgm skips the matching one");
+}
+
+# large chunked values aren't sent when unchanged.
+{
+    my $val = join(':', 1 .. 100000);
+    my $len = length($val);
+    print $sock "set big 0 0 $len\r\n$val\r\n";
+    is(scalar <$sock>, "STORED\r\n", "stored chunked item");
+    my $cas = cas_of("big");
+    my $before = mem_stats($sock)->{bytes_written};
+    is(cmd("mg big v s C$cas"), "HD s$len\r\n", "unchanged");
+    cmp_ok(mem_stats($sock)->{bytes_written} - $before, '<', $len / 10,
+        "value not sent");
+    is(cmd("mg big v C" . ($cas + 1)), "VA $len\r\n", "changed");
+    read($sock, my $got, $len + 2);
+    ok($got eq "$val\r\n", "chunked value returned");
+}
+
+# with CAS disabled every item's CAS is 0, which says nothing about the value.
+{
+    my $nocas = new_memcached('-C');
+    my $s = $nocas->sock;
+    print $s "set foo 0 0 5\r\nhello\r\n";
+    is(scalar <$s>, "STORED\r\n", "stored foo without CAS");
+    print $s "mg foo v c C0\r\n";
+    is(scalar <$s>, "VA 5 c0\r\n", "C0 doesn't skip the value");
+    is(scalar <$s>, "hello\r\n", "value returned");
+}
+
+done_testing();
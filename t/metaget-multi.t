@@ -0,0 +1,82 @@
+#!/usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached();
+my $sock = $server->sock;
+
+# command syntax:
+# mgm [flags] -- [key] [key] ...\r\n
+# response: one mg response per key, in order.
+
+print $sock "set foo 0 0 2\r\nhi\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored foo");
+print $sock "set bar 5 0 3\r\nbye\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored bar");
+
+sub mgm_is {
+    my ($cmd, $expect, $msg) = @_;
+    print $sock "$cmd\r\nmn\r\n";
+    my $got = '';
+    while (my $line = <$sock>) {
+        last if $line eq "MN\r\n";
+        $got .= $line;
+    }
+    is($got, $expect, $msg);
+}
+
+mgm_is("mgm v f k O123 -- foo missing bar",
+    "VA 2 f0 kfoo O123\r\nhi\r\nEN kmissing O123\r\nVA 3 f5 kbar O123\r\nbye\r\n",
+    "hits and misses in order with key and opaque");
+
+mgm_is("mgm s t -- bar foo", "HD s3 t-1\r\nHD s2 t-1\r\n", "no value");
+
+mgm_is("mgm v k q -- missing foo nope",
+    "VA 2 kfoo\r\nhi\r\n", "q hides misses");
+
+mgm_is("mgm -- foo", "HD\r\n", "no flags");
+
+# b64 keys: Zm9v is foo.
+mgm_is("mgm b k v -- Zm9v bWlzcw== !!",
+    "VA 2 kfoo\r\nhi\r\nEN kbWlzcw== b\r\nCLIENT_ERROR error decoding key\r\n",
+    "binary keys decoded one at a time");
+
+{
+    my $long = 'x' x 251;
+    mgm_is("mgm v -- foo $long foo",
+        "VA 2\r\nhi\r\nCLIENT_ERROR bad command line format\r\nVA 2\r\nhi\r\n",
+        "bad key only fails its own response");
+}
+
+mgm_is("mgm v foo bar", "CLIENT_ERROR bad command line format\r\n",
+    "separator required");
+mgm_is("mgm v --", "CLIENT_ERROR bad command line format\r\n",
+    "keys required");
+mgm_is("mgm v v -- foo", "CLIENT_ERROR duplicate flag\r\n",
+    "flags checked once");
+mgm_is("mgm O" . ('x' x 40) . " -- foo",
+    "CLIENT_ERROR opaque token too long\r\n", "opaque checked up front");
+
+# more keys than the tokenizer takes at once, on a line longer than the
+# read buffer would normally allow without a newline.
+{
+    my @keys = map { sprintf("mgmkey%04d_%s", $_, 'y' x 40) } 1 .. 300;
+    for my $k (@keys[0 .. 9]) {
+        print $sock "set $k 0 0 1 noreply\r\n1\r\n";
+    }
+    my $expect = join('', map { "VA 1 k$_\r\n1\r\n" } @keys[0 .. 9])
+        . join('', map { "EN k$_\r\n" } @keys[10 .. $#keys])
+        . "VA 2 kfoo\r\nhi\r\n";
+    mgm_is("mgm v k -- @keys foo", $expect, "large batch");
+}
+
+my $stats = mem_stats($sock);
+is($stats->{get_hits}, 20, "hits counted per key");
+is($stats->{get_misses}, 294, "misses counted per key");
+
+done_testing();
@@ -0,0 +1,132 @@
+#!/usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+# mg r(offset) n(length): return a window of the value.
+
+my $ext_path;
+
+# non-repeating so a misplaced window shows up.
+my $pattern = join(':', 1 .. 8000);
+my $plen = length($pattern);
+
+sub mg_range {
+    my ($sock, $key, $flags) = @_;
+    print $sock "mg $key $flags\r\n";
+    my $line = <$sock>;
+    return $line unless $line =~ /^VA (\d+)/;
+    my $len = $1;
+    my $data = '';
+    while (length($data) < $len + 2) {
+        read($sock, $data, $len + 2 - length($data), length($data));
+    }
+    return ($line, substr($data, 0, $len), substr($data, $len));
+}
+
+sub check_windows {
+    my ($sock, $key, $value, $where) = @_;
+    my $vlen = length($value);
+    my @cases = (
+        [0, 10], [1, 1], [1000, 4000], [$vlen - 5, 5], [$vlen - 5, 100],
+        [100, undef], [$vlen, 10], [$vlen + 50, 10], [20000, 30000],
+    );
+    for my $c (@cases) {
+        my ($off, $len) = @$c;
+        my $flags = "v s r$off" . (defined $len ? " n$len" : "");
+        my ($line, $data, $end) = mg_range($sock, $key, $flags);
+        my $expect = $off >= $vlen ? '' : substr($value, $off, $len // $vlen);
+        my $elen = length($expect);
+        is($line, "VA $elen s$vlen\r\n", "$where: header for $flags");
+        ok($data eq $expect && $end eq "\r\n", "$where: window for $flags");
+    }
+}
+
+{
+    my $server = new_memcached();
+    my $sock = $server->sock;
+
+    print $sock "set pattern 0 0 $plen\r\n$pattern\r\n";
+    is(scalar <$sock>, "STORED\r\n", "stored pattern");
+    check_windows($sock, "pattern", $pattern, "memory");
+
+    my ($line, $data, $end) = mg_range($sock, "pattern", "v n0");
+    is($line . $data . $end, "VA 0\r\n\r\n", "empty window");
+    ($line) = mg_range($sock, "pattern", "s r5 n5");
+    is($line, "HD s$plen\r\n", "ignored without v");
+    is(mg_range($sock, "missing", "v r1 n1"), "EN\r\n", "miss");
+    print $sock "mg pattern v r-1\r\n";
+    is(scalar <$sock>, "CLIENT_ERROR bad token in command line format\r\n",
+        "bad offset");
+
+    print $sock "mgm v r2 n3 -- pattern missing pattern\r\n";
+    is(scalar <$sock> . <$sock> . <$sock> . <$sock> . <$sock>,
+        "VA 3\r\n2:3\r\nEN\r\nVA 3\r\n2:3\r\n", "windows with mgm");
+
+    # commands that don't return a value refuse the window flags.
+    for my $cmd ("md pattern r1", "md pattern n1", "ma pattern r1",
+            "ma pattern n1 q") {
+        print $sock "$cmd\r\n";
+        is(scalar <$sock>, "CLIENT_ERROR invalid flag\r\n", "$cmd refused");
+    }
+    print $sock "ms pattern 1 r0\r\nx\r\n";
+    is(scalar <$sock>, "CLIENT_ERROR invalid flag\r\n",
+        "ms refuses r without MW");
+    mem_get_is($sock, "pattern", $pattern, "pattern untouched");
+}
+
+# values split over several 16k chunks.
+{
+    my $server = new_memcached("-o slab_chunk_max=16");
+    my $sock = $server->sock;
+    my $big = $pattern x 3;
+    my $blen = length($big);
+    print $sock "set big 0 0 $blen\r\n$big\r\n";
+    is(scalar <$sock>, "STORED\r\n", "stored chunked value");
+    check_windows($sock, "big", $big, "chunked");
+    my ($line, $data) = mg_range($sock, "big", "v r16000 n50000");
+    is($data, substr($big, 16000, 50000), "window across several chunks");
+}
+
+SKIP: {
+    skip "extstore not enabled", 1 unless supports_extstore();
+    $ext_path = "/tmp/extstore-range.$$";
+    my $server = new_memcached("-m 64 -U 0 -o ext_page_size=8,ext_wbuf_size=2,ext_threads=1,ext_io_depth=2,ext_item_size=512,ext_item_age=2,ext_recache_rate=0,ext_max_frag=0,ext_path=$ext_path:64m,slab_chunk_max=16,slab_automove=0,ext_max_sleep=100000");
+    my $sock = $server->sock;
+
+    my $big = $pattern x 3;
+    my $blen = length($big);
+    for my $k (qw(small big)) {
+        my $v = $k eq 'big' ? $big : $pattern;
+        my $vlen = length($v);
+        print $sock "set $k 0 0 $vlen\r\n$v\r\n";
+        is(scalar <$sock>, "STORED\r\n", "stored $k for extstore");
+    }
+    my $stats;
+    for (1 .. 20) {
+        $stats = mem_stats($sock);
+        last if $stats->{extstore_objects_written} >= 2;
+        sleep 1;
+    }
+    cmp_ok($stats->{extstore_objects_written}, '>=', 2, "values flushed");
+
+    check_windows($sock, "small", $pattern, "extstore");
+    check_windows($sock, "big", $big, "extstore chunked");
+
+    my $before = mem_stats($sock)->{extstore_bytes_read};
+    my ($line, $data) = mg_range($sock, "big", "v r50000 n100");
+    is($data, substr($big, 50000, 100), "window read from flash");
+    is(mem_stats($sock)->{extstore_bytes_read} - $before, 100,
+        "only the window was read");
+    mem_get_is($sock, "big", $big, "whole value still intact");
+}
+
+done_testing();
+
+END {
+    unlink $ext_path if $ext_path;
+}
@@ -0,0 +1,110 @@
+#!/usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+# ms MW writes the data over part of an existing value without changing its
+# length.
+
+my $server = new_memcached('-m 128 -I 8m -o slab_chunk_max=16');
+my $sock = $server->sock;
+
+sub ms_w {
+    my ($key, $data, $flags) = @_;
+    print $sock "ms $key " . length($data) . " MW $flags\r\n$data\r\n";
+    return scalar <$sock>;
+}
+
+{
+    print $sock "ms foo 11 F5 T100\r\nhello world\r\n";
+    is(scalar <$sock>, "HD\r\n", "stored foo");
+    print $sock "mg foo c\r\n";
+    my ($cas) = scalar(<$sock>) =~ /^HD c(\d+)/;
+
+    like(ms_w("foo", "there", "r6 c s"), qr/^HD c(\d+) s11\r\n$/,
+        "overwrote the end of the value");
+    mem_get_is({ sock => $sock, flags => 5 }, "foo", "hello there");
+    print $sock "mg foo c f t\r\n";
+    like(scalar <$sock>, qr/^HD c(\d+) f5 t(9\d|100)\r\n/,
+        "flags and TTL kept");
+    print $sock "mg foo c\r\n";
+    my ($newcas) = scalar(<$sock>) =~ /^HD c(\d+)/;
+    isnt($newcas, $cas, "CAS changed");
+
+    is(ms_w("foo", "J", ""), "HD\r\n", "offset defaults to 0");
+    mem_get_is({ sock => $sock, flags => 5 }, "foo", "Jello there");
+
+    is(ms_w("foo", "abcdef", "r6"), "NS\r\n", "can't run past the end");
+    is(ms_w("foo", "x", "r11"), "NS\r\n", "can't start past the end");
+    is(ms_w("foo", "", "r11"), "HD\r\n", "empty write at the end");
+    mem_get_is({ sock => $sock, flags => 5 }, "foo", "Jello there");
+
+    is(ms_w("foo", "Y", "r0 C$cas"), "EX\r\n", "stale CAS refused");
+    print $sock "mg foo c\r\n";
+    ($cas) = scalar(<$sock>) =~ /^HD c(\d+)/;
+    is(ms_w("foo", "Y", "r0 C$cas"), "HD\r\n", "matching CAS accepted");
+    mem_get_is({ sock => $sock, flags => 5 }, "foo", "Yello there");
+
+    is(ms_w("foo", "Z", "r0 E9999 c"), "HD c9999\r\n", "explicit new CAS");
+
+    is(ms_w("missing", "abc", "r0"), "NF\r\n", "missing item");
+    print $sock "ms foo 1 r0\r\nx\r\n";
+    like(scalar <$sock>, qr/^CLIENT_ERROR/, "offset needs overwrite mode");
+    print $sock "ms foo 1 MW n1\r\nx\r\n";
+    like(scalar <$sock>, qr/^CLIENT_ERROR/, "no length flag for ms");
+    mem_get_is({ sock => $sock, flags => 5 }, "foo", "Zello there");
+}
+
+# chunked values, chunked data.
+{
+    my $val = join(':', 1 .. 30000);
+    my $len = length($val);
+    print $sock "ms big $len\r\n$val\r\n";
+    is(scalar <$sock>, "HD\r\n", "stored chunked item");
+
+    my $bad = 0;
+    for my $n (1 .. 200) {
+        my $off = ($n * 7919) % ($len - 100);
+        my $data = "<$n>" x ($n % 20 + 1);
+        $data = substr($data, 0, $len - $off);
+        substr($val, $off, length($data), $data);
+        $bad++ unless ms_w("big", $data, "r$off") eq "HD\r\n";
+    }
+    my $data = "Q" x 50000;
+    substr($val, 1000, 50000, $data);
+    $bad++ unless ms_w("big", $data, "r1000") eq "HD\r\n";
+    $data = "E" x 16;
+    substr($val, $len - 16, 16, $data);
+    $bad++ unless ms_w("big", $data, "r" . ($len - 16) . " s") eq "HD s$len\r\n";
+    is($bad, 0, "overwrites stored");
+    mem_get_is($sock, "big", $val, "chunked value matches");
+}
+
+# another connection still sending the old value keeps seeing it.
+{
+    my $val = join('', map { chr(65 + $_ % 26) } 1 .. 6 * 1024 * 1024);
+    my $len = length($val);
+    print $sock "ms busy $len\r\n$val\r\n";
+    is(scalar <$sock>, "HD\r\n", "stored large item");
+
+    my $reader = $server->new_sock;
+    print $reader "get busy\r\n";
+    select(undef, undef, undef, 0.3);
+
+    my $off = $len - 100;
+    is(ms_w("busy", "0123456789", "r$off"), "HD\r\n", "overwrote while being read");
+
+    is(scalar <$reader>, "VALUE busy 0 $len\r\n", "reader got the old header");
+    read($reader, my $got, $len + 2);
+    ok($got eq "$val\r\n", "reader got the old value intact");
+    is(scalar <$reader>, "END\r\n", "reader got END");
+
+    substr($val, $off, 10, "0123456789");
+    mem_get_is($sock, "busy", $val, "new value readable");
+}
+
+done_testing();
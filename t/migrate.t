@@ -0,0 +1,117 @@
+#!/usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use Time::HiRes qw(time);
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+# A worker thread burning much more CPU than the others hands connections
+# over to the idlest one. Keep two connections on one worker busy and make
+# sure one moves, without losing or mangling any responses.
+
+if (MemcachedTest::print_help() !~ /migrate_threshold/) {
+    plan skip_all => 'connection migration not available';
+}
+
+my $server = new_memcached("-t 2 -o migrate_threshold=10,migrate_interval=1");
+my $sock = $server->sock;
+
+my $stats = mem_stats($sock, ' settings');
+is($stats->{migrate_threshold}, 10, "migrate_threshold set");
+is($stats->{migrate_interval}, 1, "migrate_interval set");
+
+sub thread_stats {
+    my %t = ();
+    print $sock "stats threads\r\n";
+    while (my $line = <$sock>) {
+        last if $line eq "END\r\n";
+        $t{$1}{$2} = $3 if $line =~ /^STAT (\d+):(\S+) (\d+)/;
+    }
+    return \%t;
+}
+
+my $t = thread_stats();
+is(scalar keys %$t, 2, "stats for both workers");
+
+# find two connections that ended up on the same worker.
+my %on = ();
+my $hot;
+for (1 .. 6) {
+    my $before = thread_stats();
+    my $s = $server->new_sock;
+    print $s "version\r\n";
+    scalar <$s>;
+    my $after = thread_stats();
+    my ($w) = grep { $after->{$_}{conns} > $before->{$_}{conns} } keys %$after;
+    next unless defined $w;
+    push(@{$on{$w}}, $s);
+    if (@{$on{$w}} == 2) {
+        $hot = $w;
+        last;
+    }
+}
+ok(defined $hot, "two connections on one worker");
+my $cold = $hot == 0 ? 1 : 0;
+my @socks = @{$on{$hot}};
+
+my $val = 'x' x 20;
+for my $k (1 .. 50) {
+    print $sock "set mig$k 0 0 20 noreply\r\n$val\r\n";
+}
+print $sock "mn\r\n";
+is(scalar <$sock>, "MN\r\n", "stored values");
+
+my $req = join('', map { "mg mig$_ v\r\n" } 1 .. 50);
+my $expect = "VA 20\r\n$val\r\n" x 50;
+my $bad = 0;
+my $rounds = 0;
+my $migrated = 0;
+my $next_check = time() + 0.5;
+my $stop = time() + 15;
+while (time() < $stop) {
+    for my $s (@socks) {
+        print $s $req;
+    }
+    for my $s (@socks) {
+        my $got = '';
+        $got .= scalar <$s> for 1 .. 100;
+        $bad++ if $got ne $expect;
+    }
+    $rounds++;
+    if (time() > $next_check) {
+        $stats = mem_stats($sock);
+        last if ($migrated = $stats->{conn_migrations}) > 0;
+        $next_check = time() + 0.5;
+    }
+}
+note("$rounds rounds");
+cmp_ok($migrated, '>=', 1, "a connection was migrated");
+
+# both connections still work afterwards.
+for (1 .. 20) {
+    for my $s (@socks) {
+        print $s $req;
+    }
+    for my $s (@socks) {
+        my $got = '';
+        $got .= scalar <$s> for 1 .. 100;
+        $bad++ if $got ne $expect;
+    }
+}
+is($bad, 0, "all responses intact");
+
+$t = thread_stats();
+cmp_ok($t->{$hot}{migrated_out}, '>=', 1, "busy worker handed off a connection");
+cmp_ok($t->{$cold}{migrated_in}, '>=', 1, "idle worker picked it up");
+cmp_ok($t->{$cold}{conns}, '>=', 1, "connection counted on its new worker");
+
+# and close cleanly from their new worker.
+close($_) for map { @$_ } values %on;
+select(undef, undef, undef, 0.2);
+$stats = mem_stats($sock);
+is($stats->{curr_connections}, 1, "migrated connections closed");
+
+done_testing();
@@ -0,0 +1,139 @@
+#!/usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+# Small responses to pipelined requests get copied together before being
+# written out. Make sure the output is the same as sending them one by one.
+
+my $server = new_memcached("-m 64 -o slab_chunk_max=16");
+my $sock = $server->sock;
+print $sock "version\r\n";
+my $version = <$sock>;
+
+my %vals = ();
+for my $k (1 .. 200) {
+    # mix of values that are copied, sent from the item, and chunked.
+    my $len = $k % 10 == 0 ? 2000 : $k % 37 == 0 ? 40000 : $k % 50;
+    $vals{"pl$k"} = join('', map { chr(97 + ($_ + $k) % 26) } 1 .. $len);
+    print $sock "set pl$k $k 0 $len noreply\r\n$vals{\"pl$k\"}\r\n";
+}
+print $sock "mn\r\n";
+is(scalar <$sock>, "MN\r\n", "stored values");
+
+sub get_resp {
+    my $k = shift;
+    return "END\r\n" unless exists $vals{$k};
+    my ($n) = $k =~ /(\d+)$/;
+    return "VALUE $k $n " . length($vals{$k}) . "\r\n$vals{$k}\r\nEND\r\n";
+}
+
+sub read_exact {
+    my ($s, $len) = @_;
+    my $data = '';
+    while (length($data) < $len) {
+        my $n = read($s, $data, $len - length($data), length($data));
+        last unless $n;
+    }
+    return $data;
+}
+
+# pipelined single key gets, including misses.
+{
+    my $req = '';
+    my $expect = '';
+    for my $k (1 .. 220) {
+        $req .= "get pl$k\r\n";
+        $expect .= get_resp("pl$k");
+    }
+    print $sock $req;
+    is(read_exact($sock, length($expect)), $expect, "pipelined gets");
+}
+
+# multiget.
+{
+    my @keys = map { "pl$_" } 1 .. 220;
+    my $expect = '';
+    for my $k (@keys) {
+        next unless exists $vals{$k};
+        my ($n) = $k =~ /(\d+)$/;
+        $expect .= "VALUE $k $n " . length($vals{$k}) . "\r\n$vals{$k}\r\n";
+    }
+    $expect .= "END\r\n";
+    print $sock "get @keys\r\n";
+    is(read_exact($sock, length($expect)), $expect, "multiget");
+}
+
+# meta gets with quiet mode misses and noreply sets mixed in.
+{
+    my $req = '';
+    my $expect = '';
+    for my $k (1 .. 220) {
+        $req .= "mg pl$k v f q k\r\n";
+        if (exists $vals{"pl$k"}) {
+            $expect .= "VA " . length($vals{"pl$k"}) . " f$k kpl$k\r\n"
+                . $vals{"pl$k"} . "\r\n";
+        }
+        if ($k % 7 == 0) {
+            $req .= "set quiet$k 0 0 2 noreply\r\nhi\r\n";
+        }
+        if ($k % 11 == 0) {
+            $req .= "version\r\n";
+            $expect .= $version;
+        }
+    }
+    $req .= "mn\r\n";
+    print $sock $req;
+    my $got = '';
+    while (my $line = <$sock>) {
+        last if $line eq "MN\r\n";
+        $got .= $line;
+    }
+    is($got, $expect, "pipelined meta gets");
+}
+
+# pipelined binary gets.
+{
+    my $bsock = $server->new_sock;
+    my $req = '';
+    for my $k (1 .. 50) {
+        my $key = "pl$k";
+        $req .= pack('CCnCCnNNNN', 0x80, 0x00, length($key), 0, 0, 0,
+            length($key), $k, 0, 0) . $key;
+    }
+    print $bsock $req;
+    my $ok = 0;
+    for my $k (1 .. 50) {
+        my $hdr = read_exact($bsock, 24);
+        my ($magic, $op, $keylen, $extlen, $dt, $status, $blen, $opaque) =
+            unpack('CCnCCnNN', $hdr);
+        my $body = read_exact($bsock, $blen);
+        $ok++ if $status == 0 && $opaque == $k
+            && substr($body, $extlen) eq $vals{"pl$k"};
+    }
+    is($ok, 50, "pipelined binary gets");
+}
+
+# responses stacking up while the client isn't reading.
+{
+    my $s = $server->new_sock;
+    my $req = "get " . join(' ', map { "pl$_" } 1 .. 200) . "\r\n";
+    my $expect = '';
+    for my $k (1 .. 200) {
+        $expect .= "VALUE pl$k $k " . length($vals{"pl$k"}) . "\r\n"
+            . $vals{"pl$k"} . "\r\n";
+    }
+    $expect .= "END\r\n";
+    print $s $req for 1 .. 20;
+    my $all = read_exact($s, length($expect) * 20);
+    is($all, $expect x 20, "large pipelined multigets");
+}
+
+my $stats = mem_stats($sock);
+is($stats->{curr_items}, 200 + int(220 / 7), "items stored");
+
+done_testing();
@@ -0,0 +1,98 @@
+#!/usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use IO::Socket::INET;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+# Connections are put into QoS classes by listener tag, and each class only
+# gets its weight in requests per event loop round on a worker.
+
+if (enabled_tls_testing()) {
+    plan skip_all => 'tagged listeners are plain TCP here';
+}
+
+my $bport = MemcachedTest::free_port();
+my $server = new_memcached("-l 127.0.0.1 -l tag_batch_:127.0.0.1:$bport -t 1 "
+    . "-o qos_weights=batch:2-online:50");
+my $sock = $server->sock;
+
+my $stats = mem_stats($sock, ' settings');
+is($stats->{qos_classes}, 3, "qos classes configured");
+
+sub qos_stats {
+    my $s = shift;
+    print $s "stats qos\r\n";
+    my %st = ();
+    while (my $line = <$s>) {
+        last if $line eq "END\r\n";
+        $st{$1} = $2 if $line =~ /^STAT (\S+) (\S+)\r\n/;
+    }
+    return \%st;
+}
+
+my $qos = qos_stats($sock);
+is($qos->{'default:weight'}, 0, "default class has no limit");
+is($qos->{'batch:weight'}, 2, "batch weight");
+is($qos->{'online:weight'}, 50, "online weight");
+is($qos->{'batch:requests'}, 0, "no batch requests yet");
+
+my $bsock = IO::Socket::INET->new(PeerAddr => "127.0.0.1:$bport");
+ok($bsock, "connected to tagged listener");
+
+# a deep pipeline on the batch listener keeps yielding, but every request is
+# answered in order.
+{
+    print $bsock "set qk 0 0 5\r\nhello\r\n";
+    is(scalar <$bsock>, "STORED\r\n", "stored through batch listener");
+    my $req = '';
+    for my $n (1 .. 500) {
+        $req .= "mg qk v O$n\r\n";
+    }
+    print $bsock $req;
+    my $ok = 0;
+    for my $n (1 .. 500) {
+        my $line = <$bsock>;
+        my $val = <$bsock>;
+        $ok++ if $line eq "VA 5 O$n\r\n" && $val eq "hello\r\n";
+    }
+    is($ok, 500, "pipelined batch requests answered in order");
+}
+
+$qos = qos_stats($sock);
+cmp_ok($qos->{'batch:requests'}, '>=', 501, "batch requests counted");
+cmp_ok($qos->{'batch:yields'}, '>=', 100, "batch class yielded between rounds");
+cmp_ok($qos->{'batch:queued'}, '>', 0, "batch waits counted");
+ok(exists $qos->{'batch:queue_time_us'}, "batch queue time reported");
+cmp_ok($qos->{'default:requests'}, '>', 0, "default requests counted");
+is($qos->{'default:yields'}, 0, "unlimited class doesn't yield for qos");
+is($qos->{'online:requests'}, 0, "online class unused");
+
+# untagged connections still pipeline without being held back.
+{
+    my $req = '';
+    $req .= "mg qk v\r\n" for 1 .. 100;
+    print $sock $req;
+    my $ok = 0;
+    for (1 .. 100) {
+        $ok++ if scalar <$sock> eq "VA 5\r\n" && scalar <$sock> eq "hello\r\n";
+    }
+    is($ok, 100, "default class pipeline");
+}
+
+print $sock "stats reset\r\n";
+is(scalar <$sock>, "RESET\r\n", "stats reset");
+$qos = qos_stats($sock);
+is($qos->{'batch:requests'}, 0, "qos stats reset");
+
+# bad configurations are refused.
+for my $bad ("batch", "batch:x", "toolongtag:1", "a:1-a:2",
+    "a:1-b:1-c:1-d:1-e:1-f:1-g:1-h:1") {
+    my $srv = eval { new_memcached("-o qos_weights=$bad") };
+    ok(!$srv, "qos_weights=$bad refused");
+}
+
+done_testing();
@@ -0,0 +1,141 @@
+#!/usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use IO::Socket::INET;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+# With -o shed_target a worker that keeps falling behind answers data
+# commands with "SERVER_ERROR busy". A tiny target and one request per event
+# (-R 1) against several deep pipelines is enough to trip it.
+
+if (enabled_tls_testing()) {
+    plan skip_all => 'tagged listeners are plain TCP here';
+}
+
+# Pipelines gets and sets on each socket at once, returning how many
+# responses were answered normally and how many were shed. The server is
+# stopped while the requests go out, so on a single CPU it can't work through
+# each connection before the next one has anything queued. Responses are read
+# from every socket in turn: one response per event fills a socket's buffer
+# well before the pipeline is done, and a connection blocked on writing isn't
+# in the queue the shedding measures.
+sub flood {
+    my ($pid, @socks) = @_;
+    my $req = '';
+    for my $n (1 .. 200) {
+        $req .= "mg shedkey v\r\n";
+        $req .= "set shed$n 0 0 5\r\nhello\r\n" if $n % 10 == 0;
+    }
+    $req .= "mn\r\n";
+    kill 'STOP', $pid;
+    print $_ $req for @socks;
+    kill 'CONT', $pid;
+
+    my ($ok, $busy, $bad) = (0, 0, 0);
+    my @left = @socks;
+    while (@left) {
+        @left = grep {
+            my $line = readline($_);
+            if (!defined $line) {
+                $bad++;
+                0;
+            } elsif ($line eq "MN\r\n") {
+                0;
+            } else {
+                if ($line eq "SERVER_ERROR busy\r\n") {
+                    $busy++;
+                } elsif ($line eq "STORED\r\n") {
+                    $ok++;
+                } elsif ($line eq "VA 5\r\n" && readline($_) eq "hello\r\n") {
+                    $ok++;
+                } else {
+                    $bad++;
+                }
+                1;
+            }
+        } @left;
+    }
+    return ($ok, $busy, $bad);
+}
+
+{
+    my $server = new_memcached("-t 1 -R 1 -o shed_target=1,shed_interval=1000");
+    my $sock = $server->sock;
+    my $settings = mem_stats($sock, ' settings');
+    is($settings->{shed_target}, 1, "shed_target set");
+    is($settings->{shed_interval}, 1000, "shed_interval set");
+
+    print $sock "set shedkey 0 0 5\r\nhello\r\n";
+    is(scalar <$sock>, "STORED\r\n", "stored");
+
+    my $pid = mem_stats($sock)->{pid};
+    my @socks = map { $server->new_sock } 1 .. 8;
+    my ($ok, $busy, $bad) = (0, 0, 0);
+    for (1 .. 5) {
+        my @r = flood($pid, @socks);
+        $ok += $r[0];
+        $busy += $r[1];
+        $bad += $r[2];
+        last if $busy;
+    }
+    is($bad, 0, "every response well formed");
+    cmp_ok($busy, '>', 0, "some requests shed");
+    cmp_ok($ok, '>', 0, "some requests served");
+
+    my $stats = mem_stats($sock);
+    is($stats->{shed_requests}, $busy, "shed requests counted");
+    cmp_ok($stats->{shed_intervals}, '>', 0, "overloaded intervals counted");
+
+    # shed sets had their data swallowed; the connections are still in sync.
+    for my $s (@socks) {
+        print $s "mg shedkey v\r\nmn\r\n";
+    }
+    my $synced = 0;
+    for my $s (@socks) {
+        my @lines = ();
+        while (my $line = <$s>) {
+            last if $line eq "MN\r\n";
+            push(@lines, $line);
+        }
+        $synced++ if @lines == 1 && $lines[0] eq "SERVER_ERROR busy\r\n"
+            || @lines == 2 && $lines[0] eq "VA 5\r\n";
+    }
+    is($synced, 8, "connections still in sync");
+}
+
+# only tagged listeners are shed with shed_tags.
+{
+    my $bport = MemcachedTest::free_port();
+    my $server = new_memcached("-l 127.0.0.1 -l tag_batch_:127.0.0.1:$bport "
+        . "-t 1 -R 1 -o shed_target=1,shed_interval=1000,shed_tags=batch");
+    my $sock = $server->sock;
+    print $sock "set shedkey 0 0 5\r\nhello\r\n";
+    is(scalar <$sock>, "STORED\r\n", "stored");
+    my $settings = mem_stats($sock, ' settings');
+    is($settings->{shed_tags}, 'batch', "shed_tags set");
+
+    my @plain = map { $server->new_sock } 1 .. 4;
+    my @batch = map { IO::Socket::INET->new(PeerAddr => "127.0.0.1:$bport") } 1 .. 4;
+    my $pid = mem_stats($sock)->{pid};
+    my ($pbusy, $bbusy, $bad) = (0, 0, 0);
+    for (1 .. 5) {
+        my @r = flood($pid, @plain, @batch);
+        $bad += $r[2];
+        my $stats = mem_stats($sock);
+        last if $stats->{shed_requests};
+    }
+    my ($ok, $busy, $pbad) = flood($pid, @plain);
+    is($busy, 0, "untagged connections aren't shed");
+    is($bad + $pbad, 0, "every response well formed");
+    my $stats = mem_stats($sock);
+    cmp_ok($stats->{shed_requests}, '>', 0, "tagged connections were shed");
+}
+
+eval { new_memcached("-o shed_tags=toolongtag") };
+ok($@, "bad shed_tags refused");
+
+done_testing();
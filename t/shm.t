@@ -0,0 +1,161 @@
+#!/usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+# Unix socket clients can switch to shared memory rings. Drive them through
+# the reference client and make sure the responses match what the socket
+# would have sent.
+
+my $client = "./shmclient";
+if (MemcachedTest::print_help() !~ /shm_ring_kb/) {
+    plan skip_all => 'shared memory transport not available';
+} elsif (!-x $client) {
+    plan skip_all => 'shmclient not built';
+}
+
+my $path = "/tmp/memcachedtest-shm.$$";
+my $server = new_memcached("-s $path -o shm_ring_kb=16");
+my $sock = $server->sock;
+
+my $stats = mem_stats($sock, ' settings');
+is($stats->{shm_ring_kb}, 16, "shm_ring_kb set");
+
+my $input = "/tmp/memcachedtest-shm-in.$$";
+sub shm_run {
+    my $req = shift;
+    open(my $fh, '>', $input) or die "open: $!";
+    print $fh $req;
+    close($fh);
+    my $out = `$client $path < $input`;
+    return ($out, $? >> 8);
+}
+
+{
+    my ($out, $rc) = shm_run("set foo 0 0 3\r\nbar\r\nget foo\r\n"
+        . "mg foo v f\r\nmg missing v\r\nmn\r\nquit\r\n");
+    is($rc, 0, "client exited cleanly");
+    is($out, "STORED\r\nVALUE foo 0 3\r\nbar\r\nEND\r\nVA 3 f0\r\nbar\r\n"
+        . "EN\r\nMN\r\n", "basic commands over the rings");
+}
+
+# values larger than the rings, both ways.
+{
+    my $big = join('', map { chr(65 + $_ % 26) } 1 .. 100000);
+    my ($out, $rc) = shm_run("set big 0 0 100000\r\n$big\r\n"
+        . "get big\r\n" x 3 . "quit\r\n");
+    is($out, "STORED\r\n" . "VALUE big 0 100000\r\n$big\r\nEND\r\n" x 3,
+        "large values wrap around the rings");
+    mem_get_is($sock, "big", $big, "value set over the rings readable");
+}
+
+# deep pipelines.
+{
+    for my $k (1 .. 50) {
+        print $sock "set shm$k 0 0 " . length($k) . " noreply\r\n$k\r\n";
+    }
+    my $req = '';
+    my $expect = '';
+    for my $n (1 .. 1000) {
+        my $k = $n % 60;
+        $req .= "mg shm$k v\r\n";
+        $expect .= $k >= 1 && $k <= 50 ? "VA " . length($k) . "\r\n$k\r\n"
+            : "EN\r\n";
+    }
+    my ($out, $rc) = shm_run($req . "quit\r\n");
+    is($out, $expect, "pipelined requests");
+}
+
+# the last client's close may still be on its way to the server.
+for (1 .. 50) {
+    $stats = mem_stats($sock);
+    last if $stats->{curr_connections} == 1;
+    select(undef, undef, undef, 0.1);
+}
+is($stats->{shm_conns}, 3, "connections switched counted");
+is($stats->{curr_connections}, 1, "ring connections closed");
+
+# the switch has to be the only thing in flight.
+{
+    my $s = $server->new_sock;
+    print $s "shm\r\nversion\r\n";
+    is(scalar <$s>, "CLIENT_ERROR shm must be sent on its own\r\n",
+        "pipelined shm refused");
+    like(scalar <$s>, qr/^VERSION /, "connection still works");
+    print $s "shm\nversion\n";
+    is(scalar <$s>, "CLIENT_ERROR shm must be sent on its own\r\n",
+        "pipelined shm refused with bare LF");
+    like(scalar <$s>, qr/^VERSION /, "connection still works");
+}
+
+# either line ending works on its own.
+for my $eol ("\r\n", "\n") {
+    my $s = $server->new_sock;
+    print $s "shm$eol";
+    like(scalar <$s>, qr/^SHM \d+\r\n$/, "shm accepted");
+}
+
+{
+    my $out = `$client -b 200 -d 10 $path`;
+    like($out, qr/^unix 200 x 10: .*\nshm  200 x 10: /, "benchmark runs");
+}
+
+# a client scribbling on the ring indexes is hung up on, and its worker
+# carries on serving everyone else.
+{
+    my $bad = new_memcached("-t 1 -s $path.bad -o shm_ring_kb=16");
+    my $s = $bad->sock;
+    my $out = `$client -c $path.bad`;
+    is($out, "closed\n", "corrupt ring index closes the connection");
+    print $s "version\r\n";
+    like(scalar <$s>, qr/^VERSION /, "worker still serving");
+    unlink("$path.bad");
+}
+
+# limits on memory handed out.
+{
+    my $lim = new_memcached("-s $path.lim -o shm_ring_kb=16,shm_max_conns=1");
+    my $s1 = $lim->new_sock;
+    print $s1 "shm\r\n";
+    like(scalar <$s1>, qr/^SHM \d+\r\n$/, "first ring connection");
+    my $s2 = $lim->new_sock;
+    print $s2 "shm\r\n";
+    is(scalar <$s2>, "SERVER_ERROR too many shared memory connections\r\n",
+        "second refused");
+    close($s1);
+    my $st;
+    for (1 .. 50) {
+        $st = mem_stats($lim->sock);
+        last if $st->{shm_curr_conns} == 0;
+        select(undef, undef, undef, 0.1);
+    }
+    is($st->{shm_curr_conns}, 0, "ring connection released");
+    print $s2 "shm\r\n";
+    like(scalar <$s2>, qr/^SHM \d+\r\n$/, "allowed once the first closed");
+    unlink("$path.lim");
+
+    eval { new_memcached("-s $path.big -o shm_ring_kb=32768") };
+    ok($@, "rings over 16MB refused");
+}
+
+# not available over TCP or when disabled.
+{
+    my $tcp = new_memcached("-l 127.0.0.1 -o shm_ring_kb=16");
+    my $s = $tcp->sock;
+    print $s "shm\r\n";
+    is(scalar <$s>, "CLIENT_ERROR shm not available on this connection\r\n",
+        "refused over TCP");
+    my $off = new_memcached();
+    $s = $off->sock;
+    print $s "shm\r\n";
+    is(scalar <$s>, "ERROR\r\n", "unknown command when disabled");
+}
+
+unlink($input);
+unlink($path);
+
+done_testing();
@@ -0,0 +1,313 @@
+#!/usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+use File::Path qw(rmtree);
+use MIME::Base64;
+
+my $snap_dir = "/tmp/mcsnap.$$";
+mkdir($snap_dir) or die "failed to create $snap_dir: $!";
+
+# reference crc32c (Castagnoli) for validating records.
+my @crc_table = ();
+for my $n (0 .. 255) {
+    my $c = $n;
+    for (1 .. 8) {
+        $c = ($c & 1) ? (($c >> 1) ^ 0x82F63B78) : ($c >> 1);
+    }
+    $crc_table[$n] = $c;
+}
+sub crc32c {
+    my $crc = 0xFFFFFFFF;
+    for my $b (unpack('C*', $_[0])) {
+        $crc = $crc_table[($crc ^ $b) & 0xFF] ^ ($crc >> 8);
+    }
+    return $crc ^ 0xFFFFFFFF;
+}
+
+# returns a hash of key => [flags, exptime, value, cas], and the trailer
+# count.
+sub read_snapshot {
+    my $file = shift;
+    open(my $fh, '<', $file) or die "failed to open $file: $!";
+    binmode $fh;
+    local $/;
+    my $data = <$fh>;
+    close($fh);
+
+    my ($magic, $version, $created, $res, $hcrc) = unpack('a6 n Q> N N', $data);
+    is($magic, "MCSNAP", "snapshot magic");
+    is($hcrc, crc32c(substr($data, 0, 20)), "snapshot header crc");
+    my $off = 24;
+    my %items = ();
+    my $badcrc = 0;
+    my $trailer;
+    while ($off < length($data)) {
+        my ($crc, $nbytes, $cas, $flags, $exp, $rflags, $nkey) =
+            unpack('N N Q> Q> Q> n C', substr($data, $off, 36));
+        my $len = 36 + $nkey + $nbytes;
+        $badcrc++ if $crc != crc32c(substr($data, $off + 4, $len - 4));
+        if ($nkey == 0) {
+            $trailer = $cas;
+            $off += $len;
+            last;
+        }
+        my $key = substr($data, $off + 36, $nkey);
+        $key = encode_base64($key, '') if $rflags & 1;
+        $items{$key} = [$flags, $exp, substr($data, $off + 36 + $nkey, $nbytes),
+            $cas];
+        $off += $len;
+    }
+    is($badcrc, 0, "all record crcs match");
+    is($off, length($data), "trailer is at end of file");
+    return (\%items, $trailer);
+}
+
+sub wait_snapshot {
+    my ($sock, $count) = @_;
+    for (1 .. 30) {
+        my $stats = mem_stats($sock);
+        return 1 if $stats->{snapshots_written} + $stats->{snapshot_errors} >= $count;
+        sleep 0.2;
+    }
+    return 0;
+}
+
+{
+    my $server = new_memcached("-m 64 -o lru_crawler,snapshot_dir=$snap_dir");
+    my $sock = $server->sock;
+
+    print $sock "lru_crawler snapshot hash snap1\r\n";
+    is(scalar <$sock>, "OK\r\n", "snapshot of empty cache started");
+    ok(wait_snapshot($sock, 1), "snapshot finished");
+    my ($items, $count) = read_snapshot("$snap_dir/snap1");
+    is($count, 0, "empty snapshot has no items");
+
+    for my $k (1 .. 100) {
+        my $v = "bar$k";
+        print $sock "set foo$k $k 0 " . length($v) . "\r\n$v\r\n";
+        is(scalar <$sock>, "STORED\r\n", "stored foo$k");
+    }
+    my $big = join(':', 1 .. 100000);
+    my $blen = length($big);
+    print $sock "set big 5 3600 $blen\r\n$big\r\n";
+    is(scalar <$sock>, "STORED\r\n", "stored chunked item");
+    print $sock "ms AQIDBA== 2 b\r\nhi\r\n";
+    is(scalar <$sock>, "HD\r\n", "stored binary key");
+    print $sock "set short 0 1 2\r\nno\r\n";
+    is(scalar <$sock>, "STORED\r\n", "stored short lived item");
+    sleep 2.2;
+
+    print $sock "lru_crawler snapshot hash bad/snap2\r\n";
+    like(scalar <$sock>, qr/^CLIENT_ERROR/, "bad snapshot name rejected");
+    print $sock "lru_crawler snapshot hash ../snap2\r\n";
+    like(scalar <$sock>, qr/^CLIENT_ERROR/, "path traversal rejected");
+
+    print $sock "lru_crawler snapshot hash snap2 100000\r\n";
+    is(scalar <$sock>, "OK\r\n", "snapshot started");
+    ok(wait_snapshot($sock, 2), "snapshot finished");
+    ($items, $count) = read_snapshot("$snap_dir/snap2");
+    is($count, 102, "snapshot trailer has all items");
+    is(scalar(keys %$items), 102, "snapshot has all live items");
+    is($items->{foo50}->[0], 50, "flags preserved");
+    is($items->{foo50}->[1], 0, "no exptime preserved");
+    is($items->{foo50}->[2], "bar50", "value preserved");
+    is($items->{big}->[2], $big, "chunked value preserved");
+    cmp_ok($items->{big}->[1], '>', time(), "exptime is absolute");
+    is($items->{"AQIDBA=="}->[2], "hi", "binary key preserved");
+    ok(!exists $items->{short}, "expired item skipped");
+    ok(! -e "$snap_dir/snap2.tmp", "temporary file renamed");
+
+    my $stats = mem_stats($sock);
+    is($stats->{snapshots_written}, 2, "snapshots_written counted");
+    is($stats->{snapshot_items}, 102, "snapshot_items counted");
+
+    # snapshots are disabled without a directory.
+    my $server2 = new_memcached("-o lru_crawler");
+    my $sock2 = $server2->sock;
+    print $sock2 "lru_crawler snapshot hash snap3\r\n";
+    is(scalar <$sock2>, "ERROR snapshot not allowed\r\n", "snapshot needs snapshot_dir");
+    print $sock2 "snapshot load snap2\r\n";
+    is(scalar <$sock2>, "ERROR snapshot not allowed\r\n", "load needs snapshot_dir");
+
+    # -X disables loading along with the other dump commands.
+    my $server3 = new_memcached("-X -o snapshot_dir=$snap_dir");
+    my $sock3 = $server3->sock;
+    print $sock3 "snapshot load snap2\r\n";
+    is(scalar <$sock3>, "ERROR snapshot not allowed\r\n", "load needs dumping");
+}
+my ($snap_items) = read_snapshot("$snap_dir/snap2");
+my $max_cas = 0;
+for (values %$snap_items) {
+    $max_cas = $_->[3] if $_->[3] > $max_cas;
+}
+
+# load at startup.
+{
+    my $server = new_memcached("-m 64 -o snapshot_load=$snap_dir/snap2");
+    my $sock = $server->sock;
+    my $stats = mem_stats($sock);
+    is($stats->{snapshot_loads}, 1, "snapshot loaded at startup");
+    is($stats->{snapshot_loaded_items}, 102, "all items loaded");
+    is($stats->{snapshot_load_errors}, 0, "no load errors");
+    is($stats->{curr_items}, 102, "items are in the cache");
+
+    mem_get_is({ sock => $sock, flags => 50 }, "foo50", "bar50",
+        "loaded item has value and flags");
+    my $big = join(':', 1 .. 100000);
+    mem_get_is({ sock => $sock, flags => 5 }, "big", $big,
+        "loaded chunked item");
+    print $sock "mg AQIDBA== b v t\r\n";
+    like(scalar <$sock>, qr/^VA 2 t-1/, "binary key loaded");
+    is(scalar <$sock>, "hi\r\n", "binary key value");
+    print $sock "mg big t\r\n";
+    like(scalar <$sock>, qr/^HD t(\d+)/, "exptime preserved");
+
+    # clients holding a CAS from the old server can still use it.
+    my $cas = $snap_items->{foo50}->[3];
+    print $sock "mg foo50 c\r\n";
+    is(scalar <$sock>, "HD c$cas\r\n", "CAS preserved");
+    print $sock "cas foo50 0 0 3 $cas\r\nnew\r\n";
+    is(scalar <$sock>, "STORED\r\n", "cas with the old CAS");
+    print $sock "set newkey 0 0 1\r\nx\r\nmg newkey c\r\n";
+    is(scalar <$sock>, "STORED\r\n", "stored a new key");
+    my ($newcas) = (scalar <$sock>) =~ /^HD c(\d+)/;
+    cmp_ok($newcas, '>', $max_cas, "new CAS is past the loaded ones");
+}
+
+# load on command, without overwriting existing keys.
+{
+    my $server = new_memcached("-m 64 -o snapshot_dir=$snap_dir");
+    my $sock = $server->sock;
+    print $sock "set foo10 0 0 3\r\nnew\r\n";
+    is(scalar <$sock>, "STORED\r\n", "stored existing key");
+
+    print $sock "snapshot load ../snap2\r\n";
+    like(scalar <$sock>, qr/^CLIENT_ERROR/, "path traversal rejected");
+    print $sock "snapshot load snap2 8\r\n";
+    is(scalar <$sock>, "OK\r\n", "snapshot load started");
+    my $stats;
+    for (1 .. 30) {
+        $stats = mem_stats($sock);
+        last if $stats->{snapshot_loads};
+        sleep 0.2;
+    }
+    is($stats->{snapshot_loads}, 1, "snapshot loaded");
+    is($stats->{snapshot_loaded_items}, 101, "loaded all but existing key");
+    is($stats->{snapshot_load_skipped}, 1, "existing key skipped");
+    mem_get_is({ sock => $sock, flags => 0 }, "foo10", "new",
+        "existing key not overwritten");
+    mem_get_is({ sock => $sock, flags => 99 }, "foo99", "bar99",
+        "other keys loaded");
+
+    # incomplete snapshots are refused.
+    my $data = do {
+        open(my $in, '<', "$snap_dir/snap2") or die $!;
+        binmode $in;
+        local $/;
+        <$in>;
+    };
+    open(my $out, '>', "$snap_dir/trunc") or die $!;
+    binmode $out;
+    print $out substr($data, 0, length($data) - 10);
+    close($out);
+    print $sock "snapshot load trunc\r\n";
+    is(scalar <$sock>, "OK\r\n", "truncated load started");
+    for (1 .. 30) {
+        $stats = mem_stats($sock);
+        last if $stats->{snapshot_load_errors};
+        sleep 0.2;
+    }
+    is($stats->{snapshot_load_errors}, 1, "truncated snapshot refused");
+    is($stats->{snapshot_loads}, 1, "no further loads");
+}
+
+# loading more than fits in memory evicts as it goes.
+{
+    my $server = new_memcached("-m 64 -o lru_crawler,snapshot_dir=$snap_dir");
+    my $sock = $server->sock;
+    my $val = 'x' x 10000;
+    for my $k (1 .. 4000) {
+        print $sock "set fill$k 0 0 10000 noreply\r\n$val\r\n";
+    }
+    print $sock "lru_crawler snapshot hash snapbig\r\n";
+    is(scalar <$sock>, "OK\r\n", "large snapshot started");
+    ok(wait_snapshot($sock, 1), "large snapshot finished");
+    my $stats = mem_stats($sock);
+    cmp_ok($stats->{snapshot_items}, '>', 2000, "more than fits in 16m");
+
+    my $small = new_memcached("-m 16 -o snapshot_load=$snap_dir/snapbig");
+    $stats = mem_stats($small->sock);
+    is($stats->{snapshot_loads}, 1, "startup load into a small cache");
+    cmp_ok($stats->{evictions}, '>', 0, "items evicted while loading");
+
+    $small = new_memcached("-m 16 -o snapshot_dir=$snap_dir");
+    my $s = $small->sock;
+    print $s "snapshot load snapbig 4\r\n";
+    is(scalar <$s>, "OK\r\n", "load into a small cache started");
+    for (1 .. 50) {
+        $stats = mem_stats($s);
+        last if $stats->{snapshot_loads};
+        sleep 0.2;
+    }
+    is($stats->{snapshot_loads}, 1, "loaded into a small cache");
+    cmp_ok($stats->{evictions}, '>', 0, "items evicted while loading");
+    print $s "flush_all\r\n";
+    is(scalar <$s>, "OK\r\n", "flushed");
+    print $s "snapshot load snapbig 4\r\n";
+    is(scalar <$s>, "OK\r\n", "second load started");
+    for (1 .. 50) {
+        $stats = mem_stats($s);
+        last if $stats->{snapshot_loads} > 1;
+        sleep 0.2;
+    }
+    is($stats->{snapshot_loads}, 2, "loaded again");
+    print $s "version\r\n";
+    like(scalar <$s>, qr/^VERSION /, "server still up");
+}
+
+if (supports_extstore()) {
+    my $ext_path = "/tmp/extstore.$$";
+    my $server = new_memcached("-m 64 -U 0 -o lru_crawler,snapshot_dir=$snap_dir,ext_page_size=8,ext_wbuf_size=2,ext_threads=1,ext_io_depth=2,ext_item_size=512,ext_item_age=2,ext_recache_rate=0,ext_max_frag=0,ext_path=$ext_path:64m,slab_chunk_max=16,slab_automove=0,ext_max_sleep=100000");
+    my $sock = $server->sock;
+    my $value = "x" x 4000;
+    for my $k (1 .. 20) {
+        print $sock "set ext$k 0 0 4000\r\n$value\r\n";
+        is(scalar <$sock>, "STORED\r\n", "stored ext$k");
+    }
+    wait_ext_flush($sock);
+    my $stats = mem_stats($sock);
+    cmp_ok($stats->{extstore_objects_written}, '>', 0, "items flushed to extstore");
+
+    print $sock "lru_crawler snapshot hash snapext\r\n";
+    is(scalar <$sock>, "OK\r\n", "extstore snapshot started");
+    ok(wait_snapshot($sock, 1), "extstore snapshot finished");
+    my ($items, $count) = read_snapshot("$snap_dir/snapext");
+    is($count, 20, "extstore snapshot has all items");
+    my $ok = 0;
+    for my $k (1 .. 20) {
+        $ok++ if $items->{"ext$k"}->[2] eq $value;
+    }
+    is($ok, 20, "extstore values read back");
+
+    # same again walking the LRUs instead of the hash table.
+    print $sock "lru_crawler snapshot all snapextlru\r\n";
+    is(scalar <$sock>, "OK\r\n", "extstore lru snapshot started");
+    ok(wait_snapshot($sock, 2), "extstore lru snapshot finished");
+    ($items, $count) = read_snapshot("$snap_dir/snapextlru");
+    is($count, 20, "extstore lru snapshot has all items");
+    $ok = 0;
+    for my $k (1 .. 20) {
+        $ok++ if $items->{"ext$k"}->[2] eq $value;
+    }
+    is($ok, 20, "extstore lru values read back");
+    unlink($ext_path);
+}
+
+rmtree($snap_dir);
+
+done_testing();
@@ -1,7 +1,7 @@
 #!/usr/bin/env perl
 
 use strict;
-use Test::More tests => 113;
+use Test::More tests => 115;
 use FindBin qw($Bin);
 use lib "$Bin/lib";
 use MemcachedTest;
@@ -28,9 +28,9 @@ if (MemcachedTest::enabled_tls_testing()) {
     # when TLS is enabled, stats contains additional keys:
     #   - ssl_handshake_errors
     #   - time_since_server_cert_refresh
-    is(scalar(keys(%$stats)), 85, "expected count of stats values");
+    is(scalar(keys(%$stats)), 88, "expected count of stats values");
 } else {
-    is(scalar(keys(%$stats)), 83, "expected count of stats values");
+    is(scalar(keys(%$stats)), 86, "expected count of stats values");
 }
 
 # Test initial state
@@ -201,4 +201,18 @@ is(scalar <$sock>, "SERVER_ERROR object too large for cache\r\n",
     "set rejected due to value too large");
 $stats = mem_stats($sock);
 is($stats->{'store_too_large'}, 1,
-    "recorded store failure due to value too large")
+    "recorded store failure due to value too large");
+
+# binary protocol state is only allocated for binary clients.
+{
+    my $before = $stats->{connection_structure_bytes};
+    cmp_ok($before, '>', 0, "connection structure bytes counted");
+    my $bsock = $server->new_sock;
+    # noop
+    print $bsock pack("CCnCCnNNNN", 0x80, 0x0a, 0, 0, 0, 0, 0, 0, 0, 0);
+    my $res;
+    read($bsock, $res, 24);
+    $stats = mem_stats($sock);
+    cmp_ok($stats->{connection_structure_bytes}, '>', $before,
+        "binary client allocated protocol state");
+}
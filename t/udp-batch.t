@@ -0,0 +1,117 @@
+#!/usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+# UDP requests are read and answered in batches. Fire off a pile of requests
+# without waiting for responses and make sure every one gets its own, intact,
+# answer.
+
+if (!MemcachedTest::supports_udp()) {
+    plan skip_all => 'UDP not supported';
+}
+
+my $batched = MemcachedTest::print_help() =~ /udp_gso/;
+
+# values of one, several and many packets.
+my %vals = ();
+for my $k (1 .. 30) {
+    my $len = $k % 10 == 0 ? 6000 : $k % 15 == 0 ? 30000 : $k * 3;
+    $vals{"ub$k"} = join('', map { chr(65 + ($_ + $k) % 26) } 1 .. $len);
+}
+
+sub udp_pkt {
+    my ($reqid, $req) = @_;
+    return pack("nnnn", $reqid, 0, 1, 0) . $req;
+}
+
+# reads datagrams until nothing shows up for a while, returning the
+# reassembled responses by request id.
+sub udp_collect {
+    my $sock = shift;
+    my %pkts = ();
+    my %totals = ();
+    while (1) {
+        my $rin = '';
+        vec($rin, fileno($sock), 1) = 1;
+        last unless select(my $rout = $rin, undef, undef, 1.0);
+        my $res;
+        $sock->recv($res, 2000, 0);
+        my ($resid, $seq, $total) = unpack("nnn", substr($res, 0, 6));
+        $pkts{$resid}{$seq} = substr($res, 8);
+        $totals{$resid} = $total;
+    }
+    my %msgs = ();
+    for my $id (keys %pkts) {
+        my $msg = '';
+        for my $seq (0 .. $totals{$id} - 1) {
+            $msg = undef, last unless exists $pkts{$id}{$seq};
+            $msg .= $pkts{$id}{$seq};
+        }
+        $msgs{$id} = $msg;
+    }
+    return \%msgs;
+}
+
+sub run_batch {
+    my ($server, $name) = @_;
+    my $sock = $server->sock;
+    for my $k (sort keys %vals) {
+        my $len = length($vals{$k});
+        print $sock "set $k 0 0 $len noreply\r\n$vals{$k}\r\n";
+    }
+    print $sock "mn\r\n";
+    is(scalar <$sock>, "MN\r\n", "$name: stored values");
+
+    my $usock = $server->new_udp_sock;
+    setsockopt($usock, Socket::SOL_SOCKET(), Socket::SO_RCVBUF(), 1 << 20);
+    my %expect = ();
+    for my $n (1 .. 40) {
+        my $k = "ub$n";
+        $expect{$n} = exists $vals{$k}
+            ? "VALUE $k 0 " . length($vals{$k}) . "\r\n$vals{$k}\r\nEND\r\n"
+            : "END\r\n";
+        send($usock, udp_pkt($n, "get $k\r\n"), 0);
+    }
+    # a request split over several packets is dropped, but doesn't get in
+    # the way of the ones after it.
+    send($usock, pack("nnnn", 41, 0, 2, 0) . "get ub1\r\n", 0);
+    send($usock, udp_pkt(42, "mg ub2 v\r\n"), 0);
+    $expect{42} = "VA 6\r\n$vals{ub2}\r\n";
+
+    my $got = udp_collect($usock);
+    my $ok = 0;
+    for my $n (keys %expect) {
+        $ok++ if defined $got->{$n} && $got->{$n} eq $expect{$n};
+    }
+    is($ok, scalar keys %expect, "$name: all responses intact");
+    ok(!exists $got->{41}, "$name: multi-packet request dropped");
+
+    my $stats = mem_stats($sock);
+    note("recv $stats->{udp_recv_packets} packets in $stats->{udp_recv_calls} calls, "
+        . "sent $stats->{udp_send_packets} in $stats->{udp_send_calls}");
+    is($stats->{udp_recv_packets}, 42, "$name: received packets counted");
+    cmp_ok($stats->{udp_recv_calls}, '<=', 42, "$name: receive calls counted");
+    cmp_ok($stats->{udp_send_packets}, '>', 41, "$name: sent packets counted");
+    if ($batched) {
+        cmp_ok($stats->{udp_send_calls}, '<', $stats->{udp_send_packets},
+            "$name: several packets sent per call");
+    }
+}
+
+my $server = new_memcached("-l 127.0.0.1 -t 1");
+run_batch($server, "sendmmsg");
+
+SKIP: {
+    skip "UDP GSO not available", 7 unless $batched;
+    my $gso = new_memcached("-l 127.0.0.1 -t 1 -o udp_gso");
+    my $settings = mem_stats($gso->sock, ' settings');
+    skip "kernel doesn't support UDP GSO", 7 if $settings->{udp_gso} ne 'yes';
+    run_batch($gso, "gso");
+}
+
+done_testing();
@@ -0,0 +1,141 @@
+#!/usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+if (MemcachedTest::print_help() !~ /worker_uring/) {
+    plan skip_all => 'io_uring support not compiled in';
+}
+
+my $server = new_memcached("-m 64 -t 2 -o worker_uring,lru_crawler");
+my $sock = $server->sock;
+
+my $stats = mem_stats($sock, ' settings');
+is($stats->{worker_uring}, "yes", "worker_uring enabled");
+
+print $sock "set foo 0 0 3\r\nbar\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored foo");
+mem_get_is($sock, "foo", "bar");
+
+# pipelined commands in a single write.
+{
+    my $cmds = '';
+    for my $k (1 .. 50) {
+        $cmds .= "set pipe$k 0 0 " . length("val$k") . "\r\nval$k\r\n";
+    }
+    print $sock $cmds;
+    my $ok = 0;
+    for my $k (1 .. 50) {
+        $ok++ if scalar <$sock> eq "STORED\r\n";
+    }
+    is($ok, 50, "pipelined sets");
+
+    print $sock "get " . join(' ', map { "pipe$_" } 1 .. 50) . "\r\n";
+    my $hits = 0;
+    for my $k (1 .. 50) {
+        my $hdr = <$sock>;
+        my $val = <$sock>;
+        $hits++ if $hdr =~ /^VALUE pipe$k 0/ && $val eq "val$k\r\n";
+    }
+    is(scalar <$sock>, "END\r\n", "multiget end");
+    is($hits, 50, "multiget returned all values");
+}
+
+# values larger than a receive buffer and a response larger than a
+# single socket write.
+{
+    my $big = join(':', 1 .. 100000);
+    my $len = length($big);
+    print $sock "set big 0 0 $len\r\n$big\r\n";
+    is(scalar <$sock>, "STORED\r\n", "stored large value");
+    mem_get_is($sock, "big", $big, "large value read back");
+}
+
+# noreply commands don't produce output.
+print $sock "set quiet 0 0 2 noreply\r\nhi\r\n";
+mem_get_is($sock, "quiet", "hi", "noreply set");
+
+# many clients at once, spread over the workers.
+{
+    my @socks = map { $server->new_sock } 1 .. 40;
+    my $x = 0;
+    for my $s (@socks) {
+        $x++;
+        print $s "set multi$x 0 0 " . length($x) . "\r\n$x\r\n";
+    }
+    my $ok = 0;
+    for my $s (@socks) {
+        $ok++ if scalar <$s> eq "STORED\r\n";
+    }
+    is($ok, 40, "stored from many connections");
+    $x = 0;
+    my $hits = 0;
+    for my $s (@socks) {
+        $x++;
+        print $s "mg multi$x v\r\n";
+    }
+    $x = 0;
+    for my $s (@socks) {
+        $x++;
+        my $hdr = <$s>;
+        my $val = <$s>;
+        $hits++ if $hdr =~ /^VA / && $val eq "$x\r\n";
+    }
+    is($hits, 40, "fetched from many connections");
+    close($_) for @socks;
+}
+
+# a client going away mid command doesn't upset anything.
+{
+    my $s = $server->new_sock;
+    print $s "set gone 0 0 10\r\nabc";
+    close($s);
+    $s = $server->new_sock;
+    print $s "get foo\r\n";
+    close($s);
+    mem_get_is($sock, "foo", "bar", "server fine after clients vanish");
+}
+
+# connections handed to side threads and back.
+{
+    my $s = $server->new_sock;
+    print $s "lru_crawler metadump all\r\n";
+    my $count = 0;
+    while (my $line = <$s>) {
+        last if $line eq "END\r\n";
+        $count++;
+    }
+    cmp_ok($count, '>=', 53, "metadump through the crawler");
+    print $s "get foo\r\n";
+    is(scalar <$s>, "VALUE foo 0 3\r\n", "conn back from the crawler");
+    is(scalar <$s>, "bar\r\n", "value");
+    is(scalar <$s>, "END\r\n", "end");
+
+    my $w = $server->new_sock;
+    print $w "watch fetchers\r\n";
+    is(scalar <$w>, "OK\r\n", "watcher started");
+    mem_get_is($sock, "foo", "bar");
+    like(scalar <$w>, qr/ts=\S+ gid=\d+ type=item_get key=foo/, "watcher saw fetch");
+}
+
+$stats = mem_stats($sock);
+cmp_ok($stats->{bytes_read}, '>', 500000, "bytes_read counted");
+cmp_ok($stats->{bytes_written}, '>', 500000, "bytes_written counted");
+
+print $sock "quit\r\n";
+is(scalar <$sock>, undef, "quit closes the connection");
+
+# features that don't cover ring-driven connections are refused.
+for my $opt ("qos_weights=batch:5", "shed_target=1000",
+        "migrate_threshold=20", "zerocopy_min_bytes=65536") {
+    my ($name) = $opt =~ /^(\w+)=/;
+    next if MemcachedTest::print_help() !~ /$name/;
+    eval { new_memcached("-o worker_uring,$opt") };
+    ok($@, "worker_uring refused with $name");
+}
+
+done_testing();
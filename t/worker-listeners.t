@@ -0,0 +1,95 @@
+#!/usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+if (MemcachedTest::print_help() !~ /worker_listeners/) {
+    plan skip_all => 'SO_REUSEPORT not available';
+}
+
+my $server = new_memcached("-l 127.0.0.1 -U 0 -t 4 -c 100 -o worker_listeners");
+my $sock = $server->sock;
+
+my $stats = mem_stats($sock, ' settings');
+is($stats->{worker_listeners}, "yes", "worker_listeners enabled");
+
+# one listening socket per worker for every address.
+{
+    print $sock "stats conns\r\n";
+    my %listeners = ();
+    my %addrs = ();
+    while (my $line = <$sock>) {
+        last if $line eq "END\r\n";
+        if ($line =~ /^STAT (\d+):addr (\S+)/) {
+            $addrs{$1} = $2;
+        } elsif ($line =~ /^STAT (\d+):state conn_listening/) {
+            $listeners{$addrs{$1}}++;
+        }
+    }
+    ok(scalar(keys %listeners) > 0, "found listeners");
+    my $per_addr = grep { $_ == 4 } values %listeners;
+    is($per_addr, scalar(keys %listeners), "four listeners per address");
+}
+
+$stats = mem_stats($sock);
+is($stats->{curr_connections}, 1, "extra listeners aren't counted as connections");
+
+# connections are spread over the workers and all of them work.
+{
+    my @socks = map { $server->new_sock } 1 .. 20;
+    my $x = 0;
+    for my $s (@socks) {
+        $x++;
+        print $s "set wl$x 0 0 " . length($x) . "\r\n$x\r\n";
+    }
+    my $ok = 0;
+    for my $s (@socks) {
+        $ok++ if scalar <$s> eq "STORED\r\n";
+    }
+    is($ok, 20, "stored through all connections");
+    $x = 0;
+    my $hits = 0;
+    for my $s (@socks) {
+        $x++;
+        print $s "get wl$x\r\n";
+        $hits++ if scalar <$s> eq "VALUE wl$x 0 " . length($x) . "\r\n"
+            && scalar <$s> eq "$x\r\n" && scalar <$s> eq "END\r\n";
+    }
+    is($hits, 20, "fetched through all connections");
+    $stats = mem_stats($sock);
+    is($stats->{curr_connections}, 21, "curr_connections counts clients");
+    close($_) for @socks;
+}
+
+# maxconns is still enforced by the workers.
+{
+    my @socks = ();
+    my $rejected = 0;
+    for (1 .. 120) {
+        my $s = $server->new_sock;
+        next unless defined $s;
+        push(@socks, $s);
+        print $s "version\r\n";
+        my $line = <$s>;
+        $rejected++ if defined $line && $line =~ /^ERROR Too many open connections/;
+    }
+    ok($rejected > 0, "connections over the limit were rejected");
+    $stats = mem_stats($sock);
+    cmp_ok($stats->{rejected_connections}, '>=', $rejected, "rejections counted");
+    close($_) for @socks;
+
+    my $s;
+    for (1 .. 10) {
+        $s = $server->new_sock;
+        last if defined $s;
+        sleep 0.1;
+    }
+    print $s "version\r\n";
+    like(scalar <$s>, qr/^VERSION /, "accepting again after closing");
+}
+
+done_testing();
@@ -0,0 +1,79 @@
+#!/usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use Socket;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+if (MemcachedTest::print_help() !~ /zerocopy_min_bytes/) {
+    plan skip_all => 'MSG_ZEROCOPY not available';
+}
+
+my $server = new_memcached("-l 127.0.0.1 -U 0 -t 2 -o zerocopy_min_bytes=16384");
+my $sock = $server->sock;
+
+my $stats = mem_stats($sock, ' settings');
+is($stats->{zerocopy_min_bytes}, 16384, "zerocopy_min_bytes set");
+
+my $big = join(':', 1 .. 100000);
+my $len = length($big);
+print $sock "set big 0 0 $len\r\n$big\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored large value");
+print $sock "set small 0 0 5\r\nhello\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored small value");
+
+# small responses are never sent with zerocopy.
+{
+    my $s = $server->new_sock;
+    mem_get_is($s, "small", "hello");
+    $stats = mem_stats($sock);
+    is($stats->{zerocopy_sends}, 0, "small response copied");
+}
+
+# large responses are.
+{
+    my $s = $server->new_sock;
+    mem_get_is($s, "big", $big, "large value intact");
+    $stats = mem_stats($sock);
+    cmp_ok($stats->{zerocopy_sends}, '>=', 1, "large response sent with zerocopy");
+    # over loopback the kernel always ends up copying, and the connection
+    # should notice and stop trying.
+    my $copied = 0;
+    for (1 .. 20) {
+        mem_get_is($s, "big", $big);
+        $stats = mem_stats($sock);
+        last if ($copied = $stats->{zerocopy_copied}) > 0;
+        select(undef, undef, undef, 0.05);
+    }
+    cmp_ok($copied, '>=', 1, "copied completions counted");
+    my $sends = $stats->{zerocopy_sends};
+    mem_get_is($s, "big", $big);
+    $stats = mem_stats($sock);
+    is($stats->{zerocopy_sends}, $sends, "connection stopped using zerocopy");
+}
+
+# a client that closes before reading everything still gets all the data,
+# even though the item memory is still in use by the kernel.
+{
+    socket(my $s, PF_INET, SOCK_STREAM, 0) or die "socket: $!";
+    setsockopt($s, SOL_SOCKET, SO_RCVBUF, 16384);
+    connect($s, pack_sockaddr_in($server->port, inet_aton("127.0.0.1")))
+        or die "connect: $!";
+    syswrite($s, "get big\r\nquit\r\n");
+    select(undef, undef, undef, 0.2);
+    my $data = '';
+    my $buf;
+    while (my $n = sysread($s, $buf, 65536)) {
+        $data .= $buf;
+    }
+    is($data, "VALUE big 0 $len\r\n$big\r\nEND\r\n", "response intact after quit");
+    close($s);
+
+    # the item is still fine.
+    mem_get_is($sock, "big", $big, "value still there");
+}
+
+done_testing();
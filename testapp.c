@@ -21,6 +21,7 @@
 #include "config.h"
 #include "cache.h"
 #include "crc32c.h"
+#include "tokenize.h"
 #include "hash.h"
 #include "jenkins_hash.h"
 #include "stats_prefix.h"
@@ -878,6 +879,43 @@ static enum test_return test_crc32c(void) {
     return TEST_PASS;
 }
 
+static enum test_return test_tokenize(void) {
+    mc_token_t tok[8], ref[8];
+    size_t stop, ref_stop;
+    int n, ref_n;
+
+    n = mc_tokenize("mg foo v t", 10, tok, 8, &stop);
+    assert(n == 4 && stop == 10);
+    assert(tok[1].start == 3 && tok[1].len == 3);
+    assert(tok[3].start == 9 && tok[3].len == 1);
+
+    /* stops at the end of the last token when max is hit */
+    n = mc_tokenize("  get a  b c", 12, tok, 2, &stop);
+    assert(n == 2 && stop == 7);
+    assert(tok[0].start == 2 && tok[0].len == 3);
+
+    n = mc_tokenize("    ", 4, tok, 8, &stop);
+    assert(n == 0 && stop == 4);
+
+    /* random lines straddling the 64 byte blocks against the byte loop */
+    char line[300];
+    unsigned int seed = 42;
+    for (int i = 0; i < 20000; i++) {
+        size_t len = rand_r(&seed) % sizeof(line);
+        int max = rand_r(&seed) % 8 + 1;
+        int spaces = rand_r(&seed) % 4 + 1;
+        for (size_t x = 0; x < len; x++) {
+            line[x] = rand_r(&seed) % (spaces * 8) < 8 ? 'a' + x % 26 : ' ';
+        }
+        n = mc_tokenize(line, len, tok, max, &stop);
+        ref_n = mc_tokenize_sw(line, len, ref, max, &ref_stop);
+        assert(n == ref_n && stop == ref_stop);
+        assert(memcmp(tok, ref, sizeof(mc_token_t) * n) == 0);
+    }
+
+    return TEST_PASS;
+}
+
 static enum test_return test_issue_102(void) {
     char buffer[4096];
     memset(buffer, ' ', sizeof(buffer));
@@ -2275,6 +2313,7 @@ struct testcase testcases[] = {
     { "vperror", test_vperror },
     { "issue_101", test_issue_101 },
     { "crc32c", test_crc32c },
+    { "tokenize", test_tokenize },
     /* The following tests all run towards the same server */
     { "start_server", start_memcached_server },
     { "issue_92", test_issue_92 },
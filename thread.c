@@ -35,9 +35,12 @@
 enum conn_queue_item_modes {
     queue_new_conn,   /* brand new connection. */
     queue_pause,      /* pause thread */
-    queue_timeout,    /* socket sfd timed out */
     queue_redispatch, /* return conn from side thread */
     queue_stop,       /* exit thread */
+    queue_new_listener, /* per-worker listening socket */
+    queue_listen_pause, /* stop accepting on a worker's listener */
+    queue_listen_resume, /* start accepting on a worker's listener */
+    queue_migrate,    /* client connection moved from another worker */
 #ifdef PROXY
     queue_proxy_reload, /* signal proxy to reload worker VM */
 #endif
@@ -54,6 +57,7 @@ struct conn_queue_item {
     void    *ssl;
     uint64_t conntag;
     enum protocol bproto;
+    bool ssl_enabled; // listeners hand out TLS connections.
     io_pending_t *io; // IO when used for deferred IO handling.
     STAILQ_ENTRY(conn_queue_item) i_next;
 };
@@ -250,9 +254,6 @@ void stop_threads(void) {
     logger_stop();
     if (settings.verbose > 0)
         fprintf(stderr, "stopped logger thread\n");
-    stop_conn_timeout_thread();
-    if (settings.verbose > 0)
-        fprintf(stderr, "stopped idle timeout thread\n");
 
     // Close all connections then let the workers finally exit.
     if (settings.verbose > 0)
@@ -442,6 +443,8 @@ static void setup_thread(LIBEVENT_THREAD *me) {
     setup_thread_notify(me, &me->ion, thread_libevent_ionotify);
     pthread_mutex_init(&me->ion_lock, NULL);
     STAILQ_INIT(&me->ion_head);
+    conn_idle_thread_init(me);
+    me->migrate_to = -1;
 
     me->ev_queue = malloc(sizeof(struct conn_queue));
     if (me->ev_queue == NULL) {
@@ -477,6 +480,18 @@ static void setup_thread(LIBEVENT_THREAD *me) {
         fprintf(stderr, "Failed to create IO object cache\n");
         exit(EXIT_FAILURE);
     }
+
+    hot_cache_thread_init(me);
+
+    if (settings.hotkey_sample) {
+        me->hotkeys = hotkeys_create(settings.hotkey_slots);
+        if (me->hotkeys == NULL) {
+            fprintf(stderr, "Failed to allocate hot key table\n");
+            exit(EXIT_FAILURE);
+        }
+        me->hotkeys_countdown = settings.hotkey_sample;
+        me->hotkeys_last = -1;
+    }
 #ifdef TLS
     if (settings.ssl_enabled) {
         me->ssl_wbuf = (char *)malloc((size_t)settings.ssl_wbuf_size);
@@ -508,6 +523,87 @@ static void setup_thread(LIBEVENT_THREAD *me) {
 /*
  * Worker thread: main event loop
  */
+static void worker_loop_once(LIBEVENT_THREAD *me, int flags) {
+    if (settings.qos_classes || settings.shed_target) {
+        conn_loop_round(me);
+    }
+#ifdef USE_URING
+    if (me->uring) {
+        conn_uring_flush(me);
+    }
+#endif
+    event_base_loop(me->base, flags);
+#ifdef PROXY
+    if (me->proxy_ctx) {
+        proxy_gc_poke(me);
+    }
+#endif
+}
+
+static uint64_t busy_poll_now(void) {
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000000 + (uint64_t)tv.tv_usec * 1000;
+#endif
+}
+
+// How often the busy poll loop folds its counters into the thread stats.
+#define BUSY_POLL_STATS_NS 10000000
+
+/*
+ * With -o busy_poll=N workers don't go to sleep in epoll as soon as they run
+ * out of work. They keep checking for events without blocking until N
+ * microseconds have passed since the last time something happened, then
+ * block as usual. This trades a core's worth of CPU for not paying the
+ * wakeup latency on every request. Any callback running counts as work.
+ */
+static void worker_busy_poll(LIBEVENT_THREAD *me) {
+    uint64_t budget = (uint64_t)settings.busy_poll * 1000;
+    uint64_t spin = 0, work = 0, sleeps = 0;
+    uint64_t last = busy_poll_now();
+    uint64_t flushed = last;
+
+    while (!event_base_got_exit(me->base)) {
+        uint64_t events = me->busy_poll_events;
+        uint64_t start = busy_poll_now();
+        worker_loop_once(me, EVLOOP_NONBLOCK);
+        uint64_t now = busy_poll_now();
+
+        if (me->busy_poll_events != events) {
+            work += now - start;
+            last = now;
+        } else {
+            spin += now - start;
+            if (now - last >= budget) {
+                sleeps++;
+            }
+        }
+
+        if (sleeps || now - flushed >= BUSY_POLL_STATS_NS) {
+            pthread_mutex_lock(&me->stats.mutex);
+            me->stats.busy_poll_spin_us += spin / 1000;
+            me->stats.busy_poll_work_us += work / 1000;
+            me->stats.busy_poll_sleeps += sleeps;
+            pthread_mutex_unlock(&me->stats.mutex);
+            // keep the remainders so short intervals still add up.
+            spin %= 1000;
+            work %= 1000;
+            flushed = now;
+        }
+
+        if (sleeps) {
+            sleeps = 0;
+            worker_loop_once(me, EVLOOP_ONCE);
+            last = busy_poll_now();
+        }
+    }
+}
+
 static void *worker_libevent(void *arg) {
     LIBEVENT_THREAD *me = arg;
 
@@ -520,21 +616,35 @@ static void *worker_libevent(void *arg) {
         abort();
     }
 
+#ifdef USE_URING
+    // the ring has to be created by the thread which submits to it.
+    if (settings.worker_uring) {
+        conn_uring_thread_init(me);
+    }
+#endif
+
     if (settings.drop_privileges) {
         drop_worker_privileges();
     }
 
     register_thread_initialized();
-#ifdef PROXY
-    while (!event_base_got_exit(me->base)) {
-        event_base_loop(me->base, EVLOOP_ONCE);
-        if (me->proxy_ctx) {
-            proxy_gc_poke(me);
+    if (settings.busy_poll) {
+        worker_busy_poll(me);
+    } else {
+        // come back out of the loop every time around if there's work to do
+        // between rounds.
+        bool once = settings.qos_classes || settings.shed_target;
+#if defined(PROXY) || defined(USE_URING)
+        once = true;
+#endif
+        if (once) {
+            while (!event_base_got_exit(me->base)) {
+                worker_loop_once(me, EVLOOP_ONCE);
+            }
+        } else {
+            event_base_loop(me->base, 0);
         }
     }
-#else
-    event_base_loop(me->base, 0);
-#endif
     // same mechanism used to watch for all threads exiting.
     register_thread_initialized();
 
@@ -552,6 +662,7 @@ static void thread_libevent_ionotify(evutil_socket_t fd, short which, void *arg)
     uint64_t ev_count = 0;
     iop_head_t head;
 
+    me->busy_poll_events++;
     STAILQ_INIT(&head);
 #ifdef HAVE_EVENTFD
     if (read(fd, &ev_count, sizeof(uint64_t)) != sizeof(uint64_t)) {
@@ -584,6 +695,55 @@ static void thread_libevent_ionotify(evutil_socket_t fd, short which, void *arg)
     }
 }
 
+/*
+ * Sets up a new client connection on the calling worker thread.
+ */
+static void thread_conn_new(LIBEVENT_THREAD *me, CQ_ITEM *item) {
+    conn *c = conn_new(item->sfd, item->init_state, item->event_flags,
+                       item->read_buffer_size, item->transport,
+                       me->base, item->ssl, item->conntag, item->bproto);
+    if (c == NULL) {
+        if (IS_UDP(item->transport)) {
+            fprintf(stderr, "Can't listen for events on UDP socket\n");
+            exit(1);
+        } else {
+            if (settings.verbose > 0) {
+                fprintf(stderr, "Can't listen for events on fd %d\n",
+                    item->sfd);
+            }
+#ifdef TLS
+            if (item->ssl) {
+                SSL_shutdown(item->ssl);
+                SSL_free(item->ssl);
+            }
+#endif
+            close(item->sfd);
+        }
+    } else {
+        c->thread = me;
+        conn_io_queue_setup(c);
+        if (!IS_UDP(c->transport)) {
+            THR_STATS_LOCK(me);
+            me->client_conns++;
+            THR_STATS_UNLOCK(me);
+        }
+        if (IS_TCP(c->transport) && c->state == conn_new_cmd) {
+            conn_idle_add(c);
+        }
+#ifdef USE_URING
+        if (me->uring) {
+            conn_uring_attach(c);
+        }
+#endif
+#ifdef TLS
+        if (settings.ssl_enabled && c->ssl != NULL) {
+            assert(c->thread && c->thread->ssl_wbuf);
+            c->ssl_wbuf = c->thread->ssl_wbuf;
+        }
+#endif
+    }
+}
+
 /*
  * Processes an incoming "connection event" item. This is called when
  * input arrives on the libevent wakeup pipe.
@@ -593,6 +753,8 @@ static void thread_libevent_process(evutil_socket_t fd, short which, void *arg)
     CQ_ITEM *item;
     conn *c;
     uint64_t ev_count = 0; // max number of events to loop through this run.
+
+    me->busy_poll_events++;
 #ifdef HAVE_EVENTFD
     // NOTE: unlike pipe we aren't limiting the number of events per read.
     // However we do limit the number of queue pulls to what the count was at
@@ -621,49 +783,37 @@ static void thread_libevent_process(evutil_socket_t fd, short which, void *arg)
 
         switch (item->mode) {
             case queue_new_conn:
-                c = conn_new(item->sfd, item->init_state, item->event_flags,
-                                   item->read_buffer_size, item->transport,
-                                   me->base, item->ssl, item->conntag, item->bproto);
+                thread_conn_new(me, item);
+                break;
+            case queue_new_listener:
+                c = conn_new(item->sfd, conn_listening, EV_READ | EV_PERSIST, 1,
+                        item->transport, me->base, NULL, item->conntag, item->bproto);
                 if (c == NULL) {
-                    if (IS_UDP(item->transport)) {
-                        fprintf(stderr, "Can't listen for events on UDP socket\n");
-                        exit(1);
-                    } else {
-                        if (settings.verbose > 0) {
-                            fprintf(stderr, "Can't listen for events on fd %d\n",
-                                item->sfd);
-                        }
-#ifdef TLS
-                        if (item->ssl) {
-                            SSL_shutdown(item->ssl);
-                            SSL_free(item->ssl);
-                        }
-#endif
-                        close(item->sfd);
-                    }
-                } else {
-                    c->thread = me;
-                    conn_io_queue_setup(c);
+                    fprintf(stderr, "failed to create listening connection\n");
+                    exit(EXIT_FAILURE);
+                }
+                c->thread = me;
 #ifdef TLS
-                    if (settings.ssl_enabled && c->ssl != NULL) {
-                        assert(c->thread && c->thread->ssl_wbuf);
-                        c->ssl_wbuf = c->thread->ssl_wbuf;
-                    }
+                c->ssl_enabled = item->ssl_enabled;
 #endif
-                }
+                /* the dispatcher waits for the listener to exist */
+                register_thread_initialized();
+                break;
+            case queue_listen_pause:
+            case queue_listen_resume:
+                listen_conn_update(conns[item->sfd], item->mode == queue_listen_resume);
                 break;
             case queue_pause:
                 /* we were told to pause and report in */
                 register_thread_initialized();
                 break;
-            case queue_timeout:
-                /* a client socket timed out */
-                conn_close_idle(conns[item->sfd]);
-                break;
             case queue_redispatch:
                 /* a side thread redispatched a client connection */
                 conn_worker_readd(conns[item->sfd]);
                 break;
+            case queue_migrate:
+                conn_migrate_in(item->c, me);
+                break;
             case queue_stop:
                 /* asked to stop */
                 event_base_loopexit(me->base, NULL);
@@ -808,6 +958,70 @@ void dispatch_conn_new(int sfd, enum conn_states init_state, int event_flags,
     notify_worker(thread, item);
 }
 
+/*
+ * Sets up a new connection on the worker thread that accepted it, for
+ * per-worker listeners. Must be called from that worker.
+ */
+void dispatch_conn_local(LIBEVENT_THREAD *t, int sfd, enum conn_states init_state, int event_flags,
+                         int read_buffer_size, enum network_transport transport, void *ssl,
+                         uint64_t conntag, enum protocol bproto) {
+    CQ_ITEM item;
+
+    memset(&item, 0, sizeof(item));
+    item.sfd = sfd;
+    item.init_state = init_state;
+    item.event_flags = event_flags;
+    item.read_buffer_size = read_buffer_size;
+    item.transport = transport;
+    item.mode = queue_new_conn;
+    item.ssl = ssl;
+    item.conntag = conntag;
+    item.bproto = bproto;
+
+    MEMCACHED_CONN_DISPATCH(sfd, (int64_t)t->thread_id);
+    thread_conn_new(t, &item);
+}
+
+/*
+ * Hands a listening socket to a worker thread and waits for it to be set
+ * up, so the caller can link it into the list of listeners. Only called by
+ * the main thread during startup.
+ */
+conn *dispatch_listen_conn(int tid, int sfd, enum network_transport transport, bool ssl_enabled,
+                           uint64_t conntag, enum protocol bproto) {
+    LIBEVENT_THREAD *thread = threads + tid;
+    CQ_ITEM *item = cqi_new(thread->ev_queue);
+    if (item == NULL) {
+        fprintf(stderr, "Failed to allocate memory for listening connection\n");
+        exit(EXIT_FAILURE);
+    }
+
+    item->sfd = sfd;
+    item->transport = transport;
+    item->mode = queue_new_listener;
+    item->ssl = NULL;
+    item->ssl_enabled = ssl_enabled;
+    item->conntag = conntag;
+    item->bproto = bproto;
+
+    pthread_mutex_lock(&init_lock);
+    init_count = 0;
+    notify_worker(thread, item);
+    wait_for_thread_registration(1);
+    pthread_mutex_unlock(&init_lock);
+
+    return conns[sfd];
+}
+
+/*
+ * Listeners owned by a worker can only have their events changed from that
+ * worker.
+ */
+void listen_conn_notify(conn *c, const bool do_accept) {
+    notify_worker_fd(c->thread, c->sfd,
+            do_accept ? queue_listen_resume : queue_listen_pause);
+}
+
 /*
  * Re-dispatches a connection back to the original thread. Can be called from
  * any side thread borrowing a connection.
@@ -816,9 +1030,6 @@ void redispatch_conn(conn *c) {
     notify_worker_fd(c->thread, c->sfd, queue_redispatch);
 }
 
-void timeout_conn(conn *c) {
-    notify_worker_fd(c->thread, c->sfd, queue_timeout);
-}
 #ifdef PROXY
 void proxy_reload_notify(LIBEVENT_THREAD *t) {
     notify_worker_fd(t, 0, queue_proxy_reload);
@@ -854,6 +1065,119 @@ void return_io_pending(io_pending_t *io) {
     }
 }
 
+/*
+ * Hands a client connection that's between commands over to another worker.
+ * Returns false, with the connection untouched, if it can't be done.
+ */
+bool migrate_conn(conn *c, int tid) {
+    LIBEVENT_THREAD *t = threads + tid;
+    CQ_ITEM *item = cqi_new(t->ev_queue);
+    if (item == NULL) {
+        return false;
+    }
+
+    conn_migrate_out(c);
+    item->mode = queue_migrate;
+    item->sfd = c->sfd;
+    item->c = c;
+    notify_worker(t, item);
+    return true;
+}
+
+/*
+ * Called by the main thread once a second to see how much CPU each worker
+ * used. With -o migrate_threshold, if the busiest worker has used that many
+ * percent more than the idlest for migrate_interval seconds in a row, it's
+ * asked to hand a connection over. It gives up the next one to go idle
+ * between commands: busy connections do that most often, so they're the
+ * likeliest to go. Nothing is moved if the busiest worker only has one
+ * connection, or if moving an average one would overshoot.
+ */
+#ifdef USE_CONN_MIGRATION
+void threads_cpu_check(void) {
+    static uint64_t last = 0;
+    static unsigned int sustained = 0;
+    struct timespec ts;
+    uint64_t now;
+    int hi = -1, lo = -1;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+        return;
+    now = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+
+    for (int i = 0; i < settings.num_threads; i++) {
+        LIBEVENT_THREAD *t = &threads[i];
+        clockid_t cid;
+        uint64_t cpu;
+
+        // a migration that wasn't picked up in time is stale now.
+        t->migrate_to = -1;
+        if (pthread_getcpuclockid(t->thread_id, &cid) != 0
+                || clock_gettime(cid, &ts) != 0) {
+            return;
+        }
+        cpu = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+        if (last && now > last) {
+            t->cpu_pct = (cpu - t->cpu_ns) * 100 / (now - last);
+        }
+        t->cpu_ns = cpu;
+
+        if (hi == -1 || t->cpu_pct > threads[hi].cpu_pct)
+            hi = i;
+        if (lo == -1 || t->cpu_pct < threads[lo].cpu_pct)
+            lo = i;
+    }
+    last = now;
+
+    if (settings.migrate_threshold == 0) {
+        return;
+    }
+
+    unsigned int gap = threads[hi].cpu_pct - threads[lo].cpu_pct;
+    LIBEVENT_THREAD *ht = &threads[hi];
+    THR_STATS_LOCK(ht);
+    int nconns = ht->client_conns;
+    THR_STATS_UNLOCK(ht);
+    if (gap < settings.migrate_threshold || nconns < 2
+            || gap <= threads[hi].cpu_pct / nconns) {
+        sustained = 0;
+        return;
+    }
+    if (++sustained < settings.migrate_interval) {
+        return;
+    }
+    sustained = 0;
+    threads[hi].migrate_to = lo;
+}
+#endif
+
+void thread_stats_workers(ADD_STAT add_stats, void *c) {
+    char key_str[STAT_KEY_LEN];
+    char val_str[STAT_VAL_LEN];
+    int klen = 0, vlen = 0;
+
+    for (int i = 0; i < settings.num_threads; i++) {
+        LIBEVENT_THREAD *t = &threads[i];
+        uint64_t in, out;
+        int conns;
+
+        pthread_mutex_lock(&t->stats.mutex);
+        in = t->stats.migrated_in;
+        out = t->stats.migrated_out;
+        conns = t->client_conns;
+        pthread_mutex_unlock(&t->stats.mutex);
+
+#ifdef USE_CONN_MIGRATION
+        APPEND_NUM_STAT(i, "cpu_pct", "%u", t->cpu_pct);
+#endif
+        APPEND_NUM_STAT(i, "conns", "%d", conns);
+        APPEND_NUM_STAT(i, "migrated_in", "%llu", (unsigned long long)in);
+        APPEND_NUM_STAT(i, "migrated_out", "%llu", (unsigned long long)out);
+    }
+
+    add_stats(NULL, 0, NULL, 0, c);
+}
+
 /* This misses the allow_new_conns flag :( */
 void sidethread_conn_close(conn *c) {
     if (settings.verbose > 1)
@@ -891,6 +1215,28 @@ item *item_get(const char *key, const size_t nkey, LIBEVENT_THREAD *t, const boo
     return it;
 }
 
+/* item_get() for plain gets, trying the worker's hot item cache first. An
+ * item found there comes back without a reference of its own: *hot is set,
+ * and the entry must be given back with hot_cache_return() instead. */
+item *item_get_hot(const char *key, const size_t nkey, LIBEVENT_THREAD *t, struct hot_item **hot) {
+    item *it;
+    uint32_t hv;
+    hv = hash(key, nkey);
+    *hot = NULL;
+    it = hot_cache_get(t, key, nkey, hv, hot);
+    if (it != NULL) {
+        return it;
+    }
+    item_lock(hv);
+    it = do_item_get(key, nkey, hv, t, DO_UPDATE);
+    item_unlock(hv);
+    // may release another item, so not under this one's lock.
+    if (it != NULL) {
+        hot_cache_count(t, it, hv);
+    }
+    return it;
+}
+
 // returns an item with the item lock held.
 // lock will still be held even if return is NULL, allowing caller to replace
 // an item atomically if desired.
@@ -976,6 +1322,20 @@ enum store_item_type store_item(item *item, int comm, LIBEVENT_THREAD *t, int *n
     return ret;
 }
 
+/*
+ * Overwrites part of an existing item's value.
+ */
+enum store_item_type store_item_range(item *item, unsigned int off, LIBEVENT_THREAD *t, int *nbytes, uint64_t *cas, const uint64_t cas_in) {
+    enum store_item_type ret;
+    uint32_t hv;
+
+    hv = hash(ITEM_key(item), item->nkey);
+    item_lock(hv);
+    ret = do_store_item_range(item, t, hv, off, nbytes, cas, cas_in);
+    item_unlock(hv);
+    return ret;
+}
+
 /******************************* GLOBAL STATS ******************************/
 
 void STATS_LOCK(void) {
@@ -1004,9 +1364,36 @@ void threadlocal_stats_reset(void) {
                 sizeof(threads[ii].stats.slab_stats));
         memset(&threads[ii].stats.lru_hits, 0,
                 sizeof(uint64_t) * POWER_LARGEST);
+        memset(&threads[ii].stats.qos, 0, sizeof(threads[ii].stats.qos));
 
         pthread_mutex_unlock(&threads[ii].stats.mutex);
+        if (threads[ii].hotkeys != NULL) {
+            hotkeys_reset(threads[ii].hotkeys);
+        }
+    }
+}
+
+/* Sums up the workers' hot keys and writes out the top ones. Returns false
+ * if hot keys aren't tracked or there is no memory to merge them. */
+bool threadlocal_hotkeys_stats(const unsigned int top, const bool by_bytes,
+        ADD_STAT add_stats, void *c) {
+    struct hotkeys *h;
+    int ii;
+
+    if (settings.hotkey_sample == 0) {
+        return false;
+    }
+    h = hotkeys_create(settings.hotkey_slots * settings.num_threads);
+    if (h == NULL) {
+        return false;
     }
+    for (ii = 0; ii < settings.num_threads; ++ii) {
+        hotkeys_merge(h, threads[ii].hotkeys);
+    }
+    hotkeys_stats(h, top, by_bytes, add_stats, c);
+    pthread_mutex_destroy(&h->lock);
+    free(h);
+    return true;
 }
 
 void threadlocal_stats_aggregate(struct thread_stats *stats) {
@@ -1042,6 +1429,12 @@ void threadlocal_stats_aggregate(struct thread_stats *stats) {
                 threads[ii].stats.lru_hits[sid];
         }
 
+        for (sid = 0; sid < settings.qos_classes; sid++) {
+#define X(name) stats->qos[sid].name += threads[ii].stats.qos[sid].name;
+            QOS_STATS_FIELDS
+#undef X
+        }
+
         stats->read_buf_count += threads[ii].rbuf_cache->total;
         stats->read_buf_bytes += threads[ii].rbuf_cache->total * READ_BUFFER_SIZE;
         stats->read_buf_bytes_free += threads[ii].rbuf_cache->freecurr * READ_BUFFER_SIZE;
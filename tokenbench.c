@@ -0,0 +1,78 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Times the request line tokenizer against the plain byte loop.
+ *
+ *   tokenbench [ROUNDS]
+ */
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "tokenize.h"
+
+#define MAX_TOKENS 24
+
+typedef int (*tokenize_func)(const char *s, size_t len, mc_token_t *tokens,
+        int max, size_t *stop);
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double run(tokenize_func f, const char *line, size_t len, int rounds,
+        int *sink) {
+    mc_token_t tokens[MAX_TOKENS];
+    size_t stop;
+    double start = now();
+    for (int i = 0; i < rounds; i++) {
+        *sink += f(line, len, tokens, MAX_TOKENS, &stop) + (int)stop;
+        // keep the compiler from hoisting the call out of the loop.
+        __asm__ volatile("" : : "r"(tokens) : "memory");
+    }
+    return (now() - start) * 1e9 / rounds;
+}
+
+int main(int argc, char **argv) {
+    int rounds = argc > 1 ? atoi(argv[1]) : 1000000;
+    char multiget[2048] = "get";
+    char longkey[300] = "mg ";
+    int sink = 0;
+
+    if (rounds <= 0) {
+        fprintf(stderr, "Usage: %s [ROUNDS]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < 100; i++) {
+        char key[16];
+        snprintf(key, sizeof(key), " key:%d", i);
+        strcat(multiget, key);
+    }
+    memset(longkey + 3, 'k', 250);
+    strcat(longkey, " s v t f q k O123456789");
+
+    struct {
+        const char *name;
+        const char *line;
+    } lines[] = {
+        { "get", "get foo:bar:baz" },
+        { "set", "set foo:bar:baz 0 3600 100 noreply" },
+        { "mg", "mg foo:bar:baz s v t f q k O123456789" },
+        { "mg-250b-key", longkey },
+        { "get-100-keys", multiget },
+    };
+
+    printf("tokenizer: %s, %d rounds\n", mc_tokenize_impl(), rounds);
+    for (size_t i = 0; i < sizeof(lines) / sizeof(lines[0]); i++) {
+        size_t len = strlen(lines[i].line);
+        double sw = run(mc_tokenize_sw, lines[i].line, len, rounds, &sink);
+        double fast = run(mc_tokenize, lines[i].line, len, rounds, &sink);
+        printf("%-14s %5zu bytes: bytewise %7.1f ns, %s %7.1f ns (%.2fx)\n",
+                lines[i].name, len, sw, mc_tokenize_impl(), fast, sw / fast);
+    }
+    return sink == 42 ? 1 : 0;
+}
@@ -0,0 +1,157 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Request line tokenizer.
+ *
+ * The vector paths compare 64 bytes at a time against a space and turn the
+ * result into a bitmask. XORing the mask with itself shifted by one byte
+ * leaves a bit on every edge: the first byte of a token, and the space right
+ * after one. Edges alternate starting with a token start, so walking them
+ * with ctz yields the tokens in order without looking at individual bytes.
+ */
+#include "config.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "tokenize.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define TOKENIZE_IMPL "avx2"
+
+static inline uint64_t space_mask(const char *p) {
+    const __m256i sp = _mm256_set1_epi8(' ');
+    __m256i lo = _mm256_loadu_si256((const __m256i *)p);
+    __m256i hi = _mm256_loadu_si256((const __m256i *)(p + 32));
+    uint32_t mlo = _mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, sp));
+    uint32_t mhi = _mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, sp));
+    return (uint64_t)mhi << 32 | mlo;
+}
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define TOKENIZE_IMPL "sse2"
+
+static inline uint64_t space_mask(const char *p) {
+    const __m128i sp = _mm_set1_epi8(' ');
+    uint64_t m = 0;
+    for (int i = 0; i < 4; i++) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + i * 16));
+        m |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, sp)) << (i * 16);
+    }
+    return m;
+}
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define TOKENIZE_IMPL "neon"
+
+// NEON has no movemask: weight each lane by its bit and add pairwise until
+// each of the 64 lanes has been folded into one bit of a 64 bit lane.
+static inline uint64_t space_mask(const char *p) {
+    static const uint8_t bits[16] = { 1, 2, 4, 8, 16, 32, 64, 128,
+        1, 2, 4, 8, 16, 32, 64, 128 };
+    const uint8x16_t sp = vdupq_n_u8(' ');
+    const uint8x16_t w = vld1q_u8(bits);
+    const uint8_t *u = (const uint8_t *)p;
+    uint8x16_t t0 = vandq_u8(vceqq_u8(vld1q_u8(u), sp), w);
+    uint8x16_t t1 = vandq_u8(vceqq_u8(vld1q_u8(u + 16), sp), w);
+    uint8x16_t t2 = vandq_u8(vceqq_u8(vld1q_u8(u + 32), sp), w);
+    uint8x16_t t3 = vandq_u8(vceqq_u8(vld1q_u8(u + 48), sp), w);
+    uint8x16_t s0 = vpaddq_u8(t0, t1);
+    uint8x16_t s1 = vpaddq_u8(t2, t3);
+    s0 = vpaddq_u8(s0, s1);
+    s0 = vpaddq_u8(s0, s0);
+    return vgetq_lane_u64(vreinterpretq_u64_u8(s0), 0);
+}
+#endif
+
+int mc_tokenize_sw(const char *s, size_t len, mc_token_t *tokens, int max,
+        size_t *stop) {
+    size_t i = 0;
+    int n = 0;
+    assert(max > 0);
+
+    while (i < len) {
+        while (i < len && s[i] == ' ')
+            i++;
+        if (i == len)
+            break;
+        tokens[n].start = i;
+        while (i < len && s[i] != ' ')
+            i++;
+        tokens[n].len = i - tokens[n].start;
+        if (++n == max) {
+            *stop = i;
+            return n;
+        }
+    }
+    *stop = len;
+    return n;
+}
+
+#ifdef TOKENIZE_IMPL
+int mc_tokenize(const char *s, size_t len, mc_token_t *tokens, int max,
+        size_t *stop) {
+    char tail[64];
+    uint64_t carry = 1; // as if the line was preceded by a space.
+    bool intoken = false;
+    int n = 0;
+    assert(max > 0);
+
+    // the byte loop wins on very short lines like "get foo".
+    if (len < 16) {
+        return mc_tokenize_sw(s, len, tokens, max, stop);
+    }
+
+    for (size_t off = 0; off < len; off += 64) {
+        uint64_t m;
+        if (len - off >= 64) {
+            m = space_mask(s + off);
+        } else {
+            // pad the last block with spaces rather than read past the end;
+            // a token running to the end of the line then closes in the pad.
+            memset(tail, ' ', sizeof(tail));
+            memcpy(tail, s + off, len - off);
+            m = space_mask(tail);
+        }
+        uint64_t edges = m ^ (m << 1 | carry);
+        carry = m >> 63;
+
+        while (edges) {
+            size_t pos = off + __builtin_ctzll(edges);
+            edges &= edges - 1;
+            if (!intoken) {
+                tokens[n].start = pos;
+            } else {
+                tokens[n].len = pos - tokens[n].start;
+                if (++n == max) {
+                    *stop = pos;
+                    return n;
+                }
+            }
+            intoken = !intoken;
+        }
+    }
+
+    // line length was a multiple of 64 and ended inside a token.
+    if (intoken) {
+        tokens[n].len = len - tokens[n].start;
+        n++;
+    }
+    *stop = len;
+    return n;
+}
+
+const char *mc_tokenize_impl(void) {
+    return TOKENIZE_IMPL;
+}
+#else
+int mc_tokenize(const char *s, size_t len, mc_token_t *tokens, int max,
+        size_t *stop) {
+    return mc_tokenize_sw(s, len, tokens, max, stop);
+}
+
+const char *mc_tokenize_impl(void) {
+    return "scalar";
+}
+#endif
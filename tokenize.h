@@ -0,0 +1,30 @@
+#ifndef TOKENIZE_H
+#define TOKENIZE_H
+
+/* Splits request lines on spaces, shared by the text protocol and proxy
+ * parsers. Where the compiler targets SSE2, AVX2 or NEON the line is scanned
+ * 64 bytes at a time; mc_tokenize_sw() is the plain byte loop, always built
+ * so tests and benchmarks can compare the two.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    uint32_t start;
+    uint32_t len;
+} mc_token_t;
+
+/* Finds up to max space separated tokens in s[0..len-1]. Returns how many
+ * were found. *stop is where the scan ended: len, unless max tokens were
+ * found, in which case it is the end of the last one.
+ */
+int mc_tokenize(const char *s, size_t len, mc_token_t *tokens, int max,
+        size_t *stop);
+int mc_tokenize_sw(const char *s, size_t len, mc_token_t *tokens, int max,
+        size_t *stop);
+
+/* Names the code path mc_tokenize() was built with. */
+const char *mc_tokenize_impl(void);
+
+#endif
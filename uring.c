@@ -0,0 +1,261 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Minimal io_uring support for the worker threads.
+ *
+ * This talks to the kernel directly instead of pulling in liburing: the
+ * worker loop only needs a handful of operations and a single issuer ring,
+ * so the ring setup and the head/tail dance are all that's required.
+ */
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+
+static int _setup(unsigned int entries, struct io_uring_params *p) {
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int _enter(int fd, unsigned int to_submit, unsigned int min_complete,
+        unsigned int flags) {
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+            NULL, 0);
+}
+
+static int _register(int fd, unsigned int opcode, void *arg,
+        unsigned int nr_args) {
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+int mc_uring_init(mc_uring_t *r, unsigned int entries) {
+    struct io_uring_params p;
+
+    memset(r, 0, sizeof(*r));
+    memset(&p, 0, sizeof(p));
+    // Completions from multishot receives can pile up quickly, so give the
+    // completion queue plenty of room.
+    p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER;
+    p.cq_entries = entries * 8;
+    r->fd = _setup(entries, &p);
+    if (r->fd < 0 && errno == EINVAL) {
+        // older kernels don't know about single issuer rings.
+        memset(&p, 0, sizeof(p));
+        p.flags = IORING_SETUP_CQSIZE;
+        p.cq_entries = entries * 8;
+        r->fd = _setup(entries, &p);
+    }
+    if (r->fd < 0) {
+        return -1;
+    }
+
+    // We need multishot receives and provided buffer rings, which arrived
+    // after these features.
+    if (!(p.features & IORING_FEAT_NODROP) ||
+        !(p.features & IORING_FEAT_FAST_POLL)) {
+        close(r->fd);
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    r->sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    r->cq_ring_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cq_ring_sz > r->sq_ring_sz) {
+            r->sq_ring_sz = r->cq_ring_sz;
+        }
+        r->cq_ring_sz = r->sq_ring_sz;
+    }
+
+    r->sq_ring = mmap(NULL, r->sq_ring_sz, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_ring == MAP_FAILED) {
+        goto error;
+    }
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        r->cq_ring = r->sq_ring;
+    } else {
+        r->cq_ring = mmap(NULL, r->cq_ring_sz, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+        if (r->cq_ring == MAP_FAILED) {
+            r->cq_ring = NULL;
+            goto error;
+        }
+    }
+
+    r->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_sz, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        r->sqes = NULL;
+        goto error;
+    }
+
+    char *sq = r->sq_ring;
+    char *cq = r->cq_ring;
+    r->sq_entries = p.sq_entries;
+    r->sq_khead = (unsigned int *)(sq + p.sq_off.head);
+    r->sq_ktail = (unsigned int *)(sq + p.sq_off.tail);
+    r->sq_kflags = (unsigned int *)(sq + p.sq_off.flags);
+    r->sq_mask = *(unsigned int *)(sq + p.sq_off.ring_mask);
+    r->cq_khead = (unsigned int *)(cq + p.cq_off.head);
+    r->cq_ktail = (unsigned int *)(cq + p.cq_off.tail);
+    r->cq_mask = *(unsigned int *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    // SQE slots are always used in ring order, so the index array is fixed.
+    unsigned int *array = (unsigned int *)(sq + p.sq_off.array);
+    for (unsigned int i = 0; i < p.sq_entries; i++) {
+        array[i] = i;
+    }
+    r->sq_tail = *r->sq_ktail;
+
+    return 0;
+error:
+    mc_uring_exit(r);
+    return -1;
+}
+
+void mc_uring_exit(mc_uring_t *r) {
+    if (r->sqes) {
+        munmap(r->sqes, r->sqes_sz);
+    }
+    if (r->cq_ring && r->cq_ring != r->sq_ring) {
+        munmap(r->cq_ring, r->cq_ring_sz);
+    }
+    if (r->sq_ring && r->sq_ring != MAP_FAILED) {
+        munmap(r->sq_ring, r->sq_ring_sz);
+    }
+    if (r->fd >= 0) {
+        close(r->fd);
+    }
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+}
+
+// Returns NULL if the submission queue is full; the caller should submit
+// and try again.
+struct io_uring_sqe *mc_uring_get_sqe(mc_uring_t *r) {
+    unsigned int head = __atomic_load_n(r->sq_khead, __ATOMIC_ACQUIRE);
+    if (r->sq_tail - head >= r->sq_entries) {
+        return NULL;
+    }
+    struct io_uring_sqe *sqe = &r->sqes[r->sq_tail & r->sq_mask];
+    r->sq_tail++;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+int mc_uring_submit(mc_uring_t *r) {
+    unsigned int head = __atomic_load_n(r->sq_khead, __ATOMIC_ACQUIRE);
+    unsigned int todo = r->sq_tail - head;
+    if (todo == 0) {
+        return 0;
+    }
+    __atomic_store_n(r->sq_ktail, r->sq_tail, __ATOMIC_RELEASE);
+
+    int ret;
+    do {
+        ret = _enter(r->fd, todo, 0, 0);
+    } while (ret < 0 && errno == EINTR);
+    return ret;
+}
+
+struct io_uring_cqe *mc_uring_peek_cqe(mc_uring_t *r) {
+    unsigned int head = *r->cq_khead;
+    if (head == __atomic_load_n(r->cq_ktail, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    return &r->cqes[head & r->cq_mask];
+}
+
+void mc_uring_cqe_seen(mc_uring_t *r) {
+    __atomic_store_n(r->cq_khead, *r->cq_khead + 1, __ATOMIC_RELEASE);
+}
+
+// If the completion queue overflowed the kernel holds on to the extra
+// completions until asked for them. Returns 1 if there may be more to reap.
+int mc_uring_cq_overflow(mc_uring_t *r) {
+    if (__atomic_load_n(r->sq_kflags, __ATOMIC_RELAXED) & IORING_SQ_CQ_OVERFLOW) {
+        _enter(r->fd, 0, 0, IORING_ENTER_GETEVENTS);
+        return 1;
+    }
+    return 0;
+}
+
+int mc_uring_register_eventfd(mc_uring_t *r, int efd) {
+    return _register(r->fd, IORING_REGISTER_EVENTFD, &efd, 1);
+}
+
+int mc_uring_bufs_init(mc_uring_t *r, mc_uring_bufs_t *b, uint16_t bgid,
+        unsigned int count, unsigned int size) {
+    memset(b, 0, sizeof(*b));
+    if (count == 0 || count > 32768 || (count & (count - 1)) != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    b->count = count;
+    b->size = size;
+    b->bgid = bgid;
+
+    // the buffer ring has to be page aligned.
+    b->br_sz = count * sizeof(struct io_uring_buf);
+    b->br = mmap(NULL, b->br_sz, PROT_READ | PROT_WRITE,
+            MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (b->br == MAP_FAILED) {
+        b->br = NULL;
+        return -1;
+    }
+
+    b->bufs = malloc((size_t)count * size);
+    if (b->bufs == NULL) {
+        goto error;
+    }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)b->br;
+    reg.ring_entries = count;
+    reg.bgid = bgid;
+    if (_register(r->fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+        goto error;
+    }
+
+    for (unsigned int i = 0; i < count; i++) {
+        mc_uring_bufs_put(b, i);
+    }
+
+    return 0;
+error:
+    free(b->bufs);
+    munmap(b->br, b->br_sz);
+    memset(b, 0, sizeof(*b));
+    return -1;
+}
+
+void mc_uring_bufs_free(mc_uring_t *r, mc_uring_bufs_t *b) {
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.bgid = b->bgid;
+    _register(r->fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+    free(b->bufs);
+    munmap(b->br, b->br_sz);
+    memset(b, 0, sizeof(*b));
+}
+
+// Hands a buffer back to the kernel.
+void mc_uring_bufs_put(mc_uring_bufs_t *b, uint16_t bid) {
+    // the ring tail shares space with the first entry's reserved field, so
+    // only the used fields are written.
+    struct io_uring_buf *buf = &b->br->bufs[b->tail & (b->count - 1)];
+    buf->addr = (uint64_t)(uintptr_t)mc_uring_buf(b, bid);
+    buf->len = b->size;
+    buf->bid = bid;
+    b->tail++;
+    __atomic_store_n(&b->br->tail, b->tail, __ATOMIC_RELEASE);
+}
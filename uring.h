@@ -0,0 +1,68 @@
+#ifndef URING_H
+#define URING_H
+
+/* Minimal io_uring ring handling on top of the raw kernel interface.
+ *
+ * Only covers what the worker threads need for -o worker_uring: a ring per
+ * thread, submit/reap helpers, an eventfd for waking up libevent, and a
+ * provided buffer ring for multishot receives. Rings are single issuer, so
+ * none of this is thread safe.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <linux/io_uring.h>
+
+typedef struct {
+    int fd;
+    unsigned int sq_entries;
+    unsigned int sq_tail; // local tail, published on submit.
+    unsigned int *sq_khead;
+    unsigned int *sq_ktail;
+    unsigned int *sq_kflags;
+    unsigned int sq_mask;
+    struct io_uring_sqe *sqes;
+    unsigned int *cq_khead;
+    unsigned int *cq_ktail;
+    unsigned int cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_ring;
+    size_t sq_ring_sz;
+    void *cq_ring;
+    size_t cq_ring_sz;
+    size_t sqes_sz;
+} mc_uring_t;
+
+typedef struct {
+    struct io_uring_buf_ring *br;
+    size_t br_sz;
+    char *bufs;
+    unsigned int count; // must be a power of two.
+    unsigned int size;
+    uint16_t tail;
+    uint16_t bgid;
+} mc_uring_bufs_t;
+
+int mc_uring_init(mc_uring_t *r, unsigned int entries);
+void mc_uring_exit(mc_uring_t *r);
+struct io_uring_sqe *mc_uring_get_sqe(mc_uring_t *r);
+int mc_uring_submit(mc_uring_t *r);
+struct io_uring_cqe *mc_uring_peek_cqe(mc_uring_t *r);
+void mc_uring_cqe_seen(mc_uring_t *r);
+int mc_uring_cq_overflow(mc_uring_t *r);
+int mc_uring_register_eventfd(mc_uring_t *r, int efd);
+
+int mc_uring_bufs_init(mc_uring_t *r, mc_uring_bufs_t *b, uint16_t bgid,
+        unsigned int count, unsigned int size);
+void mc_uring_bufs_free(mc_uring_t *r, mc_uring_bufs_t *b);
+void mc_uring_bufs_put(mc_uring_bufs_t *b, uint16_t bid);
+
+static inline char *mc_uring_buf(mc_uring_bufs_t *b, uint16_t bid) {
+    return b->bufs + (size_t)bid * b->size;
+}
+
+static inline int mc_uring_sq_pending(mc_uring_t *r) {
+    return r->sq_tail != __atomic_load_n(r->sq_khead, __ATOMIC_ACQUIRE);
+}
+
+#endif